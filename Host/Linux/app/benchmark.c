@@ -0,0 +1,875 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "benchmark.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nx_api.h"
+#include "nxd_dns.h"
+
+#include "azure_iot_nx_client.h"
+#include "azure_iot_store.h"
+
+#include "broker.h"
+#include "broker_cert.h"
+#include "nx_driver_loopback.h"
+
+#define BENCHMARK_DEVICE_ID "benchmark"
+#define BENCHMARK_ID_SCOPE  "0ne00000000"
+#define BENCHMARK_SAS_KEY   "YmVuY2htYXJrLWRldmljZS1rZXktbm90LWEtc2VjcmV0"
+#define BENCHMARK_MODEL_ID  "dtmi:azurertos:devkit:gsg;1"
+#define BENCHMARK_COMMAND   "benchmark"
+#define BENCHMARK_PROPERTY  "benchmark"
+
+// Longer than one device packet, so the client has to gather the command payload for the handler
+#define BENCHMARK_COMMAND_PADDING 1600
+
+#define BENCHMARK_BATCH_BYTES   1024
+#define BENCHMARK_BATCH_SAMPLES 32
+#define BENCHMARK_BATCH_AGE     1
+
+#define BENCHMARK_OFFLINE_MESSAGES 100
+#define BENCHMARK_STORE_SIZE       (16 * 1024)
+#define BENCHMARK_REPLAY_RATE      TX_TIMER_TICKS_PER_SECOND
+#define BENCHMARK_DPS_STORE_SIZE   512
+
+#define BENCHMARK_CONNECT_TIMEOUT (30 * TX_TIMER_TICKS_PER_SECOND)
+#define BENCHMARK_DRAIN_TIMEOUT   (10 * TX_TIMER_TICKS_PER_SECOND)
+#define BENCHMARK_PATCH_TIMEOUT   (5 * TX_TIMER_TICKS_PER_SECOND)
+
+#define BENCHMARK_CONNECTED_EVENT 0x01
+
+#define DEVICE_IP_ADDRESS IP_ADDRESS(10, 0, 0, 2)
+#define BROKER_IP_ADDRESS IP_ADDRESS(10, 0, 0, 1)
+#define NETWORK_MASK      IP_ADDRESS(255, 255, 255, 0)
+
+#define PACKET_COUNT      60
+#define PACKET_SIZE       1536
+#define POOL_SIZE         ((PACKET_SIZE + sizeof(NX_PACKET)) * PACKET_COUNT)
+#define IP_STACK_SIZE     (4 * 1024)
+#define IP_PRIORITY       1
+#define CLIENT_STACK_SIZE (8 * 1024)
+#define CLIENT_PRIORITY   4
+
+typedef struct BENCHMARK_RESULT_STRUCT
+{
+    CHAR* name;
+    UINT count;
+    UINT errors;
+    ULONG elapsed_us;
+    ULONG latency_us[BENCHMARK_ITERATIONS_MAX];
+} BENCHMARK_RESULT;
+
+typedef struct BENCHMARK_NETWORK_STRUCT
+{
+    NX_IP ip;
+    NX_PACKET_POOL pool;
+    UCHAR pool_memory[POOL_SIZE];
+    ULONG ip_memory[IP_STACK_SIZE / sizeof(ULONG)];
+    ULONG pool_free_min;
+} BENCHMARK_NETWORK;
+
+static BENCHMARK_NETWORK device_network;
+static BENCHMARK_NETWORK broker_network;
+static NX_DNS device_dns;
+
+static AZURE_IOT_NX_CONTEXT azure_iot_nx_client;
+#ifdef BENCHMARK_GATEWAY
+// The device is the one client of a gateway, connecting straight to the hub
+static AZURE_IOT_NX_GATEWAY gateway;
+#else
+static TX_THREAD client_thread;
+static ULONG client_thread_stack[CLIENT_STACK_SIZE / sizeof(ULONG)];
+#endif
+static TX_EVENT_FLAGS_GROUP benchmark_events;
+static TX_TIMER watermark_timer;
+
+static BENCHMARK_RESULT result;
+static UINT telemetry_sequence;
+static UINT mismatch_count;
+
+static TX_SEMAPHORE async_slots;
+static ULONG async_start_us[BENCHMARK_ITERATIONS_MAX];
+static UINT async_completed;
+
+static TX_SEMAPHORE properties_reported;
+static UINT properties_result;
+
+static CHAR command_padding[BENCHMARK_COMMAND_PADDING + 1];
+static CHAR command_payload[BENCHMARK_COMMAND_PADDING + 64];
+static CHAR command_response[32];
+
+// Telemetry published while the broker is offline is kept here until it can be replayed
+static AZURE_IOT_RAM_STORE telemetry_store;
+static UCHAR telemetry_store_buffer[BENCHMARK_STORE_SIZE];
+
+// The hub assignment from DPS, as a device would keep it in flash
+static AZURE_IOT_RAM_STORE dps_store;
+static UCHAR dps_store_buffer[BENCHMARK_DPS_STORE_SIZE];
+
+static ULONG timestamp_us(VOID)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ULONG)(now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+static UINT unix_time_get(ULONG* unix_time)
+{
+    *unix_time = (ULONG)time(NX_NULL);
+    return NX_SUCCESS;
+}
+
+static UINT network_connect(UINT invalid_layers)
+{
+    // Addresses are static and the wire is always up
+    return NX_SUCCESS;
+}
+
+static VOID watermark_sample(BENCHMARK_NETWORK* network)
+{
+    ULONG free_packets;
+
+    if (nx_packet_pool_info_get(&network->pool, NX_NULL, &free_packets, NX_NULL, NX_NULL, NX_NULL) == NX_SUCCESS &&
+        free_packets < network->pool_free_min)
+    {
+        network->pool_free_min = free_packets;
+    }
+}
+
+static VOID watermark_timer_entry(ULONG parameter)
+{
+    watermark_sample(&device_network);
+    watermark_sample(&broker_network);
+}
+
+static UINT append_telemetry(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr)
+{
+    return nx_azure_iot_json_writer_append_property_with_int32_value(
+        json_writer_ptr, (UCHAR*)"sequence", sizeof("sequence") - 1, telemetry_sequence);
+}
+
+// Responds with how much of the request it was given, so the broker can tell a payload was cut short
+static UINT benchmark_command(
+    AZURE_IOT_NX_CONTEXT* nx_context, UCHAR* payload, USHORT payload_length, NX_AZURE_IOT_JSON_WRITER* response)
+{
+    if (nx_azure_iot_json_writer_append_begin_object(response) ||
+        nx_azure_iot_json_writer_append_property_with_int32_value(
+            response, (UCHAR*)"length", sizeof("length") - 1, payload_length) ||
+        nx_azure_iot_json_writer_append_end_object(response))
+    {
+        return 500;
+    }
+
+    return 200;
+}
+
+static VOID properties_reported_cb(AZURE_IOT_NX_CONTEXT* nx_context, UINT publish_result)
+{
+    properties_result = publish_result;
+    tx_semaphore_put(&properties_reported);
+}
+
+static VOID properties_complete_cb(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    tx_event_flags_set(&benchmark_events, BENCHMARK_CONNECTED_EVENT, TX_OR);
+}
+
+#ifndef BENCHMARK_GATEWAY
+static VOID client_thread_entry(ULONG parameter)
+{
+    UINT status;
+
+    // The broker also answers for DPS and assigns the device to itself
+    if ((status = azure_iot_nx_client_dps_run(
+             &azure_iot_nx_client, BENCHMARK_ID_SCOPE, BENCHMARK_DEVICE_ID, network_connect)))
+    {
+        printf("ERROR: azure_iot_nx_client_dps_run failed (0x%08x)\r\n", status);
+    }
+}
+#endif
+
+static UINT network_create(BENCHMARK_NETWORK* network, CHAR* name, ULONG ip_address)
+{
+    UINT status;
+
+    network->pool_free_min = PACKET_COUNT;
+
+    if ((status = nx_packet_pool_create(&network->pool, name, PACKET_SIZE, network->pool_memory, POOL_SIZE)))
+    {
+        printf("ERROR: nx_packet_pool_create (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_ip_create(&network->ip,
+                  name,
+                  ip_address,
+                  NETWORK_MASK,
+                  &network->pool,
+                  nx_driver_loopback,
+                  (UCHAR*)network->ip_memory,
+                  sizeof(network->ip_memory),
+                  IP_PRIORITY)))
+    {
+        printf("ERROR: nx_ip_create (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_icmp_enable(&network->ip)))
+    {
+        printf("ERROR: nx_icmp_enable (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_tcp_enable(&network->ip)))
+    {
+        printf("ERROR: nx_tcp_enable (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_udp_enable(&network->ip)))
+    {
+        printf("ERROR: nx_udp_enable (0x%08x)\r\n", status);
+    }
+
+    return status;
+}
+
+static UINT benchmark_setup(VOID)
+{
+    UINT status;
+    ULONG actual_events;
+
+    nx_system_initialize();
+
+    if ((status = network_create(&broker_network, "broker", BROKER_IP_ADDRESS)) ||
+        (status = network_create(&device_network, "device", DEVICE_IP_ADDRESS)))
+    {
+        return status;
+    }
+
+    if ((status = broker_start(&broker_network.ip, &broker_network.pool)))
+    {
+        printf("ERROR: broker_start (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_dns_create(&device_dns, &device_network.ip, (UCHAR*)"DNS Client")))
+    {
+        printf("ERROR: nx_dns_create (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_dns_server_add(&device_dns, BROKER_IP_ADDRESS)))
+    {
+        printf("ERROR: nx_dns_server_add (0x%08x)\r\n", status);
+    }
+
+    else if ((status = tx_event_flags_create(&benchmark_events, "benchmark")))
+    {
+        printf("ERROR: tx_event_flags_create (0x%08x)\r\n", status);
+    }
+
+    else if ((status = tx_semaphore_create(&async_slots, "async", AZURE_IOT_PUBLISH_QUEUE_SIZE)))
+    {
+        printf("ERROR: tx_semaphore_create (0x%08x)\r\n", status);
+    }
+
+    else if ((status = tx_semaphore_create(&properties_reported, "properties", 0)))
+    {
+        printf("ERROR: tx_semaphore_create (0x%08x)\r\n", status);
+    }
+
+    else if ((status = tx_timer_create(
+                  &watermark_timer, "watermark", watermark_timer_entry, 0, 1, 1, TX_AUTO_ACTIVATE)))
+    {
+        printf("ERROR: tx_timer_create (0x%08x)\r\n", status);
+    }
+
+#ifdef BENCHMARK_GATEWAY
+    else if ((status = azure_iot_nx_client_gateway_create(
+                  &gateway, &device_network.ip, &device_network.pool, &device_dns, unix_time_get, network_connect)))
+    {
+        printf("ERROR: azure_iot_nx_client_gateway_create failed (0x%08x)\r\n", status);
+    }
+
+    else if ((status = azure_iot_nx_client_gateway_add(
+                  &gateway, &azure_iot_nx_client, BENCHMARK_MODEL_ID, sizeof(BENCHMARK_MODEL_ID) - 1)))
+    {
+        printf("ERROR: azure_iot_nx_client_gateway_add failed (0x%08x)\r\n", status);
+    }
+#else
+    else if ((status = azure_iot_nx_client_create(&azure_iot_nx_client,
+                  &device_network.ip,
+                  &device_network.pool,
+                  &device_dns,
+                  unix_time_get,
+                  BENCHMARK_MODEL_ID,
+                  sizeof(BENCHMARK_MODEL_ID) - 1)))
+    {
+        printf("ERROR: azure_iot_nx_client_create failed (0x%08x)\r\n", status);
+    }
+#endif
+
+    // Trust the broker's self-signed certificate instead of the hub root
+    else if ((status = nx_secure_x509_certificate_initialize(&azure_iot_nx_client.root_ca_cert,
+                  (UCHAR*)broker_cert,
+                  (USHORT)broker_cert_size,
+                  NX_NULL,
+                  0,
+                  NULL,
+                  0,
+                  NX_SECURE_X509_KEY_TYPE_NONE)))
+    {
+        printf("ERROR: nx_secure_x509_certificate_initialize (0x%08x)\r\n", status);
+    }
+
+    else if ((status = azure_iot_nx_client_sas_set(&azure_iot_nx_client, BENCHMARK_SAS_KEY)))
+    {
+        printf("ERROR: azure_iot_nx_client_sas_set (0x%08x)\r\n", status);
+    }
+
+    else if ((status = azure_iot_ram_store_create(
+                  &telemetry_store, telemetry_store_buffer, sizeof(telemetry_store_buffer))) ||
+             (status = azure_iot_nx_client_store_forward_set(
+                  &azure_iot_nx_client, &telemetry_store.store, BENCHMARK_REPLAY_RATE)))
+    {
+        printf("ERROR: failed to set the telemetry store (0x%08x)\r\n", status);
+    }
+
+    else if ((status = azure_iot_ram_store_create(&dps_store, dps_store_buffer, sizeof(dps_store_buffer))) ||
+             (status = azure_iot_nx_client_dps_assignment_store_set(&azure_iot_nx_client, &dps_store.store)))
+    {
+        printf("ERROR: failed to set the DPS assignment store (0x%08x)\r\n", status);
+    }
+
+    else if ((status = azure_iot_nx_client_register_command(
+                  &azure_iot_nx_client, NX_NULL, BENCHMARK_COMMAND, benchmark_command)) ||
+             (status = azure_iot_nx_client_register_properties_complete_callback(
+                  &azure_iot_nx_client, properties_complete_cb)) ||
+             (status = azure_iot_nx_client_register_properties_reported_callback(
+                  &azure_iot_nx_client, properties_reported_cb)))
+    {
+        printf("ERROR: failed to register callbacks (0x%08x)\r\n", status);
+    }
+
+#ifdef BENCHMARK_GATEWAY
+    else if ((status = azure_iot_nx_client_gateway_hub_start(
+                  &azure_iot_nx_client, BROKER_HOSTNAME, BENCHMARK_DEVICE_ID)))
+    {
+        printf("ERROR: azure_iot_nx_client_gateway_hub_start failed (0x%08x)\r\n", status);
+    }
+#else
+    else if ((status = tx_thread_create(&client_thread,
+                  "client",
+                  client_thread_entry,
+                  0,
+                  client_thread_stack,
+                  sizeof(client_thread_stack),
+                  CLIENT_PRIORITY,
+                  CLIENT_PRIORITY,
+                  TX_NO_TIME_SLICE,
+                  TX_AUTO_START)))
+    {
+        printf("ERROR: client thread create (0x%08x)\r\n", status);
+    }
+#endif
+
+    else if ((status = tx_event_flags_get(&benchmark_events,
+                  BENCHMARK_CONNECTED_EVENT,
+                  TX_OR_CLEAR,
+                  &actual_events,
+                  BENCHMARK_CONNECT_TIMEOUT)))
+    {
+        printf("ERROR: client failed to connect to the broker (0x%08x)\r\n", status);
+    }
+
+    return status;
+}
+
+static int latency_compare(const void* a, const void* b)
+{
+    ULONG left  = *(const ULONG*)a;
+    ULONG right = *(const ULONG*)b;
+
+    return (left > right) - (left < right);
+}
+
+static VOID result_begin(CHAR* name)
+{
+    result.name   = name;
+    result.count  = 0;
+    result.errors = 0;
+
+    device_network.pool_free_min = PACKET_COUNT;
+    broker_network.pool_free_min = PACKET_COUNT;
+}
+
+static VOID result_record(UINT status, ULONG start_us)
+{
+    if (status != NX_SUCCESS)
+    {
+        result.errors++;
+        return;
+    }
+
+    result.latency_us[result.count++] = timestamp_us() - start_us;
+}
+
+static VOID result_print(VOID)
+{
+    ULONG p50 = 0;
+    ULONG p99 = 0;
+
+    if (result.count > 0)
+    {
+        qsort(result.latency_us, result.count, sizeof(ULONG), latency_compare);
+        p50 = result.latency_us[(result.count * 50) / 100];
+        p99 = result.latency_us[(result.count * 99) / 100];
+    }
+
+    printf("%-10s %6u msgs %4u errors %10.1f msg/s  p50 %7lu us  p99 %7lu us  pool hwm device %2lu broker %2lu\r\n",
+        result.name,
+        result.count,
+        result.errors,
+        result.elapsed_us ? (double)result.count * 1000000 / result.elapsed_us : 0.0,
+        p50,
+        p99,
+        PACKET_COUNT - device_network.pool_free_min,
+        PACKET_COUNT - broker_network.pool_free_min);
+}
+
+static VOID benchmark_telemetry(UINT iterations)
+{
+    ULONG start_us;
+    ULONG phase_start_us;
+    ULONG expected = broker_telemetry_count_get() + iterations;
+    ULONG drain_ticks;
+
+    result_begin("telemetry");
+
+    phase_start_us = timestamp_us();
+    for (telemetry_sequence = 0; telemetry_sequence < iterations; ++telemetry_sequence)
+    {
+        start_us = timestamp_us();
+        result_record(azure_iot_nx_client_publish_telemetry(&azure_iot_nx_client, NX_NULL, append_telemetry), start_us);
+    }
+
+    // Throughput counts until the broker has seen every message
+    for (drain_ticks = 0; broker_telemetry_count_get() < expected && drain_ticks < BENCHMARK_DRAIN_TIMEOUT;
+         ++drain_ticks)
+    {
+        tx_thread_sleep(1);
+    }
+
+    result.elapsed_us = timestamp_us() - phase_start_us;
+    result_print();
+
+    if (broker_telemetry_count_get() != expected)
+    {
+        printf("ERROR: broker received %lu of %u telemetry messages\r\n",
+            broker_telemetry_count_get() - (expected - iterations),
+            iterations);
+        mismatch_count++;
+    }
+}
+
+static VOID benchmark_telemetry_batch(UINT iterations)
+{
+    ULONG start_us;
+    ULONG phase_start_us;
+    ULONG broker_start         = broker_telemetry_count_get();
+    ULONG broker_samples_start = broker_telemetry_sample_count_get();
+    ULONG broker_count;
+
+    result_begin("batched");
+
+    azure_iot_nx_client_telemetry_batch_configure(
+        &azure_iot_nx_client, NX_NULL, BENCHMARK_BATCH_BYTES, BENCHMARK_BATCH_SAMPLES, BENCHMARK_BATCH_AGE);
+
+    phase_start_us = timestamp_us();
+    for (telemetry_sequence = 0; telemetry_sequence < iterations; ++telemetry_sequence)
+    {
+        start_us = timestamp_us();
+        result_record(azure_iot_nx_client_telemetry_batch_append(&azure_iot_nx_client, append_telemetry), start_us);
+    }
+
+    azure_iot_nx_client_telemetry_batch_flush(&azure_iot_nx_client);
+
+    // Wait for the broker message count to settle
+    do
+    {
+        broker_count = broker_telemetry_count_get();
+        tx_thread_sleep(TX_TIMER_TICKS_PER_SECOND / 10);
+    } while (broker_count != broker_telemetry_count_get());
+
+    result.elapsed_us = timestamp_us() - phase_start_us;
+    result_print();
+    printf("%-10s %6u samples in %lu broker messages\r\n", "", result.count, broker_count - broker_start);
+
+    // Every appended sample has to arrive, exactly once
+    if (broker_telemetry_sample_count_get() - broker_samples_start != result.count)
+    {
+        printf("ERROR: broker received %lu of %u batched samples\r\n",
+            broker_telemetry_sample_count_get() - broker_samples_start,
+            result.count);
+        mismatch_count++;
+    }
+}
+
+static VOID async_complete_cb(AZURE_IOT_NX_CONTEXT* nx_context, UINT publish_result, VOID* context)
+{
+    ULONG* start_us = (ULONG*)context;
+
+    result_record(publish_result == AZURE_IOT_PUBLISH_SUCCESS ? NX_SUCCESS : NX_NOT_SUCCESSFUL, *start_us);
+    async_completed++;
+
+    tx_semaphore_put(&async_slots);
+}
+
+static VOID benchmark_telemetry_async(UINT iterations)
+{
+    UINT status;
+    UINT rejected = 0;
+    ULONG phase_start_us;
+    ULONG drain_ticks;
+    ULONG expected;
+
+    result_begin("async");
+    async_completed = 0;
+    expected        = broker_telemetry_count_get();
+
+    phase_start_us = timestamp_us();
+    for (telemetry_sequence = 0; telemetry_sequence < iterations; ++telemetry_sequence)
+    {
+        // Block while the publish queue is full
+        tx_semaphore_get(&async_slots, TX_WAIT_FOREVER);
+
+        async_start_us[telemetry_sequence] = timestamp_us();
+        if ((status = azure_iot_nx_client_publish_telemetry_async(&azure_iot_nx_client,
+                 NX_NULL,
+                 append_telemetry,
+                 async_complete_cb,
+                 &async_start_us[telemetry_sequence])))
+        {
+            rejected++;
+            tx_semaphore_put(&async_slots);
+        }
+    }
+
+    for (drain_ticks = 0; async_completed + rejected < iterations && drain_ticks < BENCHMARK_DRAIN_TIMEOUT;
+         ++drain_ticks)
+    {
+        tx_thread_sleep(1);
+    }
+
+    result.elapsed_us = timestamp_us() - phase_start_us;
+    result.errors += rejected;
+    result_print();
+
+    // Each acknowledged publish has to match a message the broker accepted
+    expected += result.count;
+    if (broker_telemetry_count_get() != expected)
+    {
+        printf("ERROR: %u async publishes acknowledged, broker accepted %lu\r\n",
+            result.count,
+            broker_telemetry_count_get() - (expected - result.count));
+        mismatch_count++;
+    }
+}
+
+// Flush the cached properties and wait for the hub to acknowledge the patch
+static UINT properties_patch(VOID)
+{
+    UINT status;
+
+    if ((status = azure_iot_nx_client_reported_properties_flush(&azure_iot_nx_client)) ||
+        (status = tx_semaphore_get(&properties_reported, BENCHMARK_PATCH_TIMEOUT)))
+    {
+        return status;
+    }
+
+    return properties_result == AZURE_IOT_PUBLISH_SUCCESS ? NX_SUCCESS : NX_NOT_SUCCESSFUL;
+}
+
+static VOID benchmark_properties(UINT iterations)
+{
+    UINT status;
+    ULONG start_us;
+    ULONG phase_start_us;
+
+    result_begin("properties");
+
+    phase_start_us = timestamp_us();
+    for (UINT i = 0; i < iterations; ++i)
+    {
+        start_us = timestamp_us();
+        if ((status = azure_iot_nx_client_reported_property_bool_set(
+                 &azure_iot_nx_client, NX_NULL, BENCHMARK_PROPERTY, i & 1)) == NX_SUCCESS)
+        {
+            status = properties_patch();
+        }
+
+        result_record(status, start_us);
+    }
+
+    result.elapsed_us = timestamp_us() - phase_start_us;
+    result_print();
+}
+
+// Three properties per patch, as a board reports them at startup
+static VOID benchmark_properties_coalesced(UINT iterations)
+{
+    UINT status;
+    ULONG start_us;
+    ULONG phase_start_us;
+
+    result_begin("coalesced");
+
+    phase_start_us = timestamp_us();
+    for (UINT i = 0; i < iterations; ++i)
+    {
+        start_us = timestamp_us();
+        if ((status = azure_iot_nx_client_reported_property_bool_set(
+                 &azure_iot_nx_client, NX_NULL, BENCHMARK_PROPERTY, i & 1)) == NX_SUCCESS &&
+            (status = azure_iot_nx_client_reported_property_int_set(
+                 &azure_iot_nx_client, NX_NULL, "sequence", i)) == NX_SUCCESS &&
+            (status = azure_iot_nx_client_reported_property_string_set(
+                 &azure_iot_nx_client, NX_NULL, "phase", i & 1 ? "odd" : "even")) == NX_SUCCESS)
+        {
+            status = properties_patch();
+        }
+
+        result_record(status, start_us);
+    }
+
+    result.elapsed_us = timestamp_us() - phase_start_us;
+    result_print();
+}
+
+static VOID benchmark_commands(UINT iterations)
+{
+    ULONG start_us;
+    ULONG phase_start_us;
+
+    AZURE_IOT_COMMAND_STATS stats;
+
+    result_begin("commands");
+    azure_iot_nx_client_command_stats_get(&azure_iot_nx_client, &stats, true);
+    memset(command_padding, 'a', BENCHMARK_COMMAND_PADDING);
+
+    phase_start_us = timestamp_us();
+    for (UINT i = 0; i < iterations; ++i)
+    {
+        // Every fourth request spans several packets
+        snprintf(command_payload,
+            sizeof(command_payload),
+            "{\"sequence\":%u,\"padding\":\"%s\"}",
+            i,
+            (i & 3) == 3 ? command_padding : "");
+        snprintf(command_response, sizeof(command_response), "{\"length\":%u}", (UINT)strlen(command_payload));
+
+        start_us = timestamp_us();
+        result_record(
+            broker_command_invoke(BENCHMARK_COMMAND, command_payload, command_response, 5 * TX_TIMER_TICKS_PER_SECOND),
+            start_us);
+    }
+
+    result.elapsed_us = timestamp_us() - phase_start_us;
+    result_print();
+
+    // Device side turnaround, from receipt to the response being sent
+    azure_iot_nx_client_command_stats_get(&azure_iot_nx_client, &stats, true);
+    printf("%-10s %6lu dispatched  mean %7lu us  max %7lu us\r\n",
+        "",
+        stats.count,
+        stats.count ? stats.total_ticks * (1000000 / TX_TIMER_TICKS_PER_SECOND) / stats.count : 0,
+        stats.max_ticks * (1000000 / TX_TIMER_TICKS_PER_SECOND));
+}
+
+// Publish with the broker offline, then time the reconnect and the replay of everything stored meanwhile
+static VOID benchmark_offline(UINT iterations)
+{
+    UINT count = iterations < BENCHMARK_OFFLINE_MESSAGES ? iterations : BENCHMARK_OFFLINE_MESSAGES;
+    UINT stored;
+    ULONG start_us;
+    ULONG phase_start_us;
+    ULONG actual_events;
+    ULONG expected;
+    ULONG drain_ticks;
+
+    result_begin("offline");
+
+    broker_offline_set(NX_TRUE);
+
+    for (drain_ticks = 0;
+         azure_iot_nx_client.azure_iot_connection_status == NX_SUCCESS && drain_ticks < BENCHMARK_DRAIN_TIMEOUT;
+         ++drain_ticks)
+    {
+        tx_thread_sleep(1);
+    }
+
+    if (azure_iot_nx_client.azure_iot_connection_status == NX_SUCCESS)
+    {
+        printf("ERROR: client did not notice the broker going offline\r\n");
+        broker_offline_set(NX_FALSE);
+        mismatch_count++;
+        return;
+    }
+
+    expected = broker_telemetry_count_get();
+    for (telemetry_sequence = 0; telemetry_sequence < count; ++telemetry_sequence)
+    {
+        start_us = timestamp_us();
+        result_record(azure_iot_nx_client_publish_telemetry(&azure_iot_nx_client, NX_NULL, append_telemetry), start_us);
+    }
+
+    // Every reading published while offline has to be waiting in the store
+    stored = telemetry_store.store.count(&telemetry_store.store);
+    if (stored != result.count)
+    {
+        printf("ERROR: %u offline publishes succeeded, %u stored\r\n", result.count, stored);
+        mismatch_count++;
+    }
+    expected += stored;
+
+    tx_event_flags_get(&benchmark_events, BENCHMARK_CONNECTED_EVENT, TX_OR_CLEAR, &actual_events, TX_NO_WAIT);
+    broker_offline_set(NX_FALSE);
+
+    phase_start_us = timestamp_us();
+    if (tx_event_flags_get(&benchmark_events,
+            BENCHMARK_CONNECTED_EVENT,
+            TX_OR_CLEAR,
+            &actual_events,
+            BENCHMARK_CONNECT_TIMEOUT))
+    {
+        printf("ERROR: client failed to reconnect to the broker\r\n");
+        mismatch_count++;
+        return;
+    }
+
+    for (drain_ticks = 0; broker_telemetry_count_get() < expected && drain_ticks < BENCHMARK_DRAIN_TIMEOUT;
+         ++drain_ticks)
+    {
+        tx_thread_sleep(1);
+    }
+
+    // Throughput covers the reconnect and the replay, latency is the time to store each reading
+    result.elapsed_us = timestamp_us() - phase_start_us;
+    result_print();
+    printf("%-10s %6lu replayed after reconnect\r\n", "", broker_telemetry_count_get() - (expected - stored));
+
+    if (broker_telemetry_count_get() != expected)
+    {
+        printf("ERROR: broker received %lu of %u stored messages\r\n",
+            broker_telemetry_count_get() - (expected - stored),
+            stored);
+        mismatch_count++;
+    }
+}
+
+#ifndef BENCHMARK_GATEWAY
+// The hub turning the device away has to drop the stored assignment and send the device back through DPS
+static VOID benchmark_reprovision(VOID)
+{
+    ULONG actual_events;
+    ULONG registrations = broker_dps_registration_count_get();
+    ULONG start_us;
+
+    if (registrations != 1 || dps_store.store.count(&dps_store.store) != 1)
+    {
+        printf("ERROR: expected one DPS registration and a stored assignment, got %lu and %u\r\n",
+            registrations,
+            dps_store.store.count(&dps_store.store));
+        mismatch_count++;
+    }
+
+    tx_event_flags_get(&benchmark_events, BENCHMARK_CONNECTED_EVENT, TX_OR_CLEAR, &actual_events, TX_NO_WAIT);
+
+    start_us = timestamp_us();
+    broker_hub_reject(1);
+
+    if (tx_event_flags_get(&benchmark_events,
+            BENCHMARK_CONNECTED_EVENT,
+            TX_OR_CLEAR,
+            &actual_events,
+            BENCHMARK_CONNECT_TIMEOUT))
+    {
+        printf("ERROR: client failed to reconnect after the hub rejected it\r\n");
+        mismatch_count++;
+        return;
+    }
+
+    printf("%-10s %6lu registrations  reconnect %7lu us\r\n",
+        "dps",
+        broker_dps_registration_count_get() - registrations,
+        timestamp_us() - start_us);
+
+    if (broker_dps_registration_count_get() != registrations + 1 || dps_store.store.count(&dps_store.store) != 1)
+    {
+        printf("ERROR: rejected assignment was not replaced through DPS\r\n");
+        mismatch_count++;
+    }
+}
+#endif
+
+static VOID benchmark_handshakes(VOID)
+{
+    AZURE_IOT_TLS_STATS stats;
+    AZURE_IOT_TLS_STATS dps_stats;
+
+    // Handshakes run by the device while connecting to the broker
+    azure_iot_nx_client_tls_stats_get(&azure_iot_nx_client, &stats, &dps_stats);
+    printf("%-10s %6lu handshakes  mean %7lu us  last %7lu us\r\n",
+        "tls",
+        stats.full_count,
+        stats.full_count ? stats.total_ticks * (1000000 / TX_TIMER_TICKS_PER_SECOND) / stats.full_count : 0,
+        stats.last_ticks * (1000000 / TX_TIMER_TICKS_PER_SECOND));
+
+    // Reconnects that went straight to the assigned hub skipped the DPS handshake
+    printf("%-10s %6lu handshakes  %6lu avoided  last %7lu us\r\n",
+        "dps tls",
+        dps_stats.full_count,
+        dps_stats.avoided_count,
+        dps_stats.last_ticks * (1000000 / TX_TIMER_TICKS_PER_SECOND));
+}
+
+UINT benchmark_run(UINT iterations)
+{
+    UINT status;
+
+    if (iterations == 0 || iterations > BENCHMARK_ITERATIONS_MAX)
+    {
+        printf("ERROR: iterations must be between 1 and %d\r\n", BENCHMARK_ITERATIONS_MAX);
+        return NX_SIZE_ERROR;
+    }
+
+    if ((status = benchmark_setup()))
+    {
+        return status;
+    }
+
+    printf("\r\nBenchmark: %u iterations per phase\r\n", iterations);
+
+    benchmark_telemetry(iterations);
+    benchmark_telemetry_async(iterations);
+    benchmark_telemetry_batch(iterations);
+    benchmark_properties(iterations);
+    benchmark_properties_coalesced(iterations);
+    benchmark_commands(iterations);
+    benchmark_offline(iterations);
+#ifndef BENCHMARK_GATEWAY
+    // The gateway client is given its hub, there is no assignment to replace
+    benchmark_reprovision();
+#endif
+    benchmark_handshakes();
+
+    if (mismatch_count > 0 || broker_error_count_get() > 0)
+    {
+        printf("ERROR: benchmark failed, %u count mismatches and %lu broker errors\r\n",
+            mismatch_count,
+            broker_error_count_get());
+        return NX_NOT_SUCCESSFUL;
+    }
+
+    return NX_SUCCESS;
+}
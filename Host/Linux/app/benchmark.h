@@ -0,0 +1,16 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _BENCHMARK_H
+#define _BENCHMARK_H
+
+#include "tx_api.h"
+
+#define BENCHMARK_ITERATIONS_DEFAULT 1000
+#define BENCHMARK_ITERATIONS_MAX     10000
+
+// Bring up the device and broker stacks on a loopback wire, connect the client
+// and run each benchmark phase for the given number of iterations
+UINT benchmark_run(UINT iterations);
+
+#endif
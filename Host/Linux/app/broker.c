@@ -0,0 +1,905 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "broker.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nx_secure_tls_api.h"
+
+#include "nx_azure_iot_json_reader.h"
+
+#include "azure_iot_ciphersuites.h"
+#include "broker_cert.h"
+
+#define BROKER_THREAD_STACK_SIZE (16 * 1024)
+#define BROKER_THREAD_PRIORITY   4
+
+#define BROKER_DNS_PORT  53
+#define BROKER_MQTT_PORT 8883
+
+#define BROKER_TCP_WINDOW_SIZE   (16 * 1024)
+#define BROKER_TLS_PACKET_SIZE   (16 * 1024)
+#define BROKER_MQTT_BUFFER_SIZE  4096
+#define BROKER_TOPIC_SIZE        256
+#define BROKER_SUBSCRIBE_FILTERS 8
+#define BROKER_CLIENT_ID_SIZE    128
+
+#define BROKER_COMMAND_RESPONSE_SIZE 64
+
+#define BROKER_COMMAND_RESPONSE_EVENT 0x01
+
+#define MQTT_CONTROL_CONNECT     0x10
+#define MQTT_CONTROL_CONNACK     0x20
+#define MQTT_CONTROL_PUBLISH     0x30
+#define MQTT_CONTROL_PUBACK      0x40
+#define MQTT_CONTROL_SUBSCRIBE   0x80
+#define MQTT_CONTROL_SUBACK      0x90
+#define MQTT_CONTROL_UNSUBSCRIBE 0xA0
+#define MQTT_CONTROL_UNSUBACK    0xB0
+#define MQTT_CONTROL_PINGREQ     0xC0
+#define MQTT_CONTROL_PINGRESP    0xD0
+#define MQTT_CONTROL_DISCONNECT  0xE0
+
+#define MQTT_CONNECT_FLAG_USERNAME 0x80
+#define MQTT_CONNECT_FLAG_WILL     0x04
+
+#define MQTT_CONNACK_ACCEPTED          0x00
+#define MQTT_CONNACK_IDENTIFIER_REJECT 0x02
+#define MQTT_CONNACK_NOT_AUTHORIZED    0x05
+
+#define TOPIC_TELEMETRY_PREFIX "devices/"
+#define TOPIC_TELEMETRY_EVENTS "/messages/events/"
+#define TOPIC_TWIN_GET         "$iothub/twin/GET/"
+#define TOPIC_TWIN_PATCH       "$iothub/twin/PATCH/properties/reported/"
+#define TOPIC_METHOD_RESPONSE  "$iothub/methods/res/"
+#define TOPIC_RID              "$rid="
+#define TOPIC_DPS_REGISTER     "$dps/registrations/PUT/iotdps-register/"
+
+// DPS clients put the registrations path in the username, hub clients the hub and device id
+#define DPS_USERNAME_MARKER "/registrations/"
+
+#define TWIN_DOCUMENT "{\"desired\":{\"$version\":1},\"reported\":{\"$version\":1}}"
+
+// Every registration is assigned straight away, to this broker under the registration id
+#define DPS_ASSIGNED_DOCUMENT                                                                                    \
+    "{\"operationId\":\"%lu\",\"status\":\"assigned\",\"registrationState\":{\"registrationId\":\"%s\","          \
+    "\"assignedHub\":\"%s\",\"deviceId\":\"%s\",\"status\":\"assigned\",\"substatus\":\"initialAssignment\"}}"
+
+static NX_IP* broker_ip;
+static NX_PACKET_POOL* broker_pool;
+
+static TX_THREAD dns_thread;
+static ULONG dns_thread_stack[BROKER_THREAD_STACK_SIZE / sizeof(ULONG)];
+static NX_UDP_SOCKET dns_socket;
+
+static TX_THREAD mqtt_thread;
+static ULONG mqtt_thread_stack[BROKER_THREAD_STACK_SIZE / sizeof(ULONG)];
+static NX_TCP_SOCKET mqtt_socket;
+static NX_SECURE_TLS_SESSION tls_session;
+static NX_SECURE_X509_CERT tls_certificate;
+static UCHAR tls_metadata_buffer[NX_AZURE_IOT_TLS_METADATA_BUFFER_SIZE];
+static UCHAR tls_packet_buffer[BROKER_TLS_PACKET_SIZE];
+
+static TX_MUTEX send_mutex;
+static TX_EVENT_FLAGS_GROUP events;
+
+static UCHAR mqtt_buffer[BROKER_MQTT_BUFFER_SIZE];
+static ULONG mqtt_buffer_length;
+
+static UINT connected;
+static UINT offline;
+static ULONG twin_version = 1;
+static ULONG command_request_id;
+static CHAR command_response_expected[BROKER_COMMAND_RESPONSE_SIZE];
+static ULONG telemetry_count;
+static ULONG telemetry_sample_count;
+static ULONG error_count;
+static ULONG dps_registration_count;
+static UINT hub_reject_count;
+
+// Identity of the connected device and the last packet identifier it published with
+static CHAR client_id[BROKER_CLIENT_ID_SIZE + 1];
+static UINT publish_id_last;
+
+static UINT mqtt_send(UCHAR control, UCHAR* header, UINT header_length, UCHAR* payload, UINT payload_length)
+{
+    UINT status;
+    UINT remaining_length = header_length + payload_length;
+    UCHAR fixed_header[5];
+    UINT fixed_header_length = 0;
+    NX_PACKET* packet_ptr;
+
+    fixed_header[fixed_header_length++] = control;
+    do
+    {
+        fixed_header[fixed_header_length] = remaining_length & 0x7F;
+        remaining_length >>= 7;
+        if (remaining_length > 0)
+        {
+            fixed_header[fixed_header_length] |= 0x80;
+        }
+        fixed_header_length++;
+    } while (remaining_length > 0);
+
+    tx_mutex_get(&send_mutex, TX_WAIT_FOREVER);
+
+    if (!connected)
+    {
+        tx_mutex_put(&send_mutex);
+        return NX_NOT_CONNECTED;
+    }
+
+    if ((status = nx_secure_tls_packet_allocate(&tls_session, broker_pool, &packet_ptr, NX_WAIT_FOREVER)))
+    {
+        printf("ERROR: broker nx_secure_tls_packet_allocate (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_packet_data_append(
+                  packet_ptr, fixed_header, fixed_header_length, broker_pool, NX_WAIT_FOREVER)) ||
+             (status = nx_packet_data_append(packet_ptr, header, header_length, broker_pool, NX_WAIT_FOREVER)) ||
+             (status = nx_packet_data_append(packet_ptr, payload, payload_length, broker_pool, NX_WAIT_FOREVER)))
+    {
+        printf("ERROR: broker nx_packet_data_append (0x%08x)\r\n", status);
+        nx_packet_release(packet_ptr);
+    }
+
+    else if ((status = nx_secure_tls_session_send(&tls_session, packet_ptr, NX_WAIT_FOREVER)))
+    {
+        printf("ERROR: broker nx_secure_tls_session_send (0x%08x)\r\n", status);
+        nx_packet_release(packet_ptr);
+    }
+
+    tx_mutex_put(&send_mutex);
+
+    return status;
+}
+
+static UINT mqtt_publish(CHAR* topic, CHAR* payload)
+{
+    UCHAR header[2 + BROKER_TOPIC_SIZE];
+    UINT topic_length = strlen(topic);
+
+    if (topic_length > BROKER_TOPIC_SIZE)
+    {
+        return NX_SIZE_ERROR;
+    }
+
+    header[0] = (UCHAR)(topic_length >> 8);
+    header[1] = (UCHAR)(topic_length & 0xFF);
+    memcpy(&header[2], topic, topic_length);
+
+    return mqtt_send(MQTT_CONTROL_PUBLISH, header, 2 + topic_length, (UCHAR*)payload, strlen(payload));
+}
+
+static ULONG topic_request_id_get(CHAR* topic)
+{
+    CHAR* rid = strstr(topic, TOPIC_RID);
+
+    return rid ? strtoul(rid + sizeof(TOPIC_RID) - 1, NX_NULL, 10) : 0;
+}
+
+static VOID broker_error(CHAR* message, CHAR* detail)
+{
+    printf("ERROR: broker %s: %s\r\n", message, detail);
+    error_count++;
+}
+
+// Length of the MQTT string at offset, zero if it runs past the end of the packet
+static UINT mqtt_string_length(UCHAR* data, UINT length, UINT offset)
+{
+    UINT string_length;
+
+    if (offset + 2 > length)
+    {
+        return 0;
+    }
+
+    string_length = (data[offset] << 8) | data[offset + 1];
+
+    return offset + 2 + string_length <= length ? string_length : 0;
+}
+
+// The payload is the client id, the will if flagged and then the username, returns the CONNACK return code
+static UCHAR mqtt_process_connect(UCHAR* data, UINT length)
+{
+    UINT offset;
+    UINT flags;
+    UINT id_length;
+    UINT username_length;
+    CHAR username[BROKER_TOPIC_SIZE + 1];
+
+    client_id[0]    = 0;
+    publish_id_last = 0;
+
+    // Protocol name, level, flags and keep alive
+    offset = 2 + mqtt_string_length(data, length, 0) + 4;
+    if (offset > length)
+    {
+        broker_error("CONNECT too short", "");
+        return MQTT_CONNACK_IDENTIFIER_REJECT;
+    }
+    flags = data[offset - 3];
+
+    id_length = mqtt_string_length(data, length, offset);
+    if (id_length == 0 || id_length > BROKER_CLIENT_ID_SIZE)
+    {
+        broker_error("CONNECT without a client id", "");
+        return MQTT_CONNACK_IDENTIFIER_REJECT;
+    }
+
+    memcpy(client_id, &data[offset + 2], id_length);
+    client_id[id_length] = 0;
+    offset += 2 + id_length;
+
+    if (flags & MQTT_CONNECT_FLAG_WILL)
+    {
+        offset += 2 + mqtt_string_length(data, length, offset);
+        offset += 2 + mqtt_string_length(data, length, offset);
+    }
+
+    username[0] = 0;
+    if (flags & MQTT_CONNECT_FLAG_USERNAME)
+    {
+        username_length = mqtt_string_length(data, length, offset);
+        if (username_length > BROKER_TOPIC_SIZE)
+        {
+            username_length = BROKER_TOPIC_SIZE;
+        }
+
+        memcpy(username, &data[offset + 2], username_length);
+        username[username_length] = 0;
+    }
+
+    // Refuse the hub while a rejection is pending, DPS is always let in
+    if (hub_reject_count > 0 && strstr(username, DPS_USERNAME_MARKER) == NX_NULL)
+    {
+        hub_reject_count--;
+        printf("Broker rejecting hub connect from %s\r\n", client_id);
+        return MQTT_CONNACK_NOT_AUTHORIZED;
+    }
+
+    return MQTT_CONNACK_ACCEPTED;
+}
+
+// Telemetry goes to devices/<client id>/messages/events/, optionally followed by a property bag
+static UINT telemetry_topic_check(CHAR* topic)
+{
+    CHAR expected[BROKER_TOPIC_SIZE];
+    UINT expected_length;
+
+    expected_length =
+        snprintf(expected, sizeof(expected), TOPIC_TELEMETRY_PREFIX "%s" TOPIC_TELEMETRY_EVENTS, client_id);
+
+    if (client_id[0] == 0 || strncmp(topic, expected, expected_length) != 0 ||
+        strchr(&topic[expected_length], '/') != NX_NULL)
+    {
+        return NX_NOT_SUCCESSFUL;
+    }
+
+    return NX_SUCCESS;
+}
+
+// A reading is an object with a numeric "sequence", a batch is an array of readings that also carry "ts"
+static UINT telemetry_payload_check(UCHAR* payload, UINT payload_length, ULONG* samples)
+{
+    NX_AZURE_IOT_JSON_READER json_reader;
+    UINT batched;
+    UINT sequence_found;
+    UINT ts_found;
+    double value;
+
+    *samples = 0;
+
+    if (payload_length == 0 || nx_azure_iot_json_reader_with_buffer_init(&json_reader, payload, payload_length) ||
+        nx_azure_iot_json_reader_next_token(&json_reader))
+    {
+        return NX_NOT_SUCCESSFUL;
+    }
+
+    batched = nx_azure_iot_json_reader_token_type(&json_reader) == NX_AZURE_IOT_READER_TOKEN_BEGIN_ARRAY;
+    if (batched && nx_azure_iot_json_reader_next_token(&json_reader))
+    {
+        return NX_NOT_SUCCESSFUL;
+    }
+
+    while (nx_azure_iot_json_reader_token_type(&json_reader) == NX_AZURE_IOT_READER_TOKEN_BEGIN_OBJECT)
+    {
+        sequence_found = NX_FALSE;
+        ts_found       = NX_FALSE;
+
+        while (nx_azure_iot_json_reader_next_token(&json_reader) == NX_AZURE_IOT_SUCCESS &&
+               nx_azure_iot_json_reader_token_type(&json_reader) == NX_AZURE_IOT_READER_TOKEN_PROPERTY_NAME)
+        {
+            if (nx_azure_iot_json_reader_token_is_text_equal(&json_reader, (UCHAR*)"sequence", sizeof("sequence") - 1))
+            {
+                sequence_found = NX_TRUE;
+            }
+            else if (nx_azure_iot_json_reader_token_is_text_equal(&json_reader, (UCHAR*)"ts", sizeof("ts") - 1))
+            {
+                ts_found = NX_TRUE;
+            }
+            else
+            {
+                return NX_NOT_SUCCESSFUL;
+            }
+
+            if (nx_azure_iot_json_reader_next_token(&json_reader) ||
+                nx_azure_iot_json_reader_token_double_get(&json_reader, &value))
+            {
+                return NX_NOT_SUCCESSFUL;
+            }
+        }
+
+        if (nx_azure_iot_json_reader_token_type(&json_reader) != NX_AZURE_IOT_READER_TOKEN_END_OBJECT ||
+            !sequence_found || ts_found != batched)
+        {
+            return NX_NOT_SUCCESSFUL;
+        }
+
+        (*samples)++;
+
+        if (!batched)
+        {
+            return NX_SUCCESS;
+        }
+
+        if (nx_azure_iot_json_reader_next_token(&json_reader))
+        {
+            return NX_NOT_SUCCESSFUL;
+        }
+    }
+
+    return batched && *samples > 0 &&
+                   nx_azure_iot_json_reader_token_type(&json_reader) == NX_AZURE_IOT_READER_TOKEN_END_ARRAY
+               ? NX_SUCCESS
+               : NX_NOT_SUCCESSFUL;
+}
+
+static VOID mqtt_process_publish(UCHAR control, UCHAR* data, UINT length)
+{
+    CHAR topic[BROKER_TOPIC_SIZE + 1];
+    CHAR response_topic[BROKER_TOPIC_SIZE];
+    CHAR document[BROKER_TOPIC_SIZE * 2];
+    UINT topic_length;
+    UINT offset;
+    UINT packet_id;
+    UINT ack_required = NX_FALSE;
+    ULONG samples;
+    UCHAR ack[2];
+
+    if (length < 2)
+    {
+        broker_error("PUBLISH too short", "");
+        return;
+    }
+
+    topic_length = (data[0] << 8) | data[1];
+    if (topic_length > BROKER_TOPIC_SIZE || 2 + topic_length > length)
+    {
+        broker_error("PUBLISH topic length invalid", "");
+        return;
+    }
+
+    memcpy(topic, &data[2], topic_length);
+    topic[topic_length] = 0;
+    offset              = 2 + topic_length;
+
+    // QoS 1, acknowledged with the packet identifier once the message is processed
+    if ((control & 0x06) == 0x02)
+    {
+        if (offset + 2 > length)
+        {
+            broker_error("PUBLISH missing packet id", topic);
+            return;
+        }
+
+        // Ids are non zero and only repeat on a redelivery, which sets DUP
+        packet_id = (data[offset] << 8) | data[offset + 1];
+        if (packet_id == 0 || (packet_id == publish_id_last && (control & 0x08) == 0))
+        {
+            broker_error("PUBLISH packet id invalid or reused", topic);
+        }
+        publish_id_last = packet_id;
+
+        ack[0]       = data[offset];
+        ack[1]       = data[offset + 1];
+        ack_required = NX_TRUE;
+        offset += 2;
+    }
+
+    if (strncmp(topic, TOPIC_TELEMETRY_PREFIX, sizeof(TOPIC_TELEMETRY_PREFIX) - 1) == 0)
+    {
+        if (telemetry_topic_check(topic))
+        {
+            broker_error("unexpected telemetry topic", topic);
+        }
+        else if (telemetry_payload_check(&data[offset], length - offset, &samples))
+        {
+            broker_error("unexpected telemetry payload", topic);
+            printf("\t%.*s\r\n", (INT)(length - offset), (CHAR*)&data[offset]);
+        }
+        else
+        {
+            telemetry_count++;
+            telemetry_sample_count += samples;
+        }
+    }
+    else if (strncmp(topic, TOPIC_DPS_REGISTER, sizeof(TOPIC_DPS_REGISTER) - 1) == 0)
+    {
+        dps_registration_count++;
+        snprintf(response_topic,
+            sizeof(response_topic),
+            "$dps/registrations/res/200/?$rid=%lu",
+            topic_request_id_get(topic));
+        snprintf(document,
+            sizeof(document),
+            DPS_ASSIGNED_DOCUMENT,
+            dps_registration_count,
+            client_id,
+            BROKER_HOSTNAME,
+            client_id);
+        mqtt_publish(response_topic, document);
+    }
+    else if (strncmp(topic, TOPIC_TWIN_GET, sizeof(TOPIC_TWIN_GET) - 1) == 0)
+    {
+        snprintf(response_topic,
+            sizeof(response_topic),
+            "$iothub/twin/res/200/?$rid=%lu",
+            topic_request_id_get(topic));
+        mqtt_publish(response_topic, TWIN_DOCUMENT);
+    }
+    else if (strncmp(topic, TOPIC_TWIN_PATCH, sizeof(TOPIC_TWIN_PATCH) - 1) == 0)
+    {
+        snprintf(response_topic,
+            sizeof(response_topic),
+            "$iothub/twin/res/204/?$rid=%lu&$version=%lu",
+            topic_request_id_get(topic),
+            ++twin_version);
+        mqtt_publish(response_topic, "");
+    }
+    else if (strncmp(topic, TOPIC_METHOD_RESPONSE, sizeof(TOPIC_METHOD_RESPONSE) - 1) == 0)
+    {
+        if (topic_request_id_get(topic) == command_request_id)
+        {
+            if (strncmp(&topic[sizeof(TOPIC_METHOD_RESPONSE) - 1], "200/", sizeof("200/") - 1) != 0 ||
+                length - offset != strlen(command_response_expected) ||
+                memcmp(&data[offset], command_response_expected, length - offset) != 0)
+            {
+                broker_error("unexpected command response", topic);
+                printf("\t%.*s\r\n", (INT)(length - offset), (CHAR*)&data[offset]);
+            }
+
+            tx_event_flags_set(&events, BROKER_COMMAND_RESPONSE_EVENT, TX_OR);
+        }
+    }
+
+    if (ack_required)
+    {
+        mqtt_send(MQTT_CONTROL_PUBACK, ack, sizeof(ack), NX_NULL, 0);
+    }
+}
+
+static VOID mqtt_process_subscribe(UCHAR* data, UINT length)
+{
+    UCHAR suback[2 + BROKER_SUBSCRIBE_FILTERS];
+    UINT suback_length = 2;
+    UINT offset        = 2;
+    UINT filter_length;
+
+    if (length < 2)
+    {
+        return;
+    }
+
+    suback[0] = data[0];
+    suback[1] = data[1];
+
+    // Grant every filter at the requested QoS
+    while (offset + 2 <= length && suback_length < sizeof(suback))
+    {
+        filter_length = (data[offset] << 8) | data[offset + 1];
+        offset += 2 + filter_length;
+        if (offset >= length)
+        {
+            break;
+        }
+
+        suback[suback_length++] = data[offset++] & 0x03;
+    }
+
+    mqtt_send(MQTT_CONTROL_SUBACK, suback, suback_length, NX_NULL, 0);
+}
+
+static UINT mqtt_process(VOID)
+{
+    UINT offset = 0;
+    UINT header_length;
+    ULONG remaining_length;
+    UINT multiplier;
+    UCHAR control;
+    UCHAR ack[2];
+
+    while (offset + 2 <= mqtt_buffer_length)
+    {
+        // Decode the variable length remaining length field
+        header_length    = 1;
+        remaining_length = 0;
+        multiplier       = 1;
+        do
+        {
+            if (offset + header_length >= mqtt_buffer_length)
+            {
+                goto incomplete;
+            }
+            remaining_length += (mqtt_buffer[offset + header_length] & 0x7F) * multiplier;
+            multiplier *= 128;
+        } while (mqtt_buffer[offset + header_length++] & 0x80);
+
+        if (offset + header_length + remaining_length > mqtt_buffer_length)
+        {
+            goto incomplete;
+        }
+
+        control = mqtt_buffer[offset];
+
+        switch (control & 0xF0)
+        {
+            case MQTT_CONTROL_CONNECT:
+                ack[0] = 0;
+                ack[1] = mqtt_process_connect(&mqtt_buffer[offset + header_length], remaining_length);
+                mqtt_send(MQTT_CONTROL_CONNACK, ack, sizeof(ack), NX_NULL, 0);
+
+                // A refused client is disconnected
+                if (ack[1] != MQTT_CONNACK_ACCEPTED)
+                {
+                    return NX_NOT_CONNECTED;
+                }
+                break;
+
+            case MQTT_CONTROL_PUBLISH:
+                mqtt_process_publish(control, &mqtt_buffer[offset + header_length], remaining_length);
+                break;
+
+            case MQTT_CONTROL_SUBSCRIBE:
+                mqtt_process_subscribe(&mqtt_buffer[offset + header_length], remaining_length);
+                break;
+
+            case MQTT_CONTROL_UNSUBSCRIBE:
+                mqtt_send(MQTT_CONTROL_UNSUBACK, &mqtt_buffer[offset + header_length], 2, NX_NULL, 0);
+                break;
+
+            case MQTT_CONTROL_PINGREQ:
+                mqtt_send(MQTT_CONTROL_PINGRESP, NX_NULL, 0, NX_NULL, 0);
+                break;
+
+            case MQTT_CONTROL_DISCONNECT:
+                return NX_NOT_CONNECTED;
+
+            default:
+                break;
+        }
+
+        offset += header_length + remaining_length;
+    }
+
+incomplete:
+    // Keep any partial packet for the next record
+    memmove(mqtt_buffer, &mqtt_buffer[offset], mqtt_buffer_length - offset);
+    mqtt_buffer_length -= offset;
+
+    return NX_SUCCESS;
+}
+
+static VOID mqtt_session_run(VOID)
+{
+    UINT status;
+    ULONG bytes_copied;
+    NX_PACKET* packet_ptr;
+
+    if ((status = nx_secure_tls_session_start(&tls_session, &mqtt_socket, NX_WAIT_FOREVER)))
+    {
+        printf("ERROR: broker nx_secure_tls_session_start (0x%08x)\r\n", status);
+        return;
+    }
+
+    tx_mutex_get(&send_mutex, TX_WAIT_FOREVER);
+    connected          = NX_TRUE;
+    mqtt_buffer_length = 0;
+    tx_mutex_put(&send_mutex);
+
+    while ((status = nx_secure_tls_session_receive(&tls_session, &packet_ptr, NX_WAIT_FOREVER)) == NX_SUCCESS)
+    {
+        if (mqtt_buffer_length + packet_ptr->nx_packet_length > sizeof(mqtt_buffer))
+        {
+            printf("ERROR: broker MQTT packet exceeds buffer\r\n");
+            nx_packet_release(packet_ptr);
+            break;
+        }
+
+        status = nx_packet_data_retrieve(packet_ptr, &mqtt_buffer[mqtt_buffer_length], &bytes_copied);
+        nx_packet_release(packet_ptr);
+
+        if (status)
+        {
+            break;
+        }
+
+        mqtt_buffer_length += bytes_copied;
+
+        if (mqtt_process())
+        {
+            break;
+        }
+    }
+
+    tx_mutex_get(&send_mutex, TX_WAIT_FOREVER);
+    connected = NX_FALSE;
+    tx_mutex_put(&send_mutex);
+
+    nx_secure_tls_session_end(&tls_session, NX_NO_WAIT);
+}
+
+static VOID mqtt_thread_entry(ULONG parameter)
+{
+    UINT status;
+
+    if ((status = nx_tcp_server_socket_listen(broker_ip, BROKER_MQTT_PORT, &mqtt_socket, 1, NX_NULL)))
+    {
+        printf("ERROR: broker nx_tcp_server_socket_listen (0x%08x)\r\n", status);
+        return;
+    }
+
+    while (true)
+    {
+        if ((status = nx_tcp_server_socket_accept(&mqtt_socket, NX_WAIT_FOREVER)))
+        {
+            printf("ERROR: broker nx_tcp_server_socket_accept (0x%08x)\r\n", status);
+        }
+        else if (!offline)
+        {
+            mqtt_session_run();
+        }
+
+        nx_tcp_socket_disconnect(&mqtt_socket, NX_IP_PERIODIC_RATE);
+        nx_tcp_server_socket_unaccept(&mqtt_socket);
+        nx_tcp_server_socket_relisten(broker_ip, BROKER_MQTT_PORT, &mqtt_socket);
+    }
+}
+
+static VOID dns_thread_entry(ULONG parameter)
+{
+    UINT status;
+    UINT source_port;
+    ULONG source_ip;
+    ULONG query_length;
+    NX_PACKET* query_ptr;
+    NX_PACKET* response_ptr;
+    UCHAR message[512];
+    UCHAR answer[16] = {
+        0xC0, 0x0C,            // name, pointer to the question
+        0x00, 0x01,            // type A
+        0x00, 0x01,            // class IN
+        0x00, 0x00, 0x00, 0x3C // ttl 60s
+    };
+    ULONG address = broker_ip->nx_ip_interface[0].nx_interface_ip_address;
+
+    answer[10] = 0x00;
+    answer[11] = 0x04;
+    answer[12] = (UCHAR)(address >> 24);
+    answer[13] = (UCHAR)(address >> 16);
+    answer[14] = (UCHAR)(address >> 8);
+    answer[15] = (UCHAR)(address);
+
+    while (true)
+    {
+        if (nx_udp_socket_receive(&dns_socket, &query_ptr, NX_WAIT_FOREVER))
+        {
+            continue;
+        }
+
+        if (query_ptr->nx_packet_length < 12 || query_ptr->nx_packet_length + sizeof(answer) > sizeof(message))
+        {
+            nx_packet_release(query_ptr);
+            continue;
+        }
+
+        nx_udp_source_extract(query_ptr, &source_ip, &source_port);
+        status = nx_packet_data_retrieve(query_ptr, message, &query_length);
+        nx_packet_release(query_ptr);
+
+        if (status)
+        {
+            continue;
+        }
+
+        // Answer every query with the broker address
+        message[2] = 0x81;
+        message[3] = 0x80;
+        message[6] = 0x00;
+        message[7] = 0x01;
+        message[8] = message[9] = message[10] = message[11] = 0x00;
+        memcpy(&message[query_length], answer, sizeof(answer));
+
+        if ((status = nx_packet_allocate(broker_pool, &response_ptr, NX_UDP_PACKET, NX_WAIT_FOREVER)))
+        {
+            printf("ERROR: broker nx_packet_allocate (0x%08x)\r\n", status);
+        }
+        else if ((status = nx_packet_data_append(
+                      response_ptr, message, query_length + sizeof(answer), broker_pool, NX_WAIT_FOREVER)) ||
+                 (status = nx_udp_socket_send(&dns_socket, response_ptr, source_ip, source_port)))
+        {
+            printf("ERROR: broker DNS response (0x%08x)\r\n", status);
+            nx_packet_release(response_ptr);
+        }
+    }
+}
+
+UINT broker_command_invoke(CHAR* command_name, CHAR* payload, CHAR* expected_response, ULONG wait_option)
+{
+    UINT status;
+    ULONG actual_events;
+    CHAR topic[BROKER_TOPIC_SIZE];
+
+    tx_event_flags_get(&events, BROKER_COMMAND_RESPONSE_EVENT, TX_OR_CLEAR, &actual_events, TX_NO_WAIT);
+
+    snprintf(command_response_expected, sizeof(command_response_expected), "%s", expected_response);
+    snprintf(topic, sizeof(topic), "$iothub/methods/POST/%s/?$rid=%lu", command_name, ++command_request_id);
+
+    if ((status = mqtt_publish(topic, payload)))
+    {
+        return status;
+    }
+
+    return tx_event_flags_get(&events, BROKER_COMMAND_RESPONSE_EVENT, TX_OR_CLEAR, &actual_events, wait_option);
+}
+
+UINT broker_offline_set(UINT is_offline)
+{
+    offline = is_offline;
+
+    // Drop the session in progress, the device sees the hub go away and every reconnect is closed until online
+    if (is_offline)
+    {
+        nx_tcp_socket_disconnect(&mqtt_socket, NX_NO_WAIT);
+    }
+
+    return NX_SUCCESS;
+}
+
+UINT broker_hub_reject(UINT count)
+{
+    hub_reject_count = count;
+
+    // Drop the session in progress so the device has to connect again
+    return nx_tcp_socket_disconnect(&mqtt_socket, NX_NO_WAIT);
+}
+
+ULONG broker_dps_registration_count_get(VOID)
+{
+    return dps_registration_count;
+}
+
+ULONG broker_telemetry_count_get(VOID)
+{
+    return telemetry_count;
+}
+
+ULONG broker_telemetry_sample_count_get(VOID)
+{
+    return telemetry_sample_count;
+}
+
+ULONG broker_error_count_get(VOID)
+{
+    return error_count;
+}
+
+UINT broker_start(NX_IP* ip_ptr, NX_PACKET_POOL* pool_ptr)
+{
+    UINT status;
+
+    broker_ip   = ip_ptr;
+    broker_pool = pool_ptr;
+
+    if ((status = tx_mutex_create(&send_mutex, "broker", TX_NO_INHERIT)))
+    {
+        printf("ERROR: broker tx_mutex_create (0x%08x)\r\n", status);
+    }
+
+    else if ((status = tx_event_flags_create(&events, "broker")))
+    {
+        printf("ERROR: broker tx_event_flags_create (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_udp_socket_create(
+                  ip_ptr, &dns_socket, "broker dns", NX_IP_NORMAL, NX_FRAGMENT_OKAY, NX_IP_TIME_TO_LIVE, 8)))
+    {
+        printf("ERROR: broker nx_udp_socket_create (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_udp_socket_bind(&dns_socket, BROKER_DNS_PORT, TX_WAIT_FOREVER)))
+    {
+        printf("ERROR: broker nx_udp_socket_bind (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_tcp_socket_create(ip_ptr,
+                  &mqtt_socket,
+                  "broker mqtt",
+                  NX_IP_NORMAL,
+                  NX_FRAGMENT_OKAY,
+                  NX_IP_TIME_TO_LIVE,
+                  BROKER_TCP_WINDOW_SIZE,
+                  NX_NULL,
+                  NX_NULL)))
+    {
+        printf("ERROR: broker nx_tcp_socket_create (0x%08x)\r\n", status);
+    }
+
+    else if ((status = _nx_secure_tls_session_create_ext(&tls_session,
+                  _nx_azure_iot_tls_supported_crypto,
+                  _nx_azure_iot_tls_supported_crypto_size,
+                  _nx_azure_iot_tls_ciphersuite_map,
+                  _nx_azure_iot_tls_ciphersuite_map_size,
+                  tls_metadata_buffer,
+                  sizeof(tls_metadata_buffer))))
+    {
+        printf("ERROR: broker _nx_secure_tls_session_create_ext (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_secure_tls_session_packet_buffer_set(
+                  &tls_session, tls_packet_buffer, sizeof(tls_packet_buffer))))
+    {
+        printf("ERROR: broker nx_secure_tls_session_packet_buffer_set (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_secure_x509_certificate_initialize(&tls_certificate,
+                  (UCHAR*)broker_cert,
+                  (USHORT)broker_cert_size,
+                  NX_NULL,
+                  0,
+                  (UCHAR*)broker_private_key,
+                  (USHORT)broker_private_key_size,
+                  NX_SECURE_X509_KEY_TYPE_RSA_PKCS1_DER)))
+    {
+        printf("ERROR: broker nx_secure_x509_certificate_initialize (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_secure_tls_local_certificate_add(&tls_session, &tls_certificate)))
+    {
+        printf("ERROR: broker nx_secure_tls_local_certificate_add (0x%08x)\r\n", status);
+    }
+
+    else if ((status = tx_thread_create(&dns_thread,
+                  "broker dns",
+                  dns_thread_entry,
+                  0,
+                  dns_thread_stack,
+                  sizeof(dns_thread_stack),
+                  BROKER_THREAD_PRIORITY,
+                  BROKER_THREAD_PRIORITY,
+                  TX_NO_TIME_SLICE,
+                  TX_AUTO_START)))
+    {
+        printf("ERROR: broker dns thread create (0x%08x)\r\n", status);
+    }
+
+    else if ((status = tx_thread_create(&mqtt_thread,
+                  "broker mqtt",
+                  mqtt_thread_entry,
+                  0,
+                  mqtt_thread_stack,
+                  sizeof(mqtt_thread_stack),
+                  BROKER_THREAD_PRIORITY,
+                  BROKER_THREAD_PRIORITY,
+                  TX_NO_TIME_SLICE,
+                  TX_AUTO_START)))
+    {
+        printf("ERROR: broker mqtt thread create (0x%08x)\r\n", status);
+    }
+
+    return status;
+}
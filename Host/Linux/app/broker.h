@@ -0,0 +1,40 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _BROKER_H
+#define _BROKER_H
+
+#include "nx_api.h"
+
+#define BROKER_HOSTNAME "broker.azure-devices.net"
+
+// Minimal stand-in for IoT Hub and DPS, serving DNS and MQTT over TLS on the broker IP.
+// It understands just enough of the hub topic space to drive the client through
+// connect, twin get, reported property patch, telemetry and direct methods, and
+// assigns every DPS registration to itself.
+UINT broker_start(NX_IP* ip_ptr, NX_PACKET_POOL* pool_ptr);
+
+// Invoke a direct method on the connected device and block until it responds. A response other than 200 with
+// expected_response as its payload counts as a broker error
+UINT broker_command_invoke(CHAR* command_name, CHAR* payload, CHAR* expected_response, ULONG wait_option);
+
+// Take the broker offline, dropping the device connection, or bring it back
+UINT broker_offline_set(UINT is_offline);
+
+// Drop the device connection and refuse its next count hub connects as not authorized, as a hub would
+// once the device has been moved. DPS connects are still accepted
+UINT broker_hub_reject(UINT count);
+
+// Number of DPS registrations served, each is assigned to this broker
+ULONG broker_dps_registration_count_get(VOID);
+
+// Number of well formed telemetry messages received since startup
+ULONG broker_telemetry_count_get(VOID);
+
+// Number of readings in those messages, a batch counts once per reading
+ULONG broker_telemetry_sample_count_get(VOID);
+
+// Number of protocol or content mismatches seen, any of which fails the benchmark
+ULONG broker_error_count_get(VOID);
+
+#endif
@@ -0,0 +1,142 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "broker_cert.h"
+
+/* Self-signed test certificate for broker.azure-devices.net, used by the local broker only */
+const unsigned char broker_cert[] = {
+  0x30, 0x82, 0x03, 0x4c, 0x30, 0x82, 0x02, 0x34, 0xa0, 0x03, 0x02, 0x01, 0x02, 0x02, 0x14, 0x2a,
+  0xee, 0x8a, 0xfe, 0xf3, 0x27, 0x3b, 0x19, 0xd3, 0x13, 0x05, 0x6c, 0x21, 0x56, 0xda, 0x85, 0xc3,
+  0x90, 0xb2, 0x8f, 0x30, 0x0d, 0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x0b,
+  0x05, 0x00, 0x30, 0x23, 0x31, 0x21, 0x30, 0x1f, 0x06, 0x03, 0x55, 0x04, 0x03, 0x0c, 0x18, 0x62,
+  0x72, 0x6f, 0x6b, 0x65, 0x72, 0x2e, 0x61, 0x7a, 0x75, 0x72, 0x65, 0x2d, 0x64, 0x65, 0x76, 0x69,
+  0x63, 0x65, 0x73, 0x2e, 0x6e, 0x65, 0x74, 0x30, 0x1e, 0x17, 0x0d, 0x32, 0x36, 0x31, 0x30, 0x31,
+  0x36, 0x32, 0x32, 0x32, 0x32, 0x35, 0x32, 0x5a, 0x17, 0x0d, 0x34, 0x36, 0x31, 0x30, 0x31, 0x31,
+  0x32, 0x32, 0x32, 0x32, 0x35, 0x32, 0x5a, 0x30, 0x23, 0x31, 0x21, 0x30, 0x1f, 0x06, 0x03, 0x55,
+  0x04, 0x03, 0x0c, 0x18, 0x62, 0x72, 0x6f, 0x6b, 0x65, 0x72, 0x2e, 0x61, 0x7a, 0x75, 0x72, 0x65,
+  0x2d, 0x64, 0x65, 0x76, 0x69, 0x63, 0x65, 0x73, 0x2e, 0x6e, 0x65, 0x74, 0x30, 0x82, 0x01, 0x22,
+  0x30, 0x0d, 0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x01, 0x05, 0x00, 0x03,
+  0x82, 0x01, 0x0f, 0x00, 0x30, 0x82, 0x01, 0x0a, 0x02, 0x82, 0x01, 0x01, 0x00, 0x97, 0x43, 0x48,
+  0x00, 0xdc, 0x5c, 0x84, 0x2e, 0x9c, 0x84, 0x9d, 0x36, 0xcc, 0x48, 0x37, 0xee, 0xa0, 0x40, 0x99,
+  0x6b, 0x82, 0x3a, 0xbe, 0x71, 0x5a, 0x6f, 0x94, 0x38, 0xfc, 0xe7, 0x80, 0xb9, 0xa5, 0x28, 0x23,
+  0xb3, 0x12, 0x63, 0xec, 0xc8, 0xc3, 0x27, 0x66, 0x8d, 0x59, 0x63, 0x30, 0xcc, 0x3e, 0xa4, 0x3b,
+  0x1f, 0xc9, 0x26, 0x22, 0xd5, 0xa1, 0x6f, 0xce, 0x24, 0x51, 0xae, 0x6b, 0x7c, 0x88, 0xa7, 0x58,
+  0x75, 0xd8, 0x97, 0x6b, 0x54, 0x54, 0x21, 0x5c, 0xff, 0xe8, 0xed, 0x10, 0x99, 0x98, 0x50, 0x0b,
+  0xe0, 0xca, 0x92, 0x13, 0xff, 0x3f, 0x3d, 0xe3, 0x05, 0xa5, 0x3b, 0x1c, 0x21, 0x2b, 0x6c, 0x31,
+  0x5a, 0x2a, 0xfd, 0x2c, 0x52, 0x06, 0x4d, 0xc0, 0xc6, 0x61, 0xe3, 0x79, 0x42, 0x69, 0xae, 0x90,
+  0x6a, 0x19, 0x46, 0x6e, 0xe9, 0x26, 0x2e, 0x9c, 0x46, 0xf2, 0xe2, 0xbc, 0xaf, 0x76, 0xa1, 0xff,
+  0x7f, 0x34, 0x5c, 0x94, 0x47, 0x89, 0x7f, 0xdc, 0x2b, 0x66, 0x23, 0x76, 0x1e, 0x48, 0xce, 0xb4,
+  0xfc, 0xc7, 0x72, 0x05, 0xdc, 0x77, 0x91, 0xaf, 0x42, 0x86, 0x89, 0xe4, 0x67, 0x2e, 0x74, 0xef,
+  0xbe, 0x53, 0x6a, 0xe9, 0x08, 0x9c, 0xf0, 0xb1, 0x71, 0x9f, 0xaa, 0xe6, 0x70, 0x51, 0xb6, 0xbd,
+  0x9b, 0x4c, 0x22, 0x3f, 0x61, 0x53, 0x20, 0x62, 0x7d, 0x3d, 0x54, 0xbc, 0x7f, 0x17, 0x39, 0x8c,
+  0x08, 0x62, 0xb6, 0x5c, 0xc7, 0xcb, 0xdf, 0xc1, 0xcb, 0x97, 0x96, 0x63, 0xfb, 0x9b, 0x08, 0xe4,
+  0x5c, 0x5b, 0x15, 0xed, 0x4a, 0x9c, 0xa2, 0xfb, 0xf7, 0xee, 0x7b, 0xbb, 0xa0, 0xfe, 0x2b, 0x38,
+  0x8f, 0x43, 0x2f, 0x8e, 0x5e, 0x50, 0x79, 0x45, 0x15, 0xd6, 0xdc, 0x2b, 0x87, 0x9f, 0xaf, 0xda,
+  0x4a, 0xc5, 0x2b, 0xc0, 0x65, 0x13, 0xf4, 0x9e, 0x5a, 0x36, 0x4c, 0xc8, 0xcf, 0x02, 0x03, 0x01,
+  0x00, 0x01, 0xa3, 0x78, 0x30, 0x76, 0x30, 0x1d, 0x06, 0x03, 0x55, 0x1d, 0x0e, 0x04, 0x16, 0x04,
+  0x14, 0x49, 0xa6, 0xd8, 0x27, 0xa6, 0xdf, 0xf4, 0xd1, 0x95, 0xc1, 0x62, 0xd3, 0x32, 0xcc, 0x00,
+  0x88, 0xee, 0x23, 0x0a, 0xe3, 0x30, 0x1f, 0x06, 0x03, 0x55, 0x1d, 0x23, 0x04, 0x18, 0x30, 0x16,
+  0x80, 0x14, 0x49, 0xa6, 0xd8, 0x27, 0xa6, 0xdf, 0xf4, 0xd1, 0x95, 0xc1, 0x62, 0xd3, 0x32, 0xcc,
+  0x00, 0x88, 0xee, 0x23, 0x0a, 0xe3, 0x30, 0x23, 0x06, 0x03, 0x55, 0x1d, 0x11, 0x04, 0x1c, 0x30,
+  0x1a, 0x82, 0x18, 0x62, 0x72, 0x6f, 0x6b, 0x65, 0x72, 0x2e, 0x61, 0x7a, 0x75, 0x72, 0x65, 0x2d,
+  0x64, 0x65, 0x76, 0x69, 0x63, 0x65, 0x73, 0x2e, 0x6e, 0x65, 0x74, 0x30, 0x0f, 0x06, 0x03, 0x55,
+  0x1d, 0x13, 0x01, 0x01, 0xff, 0x04, 0x05, 0x30, 0x03, 0x01, 0x01, 0xff, 0x30, 0x0d, 0x06, 0x09,
+  0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x0b, 0x05, 0x00, 0x03, 0x82, 0x01, 0x01, 0x00,
+  0x32, 0xef, 0xf7, 0x7b, 0x00, 0x71, 0x5a, 0xf9, 0x91, 0x1b, 0x3a, 0xe9, 0x7c, 0xca, 0xcf, 0xd6,
+  0x3d, 0xa9, 0x1b, 0x40, 0x77, 0x28, 0x6a, 0x70, 0x13, 0x40, 0xf2, 0x83, 0xf6, 0x33, 0x93, 0x3b,
+  0xfd, 0x48, 0x3d, 0xf5, 0x81, 0x5c, 0x9d, 0x38, 0x9f, 0x65, 0x27, 0x07, 0xb6, 0x22, 0x9c, 0xed,
+  0xe6, 0xde, 0x6c, 0x5c, 0x43, 0x5c, 0x67, 0x92, 0xaa, 0x8a, 0x03, 0x57, 0xc2, 0xaf, 0x34, 0xe1,
+  0x78, 0x37, 0x70, 0x77, 0x86, 0xcd, 0x31, 0xe3, 0x0d, 0xfe, 0x5a, 0xae, 0xa5, 0xc7, 0xbe, 0x1a,
+  0xce, 0x35, 0xa0, 0xbd, 0x56, 0xca, 0x89, 0x96, 0xad, 0x85, 0xef, 0xce, 0x30, 0x3f, 0x81, 0x78,
+  0x1d, 0x94, 0x57, 0x48, 0xb1, 0xdc, 0x6f, 0x16, 0x65, 0x5f, 0xee, 0xf3, 0xcb, 0x0b, 0xb1, 0x21,
+  0xb1, 0xa7, 0x7e, 0x29, 0xd6, 0x58, 0xee, 0x57, 0x3d, 0x76, 0xc1, 0x86, 0x5d, 0x34, 0xce, 0x98,
+  0x3e, 0xe1, 0xf8, 0xd4, 0xb5, 0xac, 0xee, 0x92, 0x6f, 0xbd, 0x2d, 0xe2, 0xc1, 0x17, 0x6b, 0x8f,
+  0x0a, 0x6c, 0x73, 0x08, 0x89, 0xc7, 0x21, 0x5d, 0x72, 0xe5, 0x11, 0xcd, 0xa9, 0x71, 0x99, 0x7b,
+  0x52, 0x24, 0x83, 0x3c, 0x55, 0xad, 0xa0, 0x76, 0x2c, 0x8c, 0x90, 0x43, 0xeb, 0x26, 0xe7, 0x7d,
+  0xc1, 0x05, 0x9a, 0x95, 0xe4, 0x43, 0xf7, 0x9e, 0x68, 0x90, 0x27, 0xe8, 0xcf, 0x2e, 0xcc, 0xe6,
+  0x22, 0x87, 0x5a, 0xe4, 0x5e, 0x25, 0x13, 0x01, 0x98, 0xe8, 0x09, 0x9f, 0xb8, 0x47, 0x02, 0xc9,
+  0x6e, 0x11, 0x50, 0xfd, 0x93, 0x80, 0xcd, 0x52, 0xcb, 0xf0, 0x10, 0x24, 0xf4, 0x66, 0x3b, 0xbc,
+  0x49, 0xa5, 0xc2, 0x33, 0x64, 0x3d, 0x34, 0x82, 0xf8, 0x51, 0xb7, 0x87, 0x99, 0xa4, 0x44, 0x3b,
+  0x73, 0x65, 0xe5, 0x56, 0x82, 0x9f, 0xc6, 0xb8, 0x8e, 0x2d, 0x7b, 0x4e, 0x00, 0xbd, 0x47, 0x6d
+};
+const unsigned int broker_cert_size = sizeof(broker_cert);
+
+/* RSA private key (PKCS#1 DER) matching broker_cert */
+const unsigned char broker_private_key[] = {
+  0x30, 0x82, 0x04, 0xa2, 0x02, 0x01, 0x00, 0x02, 0x82, 0x01, 0x01, 0x00, 0x97, 0x43, 0x48, 0x00,
+  0xdc, 0x5c, 0x84, 0x2e, 0x9c, 0x84, 0x9d, 0x36, 0xcc, 0x48, 0x37, 0xee, 0xa0, 0x40, 0x99, 0x6b,
+  0x82, 0x3a, 0xbe, 0x71, 0x5a, 0x6f, 0x94, 0x38, 0xfc, 0xe7, 0x80, 0xb9, 0xa5, 0x28, 0x23, 0xb3,
+  0x12, 0x63, 0xec, 0xc8, 0xc3, 0x27, 0x66, 0x8d, 0x59, 0x63, 0x30, 0xcc, 0x3e, 0xa4, 0x3b, 0x1f,
+  0xc9, 0x26, 0x22, 0xd5, 0xa1, 0x6f, 0xce, 0x24, 0x51, 0xae, 0x6b, 0x7c, 0x88, 0xa7, 0x58, 0x75,
+  0xd8, 0x97, 0x6b, 0x54, 0x54, 0x21, 0x5c, 0xff, 0xe8, 0xed, 0x10, 0x99, 0x98, 0x50, 0x0b, 0xe0,
+  0xca, 0x92, 0x13, 0xff, 0x3f, 0x3d, 0xe3, 0x05, 0xa5, 0x3b, 0x1c, 0x21, 0x2b, 0x6c, 0x31, 0x5a,
+  0x2a, 0xfd, 0x2c, 0x52, 0x06, 0x4d, 0xc0, 0xc6, 0x61, 0xe3, 0x79, 0x42, 0x69, 0xae, 0x90, 0x6a,
+  0x19, 0x46, 0x6e, 0xe9, 0x26, 0x2e, 0x9c, 0x46, 0xf2, 0xe2, 0xbc, 0xaf, 0x76, 0xa1, 0xff, 0x7f,
+  0x34, 0x5c, 0x94, 0x47, 0x89, 0x7f, 0xdc, 0x2b, 0x66, 0x23, 0x76, 0x1e, 0x48, 0xce, 0xb4, 0xfc,
+  0xc7, 0x72, 0x05, 0xdc, 0x77, 0x91, 0xaf, 0x42, 0x86, 0x89, 0xe4, 0x67, 0x2e, 0x74, 0xef, 0xbe,
+  0x53, 0x6a, 0xe9, 0x08, 0x9c, 0xf0, 0xb1, 0x71, 0x9f, 0xaa, 0xe6, 0x70, 0x51, 0xb6, 0xbd, 0x9b,
+  0x4c, 0x22, 0x3f, 0x61, 0x53, 0x20, 0x62, 0x7d, 0x3d, 0x54, 0xbc, 0x7f, 0x17, 0x39, 0x8c, 0x08,
+  0x62, 0xb6, 0x5c, 0xc7, 0xcb, 0xdf, 0xc1, 0xcb, 0x97, 0x96, 0x63, 0xfb, 0x9b, 0x08, 0xe4, 0x5c,
+  0x5b, 0x15, 0xed, 0x4a, 0x9c, 0xa2, 0xfb, 0xf7, 0xee, 0x7b, 0xbb, 0xa0, 0xfe, 0x2b, 0x38, 0x8f,
+  0x43, 0x2f, 0x8e, 0x5e, 0x50, 0x79, 0x45, 0x15, 0xd6, 0xdc, 0x2b, 0x87, 0x9f, 0xaf, 0xda, 0x4a,
+  0xc5, 0x2b, 0xc0, 0x65, 0x13, 0xf4, 0x9e, 0x5a, 0x36, 0x4c, 0xc8, 0xcf, 0x02, 0x03, 0x01, 0x00,
+  0x01, 0x02, 0x82, 0x01, 0x00, 0x05, 0x31, 0x70, 0x25, 0x67, 0x6b, 0x5d, 0xb6, 0x63, 0xf5, 0x41,
+  0x98, 0x82, 0x06, 0xf0, 0xb4, 0xa6, 0x97, 0xd1, 0x2c, 0x99, 0xb9, 0xfe, 0x93, 0xd1, 0xb1, 0x06,
+  0xfb, 0xb5, 0xe3, 0x14, 0xce, 0x4a, 0xd7, 0x47, 0xf2, 0x7b, 0xed, 0x26, 0x51, 0xf6, 0x31, 0x42,
+  0x1a, 0x14, 0x39, 0x8d, 0x91, 0x55, 0x8d, 0x39, 0xe2, 0x6b, 0x7b, 0x7d, 0xb2, 0xab, 0xea, 0x34,
+  0xbf, 0x96, 0x76, 0x50, 0x86, 0x64, 0x02, 0xaa, 0xcc, 0xd0, 0xf4, 0xd1, 0xe0, 0x81, 0x4a, 0xeb,
+  0xf0, 0x75, 0x44, 0xbe, 0x4f, 0x27, 0xa5, 0x87, 0xe2, 0xdd, 0xd1, 0x8a, 0x12, 0x37, 0x4f, 0x9e,
+  0x9d, 0xb1, 0x00, 0x88, 0x84, 0xb3, 0x02, 0xf1, 0xe6, 0xd0, 0x97, 0x04, 0x90, 0x84, 0x5a, 0xe3,
+  0x05, 0x6c, 0x92, 0xec, 0xb4, 0xd5, 0x00, 0x03, 0x41, 0x41, 0x40, 0xe3, 0xc9, 0xe9, 0x5f, 0xac,
+  0x49, 0xdb, 0x48, 0xe1, 0x85, 0x6f, 0x20, 0x23, 0xe2, 0x0a, 0x28, 0x33, 0xe5, 0x12, 0x43, 0x5d,
+  0x23, 0x9d, 0x06, 0x89, 0x9a, 0x5d, 0x29, 0x2e, 0x5d, 0x63, 0xec, 0x82, 0xc1, 0x2f, 0xfa, 0x5f,
+  0x31, 0x6b, 0x56, 0x0f, 0xa1, 0x1d, 0x01, 0x56, 0x0a, 0x65, 0x03, 0x59, 0x43, 0xb8, 0x33, 0xe8,
+  0x57, 0x19, 0xa8, 0xcb, 0x55, 0xaa, 0x96, 0xea, 0x98, 0xd4, 0x39, 0x68, 0xff, 0x54, 0xbe, 0xf4,
+  0xd4, 0xb7, 0x4b, 0x9a, 0x89, 0x5d, 0x39, 0x30, 0xf4, 0xd8, 0x71, 0x80, 0x90, 0x66, 0x8f, 0x4e,
+  0x24, 0x3d, 0x39, 0xa9, 0x58, 0x0f, 0x46, 0x7f, 0xfb, 0x83, 0xc1, 0x0a, 0x44, 0x9e, 0xba, 0x47,
+  0x5e, 0xee, 0xd1, 0x3f, 0x28, 0x47, 0x20, 0x78, 0x03, 0x01, 0x54, 0x9a, 0x0d, 0x08, 0x11, 0x08,
+  0xab, 0xff, 0x4b, 0xd2, 0x75, 0x86, 0x4d, 0x61, 0x72, 0x63, 0x57, 0x00, 0xfa, 0xcd, 0x68, 0x4b,
+  0x6b, 0xf9, 0x0b, 0x7e, 0xb1, 0x02, 0x81, 0x81, 0x00, 0xc5, 0xa3, 0xb5, 0xe0, 0xf2, 0x67, 0x2b,
+  0xf3, 0x1f, 0xb2, 0x26, 0xfc, 0x90, 0xc1, 0x8e, 0xb0, 0xe7, 0xd2, 0xc6, 0x3b, 0x48, 0xcf, 0xd5,
+  0x1c, 0xcc, 0x22, 0xef, 0xa2, 0xf2, 0x14, 0x9c, 0xe2, 0x80, 0xe9, 0xcd, 0x24, 0xab, 0x6f, 0x3f,
+  0x4b, 0x5d, 0x98, 0x69, 0xd3, 0x2a, 0x24, 0xae, 0x4f, 0xdf, 0x45, 0x8f, 0x40, 0x5e, 0x2f, 0xda,
+  0xac, 0x0c, 0xb4, 0x23, 0x0d, 0xe2, 0xce, 0xea, 0x0a, 0xc1, 0x55, 0x5b, 0x59, 0x1d, 0xb5, 0x1e,
+  0xb3, 0xfa, 0xbd, 0x64, 0x5d, 0x99, 0x9f, 0x47, 0xd7, 0x88, 0x7b, 0xa2, 0xe8, 0x33, 0x50, 0xdd,
+  0x92, 0x2a, 0xe4, 0xb7, 0x81, 0x33, 0x8a, 0x3b, 0xab, 0x7e, 0x54, 0xe7, 0x02, 0x6c, 0xa6, 0x15,
+  0xa8, 0x65, 0xf3, 0x1a, 0xf7, 0x72, 0x49, 0x59, 0xe7, 0x7e, 0xe6, 0x47, 0x71, 0xff, 0x67, 0x3e,
+  0xdf, 0x5e, 0x2b, 0xbb, 0x15, 0x6d, 0x68, 0x6e, 0xcb, 0x02, 0x81, 0x81, 0x00, 0xc3, 0xed, 0xc9,
+  0xf0, 0x66, 0x91, 0x46, 0xf6, 0x2f, 0xf4, 0x75, 0xcf, 0xb2, 0x52, 0x5b, 0xd5, 0x48, 0xea, 0x3c,
+  0xbe, 0x0c, 0x69, 0x73, 0xaf, 0x33, 0xc9, 0xdd, 0x74, 0xf7, 0x81, 0x00, 0x9d, 0x68, 0xc5, 0x45,
+  0x38, 0x24, 0x7c, 0x33, 0x49, 0xef, 0xf8, 0x6a, 0xc6, 0x82, 0x47, 0x87, 0x43, 0x7f, 0xcd, 0x34,
+  0xc1, 0x76, 0xae, 0x37, 0x1c, 0xd7, 0x92, 0x11, 0xf6, 0x0d, 0x58, 0x54, 0x81, 0x8f, 0xa0, 0x95,
+  0xf1, 0x54, 0x36, 0x25, 0xf7, 0xb3, 0x21, 0x5f, 0xfc, 0x0f, 0x0b, 0x11, 0xee, 0xc1, 0x05, 0xf1,
+  0xce, 0xc0, 0x9f, 0xbd, 0x62, 0x50, 0xa5, 0x39, 0xa1, 0x7d, 0x41, 0x5f, 0xed, 0x80, 0xa9, 0x96,
+  0x8f, 0x30, 0x3d, 0x15, 0x4f, 0x80, 0xb4, 0x0b, 0xf6, 0xcd, 0x45, 0x05, 0xcf, 0x5f, 0x7d, 0x5e,
+  0xfd, 0x8c, 0x09, 0xa5, 0x7f, 0x85, 0xa5, 0x4b, 0x75, 0x6d, 0xb3, 0xe9, 0x8d, 0x02, 0x81, 0x80,
+  0x13, 0x4a, 0x98, 0x8d, 0x3d, 0x7b, 0xfe, 0x99, 0x3b, 0xa5, 0xcb, 0x12, 0x6a, 0x1a, 0xca, 0x8f,
+  0xd0, 0x01, 0x0d, 0xe2, 0x69, 0x88, 0x07, 0xd8, 0x48, 0xc0, 0xbc, 0x3d, 0x5e, 0x7d, 0xce, 0x96,
+  0x79, 0x58, 0xd8, 0xf2, 0x54, 0x5d, 0x86, 0x83, 0x17, 0xbe, 0xb1, 0xcd, 0xaf, 0xd6, 0x66, 0xc1,
+  0x5b, 0x1c, 0xd2, 0x0f, 0xc9, 0x61, 0xc8, 0x69, 0x74, 0xcf, 0xfc, 0x7f, 0xf5, 0x7c, 0x96, 0xf1,
+  0xb7, 0xcf, 0x5a, 0x1c, 0x47, 0xbf, 0x0f, 0x21, 0x28, 0x3f, 0x66, 0x55, 0x90, 0x92, 0x30, 0x94,
+  0x04, 0x39, 0x75, 0x3c, 0x4f, 0x0d, 0xfc, 0xa2, 0xb0, 0xd7, 0x24, 0x66, 0x53, 0x1e, 0x92, 0x16,
+  0x7a, 0x3d, 0x55, 0x53, 0x32, 0x41, 0xbf, 0xe9, 0x71, 0x12, 0x1a, 0xb6, 0xbe, 0x8c, 0x14, 0x5f,
+  0x79, 0x4e, 0x86, 0xf8, 0xc4, 0xa2, 0x52, 0x4b, 0xc1, 0x48, 0x69, 0x79, 0x7c, 0xf5, 0x6d, 0xa3,
+  0x02, 0x81, 0x80, 0x02, 0x6b, 0x28, 0x08, 0x00, 0xac, 0x20, 0x6d, 0x1f, 0x90, 0x6b, 0xf7, 0xe1,
+  0x62, 0xa4, 0xe1, 0x90, 0x21, 0xdc, 0x18, 0x18, 0x7d, 0x20, 0xc1, 0x73, 0xe9, 0x35, 0x03, 0xa1,
+  0x9e, 0x85, 0x0c, 0x6c, 0x63, 0xab, 0x04, 0x13, 0x67, 0x39, 0x16, 0xdb, 0x90, 0x7c, 0x78, 0xf0,
+  0xd8, 0xc3, 0x31, 0xb1, 0x1d, 0x2e, 0x5e, 0x89, 0x01, 0x83, 0x8a, 0xa6, 0x9a, 0x96, 0x00, 0x2c,
+  0x8f, 0xff, 0x93, 0x0d, 0xdb, 0xd4, 0x9e, 0x03, 0x05, 0x1c, 0x18, 0xdf, 0xac, 0x34, 0xcc, 0x1e,
+  0xbf, 0x6b, 0x3c, 0x40, 0x43, 0xbb, 0x85, 0x6a, 0xd9, 0x4d, 0xf4, 0x2d, 0xbc, 0xac, 0x66, 0x72,
+  0xee, 0x60, 0xa9, 0xc4, 0xe1, 0xd3, 0x0a, 0xf7, 0x74, 0x79, 0x93, 0xde, 0xa9, 0xda, 0x4f, 0xf4,
+  0x9e, 0xba, 0x80, 0xa1, 0xd4, 0x21, 0x5d, 0x0d, 0xe2, 0x7c, 0x99, 0x83, 0x63, 0xd3, 0xf7, 0xa2,
+  0x20, 0x0b, 0x6d, 0x02, 0x81, 0x80, 0x7e, 0xdf, 0xce, 0x34, 0xa2, 0xcb, 0x47, 0x50, 0xc9, 0xb5,
+  0xdc, 0xf1, 0x4d, 0x22, 0x21, 0x98, 0x2b, 0xe0, 0x31, 0xbb, 0x3c, 0x0c, 0x53, 0xed, 0xff, 0x90,
+  0x0b, 0xe2, 0xcb, 0x16, 0x20, 0x69, 0x54, 0x8e, 0x3f, 0xd8, 0x98, 0x22, 0xd7, 0xa0, 0xf2, 0xd9,
+  0x11, 0x52, 0x77, 0x4f, 0x6d, 0xa3, 0x9d, 0x8e, 0x75, 0xf9, 0xf1, 0x3e, 0x5e, 0xf6, 0x8d, 0xde,
+  0x90, 0x2e, 0xcc, 0x0f, 0xab, 0xb4, 0xdd, 0x28, 0x0d, 0xbb, 0xbd, 0xd6, 0x28, 0x0c, 0x60, 0xc2,
+  0xdd, 0x95, 0xa3, 0xf4, 0xb5, 0xac, 0x91, 0x49, 0x17, 0xe0, 0xaa, 0x51, 0xa4, 0xf7, 0xec, 0xcf,
+  0x76, 0x38, 0x39, 0x85, 0xb6, 0x41, 0x49, 0x5d, 0x0d, 0xbe, 0x70, 0x61, 0x78, 0xa5, 0x27, 0xcb,
+  0x0e, 0xaa, 0x1a, 0x2b, 0xb5, 0x2e, 0x64, 0x7a, 0xee, 0x56, 0x35, 0x21, 0x34, 0xcb, 0x42, 0xbc,
+  0x1f, 0x34, 0xb8, 0xbe, 0x7c, 0xc2
+};
+const unsigned int broker_private_key_size = sizeof(broker_private_key);
@@ -0,0 +1,13 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _BROKER_CERT_H
+#define _BROKER_CERT_H
+
+extern const unsigned char broker_cert[];
+extern const unsigned int broker_cert_size;
+
+extern const unsigned char broker_private_key[];
+extern const unsigned int broker_private_key_size;
+
+#endif
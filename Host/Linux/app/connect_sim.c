@@ -0,0 +1,201 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+// Replays connection failure sequences through the reconnect policy engine on a simulated clock, so the
+// same seed always gives the same delays
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "azure_iot_connect_policy.h"
+
+// An attempt that ends in CONNECTION_FAILURE_NONE connected
+typedef struct SIM_STEP_STRUCT
+{
+    CONNECTION_FAILURE_CLASS outcome;
+    ULONG attempt_ms;
+} SIM_STEP;
+
+typedef struct SIM_SCENARIO_STRUCT
+{
+    const char* name;
+    const SIM_STEP* steps;
+    UINT step_count;
+} SIM_SCENARIO;
+
+#define SIM_FLEET_SIZE 8
+
+static const SIM_STEP transient_drop[] = {
+    {CONNECTION_FAILURE_TRANSIENT, 50},
+    {CONNECTION_FAILURE_TRANSIENT, 50},
+    {CONNECTION_FAILURE_NONE, 800},
+};
+
+static const SIM_STEP network_outage[] = {
+    {CONNECTION_FAILURE_NETWORK, 5000},
+    {CONNECTION_FAILURE_NETWORK, 5000},
+    {CONNECTION_FAILURE_NETWORK, 5000},
+    {CONNECTION_FAILURE_NETWORK, 5000},
+    {CONNECTION_FAILURE_NETWORK, 5000},
+    {CONNECTION_FAILURE_NETWORK, 5000},
+    {CONNECTION_FAILURE_NONE, 2500},
+};
+
+static const SIM_STEP revoked_credentials[] = {
+    {CONNECTION_FAILURE_AUTH, 900},
+    {CONNECTION_FAILURE_AUTH, 900},
+    {CONNECTION_FAILURE_AUTH, 900},
+    {CONNECTION_FAILURE_AUTH, 900},
+    {CONNECTION_FAILURE_AUTH, 900},
+    {CONNECTION_FAILURE_NONE, 900},
+};
+
+static const SIM_STEP token_expiry[] = {
+    {CONNECTION_FAILURE_TOKEN, 0},
+    {CONNECTION_FAILURE_NONE, 900},
+};
+
+static const SIM_STEP mixed[] = {
+    {CONNECTION_FAILURE_TRANSIENT, 50},
+    {CONNECTION_FAILURE_NETWORK, 5000},
+    {CONNECTION_FAILURE_NETWORK, 5000},
+    {CONNECTION_FAILURE_AUTH, 900},
+    {CONNECTION_FAILURE_TRANSIENT, 50},
+    {CONNECTION_FAILURE_NONE, 900},
+    {CONNECTION_FAILURE_TRANSIENT, 50},
+    {CONNECTION_FAILURE_NONE, 900},
+};
+
+#define SCENARIO(steps) #steps, steps, sizeof(steps) / sizeof(steps[0])
+
+static const SIM_SCENARIO scenarios[] = {
+    {SCENARIO(transient_drop)},
+    {SCENARIO(network_outage)},
+    {SCENARIO(revoked_credentials)},
+    {SCENARIO(token_expiry)},
+    {SCENARIO(mixed)},
+};
+
+static const char* class_name(CONNECTION_FAILURE_CLASS failure_class)
+{
+    switch (failure_class)
+    {
+        case CONNECTION_FAILURE_TRANSIENT:
+            return "transient";
+        case CONNECTION_FAILURE_NETWORK:
+            return "network";
+        case CONNECTION_FAILURE_AUTH:
+            return "auth";
+        case CONNECTION_FAILURE_TOKEN:
+            return "token";
+        default:
+            return "connected";
+    }
+}
+
+// Runs one scenario and returns a checksum of the delays it produced
+static ULONG scenario_run(const SIM_SCENARIO* scenario, ULONG seed, bool verbose)
+{
+    CONNECTION_POLICY_ENGINE engine;
+    uint64_t now_ms = 0;
+    ULONG checksum  = 2166136261u;
+    ULONG delay_ms;
+
+    connection_policy_init(&engine);
+    connection_policy_seed(&engine, seed);
+
+    if (verbose)
+    {
+        printf("%s\r\n", scenario->name);
+    }
+
+    // The first attempt has nothing to recover from
+    connection_policy_failure(&engine, CONNECTION_FAILURE_NONE, now_ms);
+
+    for (UINT i = 0; i < scenario->step_count; i++)
+    {
+        const SIM_STEP* step = &scenario->steps[i];
+
+        now_ms += step->attempt_ms;
+
+        if (step->outcome == CONNECTION_FAILURE_NONE)
+        {
+            connection_policy_success(&engine, now_ms);
+            delay_ms = 0;
+        }
+        else
+        {
+            delay_ms = connection_policy_failure(&engine, step->outcome, now_ms);
+            now_ms += delay_ms;
+        }
+
+        checksum = ((checksum ^ delay_ms) * 16777619u) & 0xFFFFFFFF;
+
+        if (verbose)
+        {
+            printf("  t=%8lu ms  %-10s wait %7lu ms\r\n",
+                (ULONG)(now_ms - delay_ms),
+                class_name(step->outcome),
+                delay_ms);
+        }
+    }
+
+    if (verbose)
+    {
+        printf("  attempts %lu, breaker opened %lu, outages %lu, disconnected %lu ms (max %lu ms)\r\n\r\n",
+            engine.stats.attempt_count,
+            engine.stats.breaker_open_count,
+            engine.stats.outage_count,
+            (ULONG)engine.stats.outage_total_ms,
+            (ULONG)engine.stats.outage_max_ms);
+    }
+
+    return checksum;
+}
+
+// Devices that lose the network together should not come back together
+static VOID fleet_run(ULONG seed)
+{
+    printf("fleet of %d devices losing the network together\r\n", SIM_FLEET_SIZE);
+
+    for (UINT device = 0; device < SIM_FLEET_SIZE; device++)
+    {
+        CONNECTION_POLICY_ENGINE engine;
+        uint64_t now_ms = 0;
+
+        connection_policy_init(&engine);
+        connection_policy_seed(&engine, seed ^ (device * 0x9E3779B9u));
+
+        printf("  device %u retries at", device);
+        for (UINT i = 0; i < 5; i++)
+        {
+            now_ms += connection_policy_failure(&engine, CONNECTION_FAILURE_NETWORK, now_ms);
+            printf(" %7lu", (ULONG)now_ms);
+        }
+        printf(" ms\r\n");
+    }
+
+    printf("\r\n");
+}
+
+int main(int argc, char** argv)
+{
+    ULONG seed = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+    UINT scenario_count = sizeof(scenarios) / sizeof(scenarios[0]);
+
+    printf("Connection policy simulation, seed %lu\r\n\r\n", seed);
+
+    for (UINT i = 0; i < scenario_count; i++)
+    {
+        // Replaying with the same seed must give exactly the same delays
+        if (scenario_run(&scenarios[i], seed, true) != scenario_run(&scenarios[i], seed, false))
+        {
+            printf("ERROR: %s is not deterministic\r\n", scenarios[i].name);
+            return 1;
+        }
+    }
+
+    fleet_run(seed);
+
+    return 0;
+}
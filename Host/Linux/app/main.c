@@ -0,0 +1,57 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tx_api.h"
+
+#include "benchmark.h"
+
+#define BENCHMARK_THREAD_STACK_SIZE (16 * 1024)
+#define BENCHMARK_THREAD_PRIORITY   5
+
+TX_THREAD benchmark_thread;
+ULONG benchmark_thread_stack[BENCHMARK_THREAD_STACK_SIZE / sizeof(ULONG)];
+
+static UINT benchmark_iterations = BENCHMARK_ITERATIONS_DEFAULT;
+
+static void benchmark_thread_entry(ULONG parameter)
+{
+    UINT status = benchmark_run(benchmark_iterations);
+
+    exit(status == TX_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+void tx_application_define(void* first_unused_memory)
+{
+    // Create benchmark thread
+    UINT status = tx_thread_create(&benchmark_thread,
+        "Benchmark Thread",
+        benchmark_thread_entry,
+        0,
+        benchmark_thread_stack,
+        BENCHMARK_THREAD_STACK_SIZE,
+        BENCHMARK_THREAD_PRIORITY,
+        BENCHMARK_THREAD_PRIORITY,
+        TX_NO_TIME_SLICE,
+        TX_AUTO_START);
+
+    if (status != TX_SUCCESS)
+    {
+        printf("ERROR: Benchmark thread creation failed\r\n");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1)
+    {
+        benchmark_iterations = strtoul(argv[1], NULL, 10);
+    }
+
+    // Enter the ThreadX kernel
+    tx_kernel_enter();
+
+    return 0;
+}
@@ -0,0 +1,139 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "nx_driver_loopback.h"
+
+#define LOOPBACK_ENDPOINT_COUNT 2
+#define LOOPBACK_MTU            1500
+
+typedef struct LOOPBACK_ENDPOINT_STRUCT
+{
+    NX_IP* ip_ptr;
+    NX_INTERFACE* interface_ptr;
+} LOOPBACK_ENDPOINT;
+
+static LOOPBACK_ENDPOINT endpoints[LOOPBACK_ENDPOINT_COUNT];
+
+static LOOPBACK_ENDPOINT* endpoint_peer_get(NX_IP* ip_ptr)
+{
+    for (UINT i = 0; i < LOOPBACK_ENDPOINT_COUNT; ++i)
+    {
+        if (endpoints[i].ip_ptr != NX_NULL && endpoints[i].ip_ptr != ip_ptr)
+        {
+            return &endpoints[i];
+        }
+    }
+
+    return NX_NULL;
+}
+
+static VOID packet_send(NX_IP_DRIVER* driver_req_ptr)
+{
+    NX_PACKET* packet_ptr = driver_req_ptr->nx_ip_driver_packet;
+    NX_PACKET* packet_copy_ptr;
+    LOOPBACK_ENDPOINT* peer;
+
+    peer = endpoint_peer_get(driver_req_ptr->nx_ip_driver_ptr);
+    if (peer == NX_NULL || peer->interface_ptr->nx_interface_link_up == NX_FALSE)
+    {
+        // Nobody listening on the other end of the wire, drop it
+        nx_packet_transmit_release(packet_ptr);
+        return;
+    }
+
+    // Copy into the peer's pool so each stack only ever frees its own packets
+    if (nx_packet_copy(packet_ptr, &packet_copy_ptr, peer->ip_ptr->nx_ip_default_packet_pool, NX_NO_WAIT))
+    {
+        driver_req_ptr->nx_ip_driver_status = NX_NO_PACKET;
+        nx_packet_transmit_release(packet_ptr);
+        return;
+    }
+
+    nx_packet_transmit_release(packet_ptr);
+
+    packet_copy_ptr->nx_packet_ip_interface = peer->interface_ptr;
+    _nx_ip_packet_deferred_receive(peer->ip_ptr, packet_copy_ptr);
+}
+
+VOID nx_driver_loopback(NX_IP_DRIVER* driver_req_ptr)
+{
+    NX_INTERFACE* interface_ptr = driver_req_ptr->nx_ip_driver_interface;
+
+    driver_req_ptr->nx_ip_driver_status = NX_SUCCESS;
+
+    switch (driver_req_ptr->nx_ip_driver_command)
+    {
+        case NX_LINK_INTERFACE_ATTACH:
+            break;
+
+        case NX_LINK_INITIALIZE:
+        {
+            UINT i;
+
+            for (i = 0; i < LOOPBACK_ENDPOINT_COUNT; ++i)
+            {
+                if (endpoints[i].ip_ptr == NX_NULL)
+                {
+                    endpoints[i].ip_ptr        = driver_req_ptr->nx_ip_driver_ptr;
+                    endpoints[i].interface_ptr = interface_ptr;
+                    break;
+                }
+            }
+
+            if (i == LOOPBACK_ENDPOINT_COUNT)
+            {
+                driver_req_ptr->nx_ip_driver_status = NX_NOT_SUCCESSFUL;
+                break;
+            }
+
+            interface_ptr->nx_interface_ip_mtu_size            = LOOPBACK_MTU;
+            interface_ptr->nx_interface_address_mapping_needed = NX_FALSE;
+            interface_ptr->nx_interface_physical_address_msw  = 0;
+            interface_ptr->nx_interface_physical_address_lsw  = i + 1;
+        }
+        break;
+
+        case NX_LINK_UNINITIALIZE:
+            for (UINT i = 0; i < LOOPBACK_ENDPOINT_COUNT; ++i)
+            {
+                if (endpoints[i].ip_ptr == driver_req_ptr->nx_ip_driver_ptr)
+                {
+                    endpoints[i].ip_ptr        = NX_NULL;
+                    endpoints[i].interface_ptr = NX_NULL;
+                }
+            }
+            break;
+
+        case NX_LINK_ENABLE:
+            interface_ptr->nx_interface_link_up = NX_TRUE;
+            break;
+
+        case NX_LINK_DISABLE:
+            interface_ptr->nx_interface_link_up = NX_FALSE;
+            break;
+
+        case NX_LINK_PACKET_SEND:
+        case NX_LINK_PACKET_BROADCAST:
+            packet_send(driver_req_ptr);
+            break;
+
+        case NX_LINK_ARP_SEND:
+        case NX_LINK_ARP_RESPONSE_SEND:
+        case NX_LINK_RARP_SEND:
+            // Address mapping is disabled, there should be no ARP traffic
+            nx_packet_transmit_release(driver_req_ptr->nx_ip_driver_packet);
+            break;
+
+        case NX_LINK_GET_STATUS:
+            *(driver_req_ptr->nx_ip_driver_return_ptr) = interface_ptr->nx_interface_link_up;
+            break;
+
+        case NX_LINK_MULTICAST_JOIN:
+        case NX_LINK_MULTICAST_LEAVE:
+            break;
+
+        default:
+            driver_req_ptr->nx_ip_driver_status = NX_UNHANDLED_COMMAND;
+            break;
+    }
+}
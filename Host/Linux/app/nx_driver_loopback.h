@@ -0,0 +1,14 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _NX_DRIVER_LOOPBACK_H
+#define _NX_DRIVER_LOOPBACK_H
+
+#include "nx_api.h"
+
+// In-process wire connecting exactly two IP instances. Packets sent by one
+// endpoint are copied into the peer's packet pool and delivered straight to its
+// IP layer, so there is no link header and no ARP.
+VOID nx_driver_loopback(NX_IP_DRIVER* driver_req_ptr);
+
+#endif
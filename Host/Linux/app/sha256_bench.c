@@ -0,0 +1,23 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+// Checks the SHA-256 test vectors and times hashing and SAS token creation on the host
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sha256_benchmark.h"
+
+#define DEFAULT_ITERATIONS 100000
+
+int main(int argc, char* argv[])
+{
+    unsigned int iterations = DEFAULT_ITERATIONS;
+
+    if (argc > 1)
+    {
+        iterations = strtoul(argv[1], NULL, 0);
+    }
+
+    return sha256_benchmark(iterations) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,28 @@
+/**************************************************************************/
+/*                                                                        */
+/*       Copyright (c) Microsoft Corporation. All rights reserved.        */
+/*                                                                        */
+/*       This software is licensed under the Microsoft Software License   */
+/*       Terms for Microsoft Azure RTOS. Full text of the license can be  */
+/*       found in the LICENSE file at https://aka.ms/AzureRTOS_EULA       */
+/*       and in the root directory of this software.                      */
+/*                                                                        */
+/**************************************************************************/
+
+#ifndef NX_USER_H
+#define NX_USER_H
+
+#define NX_SECURE_ENABLE
+#define NX_ENABLE_EXTENDED_NOTIFY_SUPPORT
+#define NX_ENABLE_IP_PACKET_FILTER
+#define NX_DISABLE_IPV6
+
+#define NXD_MQTT_CLOUD_ENABLE
+
+#define NX_SNTP_CLIENT_MIN_SERVER_STRATUM 3
+
+/* The device and broker stand-in share a loopback wire, so there is no link header.  */
+#define NX_PHYSICAL_HEADER              (16)
+#define NX_PHYSICAL_TRAILER             (0)
+
+#endif /* NX_USER_H */
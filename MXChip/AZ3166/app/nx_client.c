@@ -37,6 +37,7 @@
 #define TELEMETRY_GYROSCOPEY        "gyroscopeY"
 #define TELEMETRY_GYROSCOPEZ        "gyroscopeZ"
 #define TELEMETRY_INTERVAL_PROPERTY "telemetryInterval"
+#define TELEMETRY_INTERVAL_ID       0
 
 // Properties
 #define LED_STATE_PROPERTY          "ledState"
@@ -228,110 +229,66 @@ static void set_led_state(bool level)
     }
 }
 
-static void command_received_cb(AZURE_IOT_NX_CONTEXT* nx_context_ptr,
-    const UCHAR* component,
-    USHORT component_length,
-    const UCHAR* method,
-    USHORT method_length,
-    UCHAR* payload,
-    USHORT payload_length,
-    VOID* context_ptr,
-    USHORT context_length)
+static UINT set_led_state_command(
+    AZURE_IOT_NX_CONTEXT* nx_context, UCHAR* payload, USHORT payload_length, NX_AZURE_IOT_JSON_WRITER* response)
 {
-    UINT status;
-
-    if (strncmp((CHAR*)method, SET_LED_STATE_COMMAND, method_length) == 0)
-    {
-        bool arg = (strncmp((CHAR*)payload, "true", payload_length) == 0);
-        set_led_state(arg);
+    bool arg = (strncmp((CHAR*)payload, "true", payload_length) == 0);
+    set_led_state(arg);
 
-        if ((status = nx_azure_iot_hub_client_command_message_response(
-                 &nx_context_ptr->iothub_client, 200, context_ptr, context_length, NULL, 0, NX_WAIT_FOREVER)))
-        {
-            printf("Direct method response failed! (0x%08x)\r\n", status);
-            return;
-        }
+    azure_iot_nx_client_publish_bool_property(nx_context, NULL, LED_STATE_PROPERTY, arg);
 
-        azure_iot_nx_client_publish_bool_property(&azure_iot_nx_client, NULL, LED_STATE_PROPERTY, arg);
-    }
-    else if (strncmp((CHAR*)method, SET_DISPLAY_TEXT_COMMAND, method_length) == 0)
-    {
-        // drop the first and last character to remove the quotes
-        screen_printn((CHAR*)payload + 1, payload_length - 2, L0);
-        if ((status = nx_azure_iot_hub_client_command_message_response(
-                 &nx_context_ptr->iothub_client, 200, context_ptr, context_length, NULL, 0, NX_WAIT_FOREVER)))
-        {
-            printf("Direct method response failed! (0x%08x)\r\n", status);
-            return;
-        }
-    }
-    else
-    {
-        printf("Direct method is not for this device\r\n");
-
-        if ((status = nx_azure_iot_hub_client_command_message_response(
-                 &nx_context_ptr->iothub_client, 501, context_ptr, context_length, NULL, 0, NX_WAIT_FOREVER)))
-        {
-            printf("Direct method response failed! (0x%08x)\r\n", status);
-            return;
-        }
-    }
+    return 200;
 }
 
-static void writable_property_received_cb(AZURE_IOT_NX_CONTEXT* nx_context,
-    const UCHAR* component_name,
-    UINT component_name_len,
-    UCHAR* property_name,
-    UINT property_name_len,
-    NX_AZURE_IOT_JSON_READER* json_reader_ptr,
-    UINT version)
+static UINT set_display_text_command(
+    AZURE_IOT_NX_CONTEXT* nx_context, UCHAR* payload, USHORT payload_length, NX_AZURE_IOT_JSON_WRITER* response)
 {
-    UINT status;
-
-    if (strncmp((CHAR*)property_name, TELEMETRY_INTERVAL_PROPERTY, property_name_len) == 0)
-    {
-        status = nx_azure_iot_json_reader_token_int32_get(json_reader_ptr, &telemetry_interval);
-        if (status == NX_AZURE_IOT_SUCCESS)
-        {
-            printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
-
-            // Confirm reception back to hub
-            azure_nx_client_respond_int_writable_property(
-                nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval, 200, version);
+    // drop the first and last character to remove the quotes
+    screen_printn((CHAR*)payload + 1, payload_length - 2, L0);
 
-            azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
-        }
-    }
+    return 200;
 }
 
-static void property_received_cb(AZURE_IOT_NX_CONTEXT* nx_context,
-    const UCHAR* component_name,
-    UINT component_name_len,
-    UCHAR* property_name,
-    UINT property_name_len,
+static void property_update_cb(AZURE_IOT_NX_CONTEXT* nx_context,
+    UINT property_id,
     NX_AZURE_IOT_JSON_READER* json_reader_ptr,
+    UINT message_type,
     UINT version)
 {
     UINT status;
 
-    if (strncmp((CHAR*)property_name, TELEMETRY_INTERVAL_PROPERTY, property_name_len) == 0)
+    switch (property_id)
     {
-        status = nx_azure_iot_json_reader_token_int32_get(json_reader_ptr, &telemetry_interval);
-        if (status == NX_AZURE_IOT_SUCCESS)
-        {
-            printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
-            azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
-        }
+        case TELEMETRY_INTERVAL_ID:
+            status = nx_azure_iot_json_reader_token_int32_get(json_reader_ptr, &telemetry_interval);
+            if (status == NX_AZURE_IOT_SUCCESS)
+            {
+                printf("Updating %s to %ld\r\n", TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
+
+                // Confirm reception of a writable property update back to hub
+                if (message_type == NX_AZURE_IOT_HUB_WRITABLE_PROPERTIES)
+                {
+                    azure_nx_client_respond_int_writable_property(
+                        nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval, 200, version);
+                }
+
+                azure_nx_client_periodic_interval_set(nx_context, telemetry_interval);
+            }
+            break;
+
+        default:
+            break;
     }
 }
 
 static void properties_complete_cb(AZURE_IOT_NX_CONTEXT* nx_context)
 {
-    // Device twin processing is done, send out property updates
+    // Device twin processing is done, send out property updates as a single patch
     azure_iot_nx_client_publish_properties(nx_context, DEVICE_INFO_COMPONENT_NAME, append_device_info_properties);
     azure_iot_nx_client_publish_bool_property(nx_context, NULL, LED_STATE_PROPERTY, false);
     azure_iot_nx_client_publish_int_writable_property(
         nx_context, NULL, TELEMETRY_INTERVAL_PROPERTY, telemetry_interval);
+    azure_iot_nx_client_reported_properties_flush(nx_context);
 
     printf("\r\nStarting Main loop\r\n");
     screen_print("Azure IoT", L0);
@@ -384,9 +341,12 @@ UINT azure_iot_nx_client_entry(
     }
 
     // Register the callbacks
-    azure_iot_nx_client_register_command_callback(&azure_iot_nx_client, command_received_cb);
-    azure_iot_nx_client_register_writable_property_callback(&azure_iot_nx_client, writable_property_received_cb);
-    azure_iot_nx_client_register_property_callback(&azure_iot_nx_client, property_received_cb);
+    azure_iot_nx_client_register_command(&azure_iot_nx_client, NULL, SET_LED_STATE_COMMAND, set_led_state_command);
+    azure_iot_nx_client_register_command(
+        &azure_iot_nx_client, NULL, SET_DISPLAY_TEXT_COMMAND, set_display_text_command);
+    azure_iot_nx_client_register_property(
+        &azure_iot_nx_client, NULL, TELEMETRY_INTERVAL_PROPERTY, TELEMETRY_INTERVAL_ID);
+    azure_iot_nx_client_register_property_update_callback(&azure_iot_nx_client, property_update_cb);
     azure_iot_nx_client_register_properties_complete_callback(&azure_iot_nx_client, properties_complete_cb);
     azure_iot_nx_client_register_timer_callback(&azure_iot_nx_client, telemetry_cb, telemetry_interval);
 
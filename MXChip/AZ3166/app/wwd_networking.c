@@ -10,6 +10,9 @@
 
 #include "wiced_sdk.h"
 
+#include "azure_iot_connect.h"
+#include "dns_cache.h"
+#include "packet_pool.h"
 #include "sntp_client.h"
 
 #define NETX_IP_STACK_SIZE   2048
@@ -309,6 +312,18 @@ UINT wwd_network_init(CHAR* ssid, CHAR* password, WiFi_Mode mode)
     }
 #endif
 
+    // Only the one pool here, small packets come from it too
+    else if ((status = packet_pool_register(PACKET_POOL_BULK, &nx_pool[0])))
+    {
+        printf("ERROR: Failed to register the packet pool (0x%08x)\r\n", status);
+    }
+
+    // Cache lookups in front of the DNS client
+    else if ((status = dns_cache_init(&nx_dns_client)))
+    {
+        printf("ERROR: Failed to init the DNS cache (0x%08x)\r\n", status);
+    }
+
     // Initialize the SNTP client
     else if ((status = sntp_init()))
     {
@@ -329,58 +344,79 @@ UINT wwd_network_init(CHAR* ssid, CHAR* password, WiFi_Mode mode)
     return status;
 }
 
-UINT wwd_network_connect()
+static UINT wifi_connect()
 {
-    UINT status;
     int32_t wifiConnectCounter = 1;
     wiced_ssid_t wiced_ssid    = {0};
     wwd_result_t join_result;
 
-    // Check if Wifi is already connected
-    if (wwd_wifi_is_ready_to_transceive(WWD_STA_INTERFACE) != WWD_SUCCESS)
+    printf("\r\nConnecting WiFi\r\n");
+
+    // Halt any existing connection attempts
+    wwd_wifi_join_halt(WICED_TRUE);
+    wwd_wifi_leave(WWD_STA_INTERFACE);
+    wwd_wifi_join_halt(WICED_FALSE);
+
+    wiced_ssid.length = strlen(netx_ssid);
+    memcpy(wiced_ssid.value, netx_ssid, wiced_ssid.length);
+
+    // Connect to the specified SSID
+    printf("\tConnecting to SSID '%s'\r\n", netx_ssid);
+    do
     {
-        printf("\r\nConnecting WiFi\r\n");
+        printf("\tAttempt %ld...\r\n", wifiConnectCounter++);
 
-        // Halt any existing connection attempts
-        wwd_wifi_join_halt(WICED_TRUE);
-        wwd_wifi_leave(WWD_STA_INTERFACE);
-        wwd_wifi_join_halt(WICED_FALSE);
+        // Obtain the IP internal mutex before reconnecting WiFi
+        tx_mutex_get(&(nx_ip.nx_ip_protection), TX_WAIT_FOREVER);
+        join_result = wwd_wifi_join(
+            &wiced_ssid, netx_mode, (uint8_t*)netx_password, strlen(netx_password), NULL, WWD_STA_INTERFACE);
+        tx_mutex_put(&(nx_ip.nx_ip_protection));
 
-        wiced_ssid.length = strlen(netx_ssid);
-        memcpy(wiced_ssid.value, netx_ssid, wiced_ssid.length);
+        tx_thread_sleep(5 * TX_TIMER_TICKS_PER_SECOND);
+    } while (join_result != WWD_SUCCESS);
 
-        // Connect to the specified SSID
-        printf("\tConnecting to SSID '%s'\r\n", netx_ssid);
-        do
-        {
-            printf("\tAttempt %ld...\r\n", wifiConnectCounter++);
+    printf("SUCCESS: WiFi connected\r\n");
 
-            // Obtain the IP internal mutex before reconnecting WiFi
-            tx_mutex_get(&(nx_ip.nx_ip_protection), TX_WAIT_FOREVER);
-            join_result = wwd_wifi_join(
-                &wiced_ssid, netx_mode, (uint8_t*)netx_password, strlen(netx_password), NULL, WWD_STA_INTERFACE);
-            tx_mutex_put(&(nx_ip.nx_ip_protection));
+    return NX_SUCCESS;
+}
+
+UINT wwd_network_connect(UINT invalid_layers)
+{
+    UINT status;
+    ULONG actual_status;
+
+    // Pick up a dropped WiFi link or a lost address as well as whatever the caller found broken
+    if (wwd_wifi_is_ready_to_transceive(WWD_STA_INTERFACE) != WWD_SUCCESS)
+    {
+        invalid_layers |= NETWORK_LAYER_LINK;
+    }
+    else if (nx_ip_status_check(&nx_ip, NX_IP_ADDRESS_RESOLVED, &actual_status, NX_NO_WAIT))
+    {
+        invalid_layers |= NETWORK_LAYER_LEASE;
+    }
 
-            tx_thread_sleep(5 * TX_TIMER_TICKS_PER_SECOND);
-        } while (join_result != WWD_SUCCESS);
+    network_layers_invalidate(invalid_layers);
 
-        printf("SUCCESS: WiFi connected\r\n");
+    // Join the WiFi network
+    if ((status = network_layer_connect(NETWORK_LAYER_LINK, wifi_connect)))
+    {
+        printf("ERROR: wifi_connect\r\n");
     }
 
     // Fetch IP details
-    if ((status = dhcp_connect()))
+    else if ((status = network_layer_connect(NETWORK_LAYER_LEASE, dhcp_connect)))
     {
         printf("ERROR: dhcp_connect\r\n");
     }
 
     // Create DNS
-    else if ((status = dns_connect()))
+    else if ((status = network_layer_connect(NETWORK_LAYER_RESOLVER, dns_connect)))
     {
         printf("ERROR: dns_connect\r\n");
     }
 
     // Wait for an SNTP sync
-    else if ((status = sntp_sync()))
+    else if ((status = network_layer_connect(NETWORK_LAYER_CLOCK, sntp_sync)))
     {
         printf("ERROR: Failed to sync SNTP time (0x%08x)\r\n", status);
     }
@@ -14,6 +14,6 @@ extern NX_IP nx_ip;
 extern NX_DNS nx_dns_client;
 
 UINT wwd_network_init(CHAR* ssid, CHAR* password, WiFi_Mode mode);
-UINT wwd_network_connect();
+UINT wwd_network_connect(UINT invalid_layers);
 
 #endif
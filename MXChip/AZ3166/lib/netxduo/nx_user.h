@@ -17,6 +17,7 @@
 #define NX_ENABLE_IP_PACKET_FILTER
 #define NX_DISABLE_IPV6
 #define NX_DNS_CLIENT_USER_CREATE_PACKET_POOL
+#define NX_DNS_CACHE_ENABLE
 
 #define NXD_MQTT_CLOUD_ENABLE
 
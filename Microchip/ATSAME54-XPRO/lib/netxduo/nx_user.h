@@ -19,6 +19,7 @@
 #define NXD_MQTT_CLOUD_ENABLE
 
 #define NX_SNTP_CLIENT_MIN_SERVER_STRATUM 3
+#define NX_DNS_CACHE_ENABLE
 
 /* Define various build options for the NetX Duo port.  The application should either make changes
    here by commenting or un-commenting the conditional compilation defined OR supply the defines
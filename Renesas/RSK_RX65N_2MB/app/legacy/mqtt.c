@@ -6,7 +6,7 @@
 #include <stdio.h>
 
 #include "azure_iot_mqtt.h"
-#include "json_utils.h"
+#include "json_query.h"
 #include "sntp_client.h"
 
 #include "azure_config.h"
@@ -52,15 +52,15 @@ static void set_led_state(bool level)
     }
 }
 
-static void mqtt_direct_method(AZURE_IOT_MQTT* iot_mqtt, CHAR* direct_method_name, CHAR* message)
+static void mqtt_direct_method(AZURE_IOT_MQTT* iot_mqtt, const MQTT_VIEW* direct_method_name, const MQTT_VIEW* message)
 {
-    if (strcmp(direct_method_name, "setLedState") == 0)
+    if (mqtt_view_equals(direct_method_name, "setLedState"))
     {
-        printf("Direct method=%s invoked\r\n", direct_method_name);
+        printf("Direct method=%.*s invoked\r\n", direct_method_name->length, direct_method_name->ptr);
 
         // 'false' - turn LED off
         // 'true'  - turn LED on
-        bool arg = (strcmp(message, "true") == 0);
+        bool arg = mqtt_view_equals(message, "true");
 
         set_led_state(arg);
 
@@ -72,26 +72,30 @@ static void mqtt_direct_method(AZURE_IOT_MQTT* iot_mqtt, CHAR* direct_method_nam
     }
     else
     {
-        printf("Received direct method=%s is unknown\r\n", direct_method_name);
+        printf("Received direct method=%.*s is unknown\r\n", direct_method_name->length, direct_method_name->ptr);
         azure_iot_mqtt_respond_direct_method(iot_mqtt, 501);
     }
 }
 
-static void mqtt_c2d_message(AZURE_IOT_MQTT* iot_mqtt, CHAR* properties, CHAR* message)
+static void mqtt_c2d_message(AZURE_IOT_MQTT* iot_mqtt, const MQTT_VIEW* properties, const MQTT_VIEW* message)
 {
-    printf("Received C2D message, properties='%s', message='%s'\r\n", properties, message);
+    MQTT_VIEW segment = *message;
+
+    printf("Received C2D message, properties='%.*s', message='", properties->length, properties->ptr);
+    do
+    {
+        printf("%.*s", segment.length, segment.ptr);
+    } while (mqtt_view_next(&segment));
+    printf("'\r\n");
 }
 
-static void mqtt_device_twin_desired_prop(AZURE_IOT_MQTT* iot_mqtt, CHAR* message)
+static void mqtt_device_twin_desired_prop(AZURE_IOT_MQTT* iot_mqtt, const MQTT_VIEW* message)
 {
-    jsmn_parser parser;
-    jsmntok_t tokens[64];
-    INT token_count;
+    JSON_QUERY query = {TELEMETRY_INTERVAL_PROPERTY, JSON_QUERY_INT, &telemetry_interval};
 
-    jsmn_init(&parser);
-    token_count = jsmn_parse(&parser, message, strlen(message), tokens, 64);
-
-    if (findJsonInt(message, tokens, token_count, TELEMETRY_INTERVAL_PROPERTY, &telemetry_interval))
+    // Twin documents can be larger than a packet, so they are parsed as they sit in the packet chain
+    json_query(message, &query, 1);
+    if (query.found)
     {
         // Set a telemetry event so we pick up the change immediately
         tx_event_flags_set(&azure_iot_flags, TELEMETRY_INTERVAL_EVENT, TX_OR);
@@ -101,16 +105,13 @@ static void mqtt_device_twin_desired_prop(AZURE_IOT_MQTT* iot_mqtt, CHAR* messag
     }
 }
 
-static void mqtt_device_twin_prop(AZURE_IOT_MQTT* iot_mqtt, CHAR* message)
+static void mqtt_device_twin_prop(AZURE_IOT_MQTT* iot_mqtt, const MQTT_VIEW* message)
 {
-    jsmn_parser parser;
-    jsmntok_t tokens[64];
-    INT token_count;
-
-    jsmn_init(&parser);
-    token_count = jsmn_parse(&parser, message, strlen(message), tokens, 64);
+    // The full twin holds the desired properties under "desired"
+    JSON_QUERY query = {"desired." TELEMETRY_INTERVAL_PROPERTY, JSON_QUERY_INT, &telemetry_interval};
 
-    if (findJsonInt(message, tokens, token_count, TELEMETRY_INTERVAL_PROPERTY, &telemetry_interval))
+    json_query(message, &query, 1);
+    if (query.found)
     {
         // Set a telemetry event so we pick up the change immediately
         tx_event_flags_set(&azure_iot_flags, TELEMETRY_INTERVAL_EVENT, TX_OR);
@@ -58,6 +58,7 @@
 #define NX_ENABLE_IP_PACKET_FILTER
 
 #define NX_SNTP_CLIENT_MIN_SERVER_STRATUM 3
+#define NX_DNS_CACHE_ENABLE
 
 #define NXD_MQTT_CLOUD_ENABLE
 
@@ -7,6 +7,9 @@
 #include "nx_secure_tls_api.h"
 #include "nxd_dns.h"
 
+#include "azure_iot_connect.h"
+#include "dns_cache.h"
+#include "packet_pool.h"
 #include "sntp_client.h"
 
 #include "nx_driver_rx65n_cloud_kit.h"
@@ -234,6 +237,18 @@ UINT rx_network_init(CHAR* ssid, CHAR* password, WiFi_Mode mode)
     }
 #endif
 
+    // Only the one pool here, small packets come from it too
+    else if ((status = packet_pool_register(PACKET_POOL_BULK, &nx_pool)))
+    {
+        printf("ERROR: Failed to register the packet pool (0x%08x)\r\n", status);
+    }
+
+    // Cache lookups in front of the DNS client
+    else if ((status = dns_cache_init(&nx_dns_client)))
+    {
+        printf("ERROR: Failed to init the DNS cache (0x%08x)\r\n", status);
+    }
+
     // Initialize the SNTP client
     else if ((status = sntp_init()))
     {
@@ -252,13 +267,11 @@ UINT rx_network_init(CHAR* ssid, CHAR* password, WiFi_Mode mode)
     return status;
 }
 
-UINT rx_network_connect()
+static UINT wifi_connect()
 {
-    UINT status;
     int32_t wifiConnectCounter = 1;
     wifi_err_t join_result;
 
-    // Check if Wifi is already connected
     printf("\r\nConnecting WiFi\r\n");
 
     // Connect to the specified SSID
@@ -270,7 +283,6 @@ UINT rx_network_connect()
         // Force a disconnect
         R_WIFI_SX_ULPGN_Disconnect();
 
-            // Obtain the IP internal mutex before reconnecting WiFi
         join_result = R_WIFI_SX_ULPGN_Connect(netx_ssid, netx_password, netx_mode, 1, &ip_cfg);
 
         tx_thread_sleep(5 * TX_TIMER_TICKS_PER_SECOND);
@@ -278,20 +290,41 @@ UINT rx_network_connect()
 
     printf("SUCCESS: WiFi connected\r\n");
 
+    return NX_SUCCESS;
+}
+
+UINT rx_network_connect(UINT invalid_layers)
+{
+    UINT status;
+
+    // Pick up a dropped WiFi link as well as whatever the caller found broken, the module holds the lease
+    if (R_WIFI_SX_ULPGN_IsConnected() != 0)
+    {
+        invalid_layers |= NETWORK_LAYER_LINK;
+    }
+
+    network_layers_invalidate(invalid_layers);
+
+    // Join the WiFi network
+    if ((status = network_layer_connect(NETWORK_LAYER_LINK, wifi_connect)))
+    {
+        printf("ERROR: wifi_connect\r\n");
+    }
+
     // Fetch IP details
-    if ((status = dhcp_connect()))
+    else if ((status = network_layer_connect(NETWORK_LAYER_LEASE, dhcp_connect)))
     {
         printf("ERROR: dhcp_connect\r\n");
     }
 
     // Create DNS
-    else if ((status = dns_connect()))
+    else if ((status = network_layer_connect(NETWORK_LAYER_RESOLVER, dns_connect)))
     {
         printf("ERROR: dns_connect\r\n");
     }
 
     // Wait for an SNTP sync
-    else if ((status = sntp_sync()))
+    else if ((status = network_layer_connect(NETWORK_LAYER_CLOCK, sntp_sync)))
     {
         printf("ERROR: Failed to sync SNTP time (0x%08x)\r\n", status);
     }
@@ -36,6 +36,7 @@
 /* NetX */
 #define NX_DNS_CLIENT_USER_CREATE_PACKET_POOL
 #define NX_DNS_CLIENT_CLEAR_QUEUE
+#define NX_DNS_CACHE_ENABLE
 
 /* Define various build options for the NetX Duo port.  The application should either make changes
    here by commenting or un-commenting the conditional compilation defined OR supply the defines
@@ -10,6 +10,9 @@
 
 #include "wifi.h"
 
+#include "azure_iot_connect.h"
+#include "dns_cache.h"
+#include "packet_pool.h"
 #include "sntp_client.h"
 
 #define NETX_IP_STACK_SIZE 2048
@@ -274,6 +277,18 @@ UINT stm_network_init(CHAR* ssid, CHAR* password, WiFi_Mode mode)
     }
 #endif
 
+    // Only the one pool here, small packets come from it too
+    else if ((status = packet_pool_register(PACKET_POOL_BULK, &nx_pool)))
+    {
+        printf("ERROR: Failed to register the packet pool (0x%08x)\r\n", status);
+    }
+
+    // Cache lookups in front of the DNS client
+    else if ((status = dns_cache_init(&nx_dns_client)))
+    {
+        printf("ERROR: Failed to init the DNS cache (0x%08x)\r\n", status);
+    }
+
     // Initialize the SNTP client
     else if ((status = sntp_init()))
     {
@@ -292,48 +307,64 @@ UINT stm_network_init(CHAR* ssid, CHAR* password, WiFi_Mode mode)
     return status;
 }
 
-UINT stm_network_connect()
+static UINT wifi_connect()
 {
-    UINT status;
     int32_t wifiConnectCounter = 1;
     WIFI_Status_t join_result;
 
-    // Check if Wifi is already connected
-    if (WIFI_IsConnected() != WIFI_STATUS_OK)
+    printf("\r\nConnecting WiFi\r\n");
+
+    // Connect to the specified SSID
+    printf("\tConnecting to SSID '%s'\r\n", netx_ssid);
+    do
     {
-        printf("\r\nConnecting WiFi\r\n");
+        printf("\tAttempt %ld...\r\n", wifiConnectCounter++);
 
-        // Connect to the specified SSID
-        printf("\tConnecting to SSID '%s'\r\n", netx_ssid);
-        do
-        {
-            printf("\tAttempt %ld...\r\n", wifiConnectCounter++);
+        // Obtain the IP internal mutex before reconnecting WiFi
+        tx_mutex_get(&(nx_ip.nx_ip_protection), TX_WAIT_FOREVER);
+        join_result = WIFI_Connect(netx_ssid, netx_password, netx_mode);
+        tx_mutex_put(&(nx_ip.nx_ip_protection));
+
+        tx_thread_sleep(5 * TX_TIMER_TICKS_PER_SECOND);
+    } while (join_result != NX_SUCCESS);
 
-            // Obtain the IP internal mutex before reconnecting WiFi
-            tx_mutex_get(&(nx_ip.nx_ip_protection), TX_WAIT_FOREVER);
-            join_result = WIFI_Connect(netx_ssid, netx_password, netx_mode);
-            tx_mutex_put(&(nx_ip.nx_ip_protection));
+    printf("SUCCESS: WiFi connected\r\n");
 
-            tx_thread_sleep(5 * TX_TIMER_TICKS_PER_SECOND);
-        } while (join_result != NX_SUCCESS);
+    return NX_SUCCESS;
+}
+
+UINT stm_network_connect(UINT invalid_layers)
+{
+    UINT status;
 
-        printf("SUCCESS: WiFi connected\r\n");
+    // Pick up a dropped WiFi link as well as whatever the caller found broken, the module holds the lease
+    if (WIFI_IsConnected() != WIFI_STATUS_OK)
+    {
+        invalid_layers |= NETWORK_LAYER_LINK;
+    }
+
+    network_layers_invalidate(invalid_layers);
+
+    // Join the WiFi network
+    if ((status = network_layer_connect(NETWORK_LAYER_LINK, wifi_connect)))
+    {
+        printf("ERROR: wifi_connect\r\n");
     }
 
     // Fetch IP details
-    if ((status = dhcp_connect()))
+    else if ((status = network_layer_connect(NETWORK_LAYER_LEASE, dhcp_connect)))
     {
         printf("ERROR: dhcp_connect\r\n");
     }
 
     // Create DNS
-    else if ((status = dns_connect()))
+    else if ((status = network_layer_connect(NETWORK_LAYER_RESOLVER, dns_connect)))
     {
         printf("ERROR: dns_connect\r\n");
     }
 
     // Wait for an SNTP sync
-    else if ((status = sntp_sync()))
+    else if ((status = network_layer_connect(NETWORK_LAYER_CLOCK, sntp_sync)))
     {
         printf("ERROR: Failed to sync SNTP time (0x%08x)\r\n", status);
     }
@@ -14,6 +14,6 @@ extern NX_PACKET_POOL nx_pool;
 extern NX_DNS nx_dns_client;
 
 UINT stm_network_init(CHAR* ssid, CHAR* password, WiFi_Mode mode);
-UINT stm_network_connect();
+UINT stm_network_connect(UINT invalid_layers);
 
 #endif // _NETWORKING_H
\ No newline at end of file
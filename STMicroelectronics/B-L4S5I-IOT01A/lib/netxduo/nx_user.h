@@ -38,6 +38,7 @@
 /* NetX */
 #define NX_DNS_CLIENT_USER_CREATE_PACKET_POOL
 #define NX_DNS_CLIENT_CLEAR_QUEUE
+#define NX_DNS_CACHE_ENABLE
 
 /* Use hardware rand */
 extern int hardware_rand(void);
@@ -15,6 +15,7 @@
 #define NX_SECURE_ENABLE
 #define NX_ENABLE_EXTENDED_NOTIFY_SUPPORT
 #define NX_DNS_CLIENT_USER_CREATE_PACKET_POOL
+#define NX_DNS_CACHE_ENABLE
 #define NX_ENABLE_IP_PACKET_FILTER
 
 #define NXD_MQTT_CLOUD_ENABLE
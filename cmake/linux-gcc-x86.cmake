@@ -0,0 +1,29 @@
+# Copyright (c) Microsoft Corporation.
+# Licensed under the MIT License.
+
+set(CMAKE_SYSTEM_NAME Linux)
+set(CMAKE_SYSTEM_PROCESSOR i386)
+
+# Define the CPU architecture for Threadx
+set(THREADX_ARCH "linux")
+set(THREADX_TOOLCHAIN "gnu")
+
+# default to Release build, the host build exists to take measurements
+if(NOT CMAKE_BUILD_TYPE)
+    set(CMAKE_BUILD_TYPE "Release" CACHE STRING "Choose the type of build, options are: Debug Release." FORCE)
+endif()
+
+set(CMAKE_C_COMPILER    gcc)
+set(CMAKE_ASM_COMPILER  gcc)
+
+# The ThreadX Linux port stores pointers in ULONG, so build 32-bit
+set(CMAKE_COMMON_FLAGS "-m32 -g3 -fno-strict-aliasing -Wall -Wno-unused-parameter")
+set(CMAKE_C_FLAGS   "${CMAKE_COMMON_FLAGS}")
+set(CMAKE_ASM_FLAGS "${CMAKE_COMMON_FLAGS}")
+set(CMAKE_EXE_LINKER_FLAGS "-m32")
+
+set(CMAKE_C_FLAGS_DEBUG "-O0")
+set(CMAKE_ASM_FLAGS_DEBUG "")
+
+set(CMAKE_C_FLAGS_RELEASE "-O2")
+set(CMAKE_ASM_FLAGS_RELEASE "")
@@ -2,78 +2,332 @@
    Licensed under the MIT License. */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "nx_azure_iot_hub_client.h"
 
+#include "azure_iot_connect.h"
 #include "azure_iot_nx_client.h"
+#include "time_service.h"
 
-#define INITIAL_EXPONENTIAL_BACKOFF_IN_SEC     (3)
-#define MAX_EXPONENTIAL_BACKOFF_IN_SEC         (10 * 60)
-#define MAX_EXPONENTIAL_BACKOFF_JITTER_PERCENT (60)
+// Stored hub assignment, [key][hostname length][hostname][device id length][device id]
+#define DPS_ASSIGNMENT_RECORD_SIZE (4 + 1 + AZURE_IOT_HOST_NAME_SIZE + 1 + AZURE_IOT_DEVICE_ID_SIZE)
 
-static UINT exponential_retry_count;
+// Class of the failure being recovered from, nothing has failed before the first attempt
+static CONNECTION_FAILURE_CLASS connection_failure_class(AZURE_IOT_NX_CONTEXT* nx_context, UINT connection_status)
+{
+    switch (connection_status)
+    {
+        // The network or the client could not be brought up
+        case NX_AZURE_IOT_NOT_INITIALIZED:
+            return nx_context->connection_policy.stats.attempt_count == 0 ? CONNECTION_FAILURE_NONE
+                                                                          : CONNECTION_FAILURE_NETWORK;
+
+        case NX_DNS_QUERY_FAILED:
+            return CONNECTION_FAILURE_NETWORK;
+
+        case NXD_MQTT_ERROR_BAD_USERNAME_PASSWORD:
+        case NXD_MQTT_ERROR_NOT_AUTHORIZED:
+            return CONNECTION_FAILURE_AUTH;
+
+        case NX_AZURE_IOT_SAS_TOKEN_EXPIRED:
+            return CONNECTION_FAILURE_TOKEN;
+
+        default:
+            return CONNECTION_FAILURE_TRANSIENT;
+    }
+}
+
+// Seed the retry jitter from the device identity and MAC so a fleet rebooting together spreads its retries
+static ULONG connection_policy_device_seed(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    NX_INTERFACE* interface_ptr = &nx_context->azure_iot_nx_ip->nx_ip_interface[0];
+    ULONG hash                  = 2166136261u;
+
+    for (UINT i = 0; i < nx_context->azure_iot_hub_device_id_len; i++)
+    {
+        hash = ((hash ^ (UCHAR)nx_context->azure_iot_hub_device_id[i]) * 16777619u) & 0xFFFFFFFF;
+    }
+
+    for (UINT i = 0; i < nx_context->azure_iot_dps_registration_id_len; i++)
+    {
+        hash = ((hash ^ (UCHAR)nx_context->azure_iot_dps_registration_id[i]) * 16777619u) & 0xFFFFFFFF;
+    }
+
+    return hash ^ interface_ptr->nx_interface_physical_address_lsw;
+}
+
+// Wait as long as the policy for the last failure asks before the next attempt
+static VOID connection_retry_wait(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    CONNECTION_POLICY_ENGINE* engine = &nx_context->connection_policy;
+    CONNECTION_FAILURE_CLASS failure_class;
+    ULONG delay_ms;
+
+    if (engine->random_state == 0)
+    {
+        connection_policy_seed(engine, connection_policy_device_seed(nx_context));
+    }
+
+    failure_class = connection_failure_class(nx_context, nx_context->azure_iot_connection_status);
+    delay_ms      = connection_policy_failure(engine, failure_class, time_ms_get());
+
+    if (delay_ms > 0)
+    {
+        printf("\r\nIoT connection backoff for %lu.%03lu seconds\r\n", delay_ms / 1000, delay_ms % 1000);
+        tx_thread_sleep((ULONG)((uint64_t)delay_ms * TX_TIMER_TICKS_PER_SECOND / 1000));
+    }
+}
+
+// Ties a stored assignment to the DPS config it was made for, FNV-1a over the ID scope and registration ID
+static UINT dps_assignment_key(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT hash = 2166136261u;
+
+    for (UINT i = 0; i < nx_context->azure_iot_dps_id_scope_len; ++i)
+    {
+        hash = (hash ^ (UCHAR)nx_context->azure_iot_dps_id_scope[i]) * 16777619u;
+    }
+
+    hash = (hash ^ '*') * 16777619u;
 
-static VOID exponential_backoff_reset()
+    for (UINT i = 0; i < nx_context->azure_iot_dps_registration_id_len; ++i)
+    {
+        hash = (hash ^ (UCHAR)nx_context->azure_iot_dps_registration_id[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static VOID dps_assignment_load(AZURE_IOT_NX_CONTEXT* nx_context)
 {
-    exponential_retry_count = 0;
+    AZURE_IOT_STORE* store_ptr = nx_context->dps_assignment.store_ptr;
+    UCHAR record[DPS_ASSIGNMENT_RECORD_SIZE];
+    UINT record_length;
+    UINT hostname_len;
+    UINT device_id_len;
+    UINT key;
+
+    if (store_ptr == NX_NULL || store_ptr->peek(store_ptr, record, sizeof(record), &record_length) != NX_SUCCESS ||
+        record_length < 6)
+    {
+        return;
+    }
+
+    key           = ((UINT)record[0] << 24) | ((UINT)record[1] << 16) | ((UINT)record[2] << 8) | record[3];
+    hostname_len  = record[4];
+    device_id_len = record_length > 5 + hostname_len ? record[5 + hostname_len] : 0;
+
+    // Ignore an assignment made for another DPS config or one that does not fit
+    if (key != dps_assignment_key(nx_context) || hostname_len == 0 || hostname_len > AZURE_IOT_HOST_NAME_SIZE ||
+        device_id_len == 0 || device_id_len > AZURE_IOT_DEVICE_ID_SIZE ||
+        record_length != 6 + hostname_len + device_id_len)
+    {
+        return;
+    }
+
+    memcpy(nx_context->azure_iot_hub_hostname, &record[5], hostname_len);
+    memcpy(nx_context->azure_iot_hub_device_id, &record[6 + hostname_len], device_id_len);
+    nx_context->azure_iot_hub_hostname_len  = hostname_len;
+    nx_context->azure_iot_hub_device_id_len = device_id_len;
+    nx_context->dps_assignment.assigned     = true;
+
+    printf("\r\nUsing stored Azure IoT DPS assignment\r\n");
 }
 
-static VOID exponential_backoff_with_jitter()
+static VOID dps_assignment_save(AZURE_IOT_NX_CONTEXT* nx_context)
 {
-    double jitter_percent = (MAX_EXPONENTIAL_BACKOFF_JITTER_PERCENT / 100.0) * (rand() / ((double)RAND_MAX));
-    UINT base_delay       = MAX_EXPONENTIAL_BACKOFF_IN_SEC;
-    uint64_t delay;
-    UINT backoff_seconds;
+    AZURE_IOT_STORE* store_ptr = nx_context->dps_assignment.store_ptr;
+    UCHAR record[DPS_ASSIGNMENT_RECORD_SIZE];
+    UINT key = dps_assignment_key(nx_context);
+    UINT record_length;
+    UINT dropped;
 
-    // If the retry is 0, then we don't need to delay the first time
-    if (exponential_retry_count++ == 0)
+    if (store_ptr == NX_NULL)
     {
         return;
     }
 
-    if (exponential_retry_count < (sizeof(UINT) * 8))
+    record[0] = (UCHAR)(key >> 24);
+    record[1] = (UCHAR)(key >> 16);
+    record[2] = (UCHAR)(key >> 8);
+    record[3] = (UCHAR)key;
+    record[4] = (UCHAR)nx_context->azure_iot_hub_hostname_len;
+    memcpy(&record[5], nx_context->azure_iot_hub_hostname, nx_context->azure_iot_hub_hostname_len);
+    record_length         = 5 + nx_context->azure_iot_hub_hostname_len;
+    record[record_length] = (UCHAR)nx_context->azure_iot_hub_device_id_len;
+    memcpy(&record[record_length + 1], nx_context->azure_iot_hub_device_id, nx_context->azure_iot_hub_device_id_len);
+    record_length += 1 + nx_context->azure_iot_hub_device_id_len;
+
+    // Only the latest assignment is kept
+    while (store_ptr->count(store_ptr) > 0)
+    {
+        store_ptr->pop(store_ptr);
+    }
+
+    if (store_ptr->push(store_ptr, record, record_length, &dropped))
     {
-        delay = (uint64_t)((1 << exponential_retry_count) * INITIAL_EXPONENTIAL_BACKOFF_IN_SEC);
-        if (delay <= (UINT)(-1))
-        {
-            base_delay = (UINT)delay;
-        }
+        printf("ERROR: failed to store the DPS assignment\r\n");
     }
+}
+
+// Forget the DPS assignment, the stored copy too so the next boot does not try the same hub first
+static VOID dps_assignment_forget(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    AZURE_IOT_STORE* store_ptr = nx_context->dps_assignment.store_ptr;
+
+    nx_context->dps_assignment.assigned  = false;
+    nx_context->dps_assignment.confirmed = false;
 
-    if (base_delay > MAX_EXPONENTIAL_BACKOFF_IN_SEC)
+    while (store_ptr != NX_NULL && store_ptr->count(store_ptr) > 0)
     {
-        base_delay = MAX_EXPONENTIAL_BACKOFF_IN_SEC;
+        store_ptr->pop(store_ptr);
     }
-    else
+}
+
+bool dps_assignment_reuse(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    // An assignment stored by an earlier boot means the hub is tried before DPS
+    if (!nx_context->dps_assignment.loaded)
     {
-        exponential_retry_count++;
+        nx_context->dps_assignment.loaded = true;
+        dps_assignment_load(nx_context);
     }
 
-    backoff_seconds = (UINT)(base_delay * (1 + jitter_percent));
+    if (!nx_context->dps_assignment.assigned)
+    {
+        return false;
+    }
+
+    printf("\r\nReusing Azure IoT DPS assignment\r\n");
+    nx_context->dps_tls_stats.avoided_count++;
+
+    return true;
+}
+
+VOID dps_assignment_record(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    nx_context->dps_assignment.assigned  = true;
+    nx_context->dps_assignment.confirmed = false;
 
-    printf("\r\nIoT connection backoff for %d seconds\r\n", backoff_seconds);
-    tx_thread_sleep(backoff_seconds * NX_IP_PERIODIC_RATE);
+    dps_assignment_save(nx_context);
 }
 
 static void iothub_connect(AZURE_IOT_NX_CONTEXT* nx_context)
 {
     UINT status;
+    ULONG start_ticks;
 
     // Connect to IoT hub
     printf("\r\nInitializing Azure IoT Hub client\r\n");
     printf("\tHub hostname: %.*s\r\n", nx_context->azure_iot_hub_hostname_len, nx_context->azure_iot_hub_hostname);
     printf("\tDevice id: %.*s\r\n", nx_context->azure_iot_hub_device_id_len, nx_context->azure_iot_hub_device_id);
+    if (nx_context->azure_iot_hub_module_id_len > 0)
+    {
+        printf("\tModule id: %.*s\r\n", nx_context->azure_iot_hub_module_id_len, nx_context->azure_iot_hub_module_id);
+    }
     printf("\tModel id: %.*s\r\n", nx_context->azure_iot_model_id_len, nx_context->azure_iot_model_id);
 
+    start_ticks = tx_time_get();
     if ((status = nx_azure_iot_hub_client_connect(&nx_context->iothub_client, NX_FALSE, NX_WAIT_FOREVER)))
     {
         printf("ERROR: nx_azure_iot_hub_client_connect (0x%08x)\r\n", status);
     }
+    else
+    {
+        connection_handshake_record(&nx_context->hub_tls_stats, start_ticks);
+    }
 
     // stash the connection status to be used by the monitor loop
     nx_context->azure_iot_connection_status = status;
 }
 
+// Gateway clients share the network, only one reconnects it at a time and the layers it brought back are
+// still valid when the next one gets in
+static UINT network_connect_shared(AZURE_IOT_NX_CONTEXT* nx_context, UINT (*network_connect)(UINT), UINT invalid_layers)
+{
+    AZURE_IOT_NX_GATEWAY* gateway = nx_context->gateway;
+    UINT status;
+
+    if (gateway == NX_NULL)
+    {
+        return network_connect(invalid_layers);
+    }
+
+    tx_mutex_get(&gateway->network_mutex, TX_WAIT_FOREVER);
+    status = network_connect(invalid_layers);
+    tx_mutex_put(&gateway->network_mutex);
+
+    return status;
+}
+
+// The layers as of the last reconnect, the single copy. Each board's network_connect updates it through the calls
+// below, the background services that need the network read it
+static UINT network_layers_valid;
+
+// Network layers a connection failure points at, the session layers are redone by reinitializing the client
+static UINT connection_failure_layers(UINT connection_status)
+{
+    switch (connection_status)
+    {
+        case NX_DNS_QUERY_FAILED:
+            return NETWORK_LAYER_RESOLVER;
+
+        // SAS tokens are signed with an expiry, so a rejected token points at the clock
+        case NXD_MQTT_ERROR_BAD_USERNAME_PASSWORD:
+        case NXD_MQTT_ERROR_NOT_AUTHORIZED:
+            return NETWORK_LAYER_CLOCK;
+
+        default:
+            return 0;
+    }
+}
+
+UINT network_layers_valid_get()
+{
+    return network_layers_valid;
+}
+
+VOID network_layers_invalidate(UINT invalid_layers)
+{
+    // A new link needs a new lease, and a new lease may hand out different DNS servers
+    if (invalid_layers & NETWORK_LAYER_LINK)
+    {
+        invalid_layers |= NETWORK_LAYER_LEASE;
+    }
+
+    if (invalid_layers & NETWORK_LAYER_LEASE)
+    {
+        invalid_layers |= NETWORK_LAYER_RESOLVER;
+    }
+
+    network_layers_valid &= ~invalid_layers;
+}
+
+UINT network_layer_connect(UINT layer, UINT (*layer_connect)())
+{
+    UINT status;
+
+    if (network_layers_valid & layer)
+    {
+        return NX_SUCCESS;
+    }
+
+    if ((status = layer_connect()) == NX_SUCCESS)
+    {
+        network_layers_valid |= layer;
+    }
+
+    return status;
+}
+
+VOID connection_handshake_record(AZURE_IOT_TLS_STATS* stats, ULONG start_ticks)
+{
+    stats->last_ticks = tx_time_get() - start_ticks;
+    stats->total_ticks += stats->last_ticks;
+    stats->full_count++;
+}
+
 VOID connection_status_set(AZURE_IOT_NX_CONTEXT* nx_context, UINT connection_status)
 {
     nx_context->azure_iot_connection_status = connection_status;
@@ -81,6 +335,9 @@ VOID connection_status_set(AZURE_IOT_NX_CONTEXT* nx_context, UINT connection_sta
     if (nx_context->azure_iot_connection_status == NX_SUCCESS)
     {
         printf("SUCCESS: Connected to IoT Hub\r\n\r\n");
+
+        // The assigned hub exists and accepts the device
+        nx_context->dps_assignment.confirmed = true;
     }
 }
 
@@ -96,9 +353,13 @@ VOID connection_status_set(AZURE_IOT_NX_CONTEXT* nx_context, UINT connection_sta
 //          +-------------------------+     +-------------------------+
 //
 //---------------------------------------------------------------------------------
-VOID connection_monitor(
-    AZURE_IOT_NX_CONTEXT* nx_context, UINT (*iot_initialize)(AZURE_IOT_NX_CONTEXT* nx_context), UINT (*network_connect)())
+VOID connection_monitor(AZURE_IOT_NX_CONTEXT* nx_context,
+    UINT (*iot_initialize)(AZURE_IOT_NX_CONTEXT* nx_context),
+    UINT (*network_connect)(UINT invalid_layers))
 {
+    UINT status;
+    UINT invalid_layers = 0;
+
     // Check parameters
     if ((nx_context == NX_NULL) || (iot_initialize == NX_NULL))
     {
@@ -108,30 +369,50 @@ VOID connection_monitor(
     // Check if connected
     if (nx_context->azure_iot_connection_status == NX_SUCCESS)
     {
-        // Reset the exponential
-        exponential_backoff_reset();
         return;
     }
 
-    // Disconnect
+    // Disconnect, the send executor and application threads only use the client under the client mutex
     if (nx_context->azure_iot_connection_status != NX_AZURE_IOT_NOT_INITIALIZED)
     {
+        tx_mutex_get(&nx_context->client_mutex, TX_WAIT_FOREVER);
         nx_azure_iot_hub_client_disconnect(&nx_context->iothub_client);
+        tx_mutex_put(&nx_context->client_mutex);
     }
 
     // Recover
     while (true)
     {
+        connection_retry_wait(nx_context);
+
         switch (nx_context->azure_iot_connection_status)
         {
+            // The hub rejected the device, it may have been moved so provision again rather than reuse the assignment
+            case NXD_MQTT_ERROR_BAD_USERNAME_PASSWORD:
+            case NXD_MQTT_ERROR_NOT_AUTHORIZED:
+            {
+                dps_assignment_forget(nx_context);
+            }
+
+            // Fallthrough
             // Something bad has happened with client state, we need to re-initialize it
             case NX_DNS_QUERY_FAILED:
             case NXD_MQTT_COMMUNICATION_FAILURE:
-            case NXD_MQTT_ERROR_BAD_USERNAME_PASSWORD:
-            case NXD_MQTT_ERROR_NOT_AUTHORIZED:
             {
+                // A stored hub that never resolved may no longer exist, fall back to DPS
+                if (nx_context->azure_iot_connection_status == NX_DNS_QUERY_FAILED &&
+                    !nx_context->dps_assignment.confirmed)
+                {
+                    nx_context->dps_assignment.assigned = false;
+                }
+
+                // Only redo the network layers the failure points at, the network checks the rest itself
+                invalid_layers = connection_failure_layers(nx_context->azure_iot_connection_status);
+
                 // Deinitialize iot hub client
+                tx_mutex_get(&nx_context->client_mutex, TX_WAIT_FOREVER);
                 nx_azure_iot_hub_client_deinitialize(&nx_context->iothub_client);
+                tx_mutex_put(&nx_context->client_mutex);
             }
 
             // Fallthrough
@@ -140,21 +421,24 @@ VOID connection_monitor(
                 // Set the state to not initialized
                 nx_context->azure_iot_connection_status = NX_AZURE_IOT_NOT_INITIALIZED;
 
-                // Connect the network
-                if (network_connect() != NX_SUCCESS)
+                // Connect the network, it remembers the invalid layers until they have been redone
+                status         = network_connect_shared(nx_context, network_connect, invalid_layers);
+                invalid_layers = 0;
+
+                if (status != NX_SUCCESS)
                 {
-                    // Failed, sleep and break out to try again next time
-                    tx_thread_sleep(5 * TX_TIMER_TICKS_PER_SECOND);
+                    // Failed, the policy decides how long to wait before trying again
                     break;
                 }
 
                 // Initialize IoT Hub
-                exponential_backoff_with_jitter();
+                tx_mutex_get(&nx_context->client_mutex, TX_WAIT_FOREVER);
                 if (iot_initialize(nx_context) == NX_SUCCESS)
                 {
                     // Connect IoT Hub
                     iothub_connect(nx_context);
                 }
+                tx_mutex_put(&nx_context->client_mutex);
             }
             break;
 
@@ -167,8 +451,9 @@ VOID connection_monitor(
             default:
             {
                 // Connect IoT Hub
-                exponential_backoff_with_jitter();
+                tx_mutex_get(&nx_context->client_mutex, TX_WAIT_FOREVER);
                 iothub_connect(nx_context);
+                tx_mutex_put(&nx_context->client_mutex);
             }
             break;
         }
@@ -177,6 +462,7 @@ VOID connection_monitor(
         if (nx_context->azure_iot_connection_status == NX_SUCCESS)
         {
             // Success!
+            connection_policy_success(&nx_context->connection_policy, time_ms_get());
             return;
         }
     }
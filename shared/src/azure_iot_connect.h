@@ -8,9 +8,31 @@
 
 #include "azure_iot_nx_client.h"
 
+// Network layers below the hub connection, from the bottom up. A reconnect only redoes the layers that are
+// no longer valid, and a layer that is redone invalidates the layers that depend on it
+#define NETWORK_LAYER_LINK     0x01
+#define NETWORK_LAYER_LEASE    0x02
+#define NETWORK_LAYER_RESOLVER 0x04
+#define NETWORK_LAYER_CLOCK    0x08
+
+// Layers known good as of the last reconnect, a link that has dropped since still reads as valid. This module owns
+// the state, a board's network_connect invalidates what it found broken then connects each layer in turn
+UINT network_layers_valid_get();
+VOID network_layers_invalidate(UINT invalid_layers);
+UINT network_layer_connect(UINT layer, UINT (*layer_connect)());
+
+VOID connection_handshake_record(AZURE_IOT_TLS_STATS* stats, ULONG start_ticks);
+
+// The hub assignment from the last DPS registration, kept in the context and in the optional assignment store.
+// Reuse loads the stored copy once and counts the DPS handshake it saves, record keeps a new registration. The
+// connection monitor forgets the assignment when the hub rejects the device
+bool dps_assignment_reuse(AZURE_IOT_NX_CONTEXT* nx_context);
+VOID dps_assignment_record(AZURE_IOT_NX_CONTEXT* nx_context);
+
 VOID connection_status_set(AZURE_IOT_NX_CONTEXT* nx_context, UINT connection_status);
 
-VOID connection_monitor(
-    AZURE_IOT_NX_CONTEXT* nx_context, UINT (*iothub_init)(AZURE_IOT_NX_CONTEXT* nx_context), UINT (*network_connect)());
+VOID connection_monitor(AZURE_IOT_NX_CONTEXT* nx_context,
+    UINT (*iothub_init)(AZURE_IOT_NX_CONTEXT* nx_context),
+    UINT (*network_connect)(UINT invalid_layers));
 
 #endif
\ No newline at end of file
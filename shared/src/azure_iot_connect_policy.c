@@ -0,0 +1,152 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "azure_iot_connect_policy.h"
+
+#include <string.h>
+
+// A dropped connection is retried straight away once, most drops are a single lost keepalive
+static const CONNECTION_POLICY DEFAULT_TRANSIENT_POLICY = {CONNECTION_STRATEGY_IMMEDIATE, 1000, 2 * 60 * 1000, 1, 0, 0};
+
+static const CONNECTION_POLICY DEFAULT_NETWORK_POLICY = {
+    CONNECTION_STRATEGY_DECORRELATED_JITTER, 3000, 10 * 60 * 1000, 0, 0, 0};
+
+// Rejected credentials rarely fix themselves, so stop hammering the hub after a few tries
+static const CONNECTION_POLICY DEFAULT_AUTH_POLICY = {
+    CONNECTION_STRATEGY_CIRCUIT_BREAKER, 3000, 10 * 60 * 1000, 0, 3, 30 * 60 * 1000};
+
+static const CONNECTION_POLICY DEFAULT_TOKEN_POLICY = {CONNECTION_STRATEGY_IMMEDIATE, 1000, 60 * 1000, 1, 0, 0};
+
+static ULONG random_next(CONNECTION_POLICY_ENGINE* engine)
+{
+    ULONG x = engine->random_state;
+
+    // xorshift32, kept to 32 bits where ULONG is wider
+    x ^= (x << 13) & 0xFFFFFFFF;
+    x ^= x >> 17;
+    x ^= (x << 5) & 0xFFFFFFFF;
+    engine->random_state = x;
+
+    return x;
+}
+
+static ULONG random_between(CONNECTION_POLICY_ENGINE* engine, ULONG low, ULONG high)
+{
+    if (high <= low)
+    {
+        return low;
+    }
+
+    return low + random_next(engine) % (high - low + 1);
+}
+
+static ULONG decorrelated_jitter(CONNECTION_POLICY_ENGINE* engine, const CONNECTION_POLICY* policy, ULONG last_delay)
+{
+    ULONG high = last_delay < policy->base_ms ? policy->base_ms : last_delay;
+
+    high = high > policy->cap_ms / 3 ? policy->cap_ms : high * 3;
+
+    return random_between(engine, policy->base_ms, high);
+}
+
+VOID connection_policy_init(CONNECTION_POLICY_ENGINE* engine)
+{
+    memset(engine, 0, sizeof(CONNECTION_POLICY_ENGINE));
+
+    engine->policy[CONNECTION_FAILURE_TRANSIENT] = DEFAULT_TRANSIENT_POLICY;
+    engine->policy[CONNECTION_FAILURE_NETWORK]   = DEFAULT_NETWORK_POLICY;
+    engine->policy[CONNECTION_FAILURE_AUTH]      = DEFAULT_AUTH_POLICY;
+    engine->policy[CONNECTION_FAILURE_TOKEN]     = DEFAULT_TOKEN_POLICY;
+}
+
+VOID connection_policy_seed(CONNECTION_POLICY_ENGINE* engine, ULONG seed)
+{
+    // Zero is a fixed point of xorshift
+    engine->random_state = (seed & 0xFFFFFFFF) != 0 ? (seed & 0xFFFFFFFF) : 0x9E3779B9;
+}
+
+VOID connection_policy_set(
+    CONNECTION_POLICY_ENGINE* engine, CONNECTION_FAILURE_CLASS failure_class, const CONNECTION_POLICY* policy)
+{
+    if (failure_class < CONNECTION_FAILURE_CLASS_COUNT)
+    {
+        engine->policy[failure_class] = *policy;
+    }
+}
+
+ULONG connection_policy_failure(
+    CONNECTION_POLICY_ENGINE* engine, CONNECTION_FAILURE_CLASS failure_class, uint64_t now_ms)
+{
+    const CONNECTION_POLICY* policy;
+    UINT failures;
+    ULONG delay;
+
+    engine->stats.attempt_count++;
+
+    if (failure_class >= CONNECTION_FAILURE_CLASS_COUNT)
+    {
+        return 0;
+    }
+
+    if (engine->random_state == 0)
+    {
+        connection_policy_seed(engine, 0);
+    }
+
+    if (!engine->stats.disconnected)
+    {
+        engine->stats.disconnected          = true;
+        engine->stats.disconnected_since_ms = now_ms;
+    }
+
+    policy   = &engine->policy[failure_class];
+    failures = ++engine->consecutive_failures[failure_class];
+    engine->stats.failure_count[failure_class]++;
+
+    if (policy->strategy == CONNECTION_STRATEGY_IMMEDIATE && failures <= policy->immediate_retries)
+    {
+        delay = 0;
+    }
+
+    else if (policy->strategy == CONNECTION_STRATEGY_CIRCUIT_BREAKER && policy->breaker_threshold > 0 &&
+             failures >= policy->breaker_threshold)
+    {
+        // Jitter the open time too so a fleet rejected together does not probe together
+        delay = random_between(engine, policy->breaker_open_ms, policy->breaker_open_ms + policy->breaker_open_ms / 4);
+        engine->stats.breaker_open_count++;
+
+        // Half open, the next failure opens it again
+        engine->consecutive_failures[failure_class] = policy->breaker_threshold - 1;
+    }
+
+    else
+    {
+        delay = decorrelated_jitter(engine, policy, engine->last_delay_ms[failure_class]);
+    }
+
+    engine->last_delay_ms[failure_class] = delay;
+
+    return delay;
+}
+
+VOID connection_policy_success(CONNECTION_POLICY_ENGINE* engine, uint64_t now_ms)
+{
+    uint64_t outage_ms;
+
+    if (engine->stats.disconnected)
+    {
+        outage_ms = now_ms - engine->stats.disconnected_since_ms;
+
+        engine->stats.outage_count++;
+        engine->stats.outage_total_ms += outage_ms;
+        if (outage_ms > engine->stats.outage_max_ms)
+        {
+            engine->stats.outage_max_ms = outage_ms;
+        }
+
+        engine->stats.disconnected = false;
+    }
+
+    memset(engine->consecutive_failures, 0, sizeof(engine->consecutive_failures));
+    memset(engine->last_delay_ms, 0, sizeof(engine->last_delay_ms));
+}
@@ -0,0 +1,96 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_IOT_CONNECT_POLICY_H
+#define _AZURE_IOT_CONNECT_POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tx_api.h"
+
+// What the last connection attempt failed on, each class is retried with its own policy
+typedef enum CONNECTION_FAILURE_CLASS_ENUM
+{
+    // the MQTT connection dropped or could not be re-established
+    CONNECTION_FAILURE_TRANSIENT,
+
+    // the network, DNS or provisioning could not be brought up
+    CONNECTION_FAILURE_NETWORK,
+
+    // the hub rejected the device credentials
+    CONNECTION_FAILURE_AUTH,
+
+    // the SAS token expired, a fresh one is made on reconnect
+    CONNECTION_FAILURE_TOKEN,
+
+    CONNECTION_FAILURE_CLASS_COUNT,
+
+    // first attempt, nothing has failed yet
+    CONNECTION_FAILURE_NONE = CONNECTION_FAILURE_CLASS_COUNT
+} CONNECTION_FAILURE_CLASS;
+
+typedef enum CONNECTION_STRATEGY_ENUM
+{
+    // retry without a delay immediate_retries times, then back off with decorrelated jitter
+    CONNECTION_STRATEGY_IMMEDIATE,
+
+    // each delay is random between base_ms and three times the last delay, capped at cap_ms
+    CONNECTION_STRATEGY_DECORRELATED_JITTER,
+
+    // decorrelated jitter until breaker_threshold failures in a row, then hold off for breaker_open_ms and
+    // open again after every failed probe
+    CONNECTION_STRATEGY_CIRCUIT_BREAKER
+} CONNECTION_STRATEGY;
+
+typedef struct CONNECTION_POLICY_STRUCT
+{
+    CONNECTION_STRATEGY strategy;
+    ULONG base_ms;
+    ULONG cap_ms;
+    UINT immediate_retries;
+    UINT breaker_threshold;
+    ULONG breaker_open_ms;
+} CONNECTION_POLICY;
+
+typedef struct CONNECTION_POLICY_STATS_STRUCT
+{
+    ULONG attempt_count;
+    ULONG failure_count[CONNECTION_FAILURE_CLASS_COUNT];
+    ULONG breaker_open_count;
+
+    // completed outages, from the first failure to the next successful connection
+    ULONG outage_count;
+    uint64_t outage_total_ms;
+    uint64_t outage_max_ms;
+
+    // the outage in progress, if any
+    bool disconnected;
+    uint64_t disconnected_since_ms;
+} CONNECTION_POLICY_STATS;
+
+typedef struct CONNECTION_POLICY_ENGINE_STRUCT
+{
+    CONNECTION_POLICY policy[CONNECTION_FAILURE_CLASS_COUNT];
+
+    // failures in a row and the last delay, per class
+    UINT consecutive_failures[CONNECTION_FAILURE_CLASS_COUNT];
+    ULONG last_delay_ms[CONNECTION_FAILURE_CLASS_COUNT];
+
+    // xorshift state, zero until seeded
+    ULONG random_state;
+
+    CONNECTION_POLICY_STATS stats;
+} CONNECTION_POLICY_ENGINE;
+
+VOID connection_policy_init(CONNECTION_POLICY_ENGINE* engine);
+VOID connection_policy_seed(CONNECTION_POLICY_ENGINE* engine, ULONG seed);
+VOID connection_policy_set(
+    CONNECTION_POLICY_ENGINE* engine, CONNECTION_FAILURE_CLASS failure_class, const CONNECTION_POLICY* policy);
+
+// Records the outcome of the last attempt and returns how long to wait before the next one
+ULONG connection_policy_failure(
+    CONNECTION_POLICY_ENGINE* engine, CONNECTION_FAILURE_CLASS failure_class, uint64_t now_ms);
+VOID connection_policy_success(CONNECTION_POLICY_ENGINE* engine, uint64_t now_ms);
+
+#endif
@@ -0,0 +1,139 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "azure_iot_diagnostics.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dns_cache.h"
+#include "packet_pool.h"
+#include "sntp_client.h"
+#include "time_service.h"
+
+typedef struct DIAGNOSTICS_FIELD_STRUCT
+{
+    const CHAR* name;
+    size_t offset;
+} DIAGNOSTICS_FIELD;
+
+// Short names keep a sample to a single small message, see shared/model/diagnostics-1.json
+static const DIAGNOSTICS_FIELD diagnostics_fields[] = {
+    {"pktFree", offsetof(AZURE_IOT_DIAGNOSTICS, pool_free)},
+    {"pktPeak", offsetof(AZURE_IOT_DIAGNOSTICS, pool_high_water)},
+    {"pktEmpty", offsetof(AZURE_IOT_DIAGNOSTICS, pool_empty_requests)},
+    {"ctlFree", offsetof(AZURE_IOT_DIAGNOSTICS, control_free)},
+    {"ctlPeak", offsetof(AZURE_IOT_DIAGNOSTICS, control_high_water)},
+    {"ctlFallback", offsetof(AZURE_IOT_DIAGNOSTICS, control_fallbacks)},
+    {"ipRx", offsetof(AZURE_IOT_DIAGNOSTICS, ip_received)},
+    {"ipTx", offsetof(AZURE_IOT_DIAGNOSTICS, ip_sent)},
+    {"ipDrop", offsetof(AZURE_IOT_DIAGNOSTICS, ip_dropped)},
+    {"ipBad", offsetof(AZURE_IOT_DIAGNOSTICS, ip_invalid)},
+    {"tcpRx", offsetof(AZURE_IOT_DIAGNOSTICS, tcp_received)},
+    {"tcpTx", offsetof(AZURE_IOT_DIAGNOSTICS, tcp_sent)},
+    {"tcpRetx", offsetof(AZURE_IOT_DIAGNOSTICS, tcp_retransmits)},
+    {"tcpDrop", offsetof(AZURE_IOT_DIAGNOSTICS, tcp_connections_dropped)},
+    {"tcpCsum", offsetof(AZURE_IOT_DIAGNOSTICS, tcp_checksum_errors)},
+    {"sntpDnsHit", offsetof(AZURE_IOT_DIAGNOSTICS, sntp_dns_hits)},
+    {"sntpDnsMiss", offsetof(AZURE_IOT_DIAGNOSTICS, sntp_dns_misses)},
+    {"sntpDnsStale", offsetof(AZURE_IOT_DIAGNOSTICS, sntp_dns_stale)},
+    {"sntpSync", offsetof(AZURE_IOT_DIAGNOSTICS, sntp_syncs)},
+    {"sntpFail", offsetof(AZURE_IOT_DIAGNOSTICS, sntp_failures)},
+    {"tlsFull", offsetof(AZURE_IOT_DIAGNOSTICS, tls_handshakes)},
+    {"tlsMs", offsetof(AZURE_IOT_DIAGNOSTICS, tls_last_ms)},
+    {"connTry", offsetof(AZURE_IOT_DIAGNOSTICS, connect_attempts)},
+    {"connFail", offsetof(AZURE_IOT_DIAGNOSTICS, connect_failures)},
+    {"authFail", offsetof(AZURE_IOT_DIAGNOSTICS, auth_failures)},
+    {"outages", offsetof(AZURE_IOT_DIAGNOSTICS, outages)},
+    {"outageMs", offsetof(AZURE_IOT_DIAGNOSTICS, outage_ms)},
+};
+
+static VOID packet_pool_sample(PACKET_POOL_CLASS pool_class, ULONG* free_packets, ULONG* high_water, ULONG* other)
+{
+    PACKET_POOL_STATS stats;
+
+    if (packet_pool_stats_get(pool_class, &stats) == NX_SUCCESS)
+    {
+        *free_packets = stats.free_packets;
+        *high_water   = stats.high_water;
+        *other        = pool_class == PACKET_POOL_CONTROL ? stats.fallback_count : stats.empty_requests;
+    }
+}
+
+VOID azure_iot_diagnostics_sample(NX_IP* ip_ptr, AZURE_IOT_DIAGNOSTICS* diagnostics)
+{
+    ULONG receive_dropped = 0;
+    ULONG send_dropped    = 0;
+    DNS_CACHE_STATS dns_stats;
+    SNTP_STATS sntp_stats;
+
+    memset(diagnostics, 0, sizeof(AZURE_IOT_DIAGNOSTICS));
+
+    packet_pool_sample(
+        PACKET_POOL_BULK, &diagnostics->pool_free, &diagnostics->pool_high_water, &diagnostics->pool_empty_requests);
+    packet_pool_sample(PACKET_POOL_CONTROL,
+        &diagnostics->control_free,
+        &diagnostics->control_high_water,
+        &diagnostics->control_fallbacks);
+
+    // Counters NetX was built without are left at zero
+    nx_ip_info_get(ip_ptr,
+        &diagnostics->ip_sent,
+        NX_NULL,
+        &diagnostics->ip_received,
+        NX_NULL,
+        &diagnostics->ip_invalid,
+        &receive_dropped,
+        NX_NULL,
+        &send_dropped,
+        NX_NULL,
+        NX_NULL);
+    diagnostics->ip_dropped = receive_dropped + send_dropped;
+
+    nx_tcp_info_get(ip_ptr,
+        &diagnostics->tcp_sent,
+        NX_NULL,
+        &diagnostics->tcp_received,
+        NX_NULL,
+        NX_NULL,
+        NX_NULL,
+        &diagnostics->tcp_checksum_errors,
+        NX_NULL,
+        NX_NULL,
+        &diagnostics->tcp_connections_dropped,
+        &diagnostics->tcp_retransmits);
+
+    dns_cache_stats_get(&dns_stats);
+    diagnostics->sntp_dns_hits   = dns_stats.hit_count;
+    diagnostics->sntp_dns_misses = dns_stats.miss_count;
+    diagnostics->sntp_dns_stale  = dns_stats.stale_count;
+
+    sntp_stats_get(&sntp_stats);
+    diagnostics->sntp_syncs      = sntp_stats.sync_count;
+    diagnostics->sntp_failures   = sntp_stats.fail_count;
+    diagnostics->clock_drift_ppb = time_drift_get();
+}
+
+UINT azure_iot_diagnostics_append(NX_AZURE_IOT_JSON_WRITER* json_writer, const AZURE_IOT_DIAGNOSTICS* diagnostics)
+{
+    UINT status;
+    ULONG value;
+
+    for (UINT i = 0; i < sizeof(diagnostics_fields) / sizeof(diagnostics_fields[0]); ++i)
+    {
+        memcpy(&value, (const UCHAR*)diagnostics + diagnostics_fields[i].offset, sizeof(ULONG));
+
+        // Counters past the int32 range are pinned rather than wrapping negative
+        if ((status = nx_azure_iot_json_writer_append_property_with_int32_value(json_writer,
+                 (UCHAR*)diagnostics_fields[i].name,
+                 strlen(diagnostics_fields[i].name),
+                 value > INT32_MAX ? INT32_MAX : (int32_t)value)))
+        {
+            return status;
+        }
+    }
+
+    return nx_azure_iot_json_writer_append_property_with_int32_value(
+        json_writer, (UCHAR*)"drift", sizeof("drift") - 1, (int32_t)diagnostics->clock_drift_ppb);
+}
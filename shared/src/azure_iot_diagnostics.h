@@ -0,0 +1,64 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_IOT_DIAGNOSTICS_H
+#define _AZURE_IOT_DIAGNOSTICS_H
+
+#include "nx_api.h"
+
+#include "nx_azure_iot_json_writer.h"
+
+// Matches shared/model/diagnostics-1.json
+#define AZURE_IOT_DIAGNOSTICS_COMPONENT "diagnostics"
+
+// One sample of the network stack, the counters are totals since boot
+typedef struct AZURE_IOT_DIAGNOSTICS_STRUCT
+{
+    // bulk and control packet pools
+    ULONG pool_free;
+    ULONG pool_high_water;
+    ULONG pool_empty_requests;
+    ULONG control_free;
+    ULONG control_high_water;
+    ULONG control_fallbacks;
+
+    ULONG ip_received;
+    ULONG ip_sent;
+    ULONG ip_dropped;
+    ULONG ip_invalid;
+
+    ULONG tcp_received;
+    ULONG tcp_sent;
+    ULONG tcp_retransmits;
+    ULONG tcp_connections_dropped;
+    ULONG tcp_checksum_errors;
+
+    // the DNS cache only serves the SNTP server lookups, hub and DPS resolve through the Azure IoT library
+    ULONG sntp_dns_hits;
+    ULONG sntp_dns_misses;
+    ULONG sntp_dns_stale;
+
+    ULONG sntp_syncs;
+    ULONG sntp_failures;
+    LONG clock_drift_ppb;
+
+    // filled in by the hub client, full TLS handshakes with the hub and how long the last one took
+    ULONG tls_handshakes;
+    ULONG tls_last_ms;
+
+    // filled in by the hub client from the connection policy stats, which connection_monitor updates on every
+    // attempt and every successful connect
+    ULONG connect_attempts;
+    ULONG connect_failures;
+    ULONG auth_failures;
+    ULONG outages;
+    ULONG outage_ms;
+} AZURE_IOT_DIAGNOSTICS;
+
+// Samples the packet pools, IP and TCP counters, DNS cache and SNTP client
+VOID azure_iot_diagnostics_sample(NX_IP* ip_ptr, AZURE_IOT_DIAGNOSTICS* diagnostics);
+
+// Appends a sample as telemetry properties, the caller opens and closes the object
+UINT azure_iot_diagnostics_append(NX_AZURE_IOT_JSON_WRITER* json_writer, const AZURE_IOT_DIAGNOSTICS* diagnostics);
+
+#endif // _AZURE_IOT_DIAGNOSTICS_H
@@ -10,12 +10,12 @@
 
 #include "azure_iot_mqtt/sas_token.h"
 
-#include "json_utils.h"
+#include "json_query.h"
+#include "packet_pool.h"
 
 #define AZURE_IOT_DPS_ENDPOINT "global.azure-devices-provisioning.net"
 
 #define USERNAME               "%s/registrations/%s/api-version=2019-03-31"
-#define DPS_REGISTER_BASE      "$dps/registrations/res"
 #define DPS_REGISTER_SUBSCRIBE "$dps/registrations/res/#"
 #define DPS_REGISTER_TOPIC     "$dps/registrations/PUT/iotdps-register/?$rid=1"
 #define DPS_STATUS_TOPIC       "$dps/registrations/GET/iotdps-get-operationstatus/?$rid=1&operationId="
@@ -28,46 +28,33 @@
 
 extern CHAR* azure_iot_x509_hostname;
 
-static VOID process_retry(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* message)
+static VOID process_retry(AZURE_IOT_MQTT* azure_iot_mqtt, const MQTT_VIEW* tail, const MQTT_VIEW* message)
 {
     UINT status;
 
-    jsmn_parser parser;
-    jsmntok_t tokens[12];
-    INT token_count;
-
-    INT retry_interval;
+    MQTT_VIEW retry_after;
     CHAR mqtt_publish_topic[256];
 
-    CHAR* find = strstr(topic, "retry-after=");
-    if (find == 0)
+    // The operation id is appended straight onto the status topic
+    JSON_QUERY query = {"operationId",
+        JSON_QUERY_STRING,
+        mqtt_publish_topic + sizeof(DPS_STATUS_TOPIC) - 1,
+        sizeof(mqtt_publish_topic) - sizeof(DPS_STATUS_TOPIC) + 1};
+
+    if (!mqtt_view_param(tail, "retry-after", &retry_after))
     {
         printf("Error: Unknown retry-after\r\n");
         return;
     }
 
-    // extract retry interval
-    retry_interval = atoi(find + 12);
-
-    jsmn_init(&parser);
-
-    token_count = jsmn_parse(&parser,
-        azure_iot_mqtt->mqtt_receive_message_buffer,
-        strlen(azure_iot_mqtt->mqtt_receive_message_buffer),
-        tokens,
-        12);
-
     strncpy(mqtt_publish_topic, DPS_STATUS_TOPIC, sizeof(mqtt_publish_topic));
-    if (!findJsonString(azure_iot_mqtt->mqtt_receive_message_buffer,
-            tokens,
-            token_count,
-            "operationId",
-            mqtt_publish_topic + sizeof(DPS_STATUS_TOPIC) - 1))
+    json_query(message, &query, 1);
+    if (!query.found)
     {
         printf("ERROR: Failed to parse DPS operationId\r\n");
     }
 
-    tx_thread_sleep(retry_interval * TX_TIMER_TICKS_PER_SECOND);
+    tx_thread_sleep(mqtt_view_int(&retry_after) * TX_TIMER_TICKS_PER_SECOND);
 
     status = mqtt_publish(azure_iot_mqtt, mqtt_publish_topic, "{}");
     if (status != NX_SUCCESS)
@@ -76,96 +63,84 @@ static VOID process_retry(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* mes
     }
 }
 
-static VOID process_success(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* message)
+// A hostname or device id that is missing or too long fails the registration rather than connect to a wrong hub
+static bool process_success(AZURE_IOT_MQTT* azure_iot_mqtt, const MQTT_VIEW* message)
 {
-    jsmn_parser parser;
-    jsmntok_t tokens[64];
-    INT token_count;
-
-    jsmn_init(&parser);
-
-    token_count = jsmn_parse(&parser,
-        azure_iot_mqtt->mqtt_receive_message_buffer,
-        strlen(azure_iot_mqtt->mqtt_receive_message_buffer),
-        tokens,
-        64);
-
-    if (!findJsonString(azure_iot_mqtt->mqtt_receive_message_buffer,
-            tokens,
-            token_count,
-            "assignedHub",
-            azure_iot_mqtt->mqtt_hub_hostname))
+    JSON_QUERY queries[] = {
+        {"registrationState.assignedHub",
+            JSON_QUERY_STRING,
+            azure_iot_mqtt->mqtt_hub_hostname,
+            sizeof(azure_iot_mqtt->mqtt_hub_hostname)},
+        {"registrationState.deviceId",
+            JSON_QUERY_STRING,
+            azure_iot_mqtt->mqtt_device_id,
+            sizeof(azure_iot_mqtt->mqtt_device_id)},
+    };
+
+    json_query(message, queries, sizeof(queries) / sizeof(queries[0]));
+
+    if (!queries[0].found)
     {
         printf("ERROR: DPS failed to parse hub hostname\r\n");
     }
 
-    if (!findJsonString(azure_iot_mqtt->mqtt_receive_message_buffer,
-            tokens,
-            token_count,
-            "deviceId",
-            azure_iot_mqtt->mqtt_device_id))
+    if (!queries[1].found)
     {
         printf("ERROR: DPS failed to parse device id\r\n");
     }
+
+    return queries[0].found && queries[1].found;
+}
+
+static VOID process_register_response(VOID* context, const MQTT_VIEW* tail, const MQTT_VIEW* message)
+{
+    AZURE_IOT_MQTT* azure_iot_mqtt = (AZURE_IOT_MQTT*)context;
+
+    // The tail is "<status>/?$rid=<request id>[&retry-after=<seconds>]"
+    INT msg_status = mqtt_view_int(tail);
+
+    switch (msg_status)
+    {
+        case 202:
+            process_retry(azure_iot_mqtt, tail, message);
+            break;
+
+        case 200:
+            if (process_success(azure_iot_mqtt, message))
+            {
+                tx_event_flags_set(&azure_iot_mqtt->mqtt_event_flags, EVENT_FLAGS_SUCCESS, TX_OR);
+            }
+            break;
+
+        default:
+            printf("ERROR: Unknown incoming DPS topic status %d\r\n", msg_status);
+            break;
+    }
 }
 
 static VOID mqtt_notify_cb(NXD_MQTT_CLIENT* client_ptr, UINT number_of_messages)
 {
-    UINT actual_topic_length;
-    UINT actual_message_length;
+    NX_PACKET* packet_ptr;
+    MQTT_VIEW topic;
+    MQTT_VIEW message;
     UINT status;
 
     AZURE_IOT_MQTT* azure_iot_mqtt = (AZURE_IOT_MQTT*)client_ptr->nxd_mqtt_packet_receive_context;
 
     for (UINT count = 0; count < number_of_messages; ++count)
     {
-        // Get the mqtt client message
-        status = nxd_mqtt_client_message_get(client_ptr,
-            (UCHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer,
-            AZURE_IOT_MQTT_TOPIC_NAME_LENGTH,
-            &actual_topic_length,
-            (UCHAR*)azure_iot_mqtt->mqtt_receive_message_buffer,
-            AZURE_IOT_MQTT_MESSAGE_LENGTH,
-            &actual_message_length);
-        if (status != NXD_MQTT_SUCCESS)
+        if ((status = mqtt_message_take(client_ptr, &packet_ptr, &topic, &message)))
         {
-            printf("ERROR: nxd_mqtt_client_message_get failed (0x%02x)\r\n", status);
+            printf("ERROR: mqtt_message_take failed (0x%02x)\r\n", status);
             continue;
         }
 
-        // Append null string terminators
-        azure_iot_mqtt->mqtt_receive_topic_buffer[actual_topic_length]     = 0;
-        azure_iot_mqtt->mqtt_receive_message_buffer[actual_message_length] = 0;
-
-        if (strstr((CHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer, DPS_REGISTER_BASE) == 0)
+        if (topic_router_dispatch(&azure_iot_mqtt->mqtt_topic_router, &topic, &message, azure_iot_mqtt))
         {
-            printf("ERROR: Unknown incoming DPS topic %s\r\n", (CHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer);
-            continue;
+            printf("ERROR: Unknown incoming DPS topic %.*s\r\n", topic.length, topic.ptr);
         }
 
-        // Parse the response status
-        CHAR* location = azure_iot_mqtt->mqtt_receive_topic_buffer + sizeof(DPS_REGISTER_BASE);
-        INT msg_status = atoi(location);
-
-        switch (msg_status)
-        {
-            case 202:
-                process_retry(azure_iot_mqtt,
-                    azure_iot_mqtt->mqtt_receive_topic_buffer,
-                    azure_iot_mqtt->mqtt_receive_message_buffer);
-                break;
-
-            case 200:
-                process_success(azure_iot_mqtt,
-                    azure_iot_mqtt->mqtt_receive_topic_buffer,
-                    azure_iot_mqtt->mqtt_receive_message_buffer);
-                tx_event_flags_set(&azure_iot_mqtt->mqtt_event_flags, EVENT_FLAGS_SUCCESS, TX_OR);
-                break;
-
-            default:
-                printf("ERROR: Unknown incoming DPS topic status %d\r\n", msg_status);
-                break;
-        }
+        packet_pool_release(packet_ptr);
     }
 
     return;
@@ -175,6 +150,15 @@ UINT azure_iot_dps_create(AZURE_IOT_MQTT* azure_iot_mqtt, NX_IP* nx_ip, NX_PACKE
 {
     UINT status;
 
+    // The hub client reinitializes the router with its own routes once registration is done
+    topic_router_init(&azure_iot_mqtt->mqtt_topic_router);
+    status = topic_router_add(&azure_iot_mqtt->mqtt_topic_router, DPS_REGISTER_SUBSCRIBE, process_register_response);
+    if (status != NX_SUCCESS)
+    {
+        printf("FAIL: Unable to add DPS topic route (0x%02x)\r\n", status);
+        return status;
+    }
+
     status = tx_event_flags_create(&azure_iot_mqtt->mqtt_event_flags, "DPS event flags");
     if (status != TX_SUCCESS)
     {
@@ -247,8 +231,7 @@ UINT azure_iot_dps_register(AZURE_IOT_MQTT* azure_iot_mqtt, UINT wait)
         azure_iot_mqtt->mqtt_dps_id_scope,
         azure_iot_mqtt->mqtt_dps_registration_id);
 
-    if (!create_dps_sas_token(azure_iot_mqtt->mqtt_sas_key,
-            strlen(azure_iot_mqtt->mqtt_sas_key),
+    if (!create_dps_sas_token_with_key(&azure_iot_mqtt->mqtt_sas_hmac,
             azure_iot_mqtt->mqtt_dps_id_scope,
             azure_iot_mqtt->mqtt_dps_registration_id,
             azure_iot_mqtt->unix_time_get(),
@@ -14,21 +14,19 @@
 #include "azure_iot_cert.h"
 #include "azure_iot_mqtt/azure_iot_dps_mqtt.h"
 #include "azure_iot_mqtt/sas_token.h"
+#include "packet_pool.h"
 
 #define USERNAME                "%s/%s/?api-version=2020-09-30&model-id=%s"
 #define PUBLISH_TELEMETRY_TOPIC "devices/%s/messages/events/"
 
-#define DEVICE_MESSAGE_BASE  "messages/devicebound/"
-#define DEVICE_MESSAGE_TOPIC "devices/%s/messages/devicebound/#"
+#define DEVICE_MESSAGE_TOPIC  "devices/%s/messages/devicebound/#"
+#define DEVICE_MESSAGE_FILTER "devices/+/messages/devicebound/#"
 
 #define DEVICE_TWIN_PUBLISH_TOPIC          "$iothub/twin/PATCH/properties/reported/?$rid=%d"
 #define DEVICE_TWIN_REQUEST_TOPIC          "$iothub/twin/GET/?$rid=%d"
-#define DEVICE_TWIN_RES_BASE               "$iothub/twin/res/"
 #define DEVICE_TWIN_RES_TOPIC              "$iothub/twin/res/#"
-#define DEVICE_TWIN_DESIRED_PROP_RES_BASE  "$iothub/twin/PATCH/properties/desired/"
 #define DEVICE_TWIN_DESIRED_PROP_RES_TOPIC "$iothub/twin/PATCH/properties/desired/#"
 
-#define DIRECT_METHOD_RECEIVE  "$iothub/methods/POST/"
 #define DIRECT_METHOD_TOPIC    "$iothub/methods/POST/#"
 #define DIRECT_METHOD_RESPONSE "$iothub/methods/res/%d/?$rid=%s"
 
@@ -220,38 +218,45 @@ static UINT mqtt_publish_bool(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR*
     return mqtt_publish(azure_iot_mqtt, topic, mqtt_message);
 }
 
-static VOID process_direct_method(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* message)
+static VOID process_direct_method(VOID* context, const MQTT_VIEW* tail, const MQTT_VIEW* message)
 {
-    INT direct_method_receive_size = sizeof(DIRECT_METHOD_RECEIVE) - 1;
-    CHAR direct_method_name[64]    = {0};
+    AZURE_IOT_MQTT* azure_iot_mqtt = (AZURE_IOT_MQTT*)context;
+    MQTT_VIEW direct_method_name   = {tail->ptr, 0};
+    MQTT_VIEW rid;
+    UINT rid_length;
 
-    CHAR* location = topic + direct_method_receive_size;
-    CHAR* find;
+    // The tail is "<method name>/?$rid=<request id>"
+    while (direct_method_name.length < tail->length && tail->ptr[direct_method_name.length] != '/')
+    {
+        direct_method_name.length++;
+    }
 
-    find = strchr(location, '/');
-    if (find == 0)
+    if (direct_method_name.length == tail->length)
     {
         return;
     }
 
-    strncpy(direct_method_name, location, find - location);
-
-    location = find;
-
-    find = strstr(location, "$rid=");
-    if (find == 0)
+    if (!mqtt_view_param(tail, "$rid", &rid))
     {
         printf("Error: failed to parse direct method rid\r\n");
         return;
     }
 
-    location = find + 5;
-    strncpy(azure_iot_mqtt->direct_command_request_id, location, AZURE_IOT_MQTT_DIRECT_COMMAND_RID_SIZE);
+    rid_length = rid.length;
+    if (rid_length >= AZURE_IOT_MQTT_DIRECT_COMMAND_RID_SIZE)
+    {
+        rid_length = AZURE_IOT_MQTT_DIRECT_COMMAND_RID_SIZE - 1;
+    }
+
+    memcpy(azure_iot_mqtt->direct_command_request_id, rid.ptr, rid_length);
+    azure_iot_mqtt->direct_command_request_id[rid_length] = 0;
 
-    printf("Received direct method=%s, rid=%s, message=%s\r\n",
-        direct_method_name,
+    printf("Received direct method=%.*s, rid=%s, message=%.*s\r\n",
+        direct_method_name.length,
+        direct_method_name.ptr,
         azure_iot_mqtt->direct_command_request_id,
-        message);
+        message->length,
+        message->ptr);
 
     if (azure_iot_mqtt->cb_ptr_mqtt_invoke_direct_method == NULL)
     {
@@ -259,30 +264,31 @@ static VOID process_direct_method(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, C
         return;
     }
 
-    azure_iot_mqtt->cb_ptr_mqtt_invoke_direct_method(azure_iot_mqtt, direct_method_name, message);
+    azure_iot_mqtt->cb_ptr_mqtt_invoke_direct_method(azure_iot_mqtt, &direct_method_name, message);
 }
 
-static VOID process_c2d_message(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* message)
+static VOID process_c2d_message(VOID* context, const MQTT_VIEW* tail, const MQTT_VIEW* message)
 {
-    CHAR* properties;
+    AZURE_IOT_MQTT* azure_iot_mqtt = (AZURE_IOT_MQTT*)context;
+    MQTT_VIEW properties;
+    MQTT_VIEW to;
 
     // Get to parameters list
-    if ((properties = strstr(topic, ".to")) == 0)
+    if (!mqtt_view_param(tail, "%24.to", &to))
     {
         printf("Received C2D message has no parameter list\r\n");
         return;
     }
 
-    // Find the properties
-    if ((properties = strstr(properties, "&")) == 0)
+    // The properties follow the '&' after the .to parameter, if there are any
+    properties.ptr         = to.ptr + to.length;
+    properties.length      = tail->ptr + tail->length - properties.ptr;
+    properties.remaining   = 0;
+    properties.next_packet = NX_NULL;
+    if (properties.length > 0)
     {
-        // No properties, point at the null terminator
-        properties = topic + strlen(topic);
-    }
-    else
-    {
-        // Skip over the '&'
-        properties++;
+        properties.ptr++;
+        properties.length--;
     }
 
     if (azure_iot_mqtt->cb_ptr_mqtt_c2d_message == NULL)
@@ -291,24 +297,15 @@ static VOID process_c2d_message(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHA
         return;
     }
 
-    azure_iot_mqtt->cb_ptr_mqtt_c2d_message(azure_iot_mqtt, properties, message);
+    azure_iot_mqtt->cb_ptr_mqtt_c2d_message(azure_iot_mqtt, &properties, message);
 }
 
-static VOID process_device_twin_response(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* message)
+static VOID process_device_twin_response(VOID* context, const MQTT_VIEW* tail, const MQTT_VIEW* message)
 {
-    INT response_status;
-
-    // Parse the device twin response status
-    CHAR* location = topic + sizeof(DEVICE_TWIN_RES_BASE) - 1;
-    CHAR* find;
+    AZURE_IOT_MQTT* azure_iot_mqtt = (AZURE_IOT_MQTT*)context;
 
-    find = strchr(location, '/');
-    if (find == 0)
-    {
-        return;
-    }
-
-    response_status = atoi(location);
+    // The tail is "<status>/?$rid=<request id>"
+    INT response_status = mqtt_view_int(tail);
 
     printf("Processed device twin update response with status=%d\r\n", response_status);
 
@@ -318,25 +315,166 @@ static VOID process_device_twin_response(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* t
     }
 }
 
-static VOID process_device_twin_desired_prop_update(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* message)
+static VOID process_device_twin_desired_prop_update(VOID* context, const MQTT_VIEW* tail, const MQTT_VIEW* message)
 {
+    AZURE_IOT_MQTT* azure_iot_mqtt = (AZURE_IOT_MQTT*)context;
+    MQTT_VIEW version;
+
     printf("Received device twin desired property\r\n");
 
     // Parse the device twin version
-    CHAR* location = topic + sizeof(DEVICE_TWIN_DESIRED_PROP_RES_BASE) - 1;
-
-    location = strstr(location, "$version=");
-    if (location == 0)
+    if (!mqtt_view_param(tail, "$version", &version))
     {
         printf("Error: Failed to parse version from desired property update\r\n");
         return;
     }
 
-    azure_iot_mqtt->desired_property_version = atoi(location + 9);
+    azure_iot_mqtt->desired_property_version = mqtt_view_int(&version);
 
     azure_iot_mqtt->cb_ptr_mqtt_device_twin_desired_prop_callback(azure_iot_mqtt, message);
 }
 
+// NetX Duo MQTT internals. nxd_mqtt_client_message_get only hands out a copy of the topic and message, so the
+// receive queue is dequeued here directly and the PUBLISH parsed with the client's private parser. This relies on the
+// layout of NXD_MQTT_CLIENT and the signature of _nxd_mqtt_process_publish_packet as of NetX Duo 6.1, recheck both
+// against nxd_mqtt_client.c before moving to another release.
+#if !defined(NETXDUO_MAJOR_VERSION) || NETXDUO_MAJOR_VERSION != 6 || NETXDUO_MINOR_VERSION != 1
+#error "mqtt_publish_dequeue was checked against NetX Duo 6.1 only"
+#endif
+
+static UINT mqtt_publish_dequeue(NXD_MQTT_CLIENT* client_ptr,
+    NX_PACKET** packet_ptr,
+    ULONG* topic_offset,
+    USHORT* topic_length,
+    ULONG* message_offset,
+    ULONG* message_length)
+{
+    NX_PACKET* head;
+    UINT status;
+
+    // Same dequeue as nxd_mqtt_client_message_get, minus the copy out
+    tx_mutex_get(client_ptr->nxd_mqtt_client_mutex_ptr, TX_WAIT_FOREVER);
+    head = client_ptr->message_receive_queue_head;
+    if (head != NX_NULL)
+    {
+        client_ptr->message_receive_queue_head = head->nx_packet_queue_next;
+        if (client_ptr->message_receive_queue_head == NX_NULL)
+        {
+            client_ptr->message_receive_queue_tail = NX_NULL;
+        }
+        client_ptr->message_receive_queue_depth--;
+    }
+    tx_mutex_put(client_ptr->nxd_mqtt_client_mutex_ptr);
+
+    if (head == NX_NULL)
+    {
+        return NXD_MQTT_NO_MESSAGE;
+    }
+
+    // Offsets are from the start of the PUBLISH fixed header
+    if ((status = _nxd_mqtt_process_publish_packet(head, topic_offset, topic_length, message_offset, message_length)))
+    {
+        packet_pool_release(head);
+        return status;
+    }
+
+    *packet_ptr = head;
+
+    return NX_SUCCESS;
+}
+
+UINT mqtt_message_take(NXD_MQTT_CLIENT* client_ptr, NX_PACKET** packet_ptr, MQTT_VIEW* topic, MQTT_VIEW* message)
+{
+    NX_PACKET* head;
+    NX_PACKET* copy;
+    NX_PACKET* segment;
+    ULONG topic_offset;
+    USHORT topic_length;
+    ULONG message_offset;
+    ULONG message_length;
+    ULONG segment_length;
+    ULONG span;
+    ULONG bytes_copied;
+    UINT status;
+
+    if ((status = mqtt_publish_dequeue(
+             client_ptr, &head, &topic_offset, &topic_length, &message_offset, &message_length)))
+    {
+        return status;
+    }
+
+    // The topic is matched in place so has to be contiguous. In the rare case it straddles two packets the message
+    // is gathered into one packet, the payload is otherwise left in the chain however large it is
+    span = message_offset + message_length - topic_offset;
+    if (topic_offset + topic_length > (ULONG)(head->nx_packet_append_ptr - head->nx_packet_prepend_ptr))
+    {
+        // Sized to the message so a short one comes from the control pool, boards without registered pools
+        // use the client's own
+        if ((status = packet_pool_allocate(span, &copy, 0, NX_NO_WAIT)) == NX_NOT_ENABLED)
+        {
+            status = nx_packet_allocate(client_ptr->nxd_mqtt_client_packet_pool_ptr, &copy, 0, NX_NO_WAIT);
+        }
+
+        if (status)
+        {
+            packet_pool_release(head);
+            return status;
+        }
+
+        if (span > (ULONG)(copy->nx_packet_data_end - copy->nx_packet_prepend_ptr))
+        {
+            status = NXD_MQTT_INSUFFICIENT_BUFFER_SPACE;
+        }
+        else
+        {
+            status = nx_packet_data_extract_offset(
+                head, topic_offset, copy->nx_packet_prepend_ptr, span, &bytes_copied);
+            copy->nx_packet_append_ptr = copy->nx_packet_prepend_ptr + bytes_copied;
+        }
+
+        packet_pool_release(head);
+        if (status != NX_SUCCESS)
+        {
+            packet_pool_release(copy);
+            return status;
+        }
+
+        head           = copy;
+        message_offset = message_offset - topic_offset;
+        topic_offset   = 0;
+    }
+
+    topic->ptr         = (const CHAR*)head->nx_packet_prepend_ptr + topic_offset;
+    topic->length      = topic_length;
+    topic->remaining   = 0;
+    topic->next_packet = NX_NULL;
+
+    // Find the packet the payload starts in
+    segment        = head;
+    segment_length = segment->nx_packet_append_ptr - segment->nx_packet_prepend_ptr;
+    while (message_offset >= segment_length && segment->nx_packet_next != NX_NULL)
+    {
+        message_offset = message_offset - segment_length;
+        segment        = segment->nx_packet_next;
+        segment_length = segment->nx_packet_append_ptr - segment->nx_packet_prepend_ptr;
+    }
+
+    segment_length = segment_length - message_offset;
+    if (segment_length > message_length)
+    {
+        segment_length = message_length;
+    }
+
+    message->ptr         = (const CHAR*)segment->nx_packet_prepend_ptr + message_offset;
+    message->length      = segment_length;
+    message->remaining   = message_length - segment_length;
+    message->next_packet = segment->nx_packet_next;
+
+    *packet_ptr = head;
+
+    return NXD_MQTT_SUCCESS;
+}
+
 static VOID mqtt_disconnect_cb(NXD_MQTT_CLIENT* client_ptr)
 {
     printf("ERROR: MQTT disconnected, reconnecting...\r\n");
@@ -352,65 +490,57 @@ static VOID mqtt_disconnect_cb(NXD_MQTT_CLIENT* client_ptr)
 
 static VOID mqtt_notify_cb(NXD_MQTT_CLIENT* client_ptr, UINT number_of_messages)
 {
-    UINT actual_topic_length;
-    UINT actual_message_length;
+    NX_PACKET* packet_ptr;
+    MQTT_VIEW topic;
+    MQTT_VIEW message;
     UINT status;
 
     AZURE_IOT_MQTT* azure_iot_mqtt = (AZURE_IOT_MQTT*)client_ptr->nxd_mqtt_packet_receive_context;
 
     for (UINT count = 0; count < number_of_messages; ++count)
     {
-        // Get the mqtt client message
-        status = nxd_mqtt_client_message_get(client_ptr,
-            (UCHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer,
-            AZURE_IOT_MQTT_TOPIC_NAME_LENGTH,
-            &actual_topic_length,
-            (UCHAR*)azure_iot_mqtt->mqtt_receive_message_buffer,
-            AZURE_IOT_MQTT_MESSAGE_LENGTH,
-            &actual_message_length);
-        if (status != NXD_MQTT_SUCCESS)
+        if ((status = mqtt_message_take(client_ptr, &packet_ptr, &topic, &message)))
         {
-            printf("ERROR: nxd_mqtt_client_message_get failed (0x%02x)\r\n", status);
+            printf("ERROR: mqtt_message_take failed (0x%02x)\r\n", status);
             continue;
         }
 
-        // Append null string terminators
-        azure_iot_mqtt->mqtt_receive_topic_buffer[actual_topic_length]     = 0;
-        azure_iot_mqtt->mqtt_receive_message_buffer[actual_message_length] = 0;
-
-        if (strstr((CHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer, DIRECT_METHOD_RECEIVE))
-        {
-            process_direct_method(
-                azure_iot_mqtt, azure_iot_mqtt->mqtt_receive_topic_buffer, azure_iot_mqtt->mqtt_receive_message_buffer);
-        }
-        else if (strstr((CHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer, DEVICE_MESSAGE_BASE))
-        {
-            process_c2d_message(
-                azure_iot_mqtt, azure_iot_mqtt->mqtt_receive_topic_buffer, azure_iot_mqtt->mqtt_receive_message_buffer);
-        }
-        else if (strstr((CHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer, DEVICE_TWIN_RES_BASE))
-        {
-            process_device_twin_response(
-                azure_iot_mqtt, azure_iot_mqtt->mqtt_receive_topic_buffer, azure_iot_mqtt->mqtt_receive_message_buffer);
-        }
-        else if (strstr((CHAR*)azure_iot_mqtt->mqtt_receive_topic_buffer, DEVICE_TWIN_DESIRED_PROP_RES_BASE))
-        {
-            process_device_twin_desired_prop_update(
-                azure_iot_mqtt, azure_iot_mqtt->mqtt_receive_topic_buffer, azure_iot_mqtt->mqtt_receive_message_buffer);
-        }
-        else
+        if (topic_router_dispatch(&azure_iot_mqtt->mqtt_topic_router, &topic, &message, azure_iot_mqtt))
         {
             printf("Unknown topic received, no custom processing specified\r\n");
         }
+
+        packet_pool_release(packet_ptr);
     }
 }
 
+static const struct
+{
+    const CHAR* filter;
+    func_ptr_topic_route route;
+} hub_routes[] = {
+    {DIRECT_METHOD_TOPIC, process_direct_method},
+    {DEVICE_MESSAGE_FILTER, process_c2d_message},
+    {DEVICE_TWIN_RES_TOPIC, process_device_twin_response},
+    {DEVICE_TWIN_DESIRED_PROP_RES_TOPIC, process_device_twin_desired_prop_update},
+};
+
 static UINT azure_iot_mqtt_create_common(AZURE_IOT_MQTT* azure_iot_mqtt, NX_IP* nx_ip, NX_PACKET_POOL* nx_pool)
 {
     UINT status;
 
     printf("\r\nInitializing MQTT Hub client\r\n");
 
+    topic_router_init(&azure_iot_mqtt->mqtt_topic_router);
+    for (UINT i = 0; i < sizeof(hub_routes) / sizeof(hub_routes[0]); ++i)
+    {
+        if ((status = topic_router_add(&azure_iot_mqtt->mqtt_topic_router, hub_routes[i].filter, hub_routes[i].route)))
+        {
+            printf("Failed to add MQTT topic route %s (0x%02x)\r\n", hub_routes[i].filter, status);
+            return status;
+        }
+    }
+
     status = nxd_mqtt_client_create(&azure_iot_mqtt->nxd_mqtt_client,
         "MQTT client",
         azure_iot_mqtt->mqtt_device_id,
@@ -602,6 +732,12 @@ UINT azure_iot_mqtt_create(AZURE_IOT_MQTT* azure_iot_mqtt,
     azure_iot_mqtt->mqtt_sas_key  = iot_sas_key;
     azure_iot_mqtt->mqtt_model_id = iot_model_id;
 
+    if (!sas_key_init(&azure_iot_mqtt->mqtt_sas_hmac, iot_sas_key, strlen(iot_sas_key)))
+    {
+        printf("ERROR: Unable to decode SAS key\r\n");
+        return NX_PTR_ERROR;
+    }
+
     // call into common code
     return azure_iot_mqtt_create_common(azure_iot_mqtt, nx_ip, nx_pool);
 }
@@ -642,6 +778,12 @@ UINT azure_iot_mqtt_create_with_dps(AZURE_IOT_MQTT* azure_iot_mqtt,
     azure_iot_mqtt->mqtt_sas_key             = iot_sas_key;
     azure_iot_mqtt->mqtt_model_id            = iot_model_id;
 
+    if (!sas_key_init(&azure_iot_mqtt->mqtt_sas_hmac, iot_sas_key, strlen(iot_sas_key)))
+    {
+        printf("ERROR: Unable to decode SAS key\r\n");
+        return NX_PTR_ERROR;
+    }
+
     // Setup DPS
     status = azure_iot_dps_create(azure_iot_mqtt, nx_ip, nx_pool);
     if (status != NX_SUCCESS)
@@ -676,6 +818,8 @@ UINT azure_iot_mqtt_delete(AZURE_IOT_MQTT* azure_iot_mqtt)
     nxd_mqtt_client_disconnect(&azure_iot_mqtt->nxd_mqtt_client);
     nxd_mqtt_client_delete(&azure_iot_mqtt->nxd_mqtt_client);
 
+    hmac_sha256_wipe(&azure_iot_mqtt->mqtt_sas_hmac, sizeof(azure_iot_mqtt->mqtt_sas_hmac));
+
     return NXD_MQTT_SUCCESS;
 }
 
@@ -697,8 +841,7 @@ UINT azure_iot_mqtt_connect(AZURE_IOT_MQTT* azure_iot_mqtt)
         azure_iot_mqtt->mqtt_device_id,
         azure_iot_mqtt->mqtt_model_id);
 
-    if (!create_sas_token(azure_iot_mqtt->mqtt_sas_key,
-            strlen(azure_iot_mqtt->mqtt_sas_key),
+    if (!create_sas_token_with_key(&azure_iot_mqtt->mqtt_sas_hmac,
             azure_iot_mqtt->mqtt_hub_hostname,
             azure_iot_mqtt->mqtt_device_id,
             azure_iot_mqtt->unix_time_get(),
@@ -13,13 +13,13 @@
 #include "nxd_mqtt_client.h"
 
 #include "azure_iot_ciphersuites.h"
+#include "hmac_sha256.h"
+#include "topic_router.h"
 
 #define AZURE_IOT_MQTT_HOSTNAME_SIZE           100
 #define AZURE_IOT_MQTT_DEVICE_ID_SIZE          64
 #define AZURE_IOT_MQTT_USERNAME_SIZE           256
 #define AZURE_IOT_MQTT_PASSWORD_SIZE           256
-#define AZURE_IOT_MQTT_TOPIC_NAME_LENGTH       256
-#define AZURE_IOT_MQTT_MESSAGE_LENGTH          1024
 #define AZURE_IOT_MQTT_DIRECT_COMMAND_RID_SIZE 6
 
 #define AZURE_IOT_MQTT_CLIENT_STACK_SIZE 4096
@@ -33,10 +33,11 @@
 
 typedef struct AZURE_IOT_MQTT_STRUCT AZURE_IOT_MQTT;
 
-typedef void (*func_ptr_direct_method)(AZURE_IOT_MQTT*, CHAR*, CHAR*);
-typedef void (*func_ptr_c2d_message)(AZURE_IOT_MQTT*, CHAR*, CHAR*);
-typedef void (*func_ptr_device_twin_desired_prop)(AZURE_IOT_MQTT*, CHAR*);
-typedef void (*func_ptr_device_twin_prop)(AZURE_IOT_MQTT*, CHAR*);
+// Views point into the received packet, which is released when the callback returns
+typedef void (*func_ptr_direct_method)(AZURE_IOT_MQTT*, const MQTT_VIEW* method, const MQTT_VIEW* message);
+typedef void (*func_ptr_c2d_message)(AZURE_IOT_MQTT*, const MQTT_VIEW* properties, const MQTT_VIEW* message);
+typedef void (*func_ptr_device_twin_desired_prop)(AZURE_IOT_MQTT*, const MQTT_VIEW* message);
+typedef void (*func_ptr_device_twin_prop)(AZURE_IOT_MQTT*, const MQTT_VIEW* message);
 typedef ULONG (*func_ptr_unix_time_get)(VOID);
 
 struct AZURE_IOT_MQTT_STRUCT
@@ -60,6 +61,10 @@ struct AZURE_IOT_MQTT_STRUCT
     CHAR* mqtt_sas_key;
     CHAR* mqtt_model_id;
 
+    // mqtt_sas_key decoded and hashed into its HMAC pads once, every SAS token is signed from this. Kept for the life
+    // of the client and key-equivalent, azure_iot_mqtt_delete wipes it
+    hmac_sha256_t mqtt_sas_hmac;
+
     UINT dps_retry_interval;
 
     UINT reported_property_version;
@@ -69,8 +74,7 @@ struct AZURE_IOT_MQTT_STRUCT
     CHAR mqtt_username[AZURE_IOT_MQTT_USERNAME_SIZE];
     CHAR mqtt_password[AZURE_IOT_MQTT_PASSWORD_SIZE];
 
-    CHAR mqtt_receive_topic_buffer[AZURE_IOT_MQTT_TOPIC_NAME_LENGTH];
-    CHAR mqtt_receive_message_buffer[AZURE_IOT_MQTT_MESSAGE_LENGTH];
+    TOPIC_ROUTER mqtt_topic_router;
 
     ULONG mqtt_client_stack[AZURE_IOT_MQTT_CLIENT_STACK_SIZE / sizeof(ULONG)];
 
@@ -104,6 +108,9 @@ UINT tls_setup(NXD_MQTT_CLIENT* client,
 
 UINT mqtt_publish(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* topic, CHAR* message);
 
+// Takes the oldest received message off the client queue without copying it, release the packet when done
+UINT mqtt_message_take(NXD_MQTT_CLIENT* client_ptr, NX_PACKET** packet_ptr, MQTT_VIEW* topic, MQTT_VIEW* message);
+
 UINT azure_iot_mqtt_publish_float_property(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* label, float value);
 UINT azure_iot_mqtt_publish_bool_property(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* label, bool value);
 UINT azure_iot_mqtt_publish_float_telemetry(AZURE_IOT_MQTT* azure_iot_mqtt, CHAR* label, float value);
@@ -3,8 +3,6 @@
    
 #include "hmac_sha256.h"
 
-#include "sha256.h"
-
 #define B 64
 #define L (SHA256_DIGEST_SIZE)
 #define K (SHA256_DIGEST_SIZE * 2)
@@ -12,10 +10,17 @@
 #define I_PAD 0x36
 #define O_PAD 0x5C
 
-void hmac_sha256(
-    uint8_t out[HMAC_SHA256_DIGEST_SIZE],
-    const uint8_t* data, size_t data_len,
-    const uint8_t* key, size_t key_len)
+void hmac_sha256_wipe(void* buffer, size_t size)
+{
+    volatile uint8_t* p = (volatile uint8_t*)buffer;
+
+    while (size--)
+    {
+        *p++ = 0;
+    }
+}
+
+void hmac_sha256_init(hmac_sha256_t* ctx, const uint8_t* key, size_t key_len)
 {
     sha256_t ss;
     uint8_t kh[SHA256_DIGEST_SIZE];
@@ -33,16 +38,47 @@ void hmac_sha256(
     for (size_t i = 0; i < key_len; i++) kx[i] = I_PAD ^ key[i];
     for (size_t i = key_len; i < B; i++) kx[i] = I_PAD ^ 0;
 
-    sha256_init(&ss);
-    sha256_update(&ss, kx, B);
-    sha256_update(&ss, data, data_len);
-    sha256_final(&ss, out);
+    sha256_init(&ctx->inner);
+    sha256_update(&ctx->inner, kx, B);
 
     for (size_t i = 0; i < key_len; i++) kx[i] = O_PAD ^ key[i];
     for (size_t i = key_len; i < B; i++) kx[i] = O_PAD ^ 0;
 
-    sha256_init(&ss);
-    sha256_update(&ss, kx, B);
+    sha256_init(&ctx->outer);
+    sha256_update(&ctx->outer, kx, B);
+
+    hmac_sha256_wipe(kx, sizeof(kx));
+    hmac_sha256_wipe(kh, sizeof(kh));
+    hmac_sha256_wipe(&ss, sizeof(ss));
+}
+
+void hmac_sha256_sign(
+    const hmac_sha256_t* ctx,
+    uint8_t out[HMAC_SHA256_DIGEST_SIZE],
+    const uint8_t* data, size_t data_len)
+{
+    // Work on copies so the context can sign again
+    sha256_t ss = ctx->inner;
+
+    sha256_update(&ss, data, data_len);
+    sha256_final(&ss, out);
+
+    ss = ctx->outer;
     sha256_update(&ss, out, SHA256_DIGEST_SIZE);
     sha256_final(&ss, out);
+
+    hmac_sha256_wipe(&ss, sizeof(ss));
+}
+
+void hmac_sha256(
+    uint8_t out[HMAC_SHA256_DIGEST_SIZE],
+    const uint8_t* data, size_t data_len,
+    const uint8_t* key, size_t key_len)
+{
+    hmac_sha256_t ctx;
+
+    hmac_sha256_init(&ctx, key, key_len);
+    hmac_sha256_sign(&ctx, out, data, data_len);
+
+    hmac_sha256_wipe(&ctx, sizeof(ctx));
 }
@@ -7,8 +7,28 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "sha256.h"
+
 #define HMAC_SHA256_DIGEST_SIZE 32
 
+// Hash state after the key's inner and outer pad blocks, so signing only hashes the message. Anyone holding this
+// state can sign as the key, so treat it as the key itself and clear it with hmac_sha256_wipe when done
+typedef struct
+{
+    sha256_t inner;
+    sha256_t outer;
+} hmac_sha256_t;
+
+// Zeroes key material through a volatile pointer so the compiler cannot drop it as a dead store
+void hmac_sha256_wipe(void* buffer, size_t size);
+
+void hmac_sha256_init(hmac_sha256_t* ctx, const uint8_t* key, size_t key_len);
+
+void hmac_sha256_sign(
+    const hmac_sha256_t* ctx,
+    uint8_t out[HMAC_SHA256_DIGEST_SIZE],
+    const uint8_t* data, size_t data_len);
+
 void hmac_sha256(
     uint8_t out[HMAC_SHA256_DIGEST_SIZE],
     const uint8_t* data, size_t data_len,
@@ -0,0 +1,192 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "json_query.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "nx_api.h"
+
+typedef struct JSON_QUERY_SET_STRUCT
+{
+    JSON_QUERY* queries;
+    UINT query_count;
+    UINT remaining;
+} JSON_QUERY_SET;
+
+static VOID segment_set(JSON_QUERY* query, const CHAR* segment)
+{
+    const CHAR* end = strchr(segment, '.');
+
+    query->segment        = segment;
+    query->segment_length = end != NX_NULL ? (UINT)(end - segment) : strlen(segment);
+}
+
+static bool segment_equals(const JSON_QUERY* query, const CHAR* key)
+{
+    return strncmp(query->segment, key, query->segment_length) == 0 && key[query->segment_length] == 0;
+}
+
+static bool segment_is_last(const JSON_QUERY* query)
+{
+    return query->segment[query->segment_length] == 0;
+}
+
+static VOID segment_back(JSON_QUERY* query)
+{
+    const CHAR* segment = query->segment - 1;
+
+    // segment - 1 is the '.' ending the previous segment
+    while (segment > query->path && segment[-1] != '.')
+    {
+        segment--;
+    }
+
+    segment_set(query, segment);
+    query->matched--;
+}
+
+// Only plain integers in range, a fraction or an exponent is not read as some other number
+static bool int_parse(const CHAR* value, INT* result)
+{
+    bool negative      = value[0] == '-';
+    uint64_t magnitude = 0;
+    uint64_t limit     = negative ? (uint64_t)INT_MAX + 1 : INT_MAX;
+
+    if (negative)
+    {
+        value++;
+    }
+
+    if (*value == 0)
+    {
+        return false;
+    }
+
+    for (; *value != 0; value++)
+    {
+        if (*value < '0' || *value > '9')
+        {
+            return false;
+        }
+
+        magnitude = magnitude * 10 + (*value - '0');
+        if (magnitude > limit)
+        {
+            return false;
+        }
+    }
+
+    *result = negative ? (INT)(0 - (int64_t)magnitude) : (INT)magnitude;
+
+    return true;
+}
+
+static bool result_store(JSON_QUERY* query, JSON_STREAM* stream, JSON_STREAM_EVENT event, const CHAR* value)
+{
+    // A value cut short by the stream is not the value that was sent
+    if (stream->truncated)
+    {
+        return false;
+    }
+
+    switch (query->type)
+    {
+        case JSON_QUERY_INT:
+            return event == JSON_STREAM_NUMBER && int_parse(value, (INT*)query->value);
+
+        case JSON_QUERY_BOOL:
+            if (event != JSON_STREAM_BOOL)
+            {
+                return false;
+            }
+            *(bool*)query->value = value[0] == 't';
+            return true;
+
+        case JSON_QUERY_STRING:
+            // Nor is one that only fits the caller's buffer cut short
+            if (event != JSON_STREAM_STRING || strlen(value) >= query->value_size)
+            {
+                return false;
+            }
+            strcpy((CHAR*)query->value, value);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static VOID query_callback(JSON_STREAM* stream, JSON_STREAM_EVENT event, const CHAR* key, const CHAR* value)
+{
+    JSON_QUERY_SET* set = (JSON_QUERY_SET*)stream->context;
+    UINT depth          = stream->depth;
+
+    for (UINT i = 0; i < set->query_count; i++)
+    {
+        JSON_QUERY* query = &set->queries[i];
+
+        if (query->found)
+        {
+            continue;
+        }
+
+        switch (event)
+        {
+            case JSON_STREAM_OBJECT_START:
+                // Members of this object are at depth, the object itself is a member one level up
+                if (key != NX_NULL && query->matched + 2 == depth && !segment_is_last(query) &&
+                    segment_equals(query, key))
+                {
+                    segment_set(query, query->segment + query->segment_length + 1);
+                    query->matched++;
+                }
+                break;
+
+            case JSON_STREAM_OBJECT_END:
+                if (depth >= 2 && query->matched + 1 == depth)
+                {
+                    segment_back(query);
+                }
+                break;
+
+            case JSON_STREAM_ARRAY_START:
+            case JSON_STREAM_ARRAY_END:
+                break;
+
+            default:
+                if (key != NX_NULL && query->matched + 1 == depth && segment_is_last(query) &&
+                    segment_equals(query, key) && result_store(query, stream, event, value))
+                {
+                    query->found = true;
+                    set->remaining--;
+                }
+                break;
+        }
+    }
+
+    if (set->remaining == 0)
+    {
+        json_stream_stop(stream);
+    }
+}
+
+UINT json_query(const MQTT_VIEW* json, JSON_QUERY* queries, UINT query_count)
+{
+    JSON_STREAM stream;
+    JSON_QUERY_SET set = {queries, query_count, query_count};
+
+    for (UINT i = 0; i < query_count; i++)
+    {
+        queries[i].found   = false;
+        queries[i].matched = 0;
+        segment_set(&queries[i], queries[i].path);
+    }
+
+    json_stream_init(&stream, query_callback, &set);
+    json_stream_feed_view(&stream, json);
+
+    return json_stream_finish(&stream);
+}
@@ -0,0 +1,46 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _JSON_QUERY_H
+#define _JSON_QUERY_H
+
+#include <stdbool.h>
+
+#include "tx_api.h"
+
+#include "json_stream.h"
+
+typedef enum JSON_QUERY_TYPE_ENUM
+{
+    // value points at an INT, a number with a fraction or an exponent or out of range is not found
+    JSON_QUERY_INT,
+
+    // value points at a bool
+    JSON_QUERY_BOOL,
+
+    // value points at value_size CHARs, the string is NUL terminated. One that does not fit, or was longer than
+    // JSON_STREAM_VALUE_SIZE, is not found rather than cut short
+    JSON_QUERY_STRING
+} JSON_QUERY_TYPE;
+
+typedef struct JSON_QUERY_STRUCT
+{
+    // Member names from the root separated by '.', e.g. "desired.telemetryInterval". Arrays are not searched
+    const CHAR* path;
+    JSON_QUERY_TYPE type;
+    VOID* value;
+    UINT value_size;
+
+    // set when the member was found with the right type
+    bool found;
+
+    // match state while the document is parsed, the next path segment and how many are matched so far
+    const CHAR* segment;
+    UINT segment_length;
+    UINT matched;
+} JSON_QUERY;
+
+// Looks up every query in a single pass over the document, stopping once they have all been found
+UINT json_query(const MQTT_VIEW* json, JSON_QUERY* queries, UINT query_count);
+
+#endif // _JSON_QUERY_H
@@ -0,0 +1,379 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "json_stream.h"
+
+#include <string.h>
+
+#include "nx_api.h"
+
+#define JSON_STATE_VALUE         0
+#define JSON_STATE_ARRAY_FIRST   1
+#define JSON_STATE_KEY_FIRST     2
+#define JSON_STATE_KEY           3
+#define JSON_STATE_KEY_STRING    4
+#define JSON_STATE_KEY_ESCAPE    5
+#define JSON_STATE_COLON         6
+#define JSON_STATE_STRING        7
+#define JSON_STATE_STRING_ESCAPE 8
+#define JSON_STATE_PRIMITIVE     9
+#define JSON_STATE_AFTER_VALUE   10
+#define JSON_STATE_DONE          11
+#define JSON_STATE_STOPPED       12
+
+static bool is_whitespace(CHAR c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool top_is_array(JSON_STREAM* stream)
+{
+    return (stream->array_levels >> (stream->depth - 1)) & 1;
+}
+
+static VOID char_append(JSON_STREAM* stream, bool key, CHAR c)
+{
+    CHAR* buffer = key ? stream->key : stream->value;
+    UINT* length = key ? &stream->key_length : &stream->value_length;
+    UINT size    = key ? JSON_STREAM_KEY_SIZE : JSON_STREAM_VALUE_SIZE;
+
+    if (*length < size - 1)
+    {
+        buffer[(*length)++] = c;
+    }
+    else
+    {
+        stream->truncated = true;
+    }
+}
+
+static VOID value_emit(JSON_STREAM* stream, JSON_STREAM_EVENT event)
+{
+    stream->value[stream->value_length] = 0;
+    stream->state                       = stream->depth == 0 ? JSON_STATE_DONE : JSON_STATE_AFTER_VALUE;
+
+    stream->callback(stream, event, stream->key_valid ? stream->key : NX_NULL, stream->value);
+
+    stream->key_valid    = false;
+    stream->value_length = 0;
+    stream->truncated    = false;
+}
+
+static VOID primitive_end(JSON_STREAM* stream)
+{
+    CHAR* value = stream->value;
+
+    value[stream->value_length] = 0;
+
+    if (strcmp(value, "true") == 0 || strcmp(value, "false") == 0)
+    {
+        value_emit(stream, JSON_STREAM_BOOL);
+    }
+    else if (strcmp(value, "null") == 0)
+    {
+        value_emit(stream, JSON_STREAM_NULL);
+    }
+    else if ((value[0] == '-' || (value[0] >= '0' && value[0] <= '9')) &&
+             strspn(value, "0123456789+-.eE") == stream->value_length)
+    {
+        value_emit(stream, JSON_STREAM_NUMBER);
+    }
+    else
+    {
+        stream->status = NX_INVALID_PARAMETERS;
+    }
+}
+
+static VOID container_open(JSON_STREAM* stream, bool array)
+{
+    if (stream->depth >= JSON_STREAM_MAX_DEPTH)
+    {
+        stream->status = NX_OVERFLOW;
+        return;
+    }
+
+    if (array)
+    {
+        stream->array_levels |= 1UL << stream->depth;
+    }
+    else
+    {
+        stream->array_levels &= ~(1UL << stream->depth);
+    }
+
+    stream->depth++;
+    stream->state = array ? JSON_STATE_ARRAY_FIRST : JSON_STATE_KEY_FIRST;
+
+    stream->callback(stream,
+        array ? JSON_STREAM_ARRAY_START : JSON_STREAM_OBJECT_START,
+        stream->key_valid ? stream->key : NX_NULL,
+        NX_NULL);
+
+    stream->key_valid = false;
+    stream->truncated = false;
+}
+
+static VOID container_close(JSON_STREAM* stream, bool array)
+{
+    if (stream->depth == 0 || top_is_array(stream) != array)
+    {
+        stream->status = NX_INVALID_PARAMETERS;
+        return;
+    }
+
+    stream->callback(stream, array ? JSON_STREAM_ARRAY_END : JSON_STREAM_OBJECT_END, NX_NULL, NX_NULL);
+
+    // The callback may have stopped the stream
+    stream->depth--;
+    if (stream->state != JSON_STATE_STOPPED)
+    {
+        stream->state = stream->depth == 0 ? JSON_STATE_DONE : JSON_STATE_AFTER_VALUE;
+    }
+}
+
+static VOID string_char(JSON_STREAM* stream, bool key, CHAR c)
+{
+    INT digit;
+
+    // Collecting the 4 hex digits of a \u escape, only ASCII is kept
+    if (stream->unicode_digits > 0)
+    {
+        if (c >= '0' && c <= '9')
+        {
+            digit = c - '0';
+        }
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+        {
+            digit = (c | 0x20) - 'a' + 10;
+        }
+        else
+        {
+            stream->status = NX_INVALID_PARAMETERS;
+            return;
+        }
+
+        stream->unicode_value = (stream->unicode_value << 4) | digit;
+        if (--stream->unicode_digits == 0)
+        {
+            char_append(stream, key, stream->unicode_value < 0x80 ? (CHAR)stream->unicode_value : '?');
+        }
+        return;
+    }
+
+    if (c == '\\')
+    {
+        stream->state = key ? JSON_STATE_KEY_ESCAPE : JSON_STATE_STRING_ESCAPE;
+    }
+    else if (c == '"')
+    {
+        if (key)
+        {
+            stream->key[stream->key_length] = 0;
+            stream->key_valid               = true;
+            stream->state                   = JSON_STATE_COLON;
+        }
+        else
+        {
+            value_emit(stream, JSON_STREAM_STRING);
+        }
+    }
+    else if ((UCHAR)c < 0x20)
+    {
+        stream->status = NX_INVALID_PARAMETERS;
+    }
+    else
+    {
+        char_append(stream, key, c);
+    }
+}
+
+static VOID escape_char(JSON_STREAM* stream, bool key, CHAR c)
+{
+    static const CHAR escapes[] = "\"\"\\\\//b\bf\fn\nr\rt\t";
+    const CHAR* find;
+
+    stream->state = key ? JSON_STATE_KEY_STRING : JSON_STATE_STRING;
+
+    if (c == 'u')
+    {
+        stream->unicode_digits = 4;
+        stream->unicode_value  = 0;
+        return;
+    }
+
+    for (find = escapes; *find != 0; find += 2)
+    {
+        if (*find == c)
+        {
+            char_append(stream, key, find[1]);
+            return;
+        }
+    }
+
+    stream->status = NX_INVALID_PARAMETERS;
+}
+
+static VOID char_process(JSON_STREAM* stream, CHAR c)
+{
+    switch (stream->state)
+    {
+        case JSON_STATE_VALUE:
+        case JSON_STATE_ARRAY_FIRST:
+            if (c == ']' && stream->state == JSON_STATE_ARRAY_FIRST)
+            {
+                container_close(stream, true);
+            }
+            else if (c == '{' || c == '[')
+            {
+                container_open(stream, c == '[');
+            }
+            else if (c == '"')
+            {
+                stream->value_length = 0;
+                stream->state        = JSON_STATE_STRING;
+            }
+            else if (c == '-' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z'))
+            {
+                stream->value_length = 0;
+                stream->state        = JSON_STATE_PRIMITIVE;
+                char_append(stream, false, c);
+            }
+            else if (!is_whitespace(c))
+            {
+                stream->status = NX_INVALID_PARAMETERS;
+            }
+            break;
+
+        case JSON_STATE_KEY_FIRST:
+        case JSON_STATE_KEY:
+            if (c == '}' && stream->state == JSON_STATE_KEY_FIRST)
+            {
+                container_close(stream, false);
+            }
+            else if (c == '"')
+            {
+                stream->key_length = 0;
+                stream->state      = JSON_STATE_KEY_STRING;
+            }
+            else if (!is_whitespace(c))
+            {
+                stream->status = NX_INVALID_PARAMETERS;
+            }
+            break;
+
+        case JSON_STATE_KEY_STRING:
+        case JSON_STATE_STRING:
+            string_char(stream, stream->state == JSON_STATE_KEY_STRING, c);
+            break;
+
+        case JSON_STATE_KEY_ESCAPE:
+        case JSON_STATE_STRING_ESCAPE:
+            escape_char(stream, stream->state == JSON_STATE_KEY_ESCAPE, c);
+            break;
+
+        case JSON_STATE_COLON:
+            if (c == ':')
+            {
+                stream->state = JSON_STATE_VALUE;
+            }
+            else if (!is_whitespace(c))
+            {
+                stream->status = NX_INVALID_PARAMETERS;
+            }
+            break;
+
+        case JSON_STATE_PRIMITIVE:
+            if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'E')
+            {
+                char_append(stream, false, c);
+            }
+            else
+            {
+                // The delimiter ending a literal is part of what follows it
+                primitive_end(stream);
+                if (stream->status == NX_SUCCESS && stream->state != JSON_STATE_STOPPED)
+                {
+                    char_process(stream, c);
+                }
+            }
+            break;
+
+        case JSON_STATE_AFTER_VALUE:
+            if (c == ',')
+            {
+                stream->state = top_is_array(stream) ? JSON_STATE_VALUE : JSON_STATE_KEY;
+            }
+            else if (c == '}' || c == ']')
+            {
+                container_close(stream, c == ']');
+            }
+            else if (!is_whitespace(c))
+            {
+                stream->status = NX_INVALID_PARAMETERS;
+            }
+            break;
+
+        default:
+            if (!is_whitespace(c))
+            {
+                stream->status = NX_INVALID_PARAMETERS;
+            }
+            break;
+    }
+}
+
+VOID json_stream_init(JSON_STREAM* stream, func_ptr_json_stream callback, VOID* context)
+{
+    memset(stream, 0, sizeof(JSON_STREAM));
+
+    stream->callback = callback;
+    stream->context  = context;
+    stream->state    = JSON_STATE_VALUE;
+    stream->status   = NX_SUCCESS;
+}
+
+UINT json_stream_feed(JSON_STREAM* stream, const CHAR* data, UINT length)
+{
+    for (UINT i = 0; i < length && stream->status == NX_SUCCESS && stream->state != JSON_STATE_STOPPED; i++)
+    {
+        char_process(stream, data[i]);
+    }
+
+    return stream->status;
+}
+
+UINT json_stream_feed_view(JSON_STREAM* stream, const MQTT_VIEW* view)
+{
+    MQTT_VIEW segment = *view;
+
+    do
+    {
+        if (json_stream_feed(stream, segment.ptr, segment.length) != NX_SUCCESS)
+        {
+            break;
+        }
+    } while (stream->state != JSON_STATE_STOPPED && mqtt_view_next(&segment));
+
+    return stream->status;
+}
+
+UINT json_stream_finish(JSON_STREAM* stream)
+{
+    // A bare number at the root has nothing after it to end it
+    if (stream->status == NX_SUCCESS && stream->state == JSON_STATE_PRIMITIVE)
+    {
+        primitive_end(stream);
+    }
+
+    if (stream->status == NX_SUCCESS && stream->state != JSON_STATE_DONE && stream->state != JSON_STATE_STOPPED)
+    {
+        stream->status = NX_INVALID_PARAMETERS;
+    }
+
+    return stream->status;
+}
+
+VOID json_stream_stop(JSON_STREAM* stream)
+{
+    stream->state = JSON_STATE_STOPPED;
+}
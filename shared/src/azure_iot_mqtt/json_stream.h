@@ -0,0 +1,78 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _JSON_STREAM_H
+#define _JSON_STREAM_H
+
+#include <stdbool.h>
+
+#include "tx_api.h"
+
+#include "topic_router.h"
+
+// Nesting is tracked one bit per level
+#define JSON_STREAM_MAX_DEPTH 32
+
+// Longer member names and scalar values are cut short and flagged as truncated
+#define JSON_STREAM_KEY_SIZE   64
+#define JSON_STREAM_VALUE_SIZE 128
+
+typedef enum JSON_STREAM_EVENT_ENUM
+{
+    JSON_STREAM_OBJECT_START,
+    JSON_STREAM_OBJECT_END,
+    JSON_STREAM_ARRAY_START,
+    JSON_STREAM_ARRAY_END,
+    JSON_STREAM_STRING,
+    JSON_STREAM_NUMBER,
+    JSON_STREAM_BOOL,
+    JSON_STREAM_NULL
+} JSON_STREAM_EVENT;
+
+typedef struct JSON_STREAM_STRUCT JSON_STREAM;
+
+// key is the member name when the value is inside an object, NX_NULL otherwise. value is NUL terminated and only
+// set for scalars. stream->depth is 1 for members of the root, and containers are opened and closed at the depth of
+// their own members
+typedef VOID (*func_ptr_json_stream)(JSON_STREAM* stream, JSON_STREAM_EVENT event, const CHAR* key, const CHAR* value);
+
+struct JSON_STREAM_STRUCT
+{
+    func_ptr_json_stream callback;
+    VOID* context;
+
+    UINT state;
+    UINT status;
+    UINT depth;
+
+    // bit n is set when level n + 1 is an array
+    ULONG array_levels;
+
+    // \uXXXX escapes in progress
+    UINT unicode_digits;
+    ULONG unicode_value;
+
+    CHAR key[JSON_STREAM_KEY_SIZE];
+    UINT key_length;
+    bool key_valid;
+
+    CHAR value[JSON_STREAM_VALUE_SIZE];
+    UINT value_length;
+    bool truncated;
+};
+
+VOID json_stream_init(JSON_STREAM* stream, func_ptr_json_stream callback, VOID* context);
+
+// Parses the next piece of the document, pieces can be split anywhere
+UINT json_stream_feed(JSON_STREAM* stream, const CHAR* data, UINT length);
+
+// Feeds every packet segment of a received payload
+UINT json_stream_feed_view(JSON_STREAM* stream, const MQTT_VIEW* view);
+
+// Checks a whole document was seen
+UINT json_stream_finish(JSON_STREAM* stream);
+
+// Called from the callback once it has what it needs, the rest of the document is skipped
+VOID json_stream_stop(JSON_STREAM* stream);
+
+#endif // _JSON_STREAM_H
@@ -137,8 +137,28 @@ static int url_encode(char* dest, char* msg)
     return dest - startPtr;
 }
 
-bool create_sas_token(char* key,
-    unsigned int key_size,
+bool sas_key_init(hmac_sha256_t* sas_key, char* key, unsigned int key_size)
+{
+    char key_binary[96];
+    size_t key_binary_size;
+
+    // base64_decode also writes a terminating NUL
+    if (key_size == 0 || key_size > 4 * (sizeof(key_binary) - 1) / 3)
+    {
+        return false;
+    }
+
+    base64_decode(key, key_size, key_binary);
+    key_binary_size = base64_decode_length(key, key_size);
+
+    hmac_sha256_init(sas_key, (unsigned char*)key_binary, key_binary_size);
+
+    hmac_sha256_wipe(key_binary, sizeof(key_binary));
+
+    return true;
+}
+
+bool create_sas_token_with_key(const hmac_sha256_t* sas_key,
     char* hostname,
     char* device_id,
     unsigned long valid_until,
@@ -146,8 +166,6 @@ bool create_sas_token(char* key,
     unsigned int output_size)
 {
     char buffer[128];
-    char key_binary[96];
-    int key_binary_size;
     char hash[32];
     char encoded_hash[44 + 1];
 
@@ -156,11 +174,7 @@ bool create_sas_token(char* key,
     valid_until += SAS_EXPIRATION_SECS;
     snprintf(buffer, sizeof(buffer), "%s%%2Fdevices%%2F%s\n%lu", hostname, device_id, valid_until);
 
-    base64_decode(key, key_size, key_binary);
-    key_binary_size = base64_decode_length(key, key_size);
-
-    hmac_sha256(
-        (unsigned char*)hash, (unsigned char*)buffer, strlen(buffer), (unsigned char*)key_binary, key_binary_size);
+    hmac_sha256_sign(sas_key, (unsigned char*)hash, (unsigned char*)buffer, strlen(buffer));
 
     base64_encode(hash, sizeof(hash), encoded_hash);
 
@@ -178,8 +192,29 @@ bool create_sas_token(char* key,
     return true;
 }
 
-bool create_dps_sas_token(char* key,
+bool create_sas_token(char* key,
     unsigned int key_size,
+    char* hostname,
+    char* device_id,
+    unsigned long valid_until,
+    char* output,
+    unsigned int output_size)
+{
+    hmac_sha256_t sas_key;
+
+    if (!sas_key_init(&sas_key, key, key_size))
+    {
+        return false;
+    }
+
+    bool result = create_sas_token_with_key(&sas_key, hostname, device_id, valid_until, output, output_size);
+
+    hmac_sha256_wipe(&sas_key, sizeof(sas_key));
+
+    return result;
+}
+
+bool create_dps_sas_token_with_key(const hmac_sha256_t* sas_key,
     char* id_scope,
     char* registration_id,
     unsigned long valid_until,
@@ -187,8 +222,6 @@ bool create_dps_sas_token(char* key,
     unsigned int output_size)
 {
     char buffer[128];
-    char key_binary[96];
-    int key_binary_size;
     char hash[32];
     char encoded_hash[44 + 1];
 
@@ -197,11 +230,7 @@ bool create_dps_sas_token(char* key,
     valid_until += SAS_DPS_EXPIRATION_SECS;
     snprintf(buffer, sizeof(buffer), "%s%%2Fregistrations%%2F%s\n%lu", id_scope, registration_id, valid_until);
 
-    base64_decode(key, key_size, key_binary);
-    key_binary_size = base64_decode_length(key, key_size);
-
-    hmac_sha256(
-        (unsigned char*)hash, (unsigned char*)buffer, strlen(buffer), (unsigned char*)key_binary, key_binary_size);
+    hmac_sha256_sign(sas_key, (unsigned char*)hash, (unsigned char*)buffer, strlen(buffer));
 
     base64_encode(hash, sizeof(hash), encoded_hash);
 
@@ -221,3 +250,25 @@ bool create_dps_sas_token(char* key,
 
     return true;
 }
+
+bool create_dps_sas_token(char* key,
+    unsigned int key_size,
+    char* id_scope,
+    char* registration_id,
+    unsigned long valid_until,
+    char* output,
+    unsigned int output_size)
+{
+    hmac_sha256_t sas_key;
+
+    if (!sas_key_init(&sas_key, key, key_size))
+    {
+        return false;
+    }
+
+    bool result = create_dps_sas_token_with_key(&sas_key, id_scope, registration_id, valid_until, output, output_size);
+
+    hmac_sha256_wipe(&sas_key, sizeof(sas_key));
+
+    return result;
+}
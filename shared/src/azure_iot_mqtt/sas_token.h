@@ -6,6 +6,26 @@
 
 #include <stdbool.h>
 
+#include "hmac_sha256.h"
+
+// Decodes a base64 device key once and keeps the HMAC state, for signing many tokens with the same key. The state
+// is as sensitive as the key, the caller wipes it with hmac_sha256_wipe once no more tokens are needed
+bool sas_key_init(hmac_sha256_t* sas_key, char* key, unsigned int key_size);
+
+bool create_sas_token_with_key(const hmac_sha256_t* sas_key,
+    char* hostname,
+    char* device_id,
+    unsigned long valid_until,
+    char* output,
+    unsigned int output_size);
+
+bool create_dps_sas_token_with_key(const hmac_sha256_t* sas_key,
+    char* id_scope,
+    char* registration_id,
+    unsigned long valid_until,
+    char* output,
+    unsigned int output_size);
+
 bool create_sas_token(char* key,
     unsigned int key_size,
     char* hostname,
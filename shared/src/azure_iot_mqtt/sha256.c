@@ -1,44 +1,26 @@
 /* Copyright (c) Microsoft Corporation.
    Licensed under the MIT License. */
-   
+
 #include "sha256.h"
 
-#define ROTL32(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
+#include <string.h>
+
 #define ROTR32(a, b) (((a) >> (b)) | ((a) << (32 - (b))))
 
 #define S0(x) (ROTR32(x, 2) ^ ROTR32(x, 13) ^ ROTR32(x, 22))
 #define S1(x) (ROTR32(x, 6) ^ ROTR32(x, 11) ^ ROTR32(x, 25))
-#define s0(x) (ROTR32(x, 7) ^ ROTR32(x, 18) ^ (x >> 3))
-#define s1(x) (ROTR32(x, 17) ^ ROTR32(x, 19) ^ (x >> 10))
-
-#define a(i) T[(0 - (i)) & 7]
-#define b(i) T[(1 - (i)) & 7]
-#define c(i) T[(2 - (i)) & 7]
-#define d(i) T[(3 - (i)) & 7]
-#define e(i) T[(4 - (i)) & 7]
-#define f(i) T[(5 - (i)) & 7]
-#define g(i) T[(6 - (i)) & 7]
-#define h(i) T[(7 - (i)) & 7]
-
-#define blk0(i) (W[i] = data[i])
-#define blk2(i) (W[i & 15] += s1(W[(i - 2) & 15]) + W[(i - 7) & 15] + s0(W[(i - 15) & 15]))
+#define s0(x) (ROTR32(x, 7) ^ ROTR32(x, 18) ^ ((x) >> 3))
+#define s1(x) (ROTR32(x, 17) ^ ROTR32(x, 19) ^ ((x) >> 10))
+
 #define Ch(x, y, z) (z ^ (x & (y ^ z)))
 #define Maj(x, y, z) ((x & y) | (z & (x | y)))
 
-#define R(a, b, c, d, e, f, g, h, i)                               \
-    h += S1(e) + Ch(e, f, g) + K[i + j] + (j ? blk2(i) : blk0(i)); \
-    d += h;                                                        \
-    h += S0(a) + Maj(a, b, c)
+// Message words are big endian, the compiler turns this into a single load and byte swap where it can
+#define LOAD32_BE(p) \
+    (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | ((uint32_t)(p)[3]))
 
-#define RX_8(i)                         \
-    R(a, b, c, d, e, f, g, h, i);       \
-    R(h, a, b, c, d, e, f, g, (i + 1)); \
-    R(g, h, a, b, c, d, e, f, (i + 2)); \
-    R(f, g, h, a, b, c, d, e, (i + 3)); \
-    R(e, f, g, h, a, b, c, d, (i + 4)); \
-    R(d, e, f, g, h, a, b, c, (i + 5)); \
-    R(c, d, e, f, g, h, a, b, (i + 6)); \
-    R(b, c, d, e, f, g, h, a, (i + 7))
+#define blk0(i) (W[i] = LOAD32_BE(block + 4 * (i)))
+#define blk2(i) (W[(i) & 15] += s1(W[((i) - 2) & 15]) + W[((i) - 7) & 15] + s0(W[((i) - 15) & 15]))
 
 static const uint32_t K[64] =
     {
@@ -51,12 +33,16 @@ static const uint32_t K[64] =
         0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
         0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
 
-static void sha256_transform(uint32_t *state, const uint32_t *data)
-{
-    uint32_t W[16] = {0};
-    uint32_t j;
+#ifdef SHA256_COMPACT
 
+// One round per iteration, for parts where flash matters more than hashing speed
+static void sha256_transform(uint32_t *state, const unsigned char *block)
+{
+    uint32_t W[16];
     uint32_t a, b, c, d, e, f, g, h;
+    uint32_t t1, t2;
+    unsigned i;
+
     a = state[0];
     b = state[1];
     c = state[2];
@@ -66,10 +52,18 @@ static void sha256_transform(uint32_t *state, const uint32_t *data)
     g = state[6];
     h = state[7];
 
-    for (j = 0; j < 64; j += 16)
+    for (i = 0; i < 64; i++)
     {
-        RX_8(0);
-        RX_8(8);
+        t1 = h + S1(e) + Ch(e, f, g) + K[i] + (i < 16 ? blk0(i) : blk2(i));
+        t2 = S0(a) + Maj(a, b, c);
+        h  = g;
+        g  = f;
+        f  = e;
+        e  = d + t1;
+        d  = c;
+        c  = b;
+        b  = a;
+        a  = t1 + t2;
     }
 
     state[0] += a;
@@ -82,21 +76,65 @@ static void sha256_transform(uint32_t *state, const uint32_t *data)
     state[7] += h;
 }
 
-static void sha256_write_byte_block(sha256_t *p)
+#else
+
+// The working variables rotate by renaming rather than moving, so each round is only the arithmetic
+#define R0(a, b, c, d, e, f, g, h, i)                   \
+    h += S1(e) + Ch(e, f, g) + K[i] + blk0(i);          \
+    d += h;                                             \
+    h += S0(a) + Maj(a, b, c)
+
+#define R2(a, b, c, d, e, f, g, h, i)                   \
+    h += S1(e) + Ch(e, f, g) + K[i] + blk2(i);          \
+    d += h;                                             \
+    h += S0(a) + Maj(a, b, c)
+
+#define RX_8(R, i)                      \
+    R(a, b, c, d, e, f, g, h, i);       \
+    R(h, a, b, c, d, e, f, g, (i + 1)); \
+    R(g, h, a, b, c, d, e, f, (i + 2)); \
+    R(f, g, h, a, b, c, d, e, (i + 3)); \
+    R(e, f, g, h, a, b, c, d, (i + 4)); \
+    R(d, e, f, g, h, a, b, c, (i + 5)); \
+    R(c, d, e, f, g, h, a, b, (i + 6)); \
+    R(b, c, d, e, f, g, h, a, (i + 7))
+
+// All 64 rounds unrolled with constant indices, several times the code of the compact variant
+static void sha256_transform(uint32_t *state, const unsigned char *block)
 {
-    uint32_t data32[16];
-    for (unsigned i = 0; i < 16; i++)
-    {
-        data32[i] =
-            ((uint32_t)(p->buffer[i * 4]) << 24) +
-            ((uint32_t)(p->buffer[i * 4 + 1]) << 16) +
-            ((uint32_t)(p->buffer[i * 4 + 2]) << 8) +
-            ((uint32_t)(p->buffer[i * 4 + 3]));
-    }
+    uint32_t W[16];
+    uint32_t a, b, c, d, e, f, g, h;
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
 
-    sha256_transform(p->state, data32);
+    RX_8(R0, 0);
+    RX_8(R0, 8);
+    RX_8(R2, 16);
+    RX_8(R2, 24);
+    RX_8(R2, 32);
+    RX_8(R2, 40);
+    RX_8(R2, 48);
+    RX_8(R2, 56);
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
 }
 
+#endif // SHA256_COMPACT
+
 void sha256_init(sha256_t *p)
 {
     p->state[0] = 0x6a09e667;
@@ -112,43 +150,61 @@ void sha256_init(sha256_t *p)
 
 void sha256_update(sha256_t *p, const unsigned char *data, size_t size)
 {
-    uint32_t curBufferPos = (uint32_t)p->count & 0x3F;
-    while (size > 0)
+    size_t curBufferPos = (size_t)(p->count & 0x3F);
+    size_t fill;
+
+    p->count += size;
+
+    // Top up a partly filled block first
+    if (curBufferPos > 0)
     {
-        p->buffer[curBufferPos++] = *data++;
-        p->count++;
-        size--;
-        if (curBufferPos == 64)
+        fill = 64 - curBufferPos;
+        if (size < fill)
         {
-            curBufferPos = 0;
-            sha256_write_byte_block(p);
+            memcpy(p->buffer + curBufferPos, data, size);
+            return;
         }
+
+        memcpy(p->buffer + curBufferPos, data, fill);
+        sha256_transform(p->state, p->buffer);
+        data += fill;
+        size -= fill;
     }
+
+    // Whole blocks are hashed straight from the caller's data
+    while (size >= 64)
+    {
+        sha256_transform(p->state, data);
+        data += 64;
+        size -= 64;
+    }
+
+    memcpy(p->buffer, data, size);
 }
 
 void sha256_final(sha256_t *p, unsigned char *digest)
 {
     uint64_t lenInBits = (p->count << 3);
-    uint32_t curBufferPos = (uint32_t)p->count & 0x3F;
+    size_t curBufferPos = (size_t)(p->count & 0x3F);
     unsigned i;
+
     p->buffer[curBufferPos++] = 0x80;
 
-    while (curBufferPos != (64 - 8))
+    // The length needs the last 8 bytes of a block, spill into another block if they are taken
+    if (curBufferPos > 64 - 8)
     {
-        curBufferPos &= 0x3F;
-        if (curBufferPos == 0)
-        {
-            sha256_write_byte_block(p);
-        }
-        p->buffer[curBufferPos++] = 0;
+        memset(p->buffer + curBufferPos, 0, 64 - curBufferPos);
+        sha256_transform(p->state, p->buffer);
+        curBufferPos = 0;
     }
 
+    memset(p->buffer + curBufferPos, 0, 64 - 8 - curBufferPos);
+
     for (i = 0; i < 8; i++)
     {
-        p->buffer[curBufferPos++] = (unsigned char)(lenInBits >> 56);
-        lenInBits <<= 8;
+        p->buffer[64 - 8 + i] = (unsigned char)(lenInBits >> (56 - 8 * i));
     }
-    sha256_write_byte_block(p);
+    sha256_transform(p->state, p->buffer);
 
     for (i = 0; i < 8; i++)
     {
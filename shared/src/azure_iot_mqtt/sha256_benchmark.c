@@ -0,0 +1,333 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "sha256_benchmark.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hmac_sha256.h"
+#include "sas_token.h"
+#include "sha256.h"
+
+#if defined(__linux__)
+
+#include <time.h>
+
+#define BENCH_UNIT "ns"
+
+typedef uint64_t bench_time_t;
+
+static void bench_timer_init(void)
+{
+}
+
+static bench_time_t bench_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (bench_time_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+#elif defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__)
+
+#define BENCH_UNIT "cycles"
+
+// Cortex-M debug registers, the cycle counter wraps after 2^32 cycles so keep each measurement shorter than that
+#define DEMCR         (*(volatile uint32_t*)0xE000EDFC)
+#define DEMCR_TRCENA  (1UL << 24)
+#define DWT_CTRL      (*(volatile uint32_t*)0xE0001000)
+#define DWT_CYCCNTENA (1UL << 0)
+#define DWT_CYCCNT    (*(volatile uint32_t*)0xE0001004)
+#define DWT_LAR       (*(volatile uint32_t*)0xE0001FB0)
+#define DWT_LAR_KEY   0xC5ACCE55
+
+typedef uint32_t bench_time_t;
+
+static void bench_timer_init(void)
+{
+    DEMCR |= DEMCR_TRCENA;
+    DWT_LAR = DWT_LAR_KEY;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CYCCNTENA;
+}
+
+static bench_time_t bench_now(void)
+{
+    return DWT_CYCCNT;
+}
+
+#else
+
+#include "tx_api.h"
+
+#define BENCH_UNIT "ticks"
+
+typedef ULONG bench_time_t;
+
+static void bench_timer_init(void)
+{
+}
+
+static bench_time_t bench_now(void)
+{
+    return tx_time_get();
+}
+
+#endif
+
+typedef struct
+{
+    const char* message;
+    const char* digest;
+} sha256_vector_t;
+
+typedef struct
+{
+    const char* key;
+    unsigned char key_byte;
+    unsigned int key_len;
+    const char* data;
+    const char* digest;
+} hmac_vector_t;
+
+// FIPS 180-2 appendix B and the NIST example values
+static const sha256_vector_t sha256_vectors[] = {
+    {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    {"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+        "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+};
+
+// RFC 4231 test cases 2 and 6, a short key and one longer than a block. A NULL key repeats key_byte key_len times
+static const hmac_vector_t hmac_vectors[] = {
+    {"Jefe",
+        0,
+        4,
+        "what do ya want for nothing?",
+        "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"},
+    {NULL,
+        0xaa,
+        131,
+        "Test Using Larger Than Block-Size Key - Hash Key First",
+        "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54"},
+};
+
+// One million 'a', fed in 103 byte chunks so most updates straddle a block boundary
+#define MILLION_A_CHUNK  103
+#define MILLION_A_DIGEST "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"
+
+static const char* sas_key      = "MDEyMzQ1Njc4OWFiY2RlZjAxMjM0NTY3ODlhYmNkZWY=";
+static const char* sas_hostname = "my-hub.azure-devices.net";
+static const char* sas_device   = "my-device";
+
+static void digest_to_hex(const unsigned char* digest, char* hex)
+{
+    const char* digits = "0123456789abcdef";
+
+    for (unsigned int i = 0; i < SHA256_DIGEST_SIZE; i++)
+    {
+        *hex++ = digits[digest[i] >> 4];
+        *hex++ = digits[digest[i] & 15];
+    }
+    *hex = 0;
+}
+
+static bool digest_check(const char* name, const unsigned char* digest, const char* expected)
+{
+    char hex[SHA256_DIGEST_SIZE * 2 + 1];
+
+    digest_to_hex(digest, hex);
+
+    if (strcmp(hex, expected) != 0)
+    {
+        printf("FAIL %s\r\n\tgot      %s\r\n\texpected %s\r\n", name, hex, expected);
+        return false;
+    }
+
+    printf("pass %s\r\n", name);
+    return true;
+}
+
+static bool vectors_check(void)
+{
+    sha256_t ctx;
+    hmac_sha256_t hmac;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    unsigned char key[131];
+    unsigned char chunk[MILLION_A_CHUNK];
+    const unsigned char* key_ptr;
+    bool result = true;
+
+    for (unsigned int i = 0; i < sizeof(sha256_vectors) / sizeof(sha256_vectors[0]); i++)
+    {
+        const sha256_vector_t* vector = &sha256_vectors[i];
+        size_t length                 = strlen(vector->message);
+
+        sha256_init(&ctx);
+        sha256_update(&ctx, (const unsigned char*)vector->message, length);
+        sha256_final(&ctx, digest);
+        result &= digest_check(vector->message[0] ? vector->message : "sha256 empty", digest, vector->digest);
+
+        // Byte at a time has to give the same digest as a single update
+        sha256_init(&ctx);
+        for (size_t j = 0; j < length; j++)
+        {
+            sha256_update(&ctx, (const unsigned char*)vector->message + j, 1);
+        }
+        sha256_final(&ctx, digest);
+        result &= digest_check("  byte at a time", digest, vector->digest);
+    }
+
+    memset(chunk, 'a', sizeof(chunk));
+    sha256_init(&ctx);
+    for (unsigned int i = 0; i < 1000000 / MILLION_A_CHUNK; i++)
+    {
+        sha256_update(&ctx, chunk, MILLION_A_CHUNK);
+    }
+    sha256_update(&ctx, chunk, 1000000 % MILLION_A_CHUNK);
+    sha256_final(&ctx, digest);
+    result &= digest_check("one million 'a'", digest, MILLION_A_DIGEST);
+
+    for (unsigned int i = 0; i < sizeof(hmac_vectors) / sizeof(hmac_vectors[0]); i++)
+    {
+        const hmac_vector_t* vector = &hmac_vectors[i];
+
+        key_ptr = (const unsigned char*)vector->key;
+        if (key_ptr == NULL)
+        {
+            memset(key, vector->key_byte, vector->key_len);
+            key_ptr = key;
+        }
+
+        hmac_sha256(digest, (const uint8_t*)vector->data, strlen(vector->data), key_ptr, vector->key_len);
+        result &= digest_check(vector->data, digest, vector->digest);
+
+        // A cached key has to keep giving the same signature
+        hmac_sha256_init(&hmac, key_ptr, vector->key_len);
+        for (unsigned int j = 0; j < 2; j++)
+        {
+            hmac_sha256_sign(&hmac, digest, (const uint8_t*)vector->data, strlen(vector->data));
+            result &= digest_check("  cached key", digest, vector->digest);
+        }
+    }
+
+    return result;
+}
+
+static void result_print(const char* name, bench_time_t elapsed, unsigned int iterations, unsigned int bytes)
+{
+    unsigned long per_call = (unsigned long)(elapsed / iterations);
+
+    if (bytes > 0)
+    {
+        printf("%-28s %10lu " BENCH_UNIT "/call %8lu.%02lu " BENCH_UNIT "/byte\r\n",
+            name,
+            per_call,
+            per_call / bytes,
+            (per_call % bytes) * 100 / bytes);
+    }
+    else
+    {
+        printf("%-28s %10lu " BENCH_UNIT "/call\r\n", name, per_call);
+    }
+}
+
+bool sha256_benchmark(unsigned int iterations)
+{
+    static unsigned char data[1024];
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char token[256];
+    char signature[128];
+    sha256_t ctx;
+    hmac_sha256_t hmac;
+    hmac_sha256_t sas_hmac;
+    bench_time_t start;
+    const unsigned int sizes[] = {64, 1024};
+
+    if (iterations == 0)
+    {
+        iterations = 1;
+    }
+
+#ifdef SHA256_COMPACT
+    printf("SHA-256 compact variant\r\n");
+#else
+    printf("SHA-256 unrolled variant\r\n");
+#endif
+
+    if (!vectors_check())
+    {
+        printf("ERROR: SHA-256 test vectors failed\r\n");
+        return false;
+    }
+
+    bench_timer_init();
+
+    for (unsigned int i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (unsigned char)i;
+    }
+
+    for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        start = bench_now();
+        for (unsigned int j = 0; j < iterations; j++)
+        {
+            sha256_init(&ctx);
+            sha256_update(&ctx, data, sizes[i]);
+            sha256_final(&ctx, digest);
+        }
+        snprintf(signature, sizeof(signature), "sha256 %u bytes", sizes[i]);
+        result_print(signature, bench_now() - start, iterations, sizes[i]);
+    }
+
+    // The string to sign for a hub SAS token, hostname, device and expiry
+    snprintf(signature, sizeof(signature), "%s%%2Fdevices%%2F%s\n%lu", sas_hostname, sas_device, 1700000000UL);
+
+    start = bench_now();
+    for (unsigned int j = 0; j < iterations; j++)
+    {
+        hmac_sha256(digest, (const uint8_t*)signature, strlen(signature), data, 32);
+    }
+    result_print("hmac_sha256 sas signature", bench_now() - start, iterations, 0);
+
+    hmac_sha256_init(&hmac, data, 32);
+
+    start = bench_now();
+    for (unsigned int j = 0; j < iterations; j++)
+    {
+        hmac_sha256_sign(&hmac, digest, (const uint8_t*)signature, strlen(signature));
+    }
+    result_print("hmac_sha256_sign cached key", bench_now() - start, iterations, 0);
+
+    start = bench_now();
+    for (unsigned int j = 0; j < iterations; j++)
+    {
+        create_sas_token((char*)sas_key,
+            strlen(sas_key),
+            (char*)sas_hostname,
+            (char*)sas_device,
+            1700000000UL,
+            token,
+            sizeof(token));
+    }
+    result_print("create_sas_token", bench_now() - start, iterations, 0);
+
+    sas_key_init(&sas_hmac, (char*)sas_key, strlen(sas_key));
+
+    start = bench_now();
+    for (unsigned int j = 0; j < iterations; j++)
+    {
+        create_sas_token_with_key(
+            &sas_hmac, (char*)sas_hostname, (char*)sas_device, 1700000000UL, token, sizeof(token));
+    }
+    result_print("create_sas_token_with_key", bench_now() - start, iterations, 0);
+
+    return true;
+}
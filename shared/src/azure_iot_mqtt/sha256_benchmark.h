@@ -0,0 +1,15 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _SHA256_BENCHMARK_H
+#define _SHA256_BENCHMARK_H
+
+#include <stdbool.h>
+
+// Checks the SHA-256 and HMAC-SHA256 implementations against the NIST and RFC 4231 test vectors, then times
+// hashing, HMAC and SAS token creation, with and without a cached key, over the given number of iterations.
+// Times are in nanoseconds on the host, DWT cycles on Cortex-M and ThreadX ticks elsewhere. Returns false if any
+// test vector fails
+bool sha256_benchmark(unsigned int iterations);
+
+#endif // _SHA256_BENCHMARK_H
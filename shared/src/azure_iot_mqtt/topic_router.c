@@ -0,0 +1,311 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "topic_router.h"
+
+#include <string.h>
+
+#define TOPIC_ROUTER_NONE 0xFF
+
+static bool level_is_wildcard(const TOPIC_ROUTER_NODE* node)
+{
+    return node->level_length == 1 && node->level[0] == '+';
+}
+
+static UINT node_allocate(TOPIC_ROUTER* router, const CHAR* level, UINT level_length)
+{
+    TOPIC_ROUTER_NODE* node;
+
+    if (router->node_count >= TOPIC_ROUTER_NODE_COUNT)
+    {
+        return TOPIC_ROUTER_NONE;
+    }
+
+    node                 = &router->nodes[router->node_count];
+    node->level          = level;
+    node->level_length   = level_length;
+    node->first_child    = TOPIC_ROUTER_NONE;
+    node->next_sibling   = TOPIC_ROUTER_NONE;
+    node->route          = TOPIC_ROUTER_NONE;
+    node->wildcard_route = TOPIC_ROUTER_NONE;
+
+    return router->node_count++;
+}
+
+// Returns the child for this filter level, adding it if needed
+static UINT node_child(TOPIC_ROUTER* router, UINT parent, const CHAR* level, UINT level_length)
+{
+    TOPIC_ROUTER_NODE* node;
+    UINT child;
+    UCHAR* link;
+
+    for (child = router->nodes[parent].first_child; child != TOPIC_ROUTER_NONE;
+         child = router->nodes[child].next_sibling)
+    {
+        node = &router->nodes[child];
+        if (node->level_length == level_length && memcmp(node->level, level, level_length) == 0)
+        {
+            return child;
+        }
+    }
+
+    if ((child = node_allocate(router, level, level_length)) == TOPIC_ROUTER_NONE)
+    {
+        return TOPIC_ROUTER_NONE;
+    }
+
+    // Exact levels go first and '+' last, so the first match found is the most specific
+    link = &router->nodes[parent].first_child;
+    if (level_is_wildcard(&router->nodes[child]))
+    {
+        while (*link != TOPIC_ROUTER_NONE)
+        {
+            link = &router->nodes[*link].next_sibling;
+        }
+    }
+
+    router->nodes[child].next_sibling = *link;
+    *link                             = child;
+
+    return child;
+}
+
+static UINT node_match(
+    const TOPIC_ROUTER* router, UINT parent, const CHAR* level, const CHAR* topic_end, MQTT_VIEW* tail)
+{
+    const TOPIC_ROUTER_NODE* node = &router->nodes[parent];
+    const CHAR* level_end;
+    const CHAR* next_level;
+    UINT child;
+    UINT route;
+
+    // Every topic level has been matched, a trailing '#' also matches its parent level
+    if (level == NX_NULL)
+    {
+        tail->ptr    = topic_end;
+        tail->length = 0;
+
+        return node->route != TOPIC_ROUTER_NONE ? node->route : node->wildcard_route;
+    }
+
+    if ((level_end = memchr(level, '/', topic_end - level)) == NX_NULL)
+    {
+        level_end  = topic_end;
+        next_level = NX_NULL;
+    }
+    else
+    {
+        next_level = level_end + 1;
+    }
+
+    for (child = node->first_child; child != TOPIC_ROUTER_NONE; child = router->nodes[child].next_sibling)
+    {
+        const TOPIC_ROUTER_NODE* candidate = &router->nodes[child];
+
+        // Wildcards at the root don't match the reserved $ topics
+        if (level_is_wildcard(candidate) ? (parent == 0 && level[0] == '$')
+                                         : (candidate->level_length != level_end - level ||
+                                               memcmp(candidate->level, level, candidate->level_length) != 0))
+        {
+            continue;
+        }
+
+        if ((route = node_match(router, child, next_level, topic_end, tail)) != TOPIC_ROUTER_NONE)
+        {
+            return route;
+        }
+    }
+
+    if (node->wildcard_route == TOPIC_ROUTER_NONE || (parent == 0 && level[0] == '$'))
+    {
+        return TOPIC_ROUTER_NONE;
+    }
+
+    tail->ptr    = level;
+    tail->length = topic_end - level;
+
+    return node->wildcard_route;
+}
+
+VOID topic_router_init(TOPIC_ROUTER* router)
+{
+    memset(router, 0, sizeof(TOPIC_ROUTER));
+
+    node_allocate(router, "", 0);
+}
+
+UINT topic_router_add(TOPIC_ROUTER* router, const CHAR* filter, func_ptr_topic_route route)
+{
+    const CHAR* level = filter;
+    const CHAR* level_end;
+    UINT level_length;
+    UINT node = 0;
+
+    if (router == NX_NULL || filter == NX_NULL || route == NX_NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    if (router->route_count >= TOPIC_ROUTER_ROUTE_COUNT)
+    {
+        return NX_OVERFLOW;
+    }
+
+    while (true)
+    {
+        level_end    = strchr(level, '/');
+        level_length = level_end != NX_NULL ? (UINT)(level_end - level) : strlen(level);
+
+        if (level_length == 1 && level[0] == '#')
+        {
+            // '#' is only valid as the last level
+            if (level_end != NX_NULL || router->nodes[node].wildcard_route != TOPIC_ROUTER_NONE)
+            {
+                return NX_INVALID_PARAMETERS;
+            }
+
+            router->nodes[node].wildcard_route = router->route_count;
+            break;
+        }
+
+        if (level_length > 0xFF || memchr(level, '#', level_length) != NX_NULL ||
+            (level_length > 1 && memchr(level, '+', level_length) != NX_NULL))
+        {
+            return NX_INVALID_PARAMETERS;
+        }
+
+        if ((node = node_child(router, node, level, level_length)) == TOPIC_ROUTER_NONE)
+        {
+            return NX_OVERFLOW;
+        }
+
+        if (level_end == NX_NULL)
+        {
+            if (router->nodes[node].route != TOPIC_ROUTER_NONE)
+            {
+                return NX_INVALID_PARAMETERS;
+            }
+
+            router->nodes[node].route = router->route_count;
+            break;
+        }
+
+        level = level_end + 1;
+    }
+
+    router->routes[router->route_count++] = route;
+
+    return NX_SUCCESS;
+}
+
+UINT topic_router_dispatch(TOPIC_ROUTER* router, const MQTT_VIEW* topic, const MQTT_VIEW* payload, VOID* context)
+{
+    MQTT_VIEW tail = {0};
+    UINT route;
+
+    route = node_match(router, 0, topic->ptr, topic->ptr + topic->length, &tail);
+    if (route == TOPIC_ROUTER_NONE)
+    {
+        return NX_NOT_FOUND;
+    }
+
+    router->routes[route](context, &tail, payload);
+
+    return NX_SUCCESS;
+}
+
+bool mqtt_view_next(MQTT_VIEW* view)
+{
+    const NX_PACKET* packet_ptr = view->next_packet;
+    ULONG length;
+
+    if (view->remaining == 0 || packet_ptr == NX_NULL)
+    {
+        return false;
+    }
+
+    length = packet_ptr->nx_packet_append_ptr - packet_ptr->nx_packet_prepend_ptr;
+    if (length > view->remaining)
+    {
+        length = view->remaining;
+    }
+
+    view->ptr         = (const CHAR*)packet_ptr->nx_packet_prepend_ptr;
+    view->length      = length;
+    view->remaining   = view->remaining - length;
+    view->next_packet = packet_ptr->nx_packet_next;
+
+    return true;
+}
+
+ULONG mqtt_view_length(const MQTT_VIEW* view)
+{
+    return view->length + view->remaining;
+}
+
+bool mqtt_view_equals(const MQTT_VIEW* view, const CHAR* string)
+{
+    MQTT_VIEW segment = *view;
+    UINT length       = strlen(string);
+
+    if (mqtt_view_length(view) != length)
+    {
+        return false;
+    }
+
+    do
+    {
+        if (memcmp(segment.ptr, string, segment.length) != 0)
+        {
+            return false;
+        }
+
+        string += segment.length;
+    } while (mqtt_view_next(&segment));
+
+    return true;
+}
+
+bool mqtt_view_param(const MQTT_VIEW* view, const CHAR* key, MQTT_VIEW* value)
+{
+    const CHAR* end  = view->ptr + view->length;
+    const CHAR* find = view->ptr;
+    UINT key_length  = strlen(key);
+
+    while (find + key_length < end)
+    {
+        // The key has to start a parameter and be followed by its '='
+        if ((find == view->ptr || find[-1] == '?' || find[-1] == '&') && find[key_length] == '=' &&
+            memcmp(find, key, key_length) == 0)
+        {
+            value->ptr         = find + key_length + 1;
+            value->remaining   = 0;
+            value->next_packet = NX_NULL;
+            find               = value->ptr;
+            while (find < end && *find != '&')
+            {
+                find++;
+            }
+
+            value->length = find - value->ptr;
+
+            return true;
+        }
+
+        find++;
+    }
+
+    return false;
+}
+
+INT mqtt_view_int(const MQTT_VIEW* view)
+{
+    INT value = 0;
+
+    for (UINT i = 0; i < view->length && view->ptr[i] >= '0' && view->ptr[i] <= '9'; i++)
+    {
+        value = value * 10 + (view->ptr[i] - '0');
+    }
+
+    return value;
+}
@@ -0,0 +1,78 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _TOPIC_ROUTER_H
+#define _TOPIC_ROUTER_H
+
+#include <stdbool.h>
+
+#include "tx_api.h"
+
+#include "nx_api.h"
+
+// Enough for the hub and DPS subscriptions, a filter takes one node per level not shared with an earlier filter
+#define TOPIC_ROUTER_NODE_COUNT  16
+#define TOPIC_ROUTER_ROUTE_COUNT 8
+
+// Read-only window onto received bytes. It is not NUL terminated and is only valid until the callback returns.
+// Payloads larger than a packet continue in the rest of the packet chain, see mqtt_view_next
+typedef struct MQTT_VIEW_STRUCT
+{
+    const CHAR* ptr;
+    UINT length;
+
+    // bytes still to come after this segment, and the packet they start in
+    ULONG remaining;
+    const NX_PACKET* next_packet;
+} MQTT_VIEW;
+
+// tail is the part of the topic matched by a trailing '#', empty for other filters
+typedef VOID (*func_ptr_topic_route)(VOID* context, const MQTT_VIEW* tail, const MQTT_VIEW* payload);
+
+typedef struct TOPIC_ROUTER_NODE_STRUCT
+{
+    // points into the filter string passed to topic_router_add
+    const CHAR* level;
+    UCHAR level_length;
+
+    UCHAR first_child;
+    UCHAR next_sibling;
+
+    // filter ending at this level, and filter ending in a '#' directly below it
+    UCHAR route;
+    UCHAR wildcard_route;
+} TOPIC_ROUTER_NODE;
+
+// Trie of topic filter levels, node 0 is the root
+typedef struct TOPIC_ROUTER_STRUCT
+{
+    TOPIC_ROUTER_NODE nodes[TOPIC_ROUTER_NODE_COUNT];
+    func_ptr_topic_route routes[TOPIC_ROUTER_ROUTE_COUNT];
+    UINT node_count;
+    UINT route_count;
+} TOPIC_ROUTER;
+
+VOID topic_router_init(TOPIC_ROUTER* router);
+
+// Adds an MQTT topic filter, which may use '+' and a trailing '#'. The filter string must outlive the router
+UINT topic_router_add(TOPIC_ROUTER* router, const CHAR* filter, func_ptr_topic_route route);
+
+// Calls the route of the best matching filter, exact levels win over '+' and '+' over '#'
+UINT topic_router_dispatch(TOPIC_ROUTER* router, const MQTT_VIEW* topic, const MQTT_VIEW* payload, VOID* context);
+
+// Moves a view on to its next segment, false once there are no more
+bool mqtt_view_next(MQTT_VIEW* view);
+
+// Total length over every segment
+ULONG mqtt_view_length(const MQTT_VIEW* view);
+
+// Compares every segment, the other helpers only look at the first
+bool mqtt_view_equals(const MQTT_VIEW* view, const CHAR* string);
+
+// Finds key=value in a "?a=1&b=2" style property list, the value runs to the next '&'
+bool mqtt_view_param(const MQTT_VIEW* view, const CHAR* key, MQTT_VIEW* value);
+
+// Parses the leading decimal digits, 0 if there are none
+INT mqtt_view_int(const MQTT_VIEW* view);
+
+#endif // _TOPIC_ROUTER_H
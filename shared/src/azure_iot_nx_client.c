@@ -11,11 +11,12 @@
 #include "azure_iot_cert.h"
 #include "azure_iot_ciphersuites.h"
 #include "azure_iot_connect.h"
+#include "packet_pool.h"
 
-#define NX_AZURE_IOT_THREAD_PRIORITY 4
+#define NX_AZURE_IOT_THREAD_PRIORITY      4
+#define AZURE_IOT_RECEIVE_THREAD_PRIORITY (NX_AZURE_IOT_THREAD_PRIORITY + 1)
 
 // Incoming events from the middleware
-#define HUB_ALL_EVENTS                        0xFF
 #define HUB_CONNECT_EVENT                     0x01
 #define HUB_DISCONNECT_EVENT                  0x02
 #define HUB_COMMAND_RECEIVE_EVENT             0x04
@@ -23,28 +24,39 @@
 #define HUB_WRITABLE_PROPERTIES_RECEIVE_EVENT 0x10
 #define HUB_PROPERTIES_COMPLETE_EVENT         0x20
 #define HUB_PERIODIC_TIMER_EVENT              0x40
+#define HUB_TELEMETRY_SEND_EVENT              0x80
+#define HUB_REPORTED_PROPERTIES_EVENT         0x100
+#define HUB_DIAGNOSTICS_EVENT                 0x200
+
+// Events handled by the receive and send executors
+#define HUB_RECEIVE_EVENTS 0x3F
+#define HUB_SEND_EVENTS    0x3C0
 
 #define AZURE_IOT_DPS_ENDPOINT "global.azure-devices-provisioning.net"
 
-#define MODULE_ID   ""
 #define DPS_PAYLOAD "{\"modelId\":\"%s\"}"
 
 // Connection timeouts in threadx ticks
 #define HUB_CONNECT_TIMEOUT_TICKS  (10 * TX_TIMER_TICKS_PER_SECOND)
 #define DPS_REGISTER_TIMEOUT_TICKS (30 * TX_TIMER_TICKS_PER_SECOND)
 
-#define DPS_PAYLOAD_SIZE       (15 + 128)
-#define TELEMETRY_BUFFER_SIZE  256
-#define PROPERTIES_BUFFER_SIZE 128
+#define DPS_PAYLOAD_SIZE (15 + 128)
+
+// PUBACK polling while publishes are in flight, from 20 ms for a fresh publish to a quarter second for one the hub
+// is slow to acknowledge
+#define PUBACK_POLL_MIN_TICKS ((NX_IP_PERIODIC_RATE / 50) > 0 ? (NX_IP_PERIODIC_RATE / 50) : 1)
+#define PUBACK_POLL_MAX_TICKS ((NX_IP_PERIODIC_RATE / 4) > 0 ? (NX_IP_PERIODIC_RATE / 4) : 1)
+
+// Stored telemetry starts with the capture time and the component name length
+#define STORE_FORWARD_TIME_SIZE   4
+#define STORE_FORWARD_HEADER_SIZE (STORE_FORWARD_TIME_SIZE + 1)
 
 // define static strings for content type and -encoding on message property bag
 static const UCHAR content_type_property[]     = "$.ct";
 static const UCHAR content_encoding_property[] = "$.ce";
 static const UCHAR content_type_json[]         = "application%2Fjson";
 static const UCHAR content_encoding_utf8[]     = "utf-8";
-
-static UCHAR telemetry_buffer[TELEMETRY_BUFFER_SIZE];
-static UCHAR properties_buffer[PROPERTIES_BUFFER_SIZE];
+static const UCHAR creation_time_property[]    = "iothub-creation-time-utc";
 
 static VOID printf_packet(CHAR* prepend, NX_PACKET* packet_ptr)
 {
@@ -79,7 +91,18 @@ static VOID connection_status_callback(NX_AZURE_IOT_HUB_CLIENT* hub_client_ptr,
 
 static VOID message_receive_command(NX_AZURE_IOT_HUB_CLIENT* hub_client_ptr, VOID* context)
 {
+    TX_INTERRUPT_SAVE_AREA
     AZURE_IOT_NX_CONTEXT* nx_context = (AZURE_IOT_NX_CONTEXT*)context;
+
+    // Turnaround is measured from the first command waiting to be dispatched, this runs on the middleware thread
+    TX_DISABLE
+    if (!nx_context->command_stats.pending)
+    {
+        nx_context->command_stats.received_ticks = tx_time_get();
+        nx_context->command_stats.pending        = true;
+    }
+    TX_RESTORE
+
     tx_event_flags_set(&nx_context->events, HUB_COMMAND_RECEIVE_EVENT, TX_OR);
 }
 
@@ -95,25 +118,72 @@ static VOID message_receive_callback_writable_property(NX_AZURE_IOT_HUB_CLIENT*
     tx_event_flags_set(&nx_context->events, HUB_WRITABLE_PROPERTIES_RECEIVE_EVENT, TX_OR);
 }
 
+static VOID reported_properties_response_callback(
+    NX_AZURE_IOT_HUB_CLIENT* hub_client_ptr, UINT request_id, UINT response_status, ULONG version, VOID* context)
+{
+    AZURE_IOT_NX_CONTEXT* nx_context     = (AZURE_IOT_NX_CONTEXT*)context;
+    AZURE_IOT_REPORTED_PROPERTIES* cache = &nx_context->reported_properties;
+
+    // Record the response, it is processed on the client thread
+    tx_mutex_get(&cache->mutex, TX_WAIT_FOREVER);
+    for (UINT i = 0; i < AZURE_IOT_REPORTED_PROPERTY_REQUEST_COUNT; ++i)
+    {
+        if (cache->requests[i].in_use && cache->requests[i].request_id == request_id)
+        {
+            cache->requests[i].responded       = true;
+            cache->requests[i].response_status = response_status;
+            break;
+        }
+    }
+    tx_mutex_put(&cache->mutex);
+
+    tx_event_flags_set(&nx_context->events, HUB_REPORTED_PROPERTIES_EVENT, TX_OR);
+}
+
 static VOID periodic_timer_entry(ULONG context)
 {
     AZURE_IOT_NX_CONTEXT* nx_context = (AZURE_IOT_NX_CONTEXT*)context;
     tx_event_flags_set(&nx_context->events, HUB_PERIODIC_TIMER_EVENT, TX_OR);
 }
 
+static VOID diagnostics_timer_entry(ULONG context)
+{
+    AZURE_IOT_NX_CONTEXT* nx_context = (AZURE_IOT_NX_CONTEXT*)context;
+    tx_event_flags_set(&nx_context->events, HUB_DIAGNOSTICS_EVENT, TX_OR);
+}
+
+// Take the client mutex, failing without it unless the hub client is connected
+static UINT client_lock(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    tx_mutex_get(&nx_context->client_mutex, TX_WAIT_FOREVER);
+
+    if (nx_context->azure_iot_connection_status != NX_SUCCESS)
+    {
+        tx_mutex_put(&nx_context->client_mutex);
+        return NX_AZURE_IOT_DISCONNECTED;
+    }
+
+    return NX_SUCCESS;
+}
+
+static VOID client_unlock(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    tx_mutex_put(&nx_context->client_mutex);
+}
+
 static UINT iot_hub_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
 {
     UINT status;
 
     // Initialize IoT Hub client.
     if ((status = nx_azure_iot_hub_client_initialize(&nx_context->iothub_client,
-             &nx_context->nx_azure_iot,
+             nx_context->nx_azure_iot_ptr,
              (UCHAR*)nx_context->azure_iot_hub_hostname,
              nx_context->azure_iot_hub_hostname_len,
              (UCHAR*)nx_context->azure_iot_hub_device_id,
              nx_context->azure_iot_hub_device_id_len,
-             (UCHAR*)MODULE_ID,
-             sizeof(MODULE_ID) - 1,
+             (UCHAR*)nx_context->azure_iot_hub_module_id,
+             nx_context->azure_iot_hub_module_id_len,
              _nx_azure_iot_tls_supported_crypto,
              _nx_azure_iot_tls_supported_crypto_size,
              _nx_azure_iot_tls_ciphersuite_map,
@@ -216,6 +286,13 @@ static UINT iot_hub_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
         printf("Error: device twin desired property callback set (0x%08x)\r\n", status);
     }
 
+    // Set the reported properties response callback
+    else if ((status = nx_azure_iot_hub_client_reported_properties_response_callback_set(
+                  &nx_context->iothub_client, reported_properties_response_callback, (VOID*)nx_context)))
+    {
+        printf("Error: reported properties response callback set (0x%08x)\r\n", status);
+    }
+
     // Register the pnp components for receiving
     for (int i = 0; i < nx_context->azure_iot_component_count; ++i)
     {
@@ -236,9 +313,33 @@ static UINT iot_hub_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
     return status;
 }
 
+// FNV-1a over a component and command or property name, the separator keeps "ab"/"c" apart from "a"/"bc"
+static UINT name_pair_hash(const UCHAR* component_name_ptr,
+    UINT component_name_length,
+    const UCHAR* name_ptr,
+    UINT name_length)
+{
+    UINT hash = 2166136261u;
+
+    for (UINT i = 0; i < component_name_length; ++i)
+    {
+        hash = (hash ^ component_name_ptr[i]) * 16777619u;
+    }
+
+    hash = (hash ^ '*') * 16777619u;
+
+    for (UINT i = 0; i < name_length; ++i)
+    {
+        hash = (hash ^ name_ptr[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
 static UINT dps_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
 {
     UINT status;
+    ULONG start_ticks;
     CHAR payload[DPS_PAYLOAD_SIZE];
 
     if (nx_context == NULL)
@@ -254,6 +355,12 @@ static UINT dps_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
         return NX_PTR_ERROR;
     }
 
+    // Go straight to the hub already assigned, saving the DPS handshake and registration
+    if (dps_assignment_reuse(nx_context))
+    {
+        return iot_hub_initialize(nx_context);
+    }
+
     printf("\r\nInitializing Azure IoT DPS client\r\n");
     printf("\tDPS endpoint: %s\r\n", AZURE_IOT_DPS_ENDPOINT);
     printf("\tDPS ID scope: %.*s\r\n", nx_context->azure_iot_dps_id_scope_len, nx_context->azure_iot_dps_id_scope);
@@ -271,9 +378,11 @@ static UINT dps_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
         return NX_SIZE_ERROR;
     }
 
+    start_ticks = tx_time_get();
+
     // Initialize IoT provisioning client
     if ((status = nx_azure_iot_provisioning_client_initialize(&nx_context->dps_client,
-             &nx_context->nx_azure_iot,
+             nx_context->nx_azure_iot_ptr,
              (UCHAR*)AZURE_IOT_DPS_ENDPOINT,
              strlen(AZURE_IOT_DPS_ENDPOINT),
              (UCHAR*)nx_context->azure_iot_dps_id_scope,
@@ -356,6 +465,12 @@ static UINT dps_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
         printf("ERROR: nx_azure_iot_provisioning_client_iothub_device_info_get (0x%08x)\r\n", status);
     }
 
+    else
+    {
+        connection_handshake_record(&nx_context->dps_tls_stats, start_ticks);
+        dps_assignment_record(nx_context);
+    }
+
     // Destroy Provisioning Client
     nx_azure_iot_provisioning_client_deinitialize(&nx_context->dps_client);
 
@@ -369,516 +484,2181 @@ static UINT dps_initialize(AZURE_IOT_NX_CONTEXT* nx_context)
     return iot_hub_initialize(nx_context);
 }
 
-static VOID process_connect(AZURE_IOT_NX_CONTEXT* nx_context)
+static UINT telemetry_message_create(AZURE_IOT_NX_CONTEXT* context_ptr,
+    const CHAR* component_name_ptr,
+    UINT component_name_length,
+    NX_PACKET** packet_ptr)
 {
     UINT status;
 
-    // Request the client properties
-    if ((status = nx_azure_iot_hub_client_properties_request(&nx_context->iothub_client, NX_WAIT_FOREVER)))
+    if ((status = nx_azure_iot_hub_client_telemetry_message_create(
+             &context_ptr->iothub_client, packet_ptr, NX_WAIT_FOREVER)))
     {
-        printf("ERROR: failed to request properties (0x%08x)\r\n", status);
+        printf("Error: nx_azure_iot_hub_client_telemetry_message_create failed (0x%08x)\r\n", status);
+        return status;
     }
 
-    // Start the periodic timer
-    if ((status = tx_timer_activate(&nx_context->periodic_timer)))
+    if (component_name_length > 0)
     {
-        printf("ERROR: tx_timer_activate (0x%08x)\r\n", status);
+        printf("appending component name: %.*s\r\n", component_name_length, component_name_ptr);
+        if ((status = nx_azure_iot_hub_client_telemetry_component_set(
+                 *packet_ptr, (UCHAR*)component_name_ptr, component_name_length, NX_WAIT_FOREVER)))
+        {
+            printf("Error: nx_azure_iot_hub_client_telemetry_component_set failed (0x%08x)\r\n", status);
+            nx_azure_iot_hub_client_telemetry_message_delete(*packet_ptr);
+            return status;
+        }
+    }
+
+    // set the ContentType property on the message to "application/json" (url-encoded)
+    if ((status = nx_azure_iot_hub_client_telemetry_property_add(*packet_ptr,
+             content_type_property,
+             sizeof(content_type_property) - 1,
+             content_type_json,
+             sizeof(content_type_json) - 1,
+             NX_WAIT_FOREVER)))
+    {
+        printf("Error: Cant set ContentType message property (0x%08X)\r\n", status);
+        nx_azure_iot_hub_client_telemetry_message_delete(*packet_ptr);
+        return status;
     }
+
+    // set the ContentEncoding property on the message to "utf-8"
+    if ((status = nx_azure_iot_hub_client_telemetry_property_add(*packet_ptr,
+             content_encoding_property,
+             sizeof(content_encoding_property) - 1,
+             content_encoding_utf8,
+             sizeof(content_encoding_utf8) - 1,
+             NX_WAIT_FOREVER)))
+    {
+        printf("Error: Cant set ContentEncoding message property (0x%08X)\r\n", status);
+        nx_azure_iot_hub_client_telemetry_message_delete(*packet_ptr);
+        return status;
+    }
+
+    return status;
 }
 
-static VOID process_disconnect(AZURE_IOT_NX_CONTEXT* nx_context)
+static UINT telemetry_message_send(
+    AZURE_IOT_NX_CONTEXT* context_ptr, NX_PACKET* packet_ptr, UCHAR* telemetry_ptr, UINT telemetry_length)
 {
     UINT status;
 
-    printf("Disconnected from IoT Hub\r\n");
-
-    // Stop the periodic timer
-    if ((status = tx_timer_deactivate(&nx_context->periodic_timer)))
+    if ((status = nx_azure_iot_hub_client_telemetry_send(
+             &context_ptr->iothub_client, packet_ptr, telemetry_ptr, telemetry_length, NX_WAIT_FOREVER)))
     {
-        printf("ERROR: tx_timer_deactivate (0x%08x)\r\n", status);
+        printf("Error: Telemetry message send failed (0x%08x)\r\n", status);
+        nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
     }
+
+    return status;
 }
 
-static VOID process_properties_complete(AZURE_IOT_NX_CONTEXT* nx_context)
+// Serialize into the telemetry buffer and create the message for it, the caller holds the client mutex.
+// telemetry_send copies the payload into the message after the topic and packet id, so a reading is capped at
+// AZURE_IOT_TELEMETRY_BUFFER_SIZE rather than by the packet pool
+static UINT telemetry_message_build(AZURE_IOT_NX_CONTEXT* context_ptr,
+    CHAR* component_name_ptr,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_builder_ptr),
+    NX_PACKET** packet_ptr,
+    UINT* telemetry_length)
 {
-    if (nx_context->properties_complete_cb)
+    UINT status;
+    NX_AZURE_IOT_JSON_WRITER json_writer;
+
+    if ((status = nx_azure_iot_json_writer_with_buffer_init(
+             &json_writer, context_ptr->telemetry_buffer, sizeof(context_ptr->telemetry_buffer))) ||
+        (status = nx_azure_iot_json_writer_append_begin_object(&json_writer)) ||
+        (status = append_properties(&json_writer)) ||
+        (status = nx_azure_iot_json_writer_append_end_object(&json_writer)))
     {
-        nx_context->properties_complete_cb(nx_context);
+        printf("Error: Failed to build telemetry (0x%08x)\r\n", status);
+        return status;
     }
+
+    *telemetry_length = nx_azure_iot_json_writer_get_bytes_used(&json_writer);
+
+    return telemetry_message_create(context_ptr,
+        component_name_ptr,
+        component_name_ptr != NX_NULL ? strlen(component_name_ptr) : 0,
+        packet_ptr);
 }
 
-static VOID process_command(AZURE_IOT_NX_CONTEXT* nx_context)
+// Packet id the MQTT client handed out last, called straight after a publish with the client held so it is ours
+static ULONG mqtt_packet_id_last(AZURE_IOT_NX_CONTEXT* nx_context)
 {
-    UINT status;
-    const UCHAR* component_name_ptr;
-    USHORT component_name_length;
-    const UCHAR* command_name_ptr;
-    USHORT command_name_length;
-    VOID* context_ptr;
-    USHORT context_length;
-    UCHAR* payload_ptr;
-    USHORT payload_length;
-    NX_PACKET* packet_ptr;
+    NXD_MQTT_CLIENT* mqtt_client_ptr = &nx_context->iothub_client.nx_azure_iot_hub_client_resource.resource_mqtt;
+    ULONG packet_id;
 
-    while ((status = nx_azure_iot_hub_client_command_message_receive(&nx_context->iothub_client,
-                &component_name_ptr,
-                &component_name_length,
-                &command_name_ptr,
-                &command_name_length,
-                &context_ptr,
-                &context_length,
-                &packet_ptr,
-                NX_NO_WAIT)) == NX_AZURE_IOT_SUCCESS)
-    {
-        printf("Received command: %.*s\r\n", (INT)command_name_length, (CHAR*)command_name_ptr);
-        printf_packet("\tPayload: ", packet_ptr);
+    tx_mutex_get(mqtt_client_ptr->nxd_mqtt_client_mutex_ptr, TX_WAIT_FOREVER);
+    packet_id = mqtt_client_ptr->nxd_mqtt_client_packet_identifier;
+    tx_mutex_put(mqtt_client_ptr->nxd_mqtt_client_mutex_ptr);
+
+    return packet_id;
+}
 
-        payload_ptr    = packet_ptr->nx_packet_prepend_ptr;
-        payload_length = packet_ptr->nx_packet_append_ptr - packet_ptr->nx_packet_prepend_ptr;
+// The MQTT client keeps each QoS1 publish on its transmit queue, tagged with its packet id, until the PUBACK
+// for that id arrives. Other QoS1 traffic on the queue does not affect the answer
+static bool mqtt_packet_acknowledged(AZURE_IOT_NX_CONTEXT* nx_context, ULONG packet_id)
+{
+    NXD_MQTT_CLIENT* mqtt_client_ptr = &nx_context->iothub_client.nx_azure_iot_hub_client_resource.resource_mqtt;
+    NX_PACKET* packet_ptr;
+    bool acknowledged = true;
 
-        if (nx_context->command_received_cb)
+    tx_mutex_get(mqtt_client_ptr->nxd_mqtt_client_mutex_ptr, TX_WAIT_FOREVER);
+    for (packet_ptr = mqtt_client_ptr->message_transmit_queue_head; packet_ptr != NX_NULL;
+         packet_ptr = packet_ptr->nx_packet_queue_next)
+    {
+        if (*(ULONG*)packet_ptr->nx_packet_data_start == packet_id)
         {
-            nx_context->command_received_cb(nx_context,
-                component_name_ptr,
-                component_name_length,
-                command_name_ptr,
-                command_name_length,
-                payload_ptr,
-                payload_length,
-                context_ptr,
-                context_length);
+            acknowledged = false;
+            break;
         }
-
-        // Release the received packet, as ownership was passed to the application from the middleware
-        nx_packet_release(packet_ptr);
     }
+    tx_mutex_put(mqtt_client_ptr->nxd_mqtt_client_mutex_ptr);
 
-    // If we failed for anything other than no packet, then report error
-    if (status != NX_AZURE_IOT_NO_PACKET)
+    return acknowledged;
+}
+
+static VOID publish_complete(AZURE_IOT_NX_CONTEXT* nx_context, AZURE_IOT_PUBLISH_ENTRY* entry, UINT result)
+{
+    if (entry->complete_cb)
     {
-        printf("Error: Command receive failed (0x%08x)\r\n", status);
-        return;
+        entry->complete_cb(nx_context, result, entry->complete_context);
     }
 }
 
-static UINT process_properties_shared(AZURE_IOT_NX_CONTEXT* nx_context,
-    NX_PACKET* packet_ptr,
-    UINT message_type,
-    UINT property_type,
-    UCHAR* scratch_buffer,
-    UINT scratch_buffer_len,
-    func_ptr_property_received property_received_cb)
+// Pop the oldest entry, which must be in flight, and report its result
+static VOID publish_queue_pop(AZURE_IOT_NX_CONTEXT* nx_context, UINT result)
+{
+    AZURE_IOT_PUBLISH_QUEUE* queue = &nx_context->publish_queue;
+    AZURE_IOT_PUBLISH_ENTRY entry  = queue->entries[queue->head];
+
+    queue->head = (queue->head + 1) % AZURE_IOT_PUBLISH_QUEUE_SIZE;
+    queue->inflight_count--;
+
+    publish_complete(nx_context, &entry, result);
+}
+
+static VOID process_publish_queue(AZURE_IOT_NX_CONTEXT* nx_context)
 {
     UINT status;
-    const UCHAR* component_name_ptr;
-    USHORT component_name_length = 0;
-    UINT property_name_length;
-    ULONG properties_version;
-    NX_AZURE_IOT_JSON_READER json_reader;
+    UINT telemetry_length;
+    NX_PACKET* packet_ptr;
+    AZURE_IOT_PUBLISH_QUEUE* queue = &nx_context->publish_queue;
+    AZURE_IOT_PUBLISH_ENTRY* entry;
+    AZURE_IOT_PUBLISH_ENTRY failed_entry;
 
-    if ((status = nx_azure_iot_json_reader_init(&json_reader, packet_ptr)))
+    if (queue->inflight_count == 0 && queue->queued_count == 0)
     {
-        printf("Error: failed to initialize json reader (0x%08x)\r\n", status);
-        nx_packet_release(packet_ptr);
-        return status;
+        return;
     }
 
-    // Get the version
-    if ((status = nx_azure_iot_hub_client_properties_version_get(
-             &nx_context->iothub_client, &json_reader, message_type, &properties_version)))
-    {
-        printf("Error: Properties version get failed (0x%08x)\r\n", status);
-        nx_packet_release(packet_ptr);
-        return status;
-    }
+    tx_mutex_get(&queue->mutex, TX_WAIT_FOREVER);
 
-    // reinitialize the json reader after reading the version to reset
-    if ((status = nx_azure_iot_json_reader_init(&json_reader, packet_ptr)))
+    // A disconnect aborts the whole queue, nothing to do until it has been handled
+    if (client_lock(nx_context))
     {
-        printf("Error: failed to initialize json reader (0x%08x)\r\n", status);
-        nx_packet_release(packet_ptr);
-        return status;
+        tx_mutex_put(&queue->mutex);
+        return;
     }
 
-    while ((status = nx_azure_iot_hub_client_properties_component_property_next_get(&nx_context->iothub_client,
-                &json_reader,
-                message_type,
-                property_type,
-                &component_name_ptr,
-                &component_name_length)) == NX_AZURE_IOT_SUCCESS)
+    if (queue->inflight_count > 0)
     {
-        if (nx_azure_iot_json_reader_token_string_get(
-                &json_reader, scratch_buffer, scratch_buffer_len, &property_name_length))
+        for (UINT i = 0; i < queue->inflight_count; ++i)
         {
-            printf("Failed to get string property value\r\n");
-            return NX_NOT_SUCCESSFUL;
+            entry = &queue->entries[(queue->head + i) % AZURE_IOT_PUBLISH_QUEUE_SIZE];
+            if (!entry->acknowledged)
+            {
+                entry->acknowledged = mqtt_packet_acknowledged(nx_context, entry->packet_id);
+            }
         }
 
-        nx_azure_iot_json_reader_next_token(&json_reader);
+        // Complete in the order they were published
+        while (queue->inflight_count > 0 && queue->entries[queue->head].acknowledged)
+        {
+            publish_queue_pop(nx_context, AZURE_IOT_PUBLISH_SUCCESS);
+        }
+
+        // Give up tracking anything left waiting too long
+        while (queue->inflight_count > 0 &&
+               (tx_time_get() - queue->entries[queue->head].sent_ticks) >= queue->timeout_ticks)
+        {
+            publish_queue_pop(nx_context, AZURE_IOT_PUBLISH_TIMEOUT);
+        }
+    }
+
+    // Fill the window from the queue
+    while (queue->queued_count > 0 && queue->inflight_count < queue->inflight_max)
+    {
+        entry = &queue->entries[(queue->head + queue->inflight_count) % AZURE_IOT_PUBLISH_QUEUE_SIZE];
+        queue->queued_count--;
 
-        property_received_cb(nx_context,
-            component_name_ptr,
-            component_name_length,
-            scratch_buffer,
-            property_name_length,
-            &json_reader,
-            properties_version);
+        // Don't wait for the PUBACK here, the MQTT client holds the message until it arrives
+        if ((status = telemetry_message_build(nx_context,
+                 entry->component_name,
+                 entry->append_properties,
+                 &packet_ptr,
+                 &telemetry_length)) == NX_SUCCESS &&
+            (status = nx_azure_iot_hub_client_telemetry_send(&nx_context->iothub_client,
+                 packet_ptr,
+                 nx_context->telemetry_buffer,
+                 telemetry_length,
+                 NX_NO_WAIT)))
+        {
+            printf("Error: Telemetry message send failed (0x%08x)\r\n", status);
+            nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
+        }
 
-        // If we are still looking at the value, then skip over it (including if it has children)
-        if (nx_azure_iot_json_reader_token_type(&json_reader) == NX_AZURE_IOT_READER_TOKEN_BEGIN_OBJECT)
+        if (status != NX_SUCCESS)
         {
-            nx_azure_iot_json_reader_skip_children(&json_reader);
+            // Remove it from the front of the queued section, shifting the in flight entries up to keep their order
+            failed_entry = *entry;
+            for (UINT i = queue->inflight_count; i > 0; --i)
+            {
+                queue->entries[(queue->head + i) % AZURE_IOT_PUBLISH_QUEUE_SIZE] =
+                    queue->entries[(queue->head + i - 1) % AZURE_IOT_PUBLISH_QUEUE_SIZE];
+            }
+            queue->head = (queue->head + 1) % AZURE_IOT_PUBLISH_QUEUE_SIZE;
+
+            publish_complete(nx_context, &failed_entry, AZURE_IOT_PUBLISH_FAILED);
+            continue;
         }
 
-        nx_azure_iot_json_reader_next_token(&json_reader);
+        entry->packet_id    = mqtt_packet_id_last(nx_context);
+        entry->acknowledged = false;
+        entry->sent_ticks   = tx_time_get();
+        queue->inflight_count++;
     }
 
-    return NX_AZURE_IOT_SUCCESS;
+    client_unlock(nx_context);
+    tx_mutex_put(&queue->mutex);
 }
 
-static VOID process_properties(AZURE_IOT_NX_CONTEXT* nx_context)
+// Time to the next PUBACK check. A PUBACK is not due before a round trip, so the check backs off with the age of
+// the oldest publish in flight rather than waking the send thread and walking the MQTT queue every tick
+static ULONG publish_queue_poll_ticks(AZURE_IOT_NX_CONTEXT* nx_context)
 {
-    UINT status;
-    NX_PACKET* packet_ptr;
+    AZURE_IOT_PUBLISH_QUEUE* queue = &nx_context->publish_queue;
+    ULONG wait_ticks               = NX_IP_PERIODIC_RATE;
 
-    if ((status = nx_azure_iot_hub_client_properties_receive(&nx_context->iothub_client, &packet_ptr, NX_WAIT_FOREVER)))
+    tx_mutex_get(&queue->mutex, TX_WAIT_FOREVER);
+    if (queue->inflight_count > 0)
     {
-        printf("ERROR: nx_azure_iot_hub_client_properties_receive failed (0x%08x)\r\n", status);
-        return;
-    }
-
-    printf_packet("Receive properties: ", packet_ptr);
+        wait_ticks = (tx_time_get() - queue->entries[queue->head].sent_ticks) / 2;
 
-    if (nx_context->property_received_cb)
-    {
-        // Parse the writable properties from the device twin receive receive message
-        if ((status = process_properties_shared(nx_context,
-                 packet_ptr,
-                 NX_AZURE_IOT_HUB_PROPERTIES,
-                 NX_AZURE_IOT_HUB_CLIENT_PROPERTY_WRITABLE,
-                 properties_buffer,
-                 sizeof(properties_buffer),
-                 nx_context->property_received_cb)))
+        if (wait_ticks < PUBACK_POLL_MIN_TICKS)
         {
-            printf("Error: failed to parse properties (0x%08x)\r\n", status);
+            wait_ticks = PUBACK_POLL_MIN_TICKS;
+        }
+        else if (wait_ticks > PUBACK_POLL_MAX_TICKS)
+        {
+            wait_ticks = PUBACK_POLL_MAX_TICKS;
         }
     }
+    tx_mutex_put(&queue->mutex);
 
-    // Release the received packet, as ownership was passed to the application from the middleware
-    nx_packet_release(packet_ptr);
-
-    // Send event to notify device twin received
-    tx_event_flags_set(&nx_context->events, HUB_PROPERTIES_COMPLETE_EVENT, TX_OR);
+    return wait_ticks;
 }
 
-static VOID process_writable_properties(AZURE_IOT_NX_CONTEXT* nx_context)
+static VOID publish_queue_abort(AZURE_IOT_NX_CONTEXT* nx_context)
 {
-    UINT status;
-    NX_PACKET* packet_ptr;
+    AZURE_IOT_PUBLISH_QUEUE* queue = &nx_context->publish_queue;
 
-    if ((status = nx_azure_iot_hub_client_writable_properties_receive(
-             &nx_context->iothub_client, &packet_ptr, NX_WAIT_FOREVER)))
+    tx_mutex_get(&queue->mutex, TX_WAIT_FOREVER);
+
+    // Unsent messages have not been serialized yet, they complete along with the rest
+    queue->inflight_count += queue->queued_count;
+    queue->queued_count = 0;
+
+    while (queue->inflight_count > 0)
     {
-        printf("ERROR: nx_azure_iot_hub_client_writable_properties_receive (0x%08x)\r\n", status);
-        return;
+        publish_queue_pop(nx_context, AZURE_IOT_PUBLISH_DISCONNECT);
     }
 
-    printf_packet("Receive properties: ", packet_ptr);
+    tx_mutex_put(&queue->mutex);
+}
 
-    if (nx_context->writable_property_received_cb)
+static bool reported_property_component_match(CHAR* component_a, CHAR* component_b)
+{
+    if (component_a == NX_NULL || component_b == NX_NULL)
     {
-        // Parse the writable properties from the writable receive message
-        if ((status = process_properties_shared(nx_context,
-                 packet_ptr,
-                 NX_AZURE_IOT_HUB_WRITABLE_PROPERTIES,
-                 NX_AZURE_IOT_HUB_CLIENT_PROPERTY_WRITABLE,
-                 properties_buffer,
-                 sizeof(properties_buffer),
-                 nx_context->writable_property_received_cb)))
-        {
-            printf("ERROR: failed to parse properties (0x%08x)\r\n", status);
-        }
+        return component_a == component_b;
     }
 
-    // Release the received packet, as ownership was passed to the application from the middleware
-    nx_packet_release(packet_ptr);
+    return strcmp(component_a, component_b) == 0;
 }
 
-static VOID process_timer_event(AZURE_IOT_NX_CONTEXT* nx_context)
+static UINT reported_property_value_append(NX_AZURE_IOT_JSON_WRITER* json_writer, AZURE_IOT_REPORTED_PROPERTY* entry)
 {
-    if (nx_context->timer_cb)
+    switch (entry->type)
     {
-        nx_context->timer_cb(nx_context);
+        case AZURE_IOT_PROPERTY_TYPE_BOOL:
+            return nx_azure_iot_json_writer_append_bool(json_writer, entry->value.bool_value);
+
+        case AZURE_IOT_PROPERTY_TYPE_INT:
+            return nx_azure_iot_json_writer_append_int32(json_writer, entry->value.int_value);
+
+        case AZURE_IOT_PROPERTY_TYPE_STRING:
+            return nx_azure_iot_json_writer_append_string(
+                json_writer, (UCHAR*)entry->value.string_value, strlen(entry->value.string_value));
+
+        default:
+            return NX_NOT_SUCCESSFUL;
     }
 }
 
-UINT azure_nx_client_periodic_interval_set(AZURE_IOT_NX_CONTEXT* nx_context, INT interval)
+static UINT reported_property_append(
+    AZURE_IOT_NX_CONTEXT* nx_context, NX_AZURE_IOT_JSON_WRITER* json_writer, AZURE_IOT_REPORTED_PROPERTY* entry)
 {
     UINT status;
-    UINT active;
-    UINT ticks = interval * TX_TIMER_TICKS_PER_SECOND;
 
-    if ((status = tx_timer_info_get(&nx_context->periodic_timer, NULL, &active, NULL, NULL, NULL)))
+    if (entry->type == AZURE_IOT_PROPERTY_TYPE_APPEND)
     {
-        printf("ERROR: tx_timer_deactivate (0x%08x)\r\n", status);
-        return status;
+        return entry->value.append_properties(json_writer);
     }
 
-    if (active == TX_TRUE && (status = tx_timer_deactivate(&nx_context->periodic_timer)))
+    if (entry->ack_status != 0)
     {
-        printf("ERROR: tx_timer_deactivate (0x%08x)\r\n", status);
-    }
+        if ((status = nx_azure_iot_hub_client_reported_properties_status_begin(&nx_context->iothub_client,
+                 json_writer,
+                 (UCHAR*)entry->name,
+                 strlen(entry->name),
+                 entry->ack_status,
+                 entry->ack_version,
+                 NULL,
+                 0)) ||
 
-    else if ((status = tx_timer_change(&nx_context->periodic_timer, ticks, ticks)))
-    {
-        printf("ERROR: tx_timer_change (0x%08x)\r\n", status);
-    }
+            (status = reported_property_value_append(json_writer, entry)) ||
 
-    else if (active == TX_TRUE && (status = tx_timer_activate(&nx_context->periodic_timer)))
+            (status = nx_azure_iot_hub_client_reported_properties_status_end(&nx_context->iothub_client, json_writer)))
+        {
+            printf("Error: Failed to append property status (0x%08x)\r\n", status);
+        }
+
+        return status;
+    }
+
+    if ((status = nx_azure_iot_json_writer_append_property_name(json_writer, (UCHAR*)entry->name, strlen(entry->name))))
     {
-        printf("ERROR: tx_timer_activate (0x%08x)\r\n", status);
+        return status;
     }
 
-    return status;
+    return reported_property_value_append(json_writer, entry);
 }
 
-UINT azure_iot_nx_client_publish_telemetry(AZURE_IOT_NX_CONTEXT* context_ptr,
-    CHAR* component_name_ptr,
-    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_builder_ptr))
+// Append every dirty property of one component, NX_NULL being the root
+static UINT reported_properties_component_append(
+    AZURE_IOT_NX_CONTEXT* nx_context, NX_AZURE_IOT_JSON_WRITER* json_writer, CHAR* component_name_ptr)
 {
     UINT status;
-    UINT telemetry_length;
-    NX_PACKET* packet_ptr;
-    NX_AZURE_IOT_JSON_WRITER json_writer;
+    AZURE_IOT_REPORTED_PROPERTIES* cache = &nx_context->reported_properties;
+    AZURE_IOT_REPORTED_PROPERTY* entry;
 
-    if ((status = nx_azure_iot_hub_client_telemetry_message_create(
-             &context_ptr->iothub_client, &packet_ptr, NX_WAIT_FOREVER)))
+    if (component_name_ptr != NX_NULL &&
+        (status = nx_azure_iot_hub_client_reported_properties_component_begin(
+             &nx_context->iothub_client, json_writer, (UCHAR*)component_name_ptr, strlen(component_name_ptr))))
     {
-        printf("Error: nx_azure_iot_hub_client_telemetry_message_create failed (0x%08x)\r\n", status);
+        printf("Error: Failed to append component begin (0x%08x)\r\n", status);
+        return status;
     }
 
-    if (component_name_ptr != NX_NULL)
+    for (UINT i = 0; i < cache->entry_count; ++i)
     {
-        printf("appending component name: %s\r\n", component_name_ptr);
-        if ((status = nx_azure_iot_hub_client_telemetry_component_set(
-                 packet_ptr, (UCHAR*)component_name_ptr, strlen(component_name_ptr), NX_WAIT_FOREVER)))
+        entry = &cache->entries[i];
+        if (entry->dirty && reported_property_component_match(entry->component_name, component_name_ptr) &&
+            (status = reported_property_append(nx_context, json_writer, entry)))
         {
-            printf("Error: nx_azure_iot_hub_client_telemetry_component_set failed (0x%08x)\r\n", status);
-            nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
+            printf("Error: Failed to append property %s (0x%08x)\r\n", entry->name, status);
             return status;
         }
     }
 
-    if ((status = nx_azure_iot_json_writer_with_buffer_init(&json_writer, telemetry_buffer, sizeof(telemetry_buffer))))
+    if (component_name_ptr != NX_NULL &&
+        (status = nx_azure_iot_hub_client_reported_properties_component_end(&nx_context->iothub_client, json_writer)))
     {
-        printf("Error: Failed to initialize json writer (0x%08x)\r\n", status);
-        nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
+        printf("Error: Failed to append component end (0x%08x)\r\n", status);
         return status;
     }
 
-    if ((status = nx_azure_iot_json_writer_append_begin_object(&json_writer)) ||
-        (status = append_properties(&json_writer)) ||
-        (status = nx_azure_iot_json_writer_append_end_object(&json_writer)))
+    return NX_SUCCESS;
+}
+
+// True for the first dirty entry of a component, so each component is written once
+static bool reported_properties_component_first(AZURE_IOT_REPORTED_PROPERTIES* cache, UINT index)
+{
+    AZURE_IOT_REPORTED_PROPERTY* entry = &cache->entries[index];
+
+    if (!entry->dirty || entry->component_name == NX_NULL)
     {
-        printf("Error: Failed to build telemetry (0x%08x)\r\n", status);
-        nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
-        return status;
+        return false;
     }
 
-    // set the ContentType property on the message to "application/json" (url-encoded)
-    if ((status = nx_azure_iot_hub_client_telemetry_property_add(packet_ptr,
-             content_type_property,
-             sizeof(content_type_property) - 1,
-             content_type_json,
-             sizeof(content_type_json) - 1,
-             NX_WAIT_FOREVER)))
+    for (UINT i = 0; i < index; ++i)
     {
-        printf("Error: Cant set ContentType message property (0x%08X)\r\n", status);
-        nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
+        if (cache->entries[i].dirty &&
+            reported_property_component_match(cache->entries[i].component_name, entry->component_name))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Merge all dirty properties into one PATCH, the caller must hold the cache mutex and the client
+static UINT reported_properties_send(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT status;
+    UINT request_id;
+    UINT slot;
+    UINT dirty_count = 0;
+    NX_PACKET* packet_ptr;
+    NX_AZURE_IOT_JSON_WRITER json_writer;
+    AZURE_IOT_REPORTED_PROPERTIES* cache = &nx_context->reported_properties;
+
+    // Leave flush_pending set until there is a free request slot
+    if (cache->request_count == AZURE_IOT_REPORTED_PROPERTY_REQUEST_COUNT)
+    {
+        return NX_SUCCESS;
+    }
+
+    cache->flush_pending = false;
+
+    for (UINT i = 0; i < cache->entry_count; ++i)
+    {
+        if (cache->entries[i].dirty)
+        {
+            dirty_count++;
+        }
+    }
+
+    if (dirty_count == 0)
+    {
+        return NX_SUCCESS;
+    }
+
+    if ((status = nx_azure_iot_hub_client_reported_properties_create(
+             &nx_context->iothub_client, &packet_ptr, NX_WAIT_FOREVER)))
+    {
+        printf("Error: Failed create reported properties (0x%08x)\r\n", status);
         return status;
     }
 
-    // set the ContentEncoding property on the message to "utf-8"
-    if ((status = nx_azure_iot_hub_client_telemetry_property_add(packet_ptr,
-             content_encoding_property,
-             sizeof(content_encoding_property) - 1,
-             content_encoding_utf8,
-             sizeof(content_encoding_utf8) - 1,
-             NX_WAIT_FOREVER)))
+    if ((status = nx_azure_iot_json_writer_init(&json_writer, packet_ptr, NX_WAIT_FOREVER)))
     {
-        printf("Error: Cant set ContentEncoding message property (0x%08X)\r\n", status);
-        nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
+        printf("Error: Failed to initialize json writer (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_azure_iot_json_writer_append_begin_object(&json_writer)))
+    {
+        printf("Error: Failed to append object begin (0x%08x)\r\n", status);
+    }
+
+    else
+    {
+        status = reported_properties_component_append(nx_context, &json_writer, NX_NULL);
+
+        for (UINT i = 0; status == NX_SUCCESS && i < cache->entry_count; ++i)
+        {
+            if (reported_properties_component_first(cache, i))
+            {
+                status =
+                    reported_properties_component_append(nx_context, &json_writer, cache->entries[i].component_name);
+            }
+        }
+
+        if (status == NX_SUCCESS && (status = nx_azure_iot_json_writer_append_end_object(&json_writer)))
+        {
+            printf("Error: Failed to append object end (0x%08x)\r\n", status);
+        }
+    }
+
+    if (status != NX_SUCCESS)
+    {
+        packet_pool_release(packet_ptr);
         return status;
     }
 
-    telemetry_length = nx_azure_iot_json_writer_get_bytes_used(&json_writer);
-    if ((status = nx_azure_iot_hub_client_telemetry_send(
-             &context_ptr->iothub_client, packet_ptr, telemetry_buffer, telemetry_length, NX_WAIT_FOREVER)))
+    printf_packet("Sending property: ", packet_ptr);
+
+    // Don't wait for the response, it is matched to the request id in the response callback
+    if ((status = nx_azure_iot_hub_client_reported_properties_send(
+             &nx_context->iothub_client, packet_ptr, &request_id, NX_NULL, NX_NULL, NX_NO_WAIT)))
     {
-        printf("Error: Telemetry message send failed (0x%08x)\r\n", status);
-        nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
+        printf("Error: nx_azure_iot_hub_client_reported_properties_send failed (0x%08x)\r\n", status);
+        packet_pool_release(packet_ptr);
         return status;
     }
 
-    printf("Telemetry message sent: %.*s.\r\n", telemetry_length, telemetry_buffer);
+    // request_count is below the maximum so a slot is free
+    slot = 0;
+    while (cache->requests[slot].in_use)
+    {
+        slot++;
+    }
+
+    cache->requests[slot].in_use     = true;
+    cache->requests[slot].responded  = false;
+    cache->requests[slot].request_id = request_id;
+    cache->requests[slot].sent_ticks = tx_time_get();
+    cache->request_count++;
 
-    return status;
+    for (UINT i = 0; i < cache->entry_count; ++i)
+    {
+        if (cache->entries[i].dirty)
+        {
+            cache->entries[i].dirty      = false;
+            cache->entries[i].inflight   = true;
+            cache->entries[i].request_id = request_id;
+        }
+    }
+
+    return NX_SUCCESS;
 }
 
-static UINT reported_properties_begin(AZURE_IOT_NX_CONTEXT* context_ptr,
-    NX_AZURE_IOT_JSON_WRITER* json_writer,
-    NX_PACKET** packet_ptr,
-    CHAR* component_name_ptr)
+// Release a request, anything it carried that hasn't been set again since is marked for resend on failure
+static VOID reported_properties_request_complete(
+    AZURE_IOT_NX_CONTEXT* nx_context, AZURE_IOT_REPORTED_PROPERTY_REQUEST* request, UINT result)
 {
-    UINT status;
+    AZURE_IOT_REPORTED_PROPERTIES* cache = &nx_context->reported_properties;
+    AZURE_IOT_REPORTED_PROPERTY* entry;
 
-    if ((status = nx_azure_iot_hub_client_reported_properties_create(
-             &context_ptr->iothub_client, packet_ptr, NX_WAIT_FOREVER)))
+    for (UINT i = 0; i < cache->entry_count; ++i)
     {
-        printf("Error: Failed create reported properties (0x%08x)\r\n", status);
+        entry = &cache->entries[i];
+        if (entry->inflight && entry->request_id == request->request_id)
+        {
+            entry->inflight = false;
+            if (result != AZURE_IOT_PUBLISH_SUCCESS)
+            {
+                entry->dirty         = true;
+                cache->flush_pending = true;
+            }
+        }
     }
 
-    else if ((status = nx_azure_iot_json_writer_init(json_writer, *packet_ptr, NX_WAIT_FOREVER)))
+    request->in_use = false;
+    cache->request_count--;
+
+    if (nx_context->properties_reported_cb)
     {
-        printf("Error: Failed to initialize json writer (0x%08x)\r\n", status);
+        nx_context->properties_reported_cb(nx_context, result);
     }
+}
+
+static VOID process_reported_properties(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT result;
+    AZURE_IOT_REPORTED_PROPERTIES* cache = &nx_context->reported_properties;
+    AZURE_IOT_REPORTED_PROPERTY_REQUEST* request;
 
-    else if ((status = nx_azure_iot_json_writer_append_begin_object(json_writer)))
+    if (cache->request_count == 0 && !cache->flush_pending)
     {
-        printf("Error: Failed to append object begin (0x%08x)\r\n", status);
+        return;
+    }
+
+    tx_mutex_get(&cache->mutex, TX_WAIT_FOREVER);
+
+    for (UINT i = 0; i < AZURE_IOT_REPORTED_PROPERTY_REQUEST_COUNT; ++i)
+    {
+        request = &cache->requests[i];
+        if (!request->in_use)
+        {
+            continue;
+        }
+
+        if (request->responded)
+        {
+            result = AZURE_IOT_PUBLISH_SUCCESS;
+            if ((request->response_status < 200) || (request->response_status >= 300))
+            {
+                printf("Error: Property sent response status failed (%d)\r\n", request->response_status);
+                result = AZURE_IOT_PUBLISH_FAILED;
+            }
+        }
+        else if ((tx_time_get() - request->sent_ticks) >=
+                 AZURE_IOT_REPORTED_PROPERTY_TIMEOUT * TX_TIMER_TICKS_PER_SECOND)
+        {
+            printf("Error: Property response timed out (request %u)\r\n", request->request_id);
+            result = AZURE_IOT_PUBLISH_TIMEOUT;
+        }
+        else
+        {
+            continue;
+        }
+
+        reported_properties_request_complete(nx_context, request, result);
     }
 
-    else if (component_name_ptr != NX_NULL &&
-             (status = nx_azure_iot_hub_client_reported_properties_component_begin(
-                  &context_ptr->iothub_client, json_writer, (UCHAR*)component_name_ptr, strlen(component_name_ptr))))
+    // Leave flush_pending set until connected
+    if (cache->flush_pending && client_lock(nx_context) == NX_SUCCESS)
     {
-        printf("Error: Failed to append component begin (0x%08x)\r\n", status);
+        reported_properties_send(nx_context);
+        client_unlock(nx_context);
     }
 
-    return status;
+    tx_mutex_put(&cache->mutex);
 }
 
-static UINT reported_properties_end(AZURE_IOT_NX_CONTEXT* nx_context,
-    NX_AZURE_IOT_JSON_WRITER* json_writer,
-    NX_PACKET** packet_ptr,
-    CHAR* component_name_ptr)
+static VOID reported_properties_abort(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    AZURE_IOT_REPORTED_PROPERTIES* cache = &nx_context->reported_properties;
+
+    tx_mutex_get(&cache->mutex, TX_WAIT_FOREVER);
+
+    // Responses won't arrive now, resend the properties once reconnected
+    for (UINT i = 0; i < AZURE_IOT_REPORTED_PROPERTY_REQUEST_COUNT; ++i)
+    {
+        if (cache->requests[i].in_use)
+        {
+            reported_properties_request_complete(nx_context, &cache->requests[i], AZURE_IOT_PUBLISH_DISCONNECT);
+        }
+    }
+
+    tx_mutex_put(&cache->mutex);
+}
+
+static VOID process_connect(AZURE_IOT_NX_CONTEXT* nx_context)
 {
     UINT status;
-    UINT response_status = 0;
+    UINT active;
 
-    if ((component_name_ptr != NX_NULL && (status = nx_azure_iot_hub_client_reported_properties_component_end(
-                                               &nx_context->iothub_client, json_writer))))
+    // Request the client properties
+    if ((status = nx_azure_iot_hub_client_properties_request(&nx_context->iothub_client, NX_WAIT_FOREVER)))
     {
-        printf("Error: Failed to append component end (0x%08x)\r\n", status);
-        return status;
+        printf("ERROR: failed to request properties (0x%08x)\r\n", status);
     }
 
-    if ((status = nx_azure_iot_json_writer_append_end_object(json_writer)))
+    // Start the periodic timer, it is still running if readings were stored while offline
+    if ((status = tx_timer_info_get(&nx_context->periodic_timer, NX_NULL, &active, NX_NULL, NX_NULL, NX_NULL)) ||
+        (active == TX_FALSE && (status = tx_timer_activate(&nx_context->periodic_timer))))
     {
-        printf("Error: Failed to append object end (0x%08x)\r\n", status);
-        return status;
+        printf("ERROR: tx_timer_activate (0x%08x)\r\n", status);
     }
+}
 
-    printf_packet("Sending property: ", *packet_ptr);
+static VOID process_disconnect(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT status;
 
-    if ((status = nx_azure_iot_hub_client_reported_properties_send(
-             &nx_context->iothub_client, *packet_ptr, NX_NULL, &response_status, NX_NULL, 5 * NX_IP_PERIODIC_RATE)))
+    printf("Disconnected from IoT Hub\r\n");
+
+    // Nothing in flight will be acknowledged now
+    publish_queue_abort(nx_context);
+    reported_properties_abort(nx_context);
+
+    // Stop the periodic timer, unless there is a store to keep the readings in until the hub is back
+    if (nx_context->store_forward.store_ptr == NX_NULL &&
+        (status = tx_timer_deactivate(&nx_context->periodic_timer)))
     {
-        printf("Error: nx_azure_iot_hub_client_reported_properties_send failed (0x%08x)\r\n", status);
-        return status;
+        printf("ERROR: tx_timer_deactivate (0x%08x)\r\n", status);
     }
+}
 
-    else if ((response_status < 200) || (response_status >= 300))
+static VOID process_properties_complete(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    if (nx_context->properties_complete_cb)
     {
-        printf("Error: Property sent response status failed (%d)\r\n", response_status);
-        return NX_NOT_SUCCESSFUL;
+        nx_context->properties_complete_cb(nx_context);
     }
+}
 
-    return NX_SUCCESS;
+static VOID command_stats_record(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    TX_INTERRUPT_SAVE_AREA
+    AZURE_IOT_COMMAND_STATS* stats = &nx_context->command_stats.stats;
+    ULONG turnaround_ticks;
+
+    TX_DISABLE
+    turnaround_ticks = tx_time_get() - nx_context->command_stats.received_ticks;
+    stats->count++;
+    stats->last_ticks = turnaround_ticks;
+    stats->total_ticks += turnaround_ticks;
+    if (turnaround_ticks > stats->max_ticks)
+    {
+        stats->max_ticks = turnaround_ticks;
+    }
+    TX_RESTORE
 }
 
-UINT azure_iot_nx_client_publish_properties(AZURE_IOT_NX_CONTEXT* nx_context,
-    CHAR* component_name_ptr,
-    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr))
+// Find the slot for a command, either its entry or the empty slot where it belongs
+static AZURE_IOT_COMMAND_ENTRY* command_slot_find(AZURE_IOT_NX_CONTEXT* nx_context,
+    const UCHAR* component_name_ptr,
+    UINT component_name_length,
+    const UCHAR* command_name_ptr,
+    UINT command_name_length)
+{
+    UINT hash = name_pair_hash(component_name_ptr, component_name_length, command_name_ptr, command_name_length);
+    UINT slot = hash & (AZURE_IOT_COMMAND_TABLE_SIZE - 1);
+    AZURE_IOT_COMMAND_ENTRY* entry;
+
+    while (true)
+    {
+        entry = &nx_context->command_table[slot];
+
+        if (entry->handler == NX_NULL ||
+            (entry->hash == hash && entry->component_name_length == component_name_length &&
+                entry->command_name_length == command_name_length &&
+                memcmp(entry->component_name, component_name_ptr, component_name_length) == 0 &&
+                memcmp(entry->command_name, command_name_ptr, command_name_length) == 0))
+        {
+            return entry;
+        }
+
+        slot = (slot + 1) & (AZURE_IOT_COMMAND_TABLE_SIZE - 1);
+    }
+}
+
+// Hands over a payload in one packet in place, a longer one is gathered into the context first
+static UINT command_payload_get(
+    AZURE_IOT_NX_CONTEXT* nx_context, NX_PACKET* packet_ptr, UCHAR** payload_ptr, USHORT* payload_length)
 {
     UINT status;
-    NX_PACKET* packet_ptr;
-    NX_AZURE_IOT_JSON_WRITER json_writer;
+    ULONG bytes_copied;
 
-    if ((status = reported_properties_begin(nx_context, &json_writer, &packet_ptr, component_name_ptr)) ||
+    if (packet_ptr->nx_packet_next == NX_NULL)
+    {
+        *payload_ptr    = packet_ptr->nx_packet_prepend_ptr;
+        *payload_length = packet_ptr->nx_packet_append_ptr - packet_ptr->nx_packet_prepend_ptr;
+        return NX_SUCCESS;
+    }
 
-        (status = append_properties(&json_writer)) ||
+    if (packet_ptr->nx_packet_length > sizeof(nx_context->command_payload))
+    {
+        printf("ERROR: command payload of %lu bytes exceeds buffer\r\n", packet_ptr->nx_packet_length);
+        return NX_SIZE_ERROR;
+    }
 
-        (status = reported_properties_end(nx_context, &json_writer, &packet_ptr, component_name_ptr)))
+    if ((status = nx_packet_data_extract_offset(
+             packet_ptr, 0, nx_context->command_payload, packet_ptr->nx_packet_length, &bytes_copied)))
     {
-        printf("ERROR: azure_iot_nx_client_publish_properties (0x%08x)", status);
-        nx_packet_release(packet_ptr);
+        printf("ERROR: nx_packet_data_extract_offset (0x%08x)\r\n", status);
+        return status;
     }
 
-    return status;
+    *payload_ptr    = nx_context->command_payload;
+    *payload_length = (USHORT)bytes_copied;
+
+    return NX_SUCCESS;
 }
 
-UINT azure_iot_nx_client_publish_bool_property(
-    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, CHAR* property_ptr, bool value)
+static VOID process_command(AZURE_IOT_NX_CONTEXT* nx_context)
 {
+    TX_INTERRUPT_SAVE_AREA
     UINT status;
-    NX_AZURE_IOT_JSON_WRITER json_writer;
+    UINT response_status;
+    const UCHAR* component_name_ptr;
+    USHORT component_name_length;
+    const UCHAR* command_name_ptr;
+    USHORT command_name_length;
+    VOID* context_ptr;
+    USHORT context_length;
+    UCHAR* payload_ptr;
+    USHORT payload_length;
     NX_PACKET* packet_ptr;
+    AZURE_IOT_COMMAND_ENTRY* entry;
+    NX_AZURE_IOT_JSON_WRITER response_writer;
+    UINT response_length;
 
-    if ((status = reported_properties_begin(nx_context, &json_writer, &packet_ptr, component_name_ptr)) ||
+    while ((status = nx_azure_iot_hub_client_command_message_receive(&nx_context->iothub_client,
+                &component_name_ptr,
+                &component_name_length,
+                &command_name_ptr,
+                &command_name_length,
+                &context_ptr,
+                &context_length,
+                &packet_ptr,
+                NX_NO_WAIT)) == NX_AZURE_IOT_SUCCESS)
+    {
+        if (nx_context->command_logging)
+        {
+            printf("Received command: %.*s\r\n", (INT)command_name_length, (CHAR*)command_name_ptr);
+            printf_packet("\tPayload: ", packet_ptr);
+        }
 
-        (status = nx_azure_iot_json_writer_append_property_with_bool_value(
-             &json_writer, (const UCHAR*)property_ptr, strlen(property_ptr), value)) ||
+        entry = command_slot_find(
+            nx_context, component_name_ptr, component_name_length, command_name_ptr, command_name_length);
 
-        (status = reported_properties_end(nx_context, &json_writer, &packet_ptr, component_name_ptr)))
-    {
-        printf("ERROR: azure_iot_nx_client_publish_bool_property (0x%08x)", status);
-        nx_packet_release(packet_ptr);
+        if (command_payload_get(nx_context, packet_ptr, &payload_ptr, &payload_length))
+        {
+            // Payload too large
+            if ((status = nx_azure_iot_hub_client_command_message_response(
+                     &nx_context->iothub_client, 413, context_ptr, context_length, NULL, 0, NX_WAIT_FOREVER)))
+            {
+                printf("Direct method response failed! (0x%08x)\r\n", status);
+            }
+        }
+
+        else if (entry->handler != NX_NULL)
+        {
+            nx_azure_iot_json_writer_with_buffer_init(
+                &response_writer, nx_context->command_response, sizeof(nx_context->command_response));
+
+            response_status = entry->handler(nx_context, payload_ptr, payload_length, &response_writer);
+            response_length = nx_azure_iot_json_writer_get_bytes_used(&response_writer);
+
+            if ((status = nx_azure_iot_hub_client_command_message_response(&nx_context->iothub_client,
+                     response_status,
+                     context_ptr,
+                     context_length,
+                     response_length > 0 ? nx_context->command_response : NULL,
+                     response_length,
+                     NX_WAIT_FOREVER)))
+            {
+                printf("Direct method response failed! (0x%08x)\r\n", status);
+            }
+        }
+
+        else if (nx_context->command_received_cb)
+        {
+            nx_context->command_received_cb(nx_context,
+                component_name_ptr,
+                component_name_length,
+                command_name_ptr,
+                command_name_length,
+                payload_ptr,
+                payload_length,
+                context_ptr,
+                context_length);
+        }
+
+        else
+        {
+            if (nx_context->command_logging)
+            {
+                printf("Direct method is not for this device\r\n");
+            }
+
+            if ((status = nx_azure_iot_hub_client_command_message_response(
+                     &nx_context->iothub_client, 501, context_ptr, context_length, NULL, 0, NX_WAIT_FOREVER)))
+            {
+                printf("Direct method response failed! (0x%08x)\r\n", status);
+            }
+        }
+
+        // Release the received packet, as ownership was passed to the application from the middleware
+        packet_pool_release(packet_ptr);
+
+        command_stats_record(nx_context);
+    }
+
+    TX_DISABLE
+    nx_context->command_stats.pending = false;
+    TX_RESTORE
+
+    // If we failed for anything other than no packet, then report error
+    if (status != NX_AZURE_IOT_NO_PACKET)
+    {
+        printf("Error: Command receive failed (0x%08x)\r\n", status);
+        return;
+    }
+}
+
+// Find the slot for a property, either its entry or the empty slot where it belongs
+static AZURE_IOT_PROPERTY_ENTRY* property_slot_find(AZURE_IOT_NX_CONTEXT* nx_context,
+    const UCHAR* component_name_ptr,
+    UINT component_name_length,
+    const UCHAR* property_name_ptr,
+    UINT property_name_length)
+{
+    UINT hash = name_pair_hash(component_name_ptr, component_name_length, property_name_ptr, property_name_length);
+    UINT slot = hash & (AZURE_IOT_PROPERTY_TABLE_SIZE - 1);
+    AZURE_IOT_PROPERTY_ENTRY* entry;
+
+    while (true)
+    {
+        entry = &nx_context->property_table[slot];
+
+        if (entry->property_name == NX_NULL ||
+            (entry->hash == hash && entry->component_name_length == component_name_length &&
+                entry->property_name_length == property_name_length &&
+                memcmp(entry->component_name, component_name_ptr, component_name_length) == 0 &&
+                memcmp(entry->property_name, property_name_ptr, property_name_length) == 0))
+        {
+            return entry;
+        }
+
+        slot = (slot + 1) & (AZURE_IOT_PROPERTY_TABLE_SIZE - 1);
+    }
+}
+
+static CHAR* properties_component_find(AZURE_IOT_NX_CONTEXT* nx_context, const UCHAR* name_ptr, UINT name_length)
+{
+    for (UINT i = 0; i < nx_context->azure_iot_component_count; ++i)
+    {
+        if (strlen(nx_context->azure_iot_components[i]) == name_length &&
+            memcmp(nx_context->azure_iot_components[i], name_ptr, name_length) == 0)
+        {
+            return nx_context->azure_iot_components[i];
+        }
+    }
+
+    return NX_NULL;
+}
+
+static VOID properties_match_add(
+    AZURE_IOT_NX_CONTEXT* nx_context, AZURE_IOT_PROPERTY_ENTRY* entry, NX_AZURE_IOT_JSON_READER* json_reader)
+{
+    AZURE_IOT_PROPERTY_MATCH* match = NX_NULL;
+
+    // A property named twice in one document takes its last value
+    for (UINT i = 0; i < nx_context->property_match_count && match == NX_NULL; ++i)
+    {
+        if (nx_context->property_matches[i].entry == entry)
+        {
+            match = &nx_context->property_matches[i];
+        }
+    }
+
+    // Keep a copy of the reader on the value, it is handed over once the version is known.
+    // The copy shares the original reader's buffers so is only valid within properties_parse.
+    if (match == NX_NULL)
+    {
+        match = &nx_context->property_matches[nx_context->property_match_count++];
+    }
+
+    match->entry       = entry;
+    match->json_reader = *json_reader;
+}
+
+// Walk the members of one object, recording registered properties and picking up $version on the way.
+// The reader starts on the BEGIN_OBJECT and is left on the matching END_OBJECT.
+static UINT properties_object_walk(AZURE_IOT_NX_CONTEXT* nx_context,
+    NX_AZURE_IOT_JSON_READER* json_reader,
+    CHAR* component_name_ptr,
+    uint32_t* version_ptr)
+{
+    UINT status;
+    UINT name_length;
+    UINT component_name_length = component_name_ptr != NX_NULL ? strlen(component_name_ptr) : 0;
+    UCHAR name[AZURE_IOT_PROPERTY_NAME_SIZE];
+    CHAR* member_component_ptr;
+    AZURE_IOT_PROPERTY_ENTRY* entry;
+
+    while ((status = nx_azure_iot_json_reader_next_token(json_reader)) == NX_AZURE_IOT_SUCCESS &&
+           nx_azure_iot_json_reader_token_type(json_reader) == NX_AZURE_IOT_READER_TOKEN_PROPERTY_NAME)
+    {
+        // A name too long for the buffer can't be registered, it is only skipped
+        if (nx_azure_iot_json_reader_token_string_get(json_reader, name, sizeof(name), &name_length))
+        {
+            name_length = 0;
+        }
+
+        if ((status = nx_azure_iot_json_reader_next_token(json_reader)))
+        {
+            return status;
+        }
+
+        if (component_name_ptr == NX_NULL && name_length == sizeof("$version") - 1 &&
+            memcmp(name, "$version", name_length) == 0)
+        {
+            if ((status = nx_azure_iot_json_reader_token_uint32_get(json_reader, version_ptr)))
+            {
+                printf("Error: Properties version get failed (0x%08x)\r\n", status);
+                return status;
+            }
+        }
+
+        else if (component_name_ptr == NX_NULL &&
+                 nx_azure_iot_json_reader_token_type(json_reader) == NX_AZURE_IOT_READER_TOKEN_BEGIN_OBJECT &&
+                 (member_component_ptr = properties_component_find(nx_context, name, name_length)) != NX_NULL)
+        {
+            if ((status = properties_object_walk(nx_context, json_reader, member_component_ptr, version_ptr)))
+            {
+                return status;
+            }
+
+            continue;
+        }
+
+        else if (name_length > 0)
+        {
+            entry = property_slot_find(
+                nx_context, (UCHAR*)component_name_ptr, component_name_length, name, name_length);
+
+            if (entry->property_name != NX_NULL)
+            {
+                properties_match_add(nx_context, entry, json_reader);
+            }
+        }
+
+        // Step over the value, including any children
+        if (nx_azure_iot_json_reader_token_type(json_reader) == NX_AZURE_IOT_READER_TOKEN_BEGIN_OBJECT ||
+            nx_azure_iot_json_reader_token_type(json_reader) == NX_AZURE_IOT_READER_TOKEN_BEGIN_ARRAY)
+        {
+            nx_azure_iot_json_reader_skip_children(json_reader);
+        }
+    }
+
+    return status;
+}
+
+// Parse a properties document in a single pass, then dispatch the registered properties found in it
+static UINT properties_parse(AZURE_IOT_NX_CONTEXT* nx_context, NX_PACKET* packet_ptr, UINT message_type)
+{
+    UINT status;
+    uint32_t version = 0;
+    NX_AZURE_IOT_JSON_READER json_reader;
+
+    nx_context->property_match_count = 0;
+
+    if ((status = nx_azure_iot_json_reader_init(&json_reader, packet_ptr)))
+    {
+        printf("Error: failed to initialize json reader (0x%08x)\r\n", status);
+        return status;
+    }
+
+    if ((status = nx_azure_iot_json_reader_next_token(&json_reader)) ||
+        nx_azure_iot_json_reader_token_type(&json_reader) != NX_AZURE_IOT_READER_TOKEN_BEGIN_OBJECT)
+    {
+        printf("Error: properties document is not an object (0x%08x)\r\n", status);
+        return NX_NOT_SUCCESSFUL;
+    }
+
+    if (message_type == NX_AZURE_IOT_HUB_WRITABLE_PROPERTIES)
+    {
+        // A writable properties update is the desired properties object itself
+        status = properties_object_walk(nx_context, &json_reader, NX_NULL, &version);
+    }
+    else
+    {
+        // The full document also holds the reported properties, only the desired section is walked
+        while ((status = nx_azure_iot_json_reader_next_token(&json_reader)) == NX_AZURE_IOT_SUCCESS &&
+               nx_azure_iot_json_reader_token_type(&json_reader) == NX_AZURE_IOT_READER_TOKEN_PROPERTY_NAME)
+        {
+            if (nx_azure_iot_json_reader_token_is_text_equal(&json_reader, (UCHAR*)"desired", sizeof("desired") - 1))
+            {
+                if ((status = nx_azure_iot_json_reader_next_token(&json_reader)) == NX_AZURE_IOT_SUCCESS)
+                {
+                    status = properties_object_walk(nx_context, &json_reader, NX_NULL, &version);
+                }
+
+                break;
+            }
+
+            if ((status = nx_azure_iot_json_reader_next_token(&json_reader)))
+            {
+                break;
+            }
+
+            nx_azure_iot_json_reader_skip_children(&json_reader);
+        }
+    }
+
+    if (status != NX_AZURE_IOT_SUCCESS)
+    {
+        return status;
+    }
+
+    for (UINT i = 0; i < nx_context->property_match_count; ++i)
+    {
+        nx_context->property_update_cb(nx_context,
+            nx_context->property_matches[i].entry->property_id,
+            &nx_context->property_matches[i].json_reader,
+            message_type,
+            version);
+    }
+
+    return NX_AZURE_IOT_SUCCESS;
+}
+
+static VOID process_properties(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT status;
+    NX_PACKET* packet_ptr;
+
+    if ((status = nx_azure_iot_hub_client_properties_receive(&nx_context->iothub_client, &packet_ptr, NX_WAIT_FOREVER)))
+    {
+        printf("ERROR: nx_azure_iot_hub_client_properties_receive failed (0x%08x)\r\n", status);
+        return;
+    }
+
+    printf_packet("Receive properties: ", packet_ptr);
+
+    if (nx_context->property_update_cb && nx_context->property_count > 0)
+    {
+        // Parse the writable properties from the device twin receive receive message
+        if ((status = properties_parse(nx_context, packet_ptr, NX_AZURE_IOT_HUB_PROPERTIES)))
+        {
+            printf("Error: failed to parse properties (0x%08x)\r\n", status);
+        }
+    }
+
+    // Release the received packet, as ownership was passed to the application from the middleware
+    packet_pool_release(packet_ptr);
+
+    // Send event to notify device twin received
+    tx_event_flags_set(&nx_context->events, HUB_PROPERTIES_COMPLETE_EVENT, TX_OR);
+}
+
+static VOID process_writable_properties(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT status;
+    NX_PACKET* packet_ptr;
+
+    if ((status = nx_azure_iot_hub_client_writable_properties_receive(
+             &nx_context->iothub_client, &packet_ptr, NX_WAIT_FOREVER)))
+    {
+        printf("ERROR: nx_azure_iot_hub_client_writable_properties_receive (0x%08x)\r\n", status);
+        return;
+    }
+
+    printf_packet("Receive properties: ", packet_ptr);
+
+    if (nx_context->property_update_cb && nx_context->property_count > 0)
+    {
+        // Parse the writable properties from the writable receive message
+        if ((status = properties_parse(nx_context, packet_ptr, NX_AZURE_IOT_HUB_WRITABLE_PROPERTIES)))
+        {
+            printf("ERROR: failed to parse properties (0x%08x)\r\n", status);
+        }
+    }
+
+    // Release the received packet, as ownership was passed to the application from the middleware
+    packet_pool_release(packet_ptr);
+}
+
+static VOID process_timer_event(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    if (nx_context->timer_cb)
+    {
+        nx_context->timer_cb(nx_context);
+    }
+}
+
+UINT azure_nx_client_periodic_interval_set(AZURE_IOT_NX_CONTEXT* nx_context, INT interval)
+{
+    UINT status;
+    UINT active;
+    UINT ticks = interval * TX_TIMER_TICKS_PER_SECOND;
+
+    if ((status = tx_timer_info_get(&nx_context->periodic_timer, NULL, &active, NULL, NULL, NULL)))
+    {
+        printf("ERROR: tx_timer_deactivate (0x%08x)\r\n", status);
+        return status;
+    }
+
+    if (active == TX_TRUE && (status = tx_timer_deactivate(&nx_context->periodic_timer)))
+    {
+        printf("ERROR: tx_timer_deactivate (0x%08x)\r\n", status);
+    }
+
+    else if ((status = tx_timer_change(&nx_context->periodic_timer, ticks, ticks)))
+    {
+        printf("ERROR: tx_timer_change (0x%08x)\r\n", status);
+    }
+
+    else if (active == TX_TRUE && (status = tx_timer_activate(&nx_context->periodic_timer)))
+    {
+        printf("ERROR: tx_timer_activate (0x%08x)\r\n", status);
+    }
+
+    return status;
+}
+
+// Stored records may outlive the build that wrote them, so the time is big endian rather than a ULONG copy
+static ULONG read_ulong(const UCHAR* data)
+{
+    return ((ULONG)data[0] << 24) | ((ULONG)data[1] << 16) | ((ULONG)data[2] << 8) | data[3];
+}
+
+static VOID write_ulong(UCHAR* data, ULONG value)
+{
+    data[0] = (UCHAR)(value >> 24);
+    data[1] = (UCHAR)(value >> 16);
+    data[2] = (UCHAR)(value >> 8);
+    data[3] = (UCHAR)value;
+}
+
+// Write the record header for a stored message, returning the length so the payload can follow
+static UINT store_forward_header_write(AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, UINT* header_length)
+{
+    AZURE_IOT_STORE_FORWARD* store_forward = &nx_context->store_forward;
+    UINT component_name_length            = component_name_ptr != NX_NULL ? strlen(component_name_ptr) : 0;
+    ULONG unix_time                        = 0;
+
+    if (component_name_length > 0xFF ||
+        STORE_FORWARD_HEADER_SIZE + component_name_length >= sizeof(store_forward->record))
+    {
+        return NX_SIZE_ERROR;
+    }
+
+    if (nx_context->unix_time_get != NX_NULL)
+    {
+        nx_context->unix_time_get(&unix_time);
+    }
+
+    write_ulong(store_forward->record, unix_time);
+    store_forward->record[STORE_FORWARD_TIME_SIZE] = (UCHAR)component_name_length;
+    memcpy(&store_forward->record[STORE_FORWARD_HEADER_SIZE], component_name_ptr, component_name_length);
+
+    *header_length = STORE_FORWARD_HEADER_SIZE + component_name_length;
+
+    return NX_SUCCESS;
+}
+
+static UINT store_forward_push(AZURE_IOT_NX_CONTEXT* nx_context, UINT record_length)
+{
+    UINT status;
+    UINT dropped;
+    AZURE_IOT_STORE_FORWARD* store_forward = &nx_context->store_forward;
+
+    if ((status = store_forward->store_ptr->push(
+             store_forward->store_ptr, store_forward->record, record_length, &dropped)))
+    {
+        printf("ERROR: Failed to store telemetry (0x%08x)\r\n", status);
+        store_forward->dropped_count++;
+        return status;
+    }
+
+    store_forward->buffered_count++;
+    store_forward->dropped_count += dropped;
+
+    printf("Telemetry stored for replay (%d pending)\r\n", store_forward->store_ptr->count(store_forward->store_ptr));
+
+    return NX_SUCCESS;
+}
+
+static UINT store_forward_telemetry(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr))
+{
+    UINT status;
+    UINT header_length;
+    NX_AZURE_IOT_JSON_WRITER json_writer;
+    AZURE_IOT_STORE_FORWARD* store_forward = &nx_context->store_forward;
+
+    tx_mutex_get(&store_forward->mutex, TX_WAIT_FOREVER);
+
+    if ((status = store_forward_header_write(nx_context, component_name_ptr, &header_length)) ||
+        (status = nx_azure_iot_json_writer_with_buffer_init(&json_writer,
+             &store_forward->record[header_length],
+             sizeof(store_forward->record) - header_length)) ||
+        (status = nx_azure_iot_json_writer_append_begin_object(&json_writer)) ||
+        (status = append_properties(&json_writer)) ||
+        (status = nx_azure_iot_json_writer_append_end_object(&json_writer)))
+    {
+        printf("ERROR: Failed to build stored telemetry (0x%08x)\r\n", status);
+        store_forward->dropped_count++;
+    }
+    else
+    {
+        status = store_forward_push(nx_context, header_length + nx_azure_iot_json_writer_get_bytes_used(&json_writer));
+    }
+
+    tx_mutex_put(&store_forward->mutex);
+
+    return status;
+}
+
+static UINT store_forward_payload(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, UCHAR* payload_ptr, UINT payload_length)
+{
+    UINT status;
+    UINT header_length;
+    AZURE_IOT_STORE_FORWARD* store_forward = &nx_context->store_forward;
+
+    tx_mutex_get(&store_forward->mutex, TX_WAIT_FOREVER);
+
+    if ((status = store_forward_header_write(nx_context, component_name_ptr, &header_length)) == NX_SUCCESS &&
+        header_length + payload_length > sizeof(store_forward->record))
+    {
+        status = NX_SIZE_ERROR;
+    }
+
+    if (status != NX_SUCCESS)
+    {
+        printf("ERROR: Telemetry too large to store (0x%08x)\r\n", status);
+        store_forward->dropped_count++;
+    }
+    else
+    {
+        memcpy(&store_forward->record[header_length], payload_ptr, payload_length);
+        status = store_forward_push(nx_context, header_length + payload_length);
+    }
+
+    tx_mutex_put(&store_forward->mutex);
+
+    return status;
+}
+
+// Format a unix time as an url-encoded ISO 8601 UTC timestamp
+static VOID creation_time_format(ULONG unix_time, CHAR* buffer, UINT buffer_size)
+{
+    // Civil from days, see http://howardhinnant.github.io/date_algorithms.html
+    LONG days   = unix_time / 86400 + 719468;
+    ULONG secs  = unix_time % 86400;
+    LONG era    = days / 146097;
+    ULONG doe   = days - era * 146097;
+    ULONG yoe   = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    ULONG doy   = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    ULONG mp    = (5 * doy + 2) / 153;
+    ULONG day   = doy - (153 * mp + 2) / 5 + 1;
+    ULONG month = mp < 10 ? mp + 3 : mp - 9;
+    ULONG year  = yoe + era * 400 + (month <= 2);
+
+    snprintf(buffer,
+        buffer_size,
+        "%04lu-%02lu-%02luT%02lu%%3A%02lu%%3A%02luZ",
+        year,
+        month,
+        day,
+        secs / 3600,
+        (secs / 60) % 60,
+        secs % 60);
+}
+
+static VOID process_store_forward(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT status;
+    UINT record_length;
+    UINT header_length;
+    ULONG unix_time;
+    CHAR creation_time[32];
+    NX_PACKET* packet_ptr;
+    AZURE_IOT_STORE_FORWARD* store_forward = &nx_context->store_forward;
+
+    if (store_forward->store_ptr == NX_NULL || nx_context->azure_iot_connection_status != NX_SUCCESS ||
+        (tx_time_get() - store_forward->last_replay_ticks) < store_forward->replay_interval_ticks)
+    {
+        return;
+    }
+
+    tx_mutex_get(&store_forward->mutex, TX_WAIT_FOREVER);
+
+    if (client_lock(nx_context))
+    {
+        tx_mutex_put(&store_forward->mutex);
+        return;
+    }
+
+    // Replay one message per interval so the backlog drains without starving live traffic
+    status = store_forward->store_ptr->peek(
+        store_forward->store_ptr, store_forward->record, sizeof(store_forward->record), &record_length);
+
+    if (status != NX_SUCCESS && status != NX_NOT_FOUND)
+    {
+        // A record that cannot be read back would block every record behind it, discard it
+        printf("ERROR: Stored telemetry unreadable, discarded (0x%08x)\r\n", status);
+        store_forward->store_ptr->pop(store_forward->store_ptr);
+        store_forward->dropped_count++;
+    }
+
+    else if (status == NX_SUCCESS)
+    {
+        store_forward->last_replay_ticks = tx_time_get();
+
+        if (record_length < STORE_FORWARD_HEADER_SIZE ||
+            (header_length = STORE_FORWARD_HEADER_SIZE + store_forward->record[STORE_FORWARD_TIME_SIZE]) >
+                record_length)
+        {
+            // Corrupt record, nothing to be done but discard it
+            store_forward->store_ptr->pop(store_forward->store_ptr);
+            store_forward->dropped_count++;
+        }
+
+        else if ((status = telemetry_message_create(nx_context,
+                      (CHAR*)&store_forward->record[STORE_FORWARD_HEADER_SIZE],
+                      store_forward->record[STORE_FORWARD_TIME_SIZE],
+                      &packet_ptr)) == NX_SUCCESS)
+        {
+            // Stamp the message with when it was captured rather than when it was sent
+            if ((unix_time = read_ulong(store_forward->record)) != 0)
+            {
+                creation_time_format(unix_time, creation_time, sizeof(creation_time));
+                if ((status = nx_azure_iot_hub_client_telemetry_property_add(packet_ptr,
+                         creation_time_property,
+                         sizeof(creation_time_property) - 1,
+                         (UCHAR*)creation_time,
+                         strlen(creation_time),
+                         NX_WAIT_FOREVER)))
+                {
+                    printf("Error: Cant set creation time message property (0x%08X)\r\n", status);
+                    nx_azure_iot_hub_client_telemetry_message_delete(packet_ptr);
+                }
+            }
+
+            if (status == NX_SUCCESS &&
+                (status = telemetry_message_send(nx_context,
+                     packet_ptr,
+                     &store_forward->record[header_length],
+                     record_length - header_length)) == NX_SUCCESS)
+            {
+                store_forward->store_ptr->pop(store_forward->store_ptr);
+                store_forward->replayed_count++;
+            }
+        }
+    }
+
+    client_unlock(nx_context);
+    tx_mutex_put(&store_forward->mutex);
+}
+
+UINT azure_iot_nx_client_store_forward_set(
+    AZURE_IOT_NX_CONTEXT* nx_context, AZURE_IOT_STORE* store_ptr, UINT replay_per_second)
+{
+    if (replay_per_second == 0 || replay_per_second > TX_TIMER_TICKS_PER_SECOND)
+    {
+        printf("ERROR: azure_iot_nx_client_store_forward_set invalid replay rate\r\n");
+        return NX_INVALID_PARAMETERS;
+    }
+
+    tx_mutex_get(&nx_context->store_forward.mutex, TX_WAIT_FOREVER);
+    nx_context->store_forward.store_ptr             = store_ptr;
+    nx_context->store_forward.replay_interval_ticks = TX_TIMER_TICKS_PER_SECOND / replay_per_second;
+    tx_mutex_put(&nx_context->store_forward.mutex);
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_dps_assignment_store_set(AZURE_IOT_NX_CONTEXT* nx_context, AZURE_IOT_STORE* store_ptr)
+{
+    if (nx_context == NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    // Read on the next DPS initialize
+    nx_context->dps_assignment.store_ptr = store_ptr;
+    nx_context->dps_assignment.loaded    = false;
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_publish_telemetry(AZURE_IOT_NX_CONTEXT* context_ptr,
+    CHAR* component_name_ptr,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_builder_ptr))
+{
+    UINT status;
+    UINT telemetry_length;
+    NX_PACKET* packet_ptr;
+
+    if ((status = client_lock(context_ptr)))
+    {
+        // Keep the reading for later rather than lose it
+        if (context_ptr->store_forward.store_ptr != NX_NULL)
+        {
+            status = store_forward_telemetry(context_ptr, component_name_ptr, append_properties);
+        }
+
+        return status;
+    }
+
+    if ((status = telemetry_message_build(
+             context_ptr, component_name_ptr, append_properties, &packet_ptr, &telemetry_length)) == NX_SUCCESS &&
+        (status = telemetry_message_send(context_ptr, packet_ptr, context_ptr->telemetry_buffer, telemetry_length)) ==
+            NX_SUCCESS)
+    {
+        printf("Telemetry message sent: %.*s.\r\n", telemetry_length, context_ptr->telemetry_buffer);
+    }
+
+    client_unlock(context_ptr);
+
+    return status;
+}
+
+static VOID process_diagnostics(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT status;
+    NX_PACKET* packet_ptr;
+    NX_AZURE_IOT_JSON_WRITER json_writer;
+    AZURE_IOT_DIAGNOSTICS diagnostics;
+
+    // The counters are totals, so an outage shows up in the first sample after it
+    if (client_lock(nx_context))
+    {
+        return;
+    }
+
+    azure_iot_nx_client_diagnostics_get(nx_context, &diagnostics);
+
+    if ((status = nx_azure_iot_json_writer_with_buffer_init(
+             &json_writer, nx_context->telemetry_buffer, sizeof(nx_context->telemetry_buffer))) ||
+        (status = nx_azure_iot_json_writer_append_begin_object(&json_writer)) ||
+        (status = azure_iot_diagnostics_append(&json_writer, &diagnostics)) ||
+        (status = nx_azure_iot_json_writer_append_end_object(&json_writer)))
+    {
+        printf("ERROR: Failed to build diagnostics (0x%08x)\r\n", status);
+    }
+    else if ((status = telemetry_message_create(nx_context,
+                  AZURE_IOT_DIAGNOSTICS_COMPONENT,
+                  sizeof(AZURE_IOT_DIAGNOSTICS_COMPONENT) - 1,
+                  &packet_ptr)) == NX_SUCCESS)
+    {
+        telemetry_message_send(nx_context,
+            packet_ptr,
+            nx_context->telemetry_buffer,
+            nx_azure_iot_json_writer_get_bytes_used(&json_writer));
+    }
+
+    client_unlock(nx_context);
+}
+
+UINT azure_iot_nx_client_publish_window_set(AZURE_IOT_NX_CONTEXT* nx_context, UINT inflight_max, UINT timeout_seconds)
+{
+    if (inflight_max == 0 || inflight_max > AZURE_IOT_PUBLISH_QUEUE_SIZE || timeout_seconds == 0)
+    {
+        printf("ERROR: azure_iot_nx_client_publish_window_set invalid limits\r\n");
+        return NX_INVALID_PARAMETERS;
+    }
+
+    tx_mutex_get(&nx_context->publish_queue.mutex, TX_WAIT_FOREVER);
+    nx_context->publish_queue.inflight_max  = inflight_max;
+    nx_context->publish_queue.timeout_ticks = timeout_seconds * TX_TIMER_TICKS_PER_SECOND;
+    tx_mutex_put(&nx_context->publish_queue.mutex);
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_publish_telemetry_async(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr),
+    func_ptr_publish_complete complete_cb,
+    VOID* complete_context)
+{
+    AZURE_IOT_PUBLISH_QUEUE* queue = &nx_context->publish_queue;
+    AZURE_IOT_PUBLISH_ENTRY* entry;
+
+    if (append_properties == NX_NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    if (nx_context->azure_iot_connection_status != NX_SUCCESS)
+    {
+        return NX_AZURE_IOT_DISCONNECTED;
+    }
+
+    // The message is built and sent on the send executor, which owns the client while it is connected
+    tx_mutex_get(&queue->mutex, TX_WAIT_FOREVER);
+
+    if (queue->inflight_count + queue->queued_count >= AZURE_IOT_PUBLISH_QUEUE_SIZE)
+    {
+        tx_mutex_put(&queue->mutex);
+        return NX_NO_MORE_ENTRIES;
+    }
+
+    entry = &queue->entries[(queue->head + queue->inflight_count + queue->queued_count) % AZURE_IOT_PUBLISH_QUEUE_SIZE];
+    entry->component_name    = component_name_ptr;
+    entry->append_properties = append_properties;
+    entry->complete_cb       = complete_cb;
+    entry->complete_context  = complete_context;
+    entry->packet_id         = 0;
+    entry->acknowledged      = false;
+    entry->sent_ticks        = 0;
+    queue->queued_count++;
+
+    tx_mutex_put(&queue->mutex);
+
+    tx_event_flags_set(&nx_context->events, HUB_TELEMETRY_SEND_EVENT, TX_OR);
+
+    return NX_SUCCESS;
+}
+
+static UINT telemetry_batch_reset(AZURE_IOT_TELEMETRY_BATCH* batch)
+{
+    UINT status;
+
+    batch->sample_count = 0;
+
+    if ((status = nx_azure_iot_json_writer_with_buffer_init(&batch->json_writer, batch->buffer, batch->max_bytes)) ||
+        (status = nx_azure_iot_json_writer_append_begin_array(&batch->json_writer)))
+    {
+        printf("Error: Failed to initialize telemetry batch (0x%08x)\r\n", status);
+    }
+
+    return status;
+}
+
+// Must be called with the batch mutex held
+static UINT telemetry_batch_flush(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT status;
+    UINT telemetry_length;
+    NX_PACKET* packet_ptr;
+    AZURE_IOT_TELEMETRY_BATCH* batch = &nx_context->telemetry_batch;
+
+    if (batch->sample_count == 0)
+    {
+        return NX_SUCCESS;
+    }
+
+    if ((status = nx_azure_iot_json_writer_append_end_array(&batch->json_writer)))
+    {
+        printf("Error: Failed to close telemetry batch (0x%08x)\r\n", status);
+    }
+    else
+    {
+        telemetry_length = nx_azure_iot_json_writer_get_bytes_used(&batch->json_writer);
+
+        if ((status = client_lock(nx_context)) == NX_SUCCESS)
+        {
+            if ((status = telemetry_message_create(nx_context,
+                     batch->component_name,
+                     batch->component_name != NX_NULL ? strlen(batch->component_name) : 0,
+                     &packet_ptr)) == NX_SUCCESS &&
+                (status = telemetry_message_send(nx_context, packet_ptr, batch->buffer, telemetry_length)) ==
+                    NX_SUCCESS)
+            {
+                printf("Telemetry batch sent: %d samples, %d bytes.\r\n", batch->sample_count, telemetry_length);
+            }
+
+            client_unlock(nx_context);
+        }
+
+        // Offline or a failed send alike, the samples go to the store when there is one
+        if (status != NX_SUCCESS && nx_context->store_forward.store_ptr != NX_NULL)
+        {
+            status = store_forward_payload(nx_context, batch->component_name, batch->buffer, telemetry_length);
+        }
+    }
+
+    // Without a store the samples are dropped on failure
+    telemetry_batch_reset(batch);
+
+    return status;
+}
+
+static UINT telemetry_batch_sample_append(AZURE_IOT_NX_CONTEXT* nx_context,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr))
+{
+    UINT status;
+    ULONG unix_time = 0;
+    AZURE_IOT_TELEMETRY_BATCH* batch = &nx_context->telemetry_batch;
+
+    if (nx_context->unix_time_get != NX_NULL)
+    {
+        nx_context->unix_time_get(&unix_time);
+    }
+
+    if ((status = nx_azure_iot_json_writer_append_begin_object(&batch->json_writer)) ||
+        (status = nx_azure_iot_json_writer_append_property_with_int32_value(
+             &batch->json_writer, (UCHAR*)"ts", sizeof("ts") - 1, (int32_t)unix_time)) ||
+        (status = append_properties(&batch->json_writer)) ||
+        (status = nx_azure_iot_json_writer_append_end_object(&batch->json_writer)))
+    {
+        return status;
+    }
+
+    // Always leave room to close the array
+    if (nx_azure_iot_json_writer_get_bytes_used(&batch->json_writer) >= batch->max_bytes)
+    {
+        return NX_AZURE_IOT_INSUFFICIENT_BUFFER_SPACE;
+    }
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_telemetry_batch_configure(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    UINT max_bytes,
+    UINT max_samples,
+    UINT max_age_seconds)
+{
+    UINT status;
+    AZURE_IOT_TELEMETRY_BATCH* batch = &nx_context->telemetry_batch;
+
+    if (max_bytes == 0 || max_bytes > sizeof(batch->buffer) || max_samples == 0)
+    {
+        printf("ERROR: azure_iot_nx_client_telemetry_batch_configure invalid limits\r\n");
+        return NX_INVALID_PARAMETERS;
+    }
+
+    tx_mutex_get(&batch->mutex, TX_WAIT_FOREVER);
+
+    // Send anything pending under the old configuration first
+    telemetry_batch_flush(nx_context);
+
+    batch->component_name = component_name_ptr;
+    batch->max_bytes      = max_bytes;
+    batch->max_samples    = max_samples;
+    batch->max_age_ticks  = max_age_seconds * TX_TIMER_TICKS_PER_SECOND;
+
+    status = telemetry_batch_reset(batch);
+
+    tx_mutex_put(&batch->mutex);
+
+    return status;
+}
+
+UINT azure_iot_nx_client_telemetry_batch_append(AZURE_IOT_NX_CONTEXT* nx_context,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr))
+{
+    UINT status;
+    NX_AZURE_IOT_JSON_WRITER json_writer_snapshot;
+    AZURE_IOT_TELEMETRY_BATCH* batch = &nx_context->telemetry_batch;
+
+    if (batch->max_samples == 0)
+    {
+        printf("ERROR: telemetry batching has not been configured\r\n");
+        return NX_NOT_ENABLED;
+    }
+
+    tx_mutex_get(&batch->mutex, TX_WAIT_FOREVER);
+
+    // Snapshot the writer so a sample that doesn't fit can be rolled back
+    json_writer_snapshot = batch->json_writer;
+
+    if ((status = telemetry_batch_sample_append(nx_context, append_properties)) ==
+            NX_AZURE_IOT_INSUFFICIENT_BUFFER_SPACE &&
+        batch->sample_count > 0)
+    {
+        // Batch is full, send what we have and retry into an empty batch
+        batch->json_writer = json_writer_snapshot;
+        telemetry_batch_flush(nx_context);
+
+        json_writer_snapshot = batch->json_writer;
+        status               = telemetry_batch_sample_append(nx_context, append_properties);
+    }
+
+    if (status != NX_SUCCESS)
+    {
+        // Roll back only this sample, the ones already pending stay in the batch
+        printf("Error: Failed to append telemetry sample (0x%08x)\r\n", status);
+        batch->json_writer = json_writer_snapshot;
+        tx_mutex_put(&batch->mutex);
+        return status;
+    }
+
+    if (batch->sample_count++ == 0)
+    {
+        batch->first_sample_ticks = tx_time_get();
+    }
+
+    if (batch->sample_count >= batch->max_samples)
+    {
+        status = telemetry_batch_flush(nx_context);
+    }
+
+    tx_mutex_put(&batch->mutex);
+
+    return status;
+}
+
+UINT azure_iot_nx_client_telemetry_batch_flush(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT status;
+
+    tx_mutex_get(&nx_context->telemetry_batch.mutex, TX_WAIT_FOREVER);
+    status = telemetry_batch_flush(nx_context);
+    tx_mutex_put(&nx_context->telemetry_batch.mutex);
+
+    return status;
+}
+
+static VOID process_telemetry_batch_age(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    AZURE_IOT_TELEMETRY_BATCH* batch = &nx_context->telemetry_batch;
+
+    if (batch->max_age_ticks == 0 || nx_context->azure_iot_connection_status != NX_SUCCESS)
+    {
+        return;
+    }
+
+    tx_mutex_get(&batch->mutex, TX_WAIT_FOREVER);
+
+    if (batch->sample_count > 0 && (tx_time_get() - batch->first_sample_ticks) >= batch->max_age_ticks)
+    {
+        telemetry_batch_flush(nx_context);
+    }
+
+    tx_mutex_put(&batch->mutex);
+}
+
+static bool reported_property_equal(AZURE_IOT_REPORTED_PROPERTY* entry, AZURE_IOT_REPORTED_PROPERTY* update)
+{
+    if (entry->type != update->type || entry->ack_status != update->ack_status ||
+        entry->ack_version != update->ack_version)
+    {
+        return false;
+    }
+
+    switch (entry->type)
+    {
+        case AZURE_IOT_PROPERTY_TYPE_BOOL:
+            return entry->value.bool_value == update->value.bool_value;
+
+        case AZURE_IOT_PROPERTY_TYPE_INT:
+            return entry->value.int_value == update->value.int_value;
+
+        case AZURE_IOT_PROPERTY_TYPE_STRING:
+            return strcmp(entry->value.string_value, update->value.string_value) == 0;
+
+        default:
+            // Appended properties are opaque, always send them again
+            return false;
+    }
+}
+
+// Update the cached value, marking it dirty if it changed
+static UINT reported_property_set(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    CHAR* property_ptr,
+    AZURE_IOT_REPORTED_PROPERTY* update)
+{
+    AZURE_IOT_REPORTED_PROPERTIES* cache = &nx_context->reported_properties;
+    AZURE_IOT_REPORTED_PROPERTY* entry   = NX_NULL;
+    bool is_append                       = update->type == AZURE_IOT_PROPERTY_TYPE_APPEND;
+    bool changed                         = true;
+    UINT i;
+
+    if (strlen(property_ptr) >= sizeof(update->name))
+    {
+        printf("ERROR: reported property name too long (%s)\r\n", property_ptr);
+        return NX_SIZE_ERROR;
+    }
+
+    tx_mutex_get(&cache->mutex, TX_WAIT_FOREVER);
+
+    for (i = 0; i < cache->entry_count; ++i)
+    {
+        entry = &cache->entries[i];
+        if (reported_property_component_match(entry->component_name, component_name_ptr) &&
+            strcmp(entry->name, property_ptr) == 0 && (entry->type == AZURE_IOT_PROPERTY_TYPE_APPEND) == is_append &&
+            (!is_append || entry->value.append_properties == update->value.append_properties))
+        {
+            changed = !reported_property_equal(entry, update);
+            break;
+        }
+    }
+
+    if (i == cache->entry_count)
+    {
+        if (cache->entry_count == AZURE_IOT_REPORTED_PROPERTY_COUNT)
+        {
+            tx_mutex_put(&cache->mutex);
+            printf("ERROR: reported property cache is full (%s)\r\n", property_ptr);
+            return NX_NO_MORE_ENTRIES;
+        }
+
+        entry = &cache->entries[cache->entry_count++];
+        memset(entry, 0, sizeof(AZURE_IOT_REPORTED_PROPERTY));
+        entry->component_name = component_name_ptr;
+        strcpy(entry->name, property_ptr);
+    }
+
+    if (changed)
+    {
+        entry->type          = update->type;
+        entry->value         = update->value;
+        entry->ack_status    = update->ack_status;
+        entry->ack_version   = update->ack_version;
+        entry->dirty         = true;
+        cache->flush_pending = true;
+    }
+
+    tx_mutex_put(&cache->mutex);
+
+    if (changed)
+    {
+        // Wake the client thread, everything set before it runs goes in the same PATCH
+        tx_event_flags_set(&nx_context->events, HUB_REPORTED_PROPERTIES_EVENT, TX_OR);
+    }
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_reported_property_bool_set(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, CHAR* property_ptr, bool value)
+{
+    AZURE_IOT_REPORTED_PROPERTY update = {0};
+
+    update.type             = AZURE_IOT_PROPERTY_TYPE_BOOL;
+    update.value.bool_value = value;
+
+    return reported_property_set(nx_context, component_name_ptr, property_ptr, &update);
+}
+
+UINT azure_iot_nx_client_reported_property_int_set(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, CHAR* property_ptr, INT value)
+{
+    AZURE_IOT_REPORTED_PROPERTY update = {0};
+
+    update.type            = AZURE_IOT_PROPERTY_TYPE_INT;
+    update.value.int_value = value;
+
+    return reported_property_set(nx_context, component_name_ptr, property_ptr, &update);
+}
+
+UINT azure_iot_nx_client_reported_property_string_set(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, CHAR* property_ptr, CHAR* value)
+{
+    AZURE_IOT_REPORTED_PROPERTY update = {0};
+
+    if (strlen(value) >= sizeof(update.value.string_value))
+    {
+        printf("ERROR: reported property value too long (%s)\r\n", property_ptr);
+        return NX_SIZE_ERROR;
+    }
+
+    update.type = AZURE_IOT_PROPERTY_TYPE_STRING;
+    strcpy(update.value.string_value, value);
+
+    return reported_property_set(nx_context, component_name_ptr, property_ptr, &update);
+}
+
+UINT azure_iot_nx_client_reported_properties_flush(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    tx_mutex_get(&nx_context->reported_properties.mutex, TX_WAIT_FOREVER);
+    nx_context->reported_properties.flush_pending = true;
+    tx_mutex_put(&nx_context->reported_properties.mutex);
+
+    // The send executor builds the PATCH, once connected with a request slot free
+    return tx_event_flags_set(&nx_context->events, HUB_REPORTED_PROPERTIES_EVENT, TX_OR);
+}
+
+UINT azure_iot_nx_client_publish_properties(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr))
+{
+    AZURE_IOT_REPORTED_PROPERTY update = {0};
+
+    update.type                    = AZURE_IOT_PROPERTY_TYPE_APPEND;
+    update.value.append_properties = append_properties;
+
+    return reported_property_set(nx_context, component_name_ptr, "", &update);
+}
+
+UINT azure_iot_nx_client_publish_bool_property(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, CHAR* property_ptr, bool value)
+{
+    return azure_iot_nx_client_reported_property_bool_set(nx_context, component_name_ptr, property_ptr, value);
+}
+
+UINT azure_nx_client_respond_int_writable_property(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    CHAR* property_ptr,
+    INT value,
+    INT http_status,
+    INT version)
+{
+    AZURE_IOT_REPORTED_PROPERTY update = {0};
+
+    update.type            = AZURE_IOT_PROPERTY_TYPE_INT;
+    update.value.int_value = value;
+    update.ack_status      = http_status;
+    update.ack_version     = version;
+
+    return reported_property_set(nx_context, component_name_ptr, property_ptr, &update);
+}
+
+UINT azure_iot_nx_client_publish_int_writable_property(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_ptr, CHAR* property_ptr, UINT value)
+{
+    // Pass in a version of 1, as we a reporting the writable property, not responding to a server request
+    return azure_nx_client_respond_int_writable_property(nx_context, component_ptr, property_ptr, value, 200, 1);
+}
+
+UINT azure_iot_nx_client_register_command(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    CHAR* command_name_ptr,
+    func_ptr_command_handler handler)
+{
+    UINT component_name_length;
+    AZURE_IOT_COMMAND_ENTRY* entry;
+
+    if (nx_context == NULL || command_name_ptr == NULL || handler == NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    // Root commands arrive with an empty component name
+    component_name_length = component_name_ptr != NULL ? strlen(component_name_ptr) : 0;
+
+    entry = command_slot_find(nx_context,
+        (UCHAR*)component_name_ptr,
+        component_name_length,
+        (UCHAR*)command_name_ptr,
+        strlen(command_name_ptr));
+
+    if (entry->handler == NX_NULL)
+    {
+        if (nx_context->command_count == AZURE_IOT_COMMAND_TABLE_SIZE - 1)
+        {
+            printf("ERROR: command table is full (%s)\r\n", command_name_ptr);
+            return NX_NO_MORE_ENTRIES;
+        }
+
+        entry->component_name        = component_name_ptr;
+        entry->component_name_length = component_name_length;
+        entry->command_name          = command_name_ptr;
+        entry->command_name_length   = strlen(command_name_ptr);
+        entry->hash                  = name_pair_hash(
+            (UCHAR*)component_name_ptr, component_name_length, (UCHAR*)command_name_ptr, entry->command_name_length);
+        nx_context->command_count++;
+    }
+
+    // Registering a command again replaces its handler
+    entry->handler = handler;
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_command_logging_set(AZURE_IOT_NX_CONTEXT* nx_context, bool enable)
+{
+    if (nx_context == NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    nx_context->command_logging = enable;
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_command_stats_get(AZURE_IOT_NX_CONTEXT* nx_context, AZURE_IOT_COMMAND_STATS* stats, bool reset)
+{
+    TX_INTERRUPT_SAVE_AREA
+
+    if (nx_context == NULL || stats == NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    TX_DISABLE
+    *stats = nx_context->command_stats.stats;
+
+    if (reset)
+    {
+        memset(&nx_context->command_stats.stats, 0, sizeof(AZURE_IOT_COMMAND_STATS));
+    }
+    TX_RESTORE
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_tls_stats_get(
+    AZURE_IOT_NX_CONTEXT* nx_context, AZURE_IOT_TLS_STATS* hub_stats, AZURE_IOT_TLS_STATS* dps_stats)
+{
+    if (nx_context == NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    if (hub_stats != NULL)
+    {
+        *hub_stats = nx_context->hub_tls_stats;
+    }
+
+    if (dps_stats != NULL)
+    {
+        *dps_stats = nx_context->dps_tls_stats;
+    }
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_connection_policy_set(
+    AZURE_IOT_NX_CONTEXT* nx_context, CONNECTION_FAILURE_CLASS failure_class, const CONNECTION_POLICY* policy)
+{
+    if (nx_context == NULL || policy == NULL || failure_class >= CONNECTION_FAILURE_CLASS_COUNT)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    connection_policy_set(&nx_context->connection_policy, failure_class, policy);
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_connection_stats_get(AZURE_IOT_NX_CONTEXT* nx_context, CONNECTION_POLICY_STATS* stats)
+{
+    if (nx_context == NULL || stats == NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    *stats = nx_context->connection_policy.stats;
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_diagnostics_enable(AZURE_IOT_NX_CONTEXT* nx_context, UINT interval_seconds)
+{
+    UINT status;
+    ULONG ticks = interval_seconds * TX_TIMER_TICKS_PER_SECOND;
+
+    if (nx_context == NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    if (!nx_context->diagnostics.timer_created)
+    {
+        if (interval_seconds == 0)
+        {
+            return NX_SUCCESS;
+        }
+
+        if ((status = azure_iot_nx_client_add_component(nx_context, AZURE_IOT_DIAGNOSTICS_COMPONENT)))
+        {
+            printf("ERROR: Failed to add the diagnostics component (0x%08x)\r\n", status);
+        }
+
+        else if ((status = tx_timer_create(&nx_context->diagnostics.timer,
+                      "diagnostics_timer",
+                      diagnostics_timer_entry,
+                      (ULONG)nx_context,
+                      ticks,
+                      ticks,
+                      TX_AUTO_ACTIVATE)))
+        {
+            printf("ERROR: tx_timer_create (0x%08x)\r\n", status);
+            nx_context->azure_iot_component_count--;
+        }
+
+        else
+        {
+            nx_context->diagnostics.timer_created = true;
+        }
+
+        return status;
+    }
+
+    if ((status = tx_timer_deactivate(&nx_context->diagnostics.timer)))
+    {
+        printf("ERROR: tx_timer_deactivate (0x%08x)\r\n", status);
+    }
+
+    else if (interval_seconds > 0 && (status = tx_timer_change(&nx_context->diagnostics.timer, ticks, ticks)))
+    {
+        printf("ERROR: tx_timer_change (0x%08x)\r\n", status);
+    }
+
+    else if (interval_seconds > 0 && (status = tx_timer_activate(&nx_context->diagnostics.timer)))
+    {
+        printf("ERROR: tx_timer_activate (0x%08x)\r\n", status);
     }
 
     return status;
 }
 
-UINT azure_nx_client_respond_int_writable_property(AZURE_IOT_NX_CONTEXT* nx_context,
-    CHAR* component_name_ptr,
-    CHAR* property_ptr,
-    INT value,
-    INT http_status,
-    INT version)
+UINT azure_iot_nx_client_diagnostics_get(AZURE_IOT_NX_CONTEXT* nx_context, AZURE_IOT_DIAGNOSTICS* diagnostics)
 {
-    UINT status;
-    NX_AZURE_IOT_JSON_WRITER json_writer;
-    NX_PACKET* packet_ptr;
+    CONNECTION_POLICY_STATS* connection_stats;
 
-    if ((status = reported_properties_begin(nx_context, &json_writer, &packet_ptr, component_name_ptr)) ||
+    if (nx_context == NULL || diagnostics == NULL)
+    {
+        return NX_PTR_ERROR;
+    }
 
-        (status = nx_azure_iot_hub_client_reported_properties_status_begin(&nx_context->iothub_client,
-             &json_writer,
-             (const UCHAR*)property_ptr,
-             strlen(property_ptr),
-             http_status,
-             version,
-             NULL,
-             0)) ||
+    azure_iot_diagnostics_sample(nx_context->azure_iot_nx_ip, diagnostics);
 
-        (status = nx_azure_iot_json_writer_append_int32(&json_writer, value)) ||
+    diagnostics->tls_handshakes = nx_context->hub_tls_stats.full_count;
+    diagnostics->tls_last_ms    = nx_context->hub_tls_stats.last_ticks * 1000 / TX_TIMER_TICKS_PER_SECOND;
 
-        (status = nx_azure_iot_hub_client_reported_properties_status_end(&nx_context->iothub_client, &json_writer)) ||
+    connection_stats              = &nx_context->connection_policy.stats;
+    diagnostics->connect_attempts = connection_stats->attempt_count;
+    diagnostics->auth_failures    = connection_stats->failure_count[CONNECTION_FAILURE_AUTH];
+    diagnostics->outages          = connection_stats->outage_count;
+    diagnostics->outage_ms        = (ULONG)connection_stats->outage_total_ms;
 
-        (status = reported_properties_end(nx_context, &json_writer, &packet_ptr, component_name_ptr)))
+    for (UINT i = 0; i < CONNECTION_FAILURE_CLASS_COUNT; ++i)
     {
-        printf("ERROR: azure_nx_client_respond_int_writable_property (0x%08x)", status);
-        nx_packet_release(packet_ptr);
+        diagnostics->connect_failures += connection_stats->failure_count[i];
     }
 
-    return status;
-}
-
-UINT azure_iot_nx_client_publish_int_writable_property(
-    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_ptr, CHAR* property_ptr, UINT value)
-{
-    // Pass in a version of 1, as we a reporting the writable property, not responding to a server request
-    return azure_nx_client_respond_int_writable_property(nx_context, component_ptr, property_ptr, value, 200, 1);
+    return NX_SUCCESS;
 }
 
 UINT azure_iot_nx_client_register_command_callback(AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_command_received callback)
@@ -892,27 +2672,65 @@ UINT azure_iot_nx_client_register_command_callback(AZURE_IOT_NX_CONTEXT* nx_cont
     return NX_SUCCESS;
 }
 
-UINT azure_iot_nx_client_register_writable_property_callback(
-    AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_writable_property_received callback)
+UINT azure_iot_nx_client_register_property(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, CHAR* property_name_ptr, UINT property_id)
 {
-    if (nx_context == NULL || nx_context->writable_property_received_cb != NULL)
+    UINT component_name_length;
+    UINT property_name_length;
+    AZURE_IOT_PROPERTY_ENTRY* entry;
+
+    if (nx_context == NULL || property_name_ptr == NULL)
     {
         return NX_PTR_ERROR;
     }
 
-    nx_context->writable_property_received_cb = callback;
+    component_name_length = component_name_ptr != NULL ? strlen(component_name_ptr) : 0;
+    property_name_length  = strlen(property_name_ptr);
+
+    if (property_name_length >= AZURE_IOT_PROPERTY_NAME_SIZE)
+    {
+        printf("ERROR: property name too long (%s)\r\n", property_name_ptr);
+        return NX_SIZE_ERROR;
+    }
+
+    entry = property_slot_find(nx_context,
+        (UCHAR*)component_name_ptr,
+        component_name_length,
+        (UCHAR*)property_name_ptr,
+        property_name_length);
+
+    if (entry->property_name == NX_NULL)
+    {
+        if (nx_context->property_count == AZURE_IOT_PROPERTY_TABLE_SIZE - 1)
+        {
+            printf("ERROR: property table is full (%s)\r\n", property_name_ptr);
+            return NX_NO_MORE_ENTRIES;
+        }
+
+        entry->component_name        = component_name_ptr;
+        entry->component_name_length = component_name_length;
+        entry->property_name         = property_name_ptr;
+        entry->property_name_length  = property_name_length;
+        entry->hash                  = name_pair_hash(
+            (UCHAR*)component_name_ptr, component_name_length, (UCHAR*)property_name_ptr, property_name_length);
+        nx_context->property_count++;
+    }
+
+    // Registering a property again replaces its id
+    entry->property_id = property_id;
+
     return NX_SUCCESS;
 }
 
-UINT azure_iot_nx_client_register_property_callback(
-    AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_property_received callback)
+UINT azure_iot_nx_client_register_property_update_callback(
+    AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_property_update callback)
 {
-    if (nx_context == NULL || nx_context->property_received_cb != NULL)
+    if (nx_context == NULL || nx_context->property_update_cb != NULL)
     {
         return NX_PTR_ERROR;
     }
 
-    nx_context->property_received_cb = callback;
+    nx_context->property_update_cb = callback;
     return NX_SUCCESS;
 }
 
@@ -928,6 +2746,18 @@ UINT azure_iot_nx_client_register_properties_complete_callback(
     return NX_SUCCESS;
 }
 
+UINT azure_iot_nx_client_register_properties_reported_callback(
+    AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_properties_reported callback)
+{
+    if (nx_context == NULL || nx_context->properties_reported_cb != NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    nx_context->properties_reported_cb = callback;
+    return NX_SUCCESS;
+}
+
 UINT azure_iot_nx_client_register_timer_callback(
     AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_timer callback, int32_t interval)
 {
@@ -1007,10 +2837,49 @@ UINT azure_iot_nx_client_cert_set(AZURE_IOT_NX_CONTEXT* nx_context,
     return NX_SUCCESS;
 }
 
-UINT azure_iot_nx_client_create(AZURE_IOT_NX_CONTEXT* nx_context,
+UINT azure_iot_nx_client_module_id_set(AZURE_IOT_NX_CONTEXT* nx_context, CHAR* module_id)
+{
+    UINT module_id_len;
+
+    if (nx_context == NX_NULL || module_id == NX_NULL)
+    {
+        printf("ERROR: azure_iot_nx_client_module_id_set module id is null\r\n");
+        return NX_PTR_ERROR;
+    }
+
+    module_id_len = strlen(module_id);
+    if (module_id_len >= AZURE_IOT_MODULE_ID_SIZE)
+    {
+        printf("ERROR: azure_iot_nx_client_module_id_set module id exceeds buffer size\r\n");
+        return NX_SIZE_ERROR;
+    }
+
+    memcpy(nx_context->azure_iot_hub_module_id, module_id, module_id_len);
+    nx_context->azure_iot_hub_module_id_len = module_id_len;
+
+    return NX_SUCCESS;
+}
+
+static VOID client_context_delete(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    tx_event_flags_delete(&nx_context->events);
+    tx_mutex_delete(&nx_context->telemetry_batch.mutex);
+    tx_mutex_delete(&nx_context->publish_queue.mutex);
+    tx_mutex_delete(&nx_context->store_forward.mutex);
+    tx_mutex_delete(&nx_context->reported_properties.mutex);
+    tx_mutex_delete(&nx_context->client_mutex);
+    tx_timer_delete(&nx_context->periodic_timer);
+
+    if (nx_context->diagnostics.timer_created)
+    {
+        tx_timer_delete(&nx_context->diagnostics.timer);
+        nx_context->diagnostics.timer_created = false;
+    }
+}
+
+// Everything a client owns apart from its azure iot instance
+static UINT client_context_create(AZURE_IOT_NX_CONTEXT* nx_context,
     NX_IP* nx_ip,
-    NX_PACKET_POOL* nx_pool,
-    NX_DNS* nx_dns,
     UINT (*unix_time_callback)(ULONG* unix_time),
     CHAR* iot_model_id,
     UINT iot_model_id_len)
@@ -1031,6 +2900,13 @@ UINT azure_iot_nx_client_create(AZURE_IOT_NX_CONTEXT* nx_context,
     nx_context->azure_iot_nx_ip             = nx_ip;
     nx_context->azure_iot_model_id          = iot_model_id;
     nx_context->azure_iot_model_id_len      = iot_model_id_len;
+    nx_context->unix_time_get               = unix_time_callback;
+
+    nx_context->publish_queue.inflight_max  = AZURE_IOT_PUBLISH_INFLIGHT_DEFAULT;
+    nx_context->publish_queue.timeout_ticks = AZURE_IOT_PUBLISH_TIMEOUT_DEFAULT * TX_TIMER_TICKS_PER_SECOND;
+
+    // Seeded from the device identity on the first connect, once it is known
+    connection_policy_init(&nx_context->connection_policy);
 
     // Initialize CA root certificates
     if ((status = nx_secure_x509_certificate_initialize(&nx_context->root_ca_cert,
@@ -1074,6 +2950,47 @@ UINT azure_iot_nx_client_create(AZURE_IOT_NX_CONTEXT* nx_context,
         printf("ERROR: tx_event_flags_creates (0x%08x)\r\n", status);
     }
 
+    else if ((status = tx_mutex_create(&nx_context->telemetry_batch.mutex, "telemetry_batch", TX_NO_INHERIT)))
+    {
+        printf("ERROR: tx_mutex_create (0x%08x)\r\n", status);
+        tx_event_flags_delete(&nx_context->events);
+    }
+
+    else if ((status = tx_mutex_create(&nx_context->publish_queue.mutex, "publish_queue", TX_NO_INHERIT)))
+    {
+        printf("ERROR: tx_mutex_create (0x%08x)\r\n", status);
+        tx_event_flags_delete(&nx_context->events);
+        tx_mutex_delete(&nx_context->telemetry_batch.mutex);
+    }
+
+    else if ((status = tx_mutex_create(&nx_context->store_forward.mutex, "store_forward", TX_NO_INHERIT)))
+    {
+        printf("ERROR: tx_mutex_create (0x%08x)\r\n", status);
+        tx_event_flags_delete(&nx_context->events);
+        tx_mutex_delete(&nx_context->telemetry_batch.mutex);
+        tx_mutex_delete(&nx_context->publish_queue.mutex);
+    }
+
+    else if ((status = tx_mutex_create(&nx_context->reported_properties.mutex, "reported_properties", TX_NO_INHERIT)))
+    {
+        printf("ERROR: tx_mutex_create (0x%08x)\r\n", status);
+        tx_event_flags_delete(&nx_context->events);
+        tx_mutex_delete(&nx_context->telemetry_batch.mutex);
+        tx_mutex_delete(&nx_context->publish_queue.mutex);
+        tx_mutex_delete(&nx_context->store_forward.mutex);
+    }
+
+    // Inherit so a reconnect is not held up by the lower priority send executor
+    else if ((status = tx_mutex_create(&nx_context->client_mutex, "client", TX_INHERIT)))
+    {
+        printf("ERROR: tx_mutex_create (0x%08x)\r\n", status);
+        tx_event_flags_delete(&nx_context->events);
+        tx_mutex_delete(&nx_context->telemetry_batch.mutex);
+        tx_mutex_delete(&nx_context->publish_queue.mutex);
+        tx_mutex_delete(&nx_context->store_forward.mutex);
+        tx_mutex_delete(&nx_context->reported_properties.mutex);
+    }
+
     else if ((status = tx_timer_create(&nx_context->periodic_timer,
                   "periodic_timer",
                   periodic_timer_entry,
@@ -1084,36 +3001,201 @@ UINT azure_iot_nx_client_create(AZURE_IOT_NX_CONTEXT* nx_context,
     {
         printf("ERROR: tx_timer_create (0x%08x)\r\n", status);
         tx_event_flags_delete(&nx_context->events);
+        tx_mutex_delete(&nx_context->telemetry_batch.mutex);
+        tx_mutex_delete(&nx_context->publish_queue.mutex);
+        tx_mutex_delete(&nx_context->store_forward.mutex);
+        tx_mutex_delete(&nx_context->reported_properties.mutex);
+        tx_mutex_delete(&nx_context->client_mutex);
+    }
+
+    return status;
+}
+
+UINT azure_iot_nx_client_create(AZURE_IOT_NX_CONTEXT* nx_context,
+    NX_IP* nx_ip,
+    NX_PACKET_POOL* nx_pool,
+    NX_DNS* nx_dns,
+    UINT (*unix_time_callback)(ULONG* unix_time),
+    CHAR* iot_model_id,
+    UINT iot_model_id_len)
+{
+    UINT status;
+
+    if ((status = client_context_create(nx_context, nx_ip, unix_time_callback, iot_model_id, iot_model_id_len)))
+    {
+        return status;
+    }
+
+    // Create Azure IoT handler, owned by this client
+    if ((status = nx_azure_iot_create(&nx_context->runtime.nx_azure_iot,
+             (UCHAR*)"Azure IoT",
+             nx_ip,
+             nx_pool,
+             nx_dns,
+             nx_context->runtime_thread_stack,
+             sizeof(nx_context->runtime_thread_stack),
+             NX_AZURE_IOT_THREAD_PRIORITY,
+             unix_time_callback)))
+    {
+        printf("ERROR: failed on nx_azure_iot_create (0x%08x)\r\n", status);
+        client_context_delete(nx_context);
+        return status;
+    }
+
+    nx_context->nx_azure_iot_ptr = &nx_context->runtime.nx_azure_iot;
+
+    return NX_SUCCESS;
+}
+
+UINT azure_iot_nx_client_gateway_create(AZURE_IOT_NX_GATEWAY* gateway,
+    NX_IP* nx_ip,
+    NX_PACKET_POOL* nx_pool,
+    NX_DNS* nx_dns,
+    UINT (*unix_time_callback)(ULONG* unix_time),
+    UINT (*network_connect)(UINT))
+{
+    UINT status;
+
+    if (gateway == NX_NULL || network_connect == NX_NULL)
+    {
+        printf("ERROR: azure_iot_nx_client_gateway_create gateway or network connect is null\r\n");
+        return NX_PTR_ERROR;
+    }
+
+    memset(gateway, 0, sizeof(AZURE_IOT_NX_GATEWAY));
+
+    gateway->nx_ip           = nx_ip;
+    gateway->unix_time_get   = unix_time_callback;
+    gateway->network_connect = network_connect;
+
+    if ((status = tx_mutex_create(&gateway->network_mutex, "gateway_network", TX_NO_INHERIT)))
+    {
+        printf("ERROR: tx_mutex_create (0x%08x)\r\n", status);
     }
 
-    // Create Azure IoT handler
-    else if ((status = nx_azure_iot_create(&nx_context->nx_azure_iot,
-                  (UCHAR*)"Azure IoT",
+    // Create Azure IoT handler, shared by every client of the gateway
+    else if ((status = nx_azure_iot_create(&gateway->nx_azure_iot,
+                  (UCHAR*)"Azure IoT gateway",
                   nx_ip,
                   nx_pool,
                   nx_dns,
-                  nx_context->nx_azure_iot_thread_stack,
-                  sizeof(nx_context->nx_azure_iot_thread_stack),
+                  gateway->nx_azure_iot_thread_stack,
+                  sizeof(gateway->nx_azure_iot_thread_stack),
                   NX_AZURE_IOT_THREAD_PRIORITY,
                   unix_time_callback)))
     {
         printf("ERROR: failed on nx_azure_iot_create (0x%08x)\r\n", status);
-        tx_event_flags_delete(&nx_context->events);
-        tx_timer_delete(&nx_context->periodic_timer);
+        tx_mutex_delete(&gateway->network_mutex);
     }
 
     return status;
 }
 
+UINT azure_iot_nx_client_gateway_add(
+    AZURE_IOT_NX_GATEWAY* gateway, AZURE_IOT_NX_CONTEXT* nx_context, CHAR* iot_model_id, UINT iot_model_id_len)
+{
+    UINT status;
+
+    if (gateway == NX_NULL)
+    {
+        printf("ERROR: azure_iot_nx_client_gateway_add gateway is null\r\n");
+        return NX_PTR_ERROR;
+    }
+
+    if ((status = client_context_create(
+             nx_context, gateway->nx_ip, gateway->unix_time_get, iot_model_id, iot_model_id_len)))
+    {
+        return status;
+    }
+
+    nx_context->gateway          = gateway;
+    nx_context->nx_azure_iot_ptr = &gateway->nx_azure_iot;
+
+    return NX_SUCCESS;
+}
+
+// Send executor, runs the telemetry callback and everything that publishes so slow sends never hold up commands
+static VOID send_thread_entry(ULONG parameter)
+{
+    AZURE_IOT_NX_CONTEXT* nx_context = (AZURE_IOT_NX_CONTEXT*)parameter;
+    ULONG app_events;
+    ULONG wait_ticks;
+
+    while (true)
+    {
+        // There is no PUBACK notification, so poll while publishes are in flight
+        wait_ticks = publish_queue_poll_ticks(nx_context);
+
+        // Wake in time for the next stored message replay
+        if (nx_context->store_forward.store_ptr != NX_NULL &&
+            nx_context->store_forward.replay_interval_ticks < wait_ticks &&
+            nx_context->store_forward.store_ptr->count(nx_context->store_forward.store_ptr) > 0)
+        {
+            wait_ticks = nx_context->store_forward.replay_interval_ticks;
+        }
+
+        app_events = 0;
+        tx_event_flags_get(&nx_context->events, HUB_SEND_EVENTS, TX_OR_CLEAR, &app_events, wait_ticks);
+
+        if (app_events & HUB_PERIODIC_TIMER_EVENT)
+        {
+            process_timer_event(nx_context);
+        }
+
+        if (app_events & HUB_DIAGNOSTICS_EVENT)
+        {
+            process_diagnostics(nx_context);
+        }
+
+        // Complete acknowledged publishes and send what is queued
+        process_publish_queue(nx_context);
+
+        // Settle reported property responses and send any dirty properties
+        process_reported_properties(nx_context);
+
+        // Replay telemetry stored while disconnected
+        process_store_forward(nx_context);
+
+        // Send any telemetry batch that has been waiting too long
+        process_telemetry_batch_age(nx_context);
+    }
+}
+
+// Receive executor, runs on the calling thread and dispatches connection, command and property events
 static UINT client_run(
-    AZURE_IOT_NX_CONTEXT* nx_context, UINT (*iot_initialize)(AZURE_IOT_NX_CONTEXT*), UINT (*network_connect)())
+    AZURE_IOT_NX_CONTEXT* nx_context, UINT (*iot_initialize)(AZURE_IOT_NX_CONTEXT*), UINT (*network_connect)(UINT))
 {
+    UINT status;
+    UINT run_priority = NX_AZURE_IOT_THREAD_PRIORITY;
     ULONG app_events;
+    TX_THREAD* run_thread = tx_thread_identify();
+
+    if (run_thread != NX_NULL)
+    {
+        tx_thread_info_get(run_thread, NX_NULL, NX_NULL, NX_NULL, &run_priority, NX_NULL, NX_NULL, NX_NULL, NX_NULL);
+    }
+
+    // Send one priority level below the receive path
+
+    if ((status = tx_thread_create(&nx_context->azure_iot_thread,
+             "Azure IoT send",
+             send_thread_entry,
+             (ULONG)nx_context,
+             nx_context->azure_iot_thread_stack,
+             sizeof(nx_context->azure_iot_thread_stack),
+             run_priority + 1,
+             run_priority + 1,
+             TX_NO_TIME_SLICE,
+             TX_AUTO_START)))
+    {
+        printf("ERROR: send thread create (0x%08x)\r\n", status);
+        return status;
+    }
 
     while (true)
     {
         app_events = 0;
-        tx_event_flags_get(&nx_context->events, HUB_ALL_EVENTS, TX_OR_CLEAR, &app_events, NX_IP_PERIODIC_RATE);
+        tx_event_flags_get(&nx_context->events, HUB_RECEIVE_EVENTS, TX_OR_CLEAR, &app_events, NX_IP_PERIODIC_RATE);
 
         if (app_events & HUB_DISCONNECT_EVENT)
         {
@@ -1125,9 +3207,9 @@ static UINT client_run(
             process_connect(nx_context);
         }
 
-        if (app_events & HUB_PERIODIC_TIMER_EVENT)
+        if (app_events & HUB_COMMAND_RECEIVE_EVENT)
         {
-            process_timer_event(nx_context);
+            process_command(nx_context);
         }
 
         if (app_events & HUB_PROPERTIES_COMPLETE_EVENT)
@@ -1135,11 +3217,6 @@ static UINT client_run(
             process_properties_complete(nx_context);
         }
 
-        if (app_events & HUB_COMMAND_RECEIVE_EVENT)
-        {
-            process_command(nx_context);
-        }
-
         if (app_events & HUB_PROPERTIES_RECEIVE_EVENT)
         {
             process_properties(nx_context);
@@ -1157,8 +3234,7 @@ static UINT client_run(
     return NX_SUCCESS;
 }
 
-UINT azure_iot_nx_client_hub_run(
-    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* iot_hub_hostname, CHAR* iot_hub_device_id, UINT (*network_connect)())
+static UINT hub_config_set(AZURE_IOT_NX_CONTEXT* nx_context, CHAR* iot_hub_hostname, CHAR* iot_hub_device_id)
 {
     if (iot_hub_hostname == 0 || iot_hub_device_id == 0)
     {
@@ -1173,16 +3249,15 @@ UINT azure_iot_nx_client_hub_run(
     }
 
     // take a copy of the hub config
-    memcpy(nx_context->azure_iot_hub_hostname, iot_hub_hostname, AZURE_IOT_HOST_NAME_SIZE);
-    memcpy(nx_context->azure_iot_hub_device_id, iot_hub_device_id, AZURE_IOT_DEVICE_ID_SIZE);
     nx_context->azure_iot_hub_hostname_len  = strlen(iot_hub_hostname);
     nx_context->azure_iot_hub_device_id_len = strlen(iot_hub_device_id);
+    memcpy(nx_context->azure_iot_hub_hostname, iot_hub_hostname, nx_context->azure_iot_hub_hostname_len);
+    memcpy(nx_context->azure_iot_hub_device_id, iot_hub_device_id, nx_context->azure_iot_hub_device_id_len);
 
-    return client_run(nx_context, iot_hub_initialize, network_connect);
+    return NX_SUCCESS;
 }
 
-UINT azure_iot_nx_client_dps_run(
-    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* dps_id_scope, CHAR* dps_registration_id, UINT (*network_connect)())
+static UINT dps_config_set(AZURE_IOT_NX_CONTEXT* nx_context, CHAR* dps_id_scope, CHAR* dps_registration_id)
 {
     if (dps_id_scope == 0 || dps_registration_id == 0)
     {
@@ -1196,5 +3271,100 @@ UINT azure_iot_nx_client_dps_run(
     nx_context->azure_iot_dps_id_scope_len        = strlen(dps_id_scope);
     nx_context->azure_iot_dps_registration_id_len = strlen(dps_registration_id);
 
+    return NX_SUCCESS;
+}
+
+// Receive executor of a gateway client, the network is connected through the gateway
+static VOID receive_thread_entry(ULONG parameter)
+{
+    AZURE_IOT_NX_CONTEXT* nx_context = (AZURE_IOT_NX_CONTEXT*)parameter;
+
+    client_run(nx_context,
+        nx_context->azure_iot_dps_id_scope_len > 0 ? dps_initialize : iot_hub_initialize,
+        nx_context->gateway->network_connect);
+}
+
+static UINT gateway_client_start(AZURE_IOT_NX_CONTEXT* nx_context)
+{
+    UINT status;
+
+    if ((status = tx_thread_create(&nx_context->runtime.receive_thread,
+             "Azure IoT receive",
+             receive_thread_entry,
+             (ULONG)nx_context,
+             nx_context->runtime_thread_stack,
+             sizeof(nx_context->runtime_thread_stack),
+             AZURE_IOT_RECEIVE_THREAD_PRIORITY,
+             AZURE_IOT_RECEIVE_THREAD_PRIORITY,
+             TX_NO_TIME_SLICE,
+             TX_AUTO_START)))
+    {
+        printf("ERROR: receive thread create (0x%08x)\r\n", status);
+    }
+
+    return status;
+}
+
+UINT azure_iot_nx_client_hub_run(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* iot_hub_hostname, CHAR* iot_hub_device_id, UINT (*network_connect)(UINT))
+{
+    UINT status;
+
+    if ((status = hub_config_set(nx_context, iot_hub_hostname, iot_hub_device_id)))
+    {
+        return status;
+    }
+
+    return client_run(nx_context, iot_hub_initialize, network_connect);
+}
+
+UINT azure_iot_nx_client_dps_run(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* dps_id_scope, CHAR* dps_registration_id, UINT (*network_connect)(UINT))
+{
+    UINT status;
+
+    if ((status = dps_config_set(nx_context, dps_id_scope, dps_registration_id)))
+    {
+        return status;
+    }
+
     return client_run(nx_context, dps_initialize, network_connect);
 }
+
+UINT azure_iot_nx_client_gateway_hub_start(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* iot_hub_hostname, CHAR* iot_hub_device_id)
+{
+    UINT status;
+
+    if (nx_context->gateway == NX_NULL)
+    {
+        printf("ERROR: azure_iot_nx_client_gateway_hub_start client is not part of a gateway\r\n");
+        return NX_PTR_ERROR;
+    }
+
+    if ((status = hub_config_set(nx_context, iot_hub_hostname, iot_hub_device_id)))
+    {
+        return status;
+    }
+
+    return gateway_client_start(nx_context);
+}
+
+UINT azure_iot_nx_client_gateway_dps_start(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* dps_id_scope, CHAR* dps_registration_id)
+{
+    UINT status;
+
+    if (nx_context->gateway == NX_NULL)
+    {
+        printf("ERROR: azure_iot_nx_client_gateway_dps_start client is not part of a gateway\r\n");
+        return NX_PTR_ERROR;
+    }
+
+    if ((status = dps_config_set(nx_context, dps_id_scope, dps_registration_id)))
+    {
+        return status;
+    }
+
+    return gateway_client_start(nx_context);
+}
@@ -12,11 +12,85 @@
 #include "nx_azure_iot_provisioning_client.h"
 
 #include "azure_iot_ciphersuites.h"
+#include "azure_iot_connect_policy.h"
+#include "azure_iot_diagnostics.h"
+#include "azure_iot_store.h"
 
 #define NX_AZURE_IOT_STACK_SIZE  (2 * 1024)
-#define AZURE_IOT_STACK_SIZE     (3 * 1024)
+#define AZURE_IOT_STACK_SIZE     (4 * 1024)
 #define AZURE_IOT_HOST_NAME_SIZE 128
 #define AZURE_IOT_DEVICE_ID_SIZE 64
+#define AZURE_IOT_MODULE_ID_SIZE 64
+
+// Caps a telemetry or diagnostics payload, large enough for a diagnostics sample with every counter at its widest.
+// Telemetry is serialized here and copied into the message by nx_azure_iot_hub_client_telemetry_send, there is no
+// way to build it in the packet because the middleware takes the topic length from the whole packet
+#ifndef AZURE_IOT_TELEMETRY_BUFFER_SIZE
+#define AZURE_IOT_TELEMETRY_BUFFER_SIZE 768
+#endif
+
+#ifndef AZURE_IOT_TELEMETRY_BATCH_SIZE
+#define AZURE_IOT_TELEMETRY_BATCH_SIZE 1024
+#endif
+
+#ifndef AZURE_IOT_PUBLISH_QUEUE_SIZE
+#define AZURE_IOT_PUBLISH_QUEUE_SIZE 8
+#endif
+
+#ifndef AZURE_IOT_STORE_RECORD_SIZE
+#define AZURE_IOT_STORE_RECORD_SIZE 384
+#endif
+
+#ifndef AZURE_IOT_REPORTED_PROPERTY_COUNT
+#define AZURE_IOT_REPORTED_PROPERTY_COUNT 8
+#endif
+
+#ifndef AZURE_IOT_REPORTED_PROPERTY_NAME_SIZE
+#define AZURE_IOT_REPORTED_PROPERTY_NAME_SIZE 32
+#endif
+
+#ifndef AZURE_IOT_REPORTED_PROPERTY_STRING_SIZE
+#define AZURE_IOT_REPORTED_PROPERTY_STRING_SIZE 32
+#endif
+
+// Largest command payload handed to a handler when it arrives split over several packets
+#ifndef AZURE_IOT_COMMAND_PAYLOAD_SIZE
+#define AZURE_IOT_COMMAND_PAYLOAD_SIZE 512
+#endif
+
+#ifndef AZURE_IOT_COMMAND_RESPONSE_SIZE
+#define AZURE_IOT_COMMAND_RESPONSE_SIZE 256
+#endif
+
+// Must be a power of two, one slot is always left empty to end probing
+#ifndef AZURE_IOT_COMMAND_TABLE_SIZE
+#define AZURE_IOT_COMMAND_TABLE_SIZE 16
+#endif
+
+// Must be a power of two, one slot is always left empty to end probing
+#ifndef AZURE_IOT_PROPERTY_TABLE_SIZE
+#define AZURE_IOT_PROPERTY_TABLE_SIZE 16
+#endif
+
+#define AZURE_IOT_PROPERTY_NAME_SIZE 64
+
+#define AZURE_IOT_REPORTED_PROPERTY_REQUEST_COUNT 4
+#define AZURE_IOT_REPORTED_PROPERTY_TIMEOUT       30
+
+// Reported property value types
+#define AZURE_IOT_PROPERTY_TYPE_BOOL   0
+#define AZURE_IOT_PROPERTY_TYPE_INT    1
+#define AZURE_IOT_PROPERTY_TYPE_STRING 2
+#define AZURE_IOT_PROPERTY_TYPE_APPEND 3
+
+#define AZURE_IOT_PUBLISH_INFLIGHT_DEFAULT 4
+#define AZURE_IOT_PUBLISH_TIMEOUT_DEFAULT  30
+
+// Async publish completion results
+#define AZURE_IOT_PUBLISH_SUCCESS    0
+#define AZURE_IOT_PUBLISH_TIMEOUT    1
+#define AZURE_IOT_PUBLISH_DISCONNECT 2
+#define AZURE_IOT_PUBLISH_FAILED     3
 
 #define AZURE_IOT_AUTH_MODE_UNKNOWN 0
 #define AZURE_IOT_AUTH_MODE_SAS     1
@@ -26,15 +100,189 @@ typedef struct AZURE_IOT_NX_CONTEXT_STRUCT AZURE_IOT_NX_CONTEXT;
 
 typedef void (*func_ptr_command_received)(
     AZURE_IOT_NX_CONTEXT*, const UCHAR*, USHORT, const UCHAR*, USHORT, UCHAR*, USHORT, VOID*, USHORT);
-typedef void (*func_ptr_writable_property_received)(
-    AZURE_IOT_NX_CONTEXT*, const UCHAR*, UINT, UCHAR*, UINT, NX_AZURE_IOT_JSON_READER*, UINT);
-typedef void (*func_ptr_property_received)(
-    AZURE_IOT_NX_CONTEXT*, const UCHAR*, UINT, UCHAR*, UINT, NX_AZURE_IOT_JSON_READER*, UINT);
+typedef void (*func_ptr_property_update)(AZURE_IOT_NX_CONTEXT*, UINT, NX_AZURE_IOT_JSON_READER*, UINT, UINT);
 typedef void (*func_ptr_properties_complete)(AZURE_IOT_NX_CONTEXT*);
 typedef void (*func_ptr_timer)(AZURE_IOT_NX_CONTEXT*);
+typedef void (*func_ptr_publish_complete)(AZURE_IOT_NX_CONTEXT*, UINT, VOID*);
+typedef void (*func_ptr_properties_reported)(AZURE_IOT_NX_CONTEXT*, UINT);
+
+// Command handler, returns the status code sent back in the command response. A JSON value written to the
+// response writer is sent as the response payload, a handler that writes nothing sends an empty response
+typedef UINT (*func_ptr_command_handler)(AZURE_IOT_NX_CONTEXT*, UCHAR*, USHORT, NX_AZURE_IOT_JSON_WRITER*);
 
 typedef ULONG (*func_ptr_unix_time_get)(VOID);
 
+// Pending telemetry samples, serialized as a JSON array and sent as one message
+typedef struct AZURE_IOT_TELEMETRY_BATCH_STRUCT
+{
+    TX_MUTEX mutex;
+    NX_AZURE_IOT_JSON_WRITER json_writer;
+
+    CHAR* component_name;
+
+    // flush thresholds, a batch is sent when any one is reached
+    UINT max_bytes;
+    UINT max_samples;
+    ULONG max_age_ticks;
+
+    UINT sample_count;
+    ULONG first_sample_ticks;
+
+    UCHAR buffer[AZURE_IOT_TELEMETRY_BATCH_SIZE];
+} AZURE_IOT_TELEMETRY_BATCH;
+
+// The message is serialized on the send executor when it goes out, so it carries the latest readings
+typedef struct AZURE_IOT_PUBLISH_ENTRY_STRUCT
+{
+    CHAR* component_name;
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr);
+    func_ptr_publish_complete complete_cb;
+    VOID* complete_context;
+
+    // MQTT packet id of the publish, acknowledged once its PUBACK has arrived
+    ULONG packet_id;
+    bool acknowledged;
+    ULONG sent_ticks;
+} AZURE_IOT_PUBLISH_ENTRY;
+
+// Ring of async telemetry, the first inflight_count entries from head have been
+// published and are waiting on PUBACK, the queued_count entries after them have not
+typedef struct AZURE_IOT_PUBLISH_QUEUE_STRUCT
+{
+    TX_MUTEX mutex;
+
+    AZURE_IOT_PUBLISH_ENTRY entries[AZURE_IOT_PUBLISH_QUEUE_SIZE];
+    UINT head;
+    UINT inflight_count;
+    UINT queued_count;
+
+    UINT inflight_max;
+    ULONG timeout_ticks;
+} AZURE_IOT_PUBLISH_QUEUE;
+
+// Telemetry captured while disconnected, replayed in order once connected
+typedef struct AZURE_IOT_STORE_FORWARD_STRUCT
+{
+    TX_MUTEX mutex;
+    AZURE_IOT_STORE* store_ptr;
+
+    ULONG replay_interval_ticks;
+    ULONG last_replay_ticks;
+
+    ULONG buffered_count;
+    ULONG dropped_count;
+    ULONG replayed_count;
+
+    // scratch for one record, [unix time][component length][component][payload]
+    UCHAR record[AZURE_IOT_STORE_RECORD_SIZE];
+} AZURE_IOT_STORE_FORWARD;
+
+// Last value of a reported property, sent again only once it changes
+typedef struct AZURE_IOT_REPORTED_PROPERTY_STRUCT
+{
+    CHAR* component_name;
+    CHAR name[AZURE_IOT_REPORTED_PROPERTY_NAME_SIZE];
+    UINT type;
+
+    union {
+        bool bool_value;
+        INT int_value;
+        CHAR string_value[AZURE_IOT_REPORTED_PROPERTY_STRING_SIZE];
+        UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr);
+    } value;
+
+    // writable property acknowledgement, ack_status is 0 for a plain reported property
+    INT ack_status;
+    INT ack_version;
+
+    bool dirty;
+    bool inflight;
+    UINT request_id;
+} AZURE_IOT_REPORTED_PROPERTY;
+
+typedef struct AZURE_IOT_REPORTED_PROPERTY_REQUEST_STRUCT
+{
+    bool in_use;
+    bool responded;
+    UINT request_id;
+    UINT response_status;
+    ULONG sent_ticks;
+} AZURE_IOT_REPORTED_PROPERTY_REQUEST;
+
+// Reported property cache, dirty entries are merged into a single PATCH per flush
+typedef struct AZURE_IOT_REPORTED_PROPERTIES_STRUCT
+{
+    TX_MUTEX mutex;
+
+    AZURE_IOT_REPORTED_PROPERTY entries[AZURE_IOT_REPORTED_PROPERTY_COUNT];
+    UINT entry_count;
+
+    AZURE_IOT_REPORTED_PROPERTY_REQUEST requests[AZURE_IOT_REPORTED_PROPERTY_REQUEST_COUNT];
+    UINT request_count;
+
+    bool flush_pending;
+} AZURE_IOT_REPORTED_PROPERTIES;
+
+typedef struct AZURE_IOT_COMMAND_ENTRY_STRUCT
+{
+    CHAR* component_name;
+    UINT component_name_length;
+    CHAR* command_name;
+    UINT command_name_length;
+    UINT hash;
+    func_ptr_command_handler handler;
+} AZURE_IOT_COMMAND_ENTRY;
+
+typedef struct AZURE_IOT_PROPERTY_ENTRY_STRUCT
+{
+    CHAR* component_name;
+    UINT component_name_length;
+    CHAR* property_name;
+    UINT property_name_length;
+    UINT hash;
+    UINT property_id;
+} AZURE_IOT_PROPERTY_ENTRY;
+
+// A registered property found in a document, the reader is positioned on its value
+typedef struct AZURE_IOT_PROPERTY_MATCH_STRUCT
+{
+    AZURE_IOT_PROPERTY_ENTRY* entry;
+    NX_AZURE_IOT_JSON_READER json_reader;
+} AZURE_IOT_PROPERTY_MATCH;
+
+// TLS handshakes with one endpoint, timed in threadx ticks until the endpoint accepted the client. NetX Secure
+// cannot resume a session so every handshake is a full one, avoided_count counts those that were not needed
+typedef struct AZURE_IOT_TLS_STATS_STRUCT
+{
+    ULONG full_count;
+    ULONG avoided_count;
+    ULONG last_ticks;
+    ULONG total_ticks;
+} AZURE_IOT_TLS_STATS;
+
+// Runtime shared by the hub clients of a gateway, one azure iot instance over one ip instance
+typedef struct AZURE_IOT_NX_GATEWAY_STRUCT
+{
+    NX_AZURE_IOT nx_azure_iot;
+    ULONG nx_azure_iot_thread_stack[NX_AZURE_IOT_STACK_SIZE / sizeof(ULONG)];
+
+    NX_IP* nx_ip;
+    UINT (*unix_time_get)(ULONG* unix_time);
+
+    // clients reconnect the network one at a time
+    TX_MUTEX network_mutex;
+    UINT (*network_connect)(UINT);
+} AZURE_IOT_NX_GATEWAY;
+
+// Command turnaround, from receipt to the handler returning, in threadx ticks
+typedef struct AZURE_IOT_COMMAND_STATS_STRUCT
+{
+    ULONG count;
+    ULONG last_ticks;
+    ULONG max_ticks;
+    ULONG total_ticks;
+} AZURE_IOT_COMMAND_STATS;
+
 struct AZURE_IOT_NX_CONTEXT_STRUCT
 {
     NX_SECURE_X509_CERT root_ca_cert;
@@ -43,8 +291,12 @@ struct AZURE_IOT_NX_CONTEXT_STRUCT
 
     NX_IP* azure_iot_nx_ip;
 
+    // gateway this client belongs to, NX_NULL for a standalone client
+    AZURE_IOT_NX_GATEWAY* gateway;
+    NX_AZURE_IOT* nx_azure_iot_ptr;
+
     ULONG nx_azure_iot_tls_metadata_buffer[NX_AZURE_IOT_TLS_METADATA_BUFFER_SIZE / sizeof(ULONG)];
-    ULONG nx_azure_iot_thread_stack[NX_AZURE_IOT_STACK_SIZE / sizeof(ULONG)];
+    ULONG runtime_thread_stack[NX_AZURE_IOT_STACK_SIZE / sizeof(ULONG)];
     ULONG azure_iot_thread_stack[AZURE_IOT_STACK_SIZE / sizeof(ULONG)];
 
     UINT azure_iot_auth_mode;
@@ -68,20 +320,89 @@ struct AZURE_IOT_NX_CONTEXT_STRUCT
     CHAR* azure_iot_dps_registration_id;
     UINT azure_iot_dps_registration_id_len;
 
+    // the hub assignment from the last registration, reused until the hub rejects the device
+    struct
+    {
+        AZURE_IOT_STORE* store_ptr;
+        bool loaded;
+        bool assigned;
+
+        // the hub has accepted the device since the assignment was made or loaded
+        bool confirmed;
+    } dps_assignment;
+
     // hub connection config
     CHAR azure_iot_hub_hostname[AZURE_IOT_HOST_NAME_SIZE];
     UINT azure_iot_hub_hostname_len;
     CHAR azure_iot_hub_device_id[AZURE_IOT_DEVICE_ID_SIZE];
     UINT azure_iot_hub_device_id_len;
+    CHAR azure_iot_hub_module_id[AZURE_IOT_MODULE_ID_SIZE];
+    UINT azure_iot_hub_module_id_len;
+
+    UINT (*unix_time_get)(ULONG* unix_time);
 
+    // send executor, the receive executor runs on the thread calling hub_run or dps_run
     TX_THREAD azure_iot_thread;
     TX_EVENT_FLAGS_GROUP events;
     TX_TIMER periodic_timer;
 
-    NX_AZURE_IOT nx_azure_iot;
+    // a standalone client owns its azure iot instance, a gateway client shares the gateway's and runs
+    // its receive executor on a thread of its own, both run on runtime_thread_stack
+    union RUNTIME_UNION {
+        NX_AZURE_IOT nx_azure_iot;
+        TX_THREAD receive_thread;
+    } runtime;
 
     UINT azure_iot_connection_status;
 
+    // the receive executor holds this while it tears down and brings back the hub client, the send executor
+    // and application threads hold it while they use the client, and only once connected
+    TX_MUTEX client_mutex;
+
+    // scratch for one telemetry payload, guarded by the client mutex
+    UCHAR telemetry_buffer[AZURE_IOT_TELEMETRY_BUFFER_SIZE];
+
+    // how long to wait before each reconnect, per class of failure
+    CONNECTION_POLICY_ENGINE connection_policy;
+
+    AZURE_IOT_TLS_STATS hub_tls_stats;
+    AZURE_IOT_TLS_STATS dps_tls_stats;
+
+    // optional diagnostics component, nothing is sampled until it is enabled
+    struct
+    {
+        TX_TIMER timer;
+        bool timer_created;
+    } diagnostics;
+
+    AZURE_IOT_TELEMETRY_BATCH telemetry_batch;
+    AZURE_IOT_PUBLISH_QUEUE publish_queue;
+    AZURE_IOT_STORE_FORWARD store_forward;
+    AZURE_IOT_REPORTED_PROPERTIES reported_properties;
+
+    // registered commands, open addressed on the (component, command) hash
+    AZURE_IOT_COMMAND_ENTRY command_table[AZURE_IOT_COMMAND_TABLE_SIZE];
+    UINT command_count;
+    bool command_logging;
+
+    // scratch for a command payload gathered from several packets and for the command response
+    UCHAR command_payload[AZURE_IOT_COMMAND_PAYLOAD_SIZE];
+    UCHAR command_response[AZURE_IOT_COMMAND_RESPONSE_SIZE];
+
+    // registered properties, open addressed on the (component, property) hash
+    AZURE_IOT_PROPERTY_ENTRY property_table[AZURE_IOT_PROPERTY_TABLE_SIZE];
+    UINT property_count;
+    // one per registered property, so every registered property in a document is dispatched
+    AZURE_IOT_PROPERTY_MATCH property_matches[AZURE_IOT_PROPERTY_TABLE_SIZE - 1];
+    UINT property_match_count;
+
+    struct
+    {
+        bool pending;
+        ULONG received_ticks;
+        AZURE_IOT_COMMAND_STATS stats;
+    } command_stats;
+
     // union DPS and Hub as they are used consecutively and will save space
     union CLIENT_UNION {
         NX_AZURE_IOT_HUB_CLIENT iothub;
@@ -92,10 +413,10 @@ struct AZURE_IOT_NX_CONTEXT_STRUCT
 #define dps_client    client.dps
 
     func_ptr_command_received command_received_cb;
-    func_ptr_writable_property_received writable_property_received_cb;
-    func_ptr_property_received property_received_cb;
+    func_ptr_property_update property_update_cb;
     func_ptr_properties_complete properties_complete_cb;
     func_ptr_timer timer_cb;
+    func_ptr_properties_reported properties_reported_cb;
 };
 
 UINT azure_nx_client_periodic_interval_set(AZURE_IOT_NX_CONTEXT* nx_context, INT interval);
@@ -104,6 +425,35 @@ UINT azure_iot_nx_client_publish_telemetry(AZURE_IOT_NX_CONTEXT* nx_context,
     CHAR* component_name_ptr,
     UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr));
 
+UINT azure_iot_nx_client_publish_window_set(AZURE_IOT_NX_CONTEXT* nx_context, UINT inflight_max, UINT timeout_seconds);
+UINT azure_iot_nx_client_publish_telemetry_async(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr),
+    func_ptr_publish_complete complete_cb,
+    VOID* complete_context);
+
+UINT azure_iot_nx_client_store_forward_set(
+    AZURE_IOT_NX_CONTEXT* nx_context, AZURE_IOT_STORE* store_ptr, UINT replay_per_second);
+
+UINT azure_iot_nx_client_dps_assignment_store_set(AZURE_IOT_NX_CONTEXT* nx_context, AZURE_IOT_STORE* store_ptr);
+
+UINT azure_iot_nx_client_telemetry_batch_configure(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    UINT max_bytes,
+    UINT max_samples,
+    UINT max_age_seconds);
+UINT azure_iot_nx_client_telemetry_batch_append(AZURE_IOT_NX_CONTEXT* nx_context,
+    UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr));
+UINT azure_iot_nx_client_telemetry_batch_flush(AZURE_IOT_NX_CONTEXT* nx_context);
+
+UINT azure_iot_nx_client_reported_property_bool_set(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, CHAR* property_ptr, bool value);
+UINT azure_iot_nx_client_reported_property_int_set(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, CHAR* property_ptr, INT value);
+UINT azure_iot_nx_client_reported_property_string_set(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, CHAR* property_ptr, CHAR* value);
+UINT azure_iot_nx_client_reported_properties_flush(AZURE_IOT_NX_CONTEXT* nx_context);
+
 UINT azure_iot_nx_client_publish_properties(AZURE_IOT_NX_CONTEXT* nx_context,
     CHAR* component_name_ptr,
     UINT (*append_properties)(NX_AZURE_IOT_JSON_WRITER* json_writer_ptr));
@@ -119,14 +469,36 @@ UINT azure_nx_client_respond_int_writable_property(AZURE_IOT_NX_CONTEXT* nx_cont
 UINT azure_iot_nx_client_publish_int_writable_property(
     AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_ptr, CHAR* property_ptr, UINT value);
 
+UINT azure_iot_nx_client_register_command(AZURE_IOT_NX_CONTEXT* nx_context,
+    CHAR* component_name_ptr,
+    CHAR* command_name_ptr,
+    func_ptr_command_handler handler);
+UINT azure_iot_nx_client_command_logging_set(AZURE_IOT_NX_CONTEXT* nx_context, bool enable);
+UINT azure_iot_nx_client_command_stats_get(
+    AZURE_IOT_NX_CONTEXT* nx_context, AZURE_IOT_COMMAND_STATS* stats, bool reset);
+
+UINT azure_iot_nx_client_tls_stats_get(
+    AZURE_IOT_NX_CONTEXT* nx_context, AZURE_IOT_TLS_STATS* hub_stats, AZURE_IOT_TLS_STATS* dps_stats);
+
+UINT azure_iot_nx_client_connection_policy_set(
+    AZURE_IOT_NX_CONTEXT* nx_context, CONNECTION_FAILURE_CLASS failure_class, const CONNECTION_POLICY* policy);
+UINT azure_iot_nx_client_connection_stats_get(AZURE_IOT_NX_CONTEXT* nx_context, CONNECTION_POLICY_STATS* stats);
+
+// Publishes diagnostics telemetry every interval_seconds while connected, 0 stops it. The first call adds the
+// diagnostics component so must come before the client connects
+UINT azure_iot_nx_client_diagnostics_enable(AZURE_IOT_NX_CONTEXT* nx_context, UINT interval_seconds);
+UINT azure_iot_nx_client_diagnostics_get(AZURE_IOT_NX_CONTEXT* nx_context, AZURE_IOT_DIAGNOSTICS* diagnostics);
+
 UINT azure_iot_nx_client_register_command_callback(
     AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_command_received callback);
-UINT azure_iot_nx_client_register_writable_property_callback(
-    AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_writable_property_received callback);
-UINT azure_iot_nx_client_register_property_callback(
-    AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_property_received callback);
+UINT azure_iot_nx_client_register_property(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* component_name_ptr, CHAR* property_name_ptr, UINT property_id);
+UINT azure_iot_nx_client_register_property_update_callback(
+    AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_property_update callback);
 UINT azure_iot_nx_client_register_properties_complete_callback(
     AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_properties_complete callback);
+UINT azure_iot_nx_client_register_properties_reported_callback(
+    AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_properties_reported callback);
 UINT azure_iot_nx_client_register_timer_callback(
     AZURE_IOT_NX_CONTEXT* nx_context, func_ptr_timer callback, int32_t interval);
 
@@ -147,9 +519,24 @@ UINT azure_iot_nx_client_create(AZURE_IOT_NX_CONTEXT* context,
     CHAR* iot_model_id,
     UINT iot_model_id_len);
 
+UINT azure_iot_nx_client_gateway_create(AZURE_IOT_NX_GATEWAY* gateway,
+    NX_IP* nx_ip,
+    NX_PACKET_POOL* nx_pool,
+    NX_DNS* nx_dns,
+    UINT (*unix_time_callback)(ULONG* unix_time),
+    UINT (*network_connect)(UINT));
+UINT azure_iot_nx_client_gateway_add(
+    AZURE_IOT_NX_GATEWAY* gateway, AZURE_IOT_NX_CONTEXT* nx_context, CHAR* iot_model_id, UINT iot_model_id_len);
+UINT azure_iot_nx_client_module_id_set(AZURE_IOT_NX_CONTEXT* nx_context, CHAR* module_id);
+
+UINT azure_iot_nx_client_gateway_hub_start(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* iot_hub_hostname, CHAR* iot_hub_device_id);
+UINT azure_iot_nx_client_gateway_dps_start(
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* dps_id_scope, CHAR* dps_registration_id);
+
 UINT azure_iot_nx_client_hub_run(
-    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* iot_hub_hostname, CHAR* iot_hub_device_id, UINT (*network_connect)());
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* iot_hub_hostname, CHAR* iot_hub_device_id, UINT (*network_connect)(UINT));
 UINT azure_iot_nx_client_dps_run(
-    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* dps_id_scope, CHAR* dps_registration_id, UINT (*network_connect)());
+    AZURE_IOT_NX_CONTEXT* nx_context, CHAR* dps_id_scope, CHAR* dps_registration_id, UINT (*network_connect)(UINT));
 
 #endif
@@ -0,0 +1,146 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "azure_iot_store.h"
+
+#include <string.h>
+
+// Each record is prefixed with its length
+#define RECORD_HEADER_SIZE 2
+
+static VOID ring_write(AZURE_IOT_RAM_STORE* ram_store_ptr, UINT offset, const UCHAR* data_ptr, UINT length)
+{
+    UINT first;
+
+    offset %= ram_store_ptr->buffer_size;
+    first = ram_store_ptr->buffer_size - offset;
+    if (first > length)
+    {
+        first = length;
+    }
+
+    memcpy(&ram_store_ptr->buffer_ptr[offset], data_ptr, first);
+    memcpy(ram_store_ptr->buffer_ptr, data_ptr + first, length - first);
+}
+
+static VOID ring_read(AZURE_IOT_RAM_STORE* ram_store_ptr, UINT offset, UCHAR* data_ptr, UINT length)
+{
+    UINT first;
+
+    offset %= ram_store_ptr->buffer_size;
+    first = ram_store_ptr->buffer_size - offset;
+    if (first > length)
+    {
+        first = length;
+    }
+
+    memcpy(data_ptr, &ram_store_ptr->buffer_ptr[offset], first);
+    memcpy(data_ptr + first, ram_store_ptr->buffer_ptr, length - first);
+}
+
+static UINT record_length_get(AZURE_IOT_RAM_STORE* ram_store_ptr)
+{
+    UCHAR header[RECORD_HEADER_SIZE];
+
+    ring_read(ram_store_ptr, ram_store_ptr->head, header, sizeof(header));
+
+    return (header[0] << 8) | header[1];
+}
+
+static UINT ram_store_pop(AZURE_IOT_STORE* store_ptr)
+{
+    AZURE_IOT_RAM_STORE* ram_store_ptr = (AZURE_IOT_RAM_STORE*)store_ptr;
+    UINT record_size;
+
+    if (ram_store_ptr->record_count == 0)
+    {
+        return NX_NOT_FOUND;
+    }
+
+    record_size = RECORD_HEADER_SIZE + record_length_get(ram_store_ptr);
+
+    ram_store_ptr->head = (ram_store_ptr->head + record_size) % ram_store_ptr->buffer_size;
+    ram_store_ptr->used -= record_size;
+    ram_store_ptr->record_count--;
+
+    return NX_SUCCESS;
+}
+
+static UINT ram_store_push(AZURE_IOT_STORE* store_ptr, const UCHAR* data_ptr, UINT data_length, UINT* dropped_ptr)
+{
+    AZURE_IOT_RAM_STORE* ram_store_ptr = (AZURE_IOT_RAM_STORE*)store_ptr;
+    UINT record_size                   = RECORD_HEADER_SIZE + data_length;
+    UCHAR header[RECORD_HEADER_SIZE];
+
+    *dropped_ptr = 0;
+
+    if (data_length > 0xFFFF || record_size > ram_store_ptr->buffer_size)
+    {
+        return NX_SIZE_ERROR;
+    }
+
+    // Oldest readings are the least valuable, evict them first
+    while (ram_store_ptr->buffer_size - ram_store_ptr->used < record_size)
+    {
+        ram_store_pop(store_ptr);
+        (*dropped_ptr)++;
+    }
+
+    header[0] = (UCHAR)(data_length >> 8);
+    header[1] = (UCHAR)(data_length & 0xFF);
+
+    ring_write(ram_store_ptr, ram_store_ptr->head + ram_store_ptr->used, header, sizeof(header));
+    ring_write(ram_store_ptr, ram_store_ptr->head + ram_store_ptr->used + RECORD_HEADER_SIZE, data_ptr, data_length);
+
+    ram_store_ptr->used += record_size;
+    ram_store_ptr->record_count++;
+
+    return NX_SUCCESS;
+}
+
+static UINT ram_store_peek(AZURE_IOT_STORE* store_ptr, UCHAR* buffer_ptr, UINT buffer_size, UINT* data_length_ptr)
+{
+    AZURE_IOT_RAM_STORE* ram_store_ptr = (AZURE_IOT_RAM_STORE*)store_ptr;
+    UINT data_length;
+
+    if (ram_store_ptr->record_count == 0)
+    {
+        return NX_NOT_FOUND;
+    }
+
+    data_length = record_length_get(ram_store_ptr);
+    if (data_length > buffer_size)
+    {
+        return NX_SIZE_ERROR;
+    }
+
+    ring_read(ram_store_ptr, ram_store_ptr->head + RECORD_HEADER_SIZE, buffer_ptr, data_length);
+    *data_length_ptr = data_length;
+
+    return NX_SUCCESS;
+}
+
+static UINT ram_store_count(AZURE_IOT_STORE* store_ptr)
+{
+    return ((AZURE_IOT_RAM_STORE*)store_ptr)->record_count;
+}
+
+UINT azure_iot_ram_store_create(AZURE_IOT_RAM_STORE* ram_store_ptr, UCHAR* buffer_ptr, UINT buffer_size)
+{
+    if (ram_store_ptr == NX_NULL || buffer_ptr == NX_NULL || buffer_size <= RECORD_HEADER_SIZE)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    memset(ram_store_ptr, 0, sizeof(AZURE_IOT_RAM_STORE));
+
+    ram_store_ptr->store.push  = ram_store_push;
+    ram_store_ptr->store.peek  = ram_store_peek;
+    ram_store_ptr->store.pop   = ram_store_pop;
+    ram_store_ptr->store.count = ram_store_count;
+
+    ram_store_ptr->buffer_ptr  = buffer_ptr;
+    ram_store_ptr->buffer_size = buffer_size;
+
+    return NX_SUCCESS;
+}
@@ -0,0 +1,40 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _AZURE_IOT_STORE_H
+#define _AZURE_IOT_STORE_H
+
+#include "nx_api.h"
+
+typedef struct AZURE_IOT_STORE_STRUCT AZURE_IOT_STORE;
+
+// FIFO of variable length records. Implementations embed this as their first
+// member, so a RAM store can later be swapped for one backed by flash.
+struct AZURE_IOT_STORE_STRUCT
+{
+    // Append a record, evicting the oldest records if needed to make room
+    UINT (*push)(AZURE_IOT_STORE* store_ptr, const UCHAR* data_ptr, UINT data_length, UINT* dropped_ptr);
+
+    // Copy out the oldest record without removing it
+    UINT (*peek)(AZURE_IOT_STORE* store_ptr, UCHAR* buffer_ptr, UINT buffer_size, UINT* data_length_ptr);
+
+    // Remove the oldest record
+    UINT (*pop)(AZURE_IOT_STORE* store_ptr);
+
+    UINT (*count)(AZURE_IOT_STORE* store_ptr);
+};
+
+typedef struct AZURE_IOT_RAM_STORE_STRUCT
+{
+    AZURE_IOT_STORE store;
+
+    UCHAR* buffer_ptr;
+    UINT buffer_size;
+    UINT head;
+    UINT used;
+    UINT record_count;
+} AZURE_IOT_RAM_STORE;
+
+UINT azure_iot_ram_store_create(AZURE_IOT_RAM_STORE* ram_store_ptr, UCHAR* buffer_ptr, UINT buffer_size);
+
+#endif
@@ -0,0 +1,191 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "dns_cache.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tx_api.h"
+
+#define DNS_CACHE_ENTRY_COUNT 4
+#define DNS_CACHE_NAME_SIZE   128
+
+// Time an address is served from memory. An expired address is only queried again when it is next looked up, so
+// a name that is not used costs no traffic. The NetX record cache underneath keeps each answer for its own TTL
+#define DNS_CACHE_TTL (300 * NX_IP_PERIODIC_RATE)
+
+#define DNS_CACHE_RECORD_SIZE 2048
+
+typedef struct DNS_CACHE_ENTRY_STRUCT
+{
+    CHAR name[DNS_CACHE_NAME_SIZE];
+    UINT name_length;
+    NXD_ADDRESS address;
+    ULONG resolved_ticks;
+    ULONG used_ticks;
+} DNS_CACHE_ENTRY;
+
+static NX_DNS* dns_cache_dns_ptr = NX_NULL;
+
+static DNS_CACHE_ENTRY dns_cache_entries[DNS_CACHE_ENTRY_COUNT];
+static DNS_CACHE_STATS dns_cache_stats;
+static TX_MUTEX dns_cache_mutex;
+
+#ifdef NX_DNS_CACHE_ENABLE
+static ULONG dns_cache_records[DNS_CACHE_RECORD_SIZE / sizeof(ULONG)];
+#endif
+
+// Caller holds the cache mutex
+static DNS_CACHE_ENTRY* entry_find(const CHAR* name, UINT name_length)
+{
+    for (UINT i = 0; i < DNS_CACHE_ENTRY_COUNT; ++i)
+    {
+        DNS_CACHE_ENTRY* entry = &dns_cache_entries[i];
+
+        if (entry->name_length == name_length && memcmp(entry->name, name, name_length) == 0)
+        {
+            return entry;
+        }
+    }
+
+    return NX_NULL;
+}
+
+// Caller holds the cache mutex, reuses an empty entry or else the least recently used one
+static DNS_CACHE_ENTRY* entry_claim(const CHAR* name, UINT name_length)
+{
+    DNS_CACHE_ENTRY* entry = entry_find(name, name_length);
+    ULONG now              = tx_time_get();
+
+    if (entry != NX_NULL)
+    {
+        return entry;
+    }
+
+    entry = &dns_cache_entries[0];
+    for (UINT i = 0; i < DNS_CACHE_ENTRY_COUNT && entry->name_length > 0; ++i)
+    {
+        DNS_CACHE_ENTRY* candidate = &dns_cache_entries[i];
+
+        if (candidate->name_length == 0 || now - candidate->used_ticks > now - entry->used_ticks)
+        {
+            entry = candidate;
+        }
+    }
+
+    memcpy(entry->name, name, name_length);
+    entry->name[name_length] = 0;
+    entry->name_length       = name_length;
+
+    return entry;
+}
+
+UINT dns_cache_init(NX_DNS* dns_ptr)
+{
+    UINT status;
+
+    if ((status = tx_mutex_create(&dns_cache_mutex, "DNS cache", TX_INHERIT)))
+    {
+        printf("ERROR: DNS cache mutex create failed (0x%08x)\r\n", status);
+    }
+
+#ifdef NX_DNS_CACHE_ENABLE
+    // NetX keeps each answer for its TTL, this also serves the lookups the Azure IoT library makes itself
+    else if ((status = nx_dns_cache_initialize(dns_ptr, dns_cache_records, sizeof(dns_cache_records))))
+    {
+        tx_mutex_delete(&dns_cache_mutex);
+        printf("ERROR: nx_dns_cache_initialize (0x%08x)\r\n", status);
+    }
+#endif
+
+    else
+    {
+        dns_cache_dns_ptr = dns_ptr;
+    }
+
+    return status;
+}
+
+// Forgets the cached addresses, for a DNS client about to be deleted
+VOID dns_cache_deinit()
+{
+    if (dns_cache_dns_ptr == NX_NULL)
+    {
+        return;
+    }
+
+    tx_mutex_delete(&dns_cache_mutex);
+
+    memset(dns_cache_entries, 0, sizeof(dns_cache_entries));
+    dns_cache_dns_ptr = NX_NULL;
+}
+
+UINT dns_cache_host_get(UCHAR* host_name, NXD_ADDRESS* address_ptr, ULONG wait_option)
+{
+    UINT status;
+    UINT name_length = strlen((CHAR*)host_name);
+    DNS_CACHE_ENTRY* entry;
+    NXD_ADDRESS address;
+    bool known = false;
+    bool fresh = false;
+
+    if (dns_cache_dns_ptr == NX_NULL)
+    {
+        return NX_NOT_ENABLED;
+    }
+
+    if (name_length == 0 || name_length >= DNS_CACHE_NAME_SIZE)
+    {
+        return nxd_dns_host_by_name_get(dns_cache_dns_ptr, host_name, address_ptr, wait_option, NX_IP_VERSION_V4);
+    }
+
+    tx_mutex_get(&dns_cache_mutex, TX_WAIT_FOREVER);
+    if ((entry = entry_find((CHAR*)host_name, name_length)))
+    {
+        entry->used_ticks = tx_time_get();
+        *address_ptr      = entry->address;
+        known             = true;
+
+        if (entry->used_ticks - entry->resolved_ticks < DNS_CACHE_TTL)
+        {
+            dns_cache_stats.hit_count++;
+            fresh = true;
+        }
+    }
+    tx_mutex_put(&dns_cache_mutex);
+
+    if (fresh)
+    {
+        return NX_SUCCESS;
+    }
+
+    status = nxd_dns_host_by_name_get(dns_cache_dns_ptr, host_name, &address, wait_option, NX_IP_VERSION_V4);
+
+    tx_mutex_get(&dns_cache_mutex, TX_WAIT_FOREVER);
+    dns_cache_stats.miss_count++;
+    if (status == NX_SUCCESS)
+    {
+        entry                 = entry_claim((CHAR*)host_name, name_length);
+        entry->address        = address;
+        entry->resolved_ticks = tx_time_get();
+        entry->used_ticks     = entry->resolved_ticks;
+        *address_ptr          = address;
+    }
+    else if (known)
+    {
+        // The server is unreachable, the last known address is better than none
+        printf("\tDNS query for %s failed, using the last known address (0x%08x)\r\n", host_name, status);
+        dns_cache_stats.stale_count++;
+        status = NX_SUCCESS;
+    }
+    tx_mutex_put(&dns_cache_mutex);
+
+    return status;
+}
+
+VOID dns_cache_stats_get(DNS_CACHE_STATS* stats_ptr)
+{
+    *stats_ptr = dns_cache_stats;
+}
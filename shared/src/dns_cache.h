@@ -0,0 +1,30 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _DNS_CACHE_H
+#define _DNS_CACHE_H
+
+#include "nx_api.h"
+#include "nxd_dns.h"
+
+typedef struct DNS_CACHE_STATS_STRUCT
+{
+    // lookups answered from memory
+    ULONG hit_count;
+
+    // lookups that had to query the DNS server
+    ULONG miss_count;
+
+    // lookups answered with an expired address because the DNS server was unreachable
+    ULONG stale_count;
+} DNS_CACHE_STATS;
+
+// Caches the addresses looked up through dns_cache_host_get, which is only SNTP. The hub and DPS hostnames are
+// resolved inside the Azure IoT library, they get the NetX record cache when NX_DNS_CACHE_ENABLE is set but
+// never the stale address fallback
+UINT dns_cache_init(NX_DNS* dns_ptr);
+VOID dns_cache_deinit();
+UINT dns_cache_host_get(UCHAR* host_name, NXD_ADDRESS* address_ptr, ULONG wait_option);
+VOID dns_cache_stats_get(DNS_CACHE_STATS* stats_ptr);
+
+#endif // _DNS_CACHE_H
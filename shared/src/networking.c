@@ -3,33 +3,72 @@
 
 #include "networking.h"
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "nx_api.h"
 #include "nx_secure_tls_api.h"
 #include "nxd_dhcp_client.h"
 #include "nxd_dns.h"
 
+#include "azure_iot_connect.h"
+#include "dns_cache.h"
+#include "packet_pool.h"
 #include "sntp_client.h"
+#include "time_service.h"
+
+#define NETX_IP_STACK_SIZE 2048
+
+#ifndef NETX_PACKET_COUNT
+#define NETX_PACKET_COUNT 60
+#endif
 
-#define NETX_IP_STACK_SIZE  2048
-#define NETX_PACKET_COUNT   60
 #define NETX_PACKET_SIZE    1536
 #define NETX_POOL_SIZE      ((NETX_PACKET_SIZE + sizeof(NX_PACKET)) * NETX_PACKET_COUNT)
 #define NETX_ARP_CACHE_SIZE 512
 #define NETX_DNS_COUNT      6
 
+#ifdef NETX_CONTROL_POOL
+// Small packets for ARP, TCP control segments and SNTP so they don't tie up MTU sized buffers. The pool costs
+// about 10 KB, so it only pays off with NETX_PACKET_COUNT lowered by what the bulk pool peak shows it spares
+#define NETX_CONTROL_PACKET_COUNT 32
+#define NETX_CONTROL_PACKET_SIZE  256
+#define NETX_CONTROL_POOL_SIZE    ((NETX_CONTROL_PACKET_SIZE + sizeof(NX_PACKET)) * NETX_CONTROL_PACKET_COUNT)
+#endif
+
 #define NETX_IPV4_ADDRESS IP_ADDRESS(0, 0, 0, 0)
 #define NETX_IPV4_MASK    IP_ADDRESS(255, 255, 255, 0)
 
-#define DHCP_WAIT_TIME_TICKS (30 * TX_TIMER_TICKS_PER_SECOND)
+#define DHCP_WAIT_TIME_TICKS        (30 * TX_TIMER_TICKS_PER_SECOND)
+#define DHCP_REBOOT_WAIT_TIME_TICKS (5 * TX_TIMER_TICKS_PER_SECOND)
+#define LINK_WAIT_TIME_TICKS        (30 * TX_TIMER_TICKS_PER_SECOND)
 
 static UCHAR netx_ip_stack[NETX_IP_STACK_SIZE];
 static UCHAR netx_ip_pool[NETX_POOL_SIZE];
 static UCHAR netx_arp_cache_area[NETX_ARP_CACHE_SIZE];
 
+#ifdef NETX_CONTROL_POOL
+static UCHAR netx_control_pool[NETX_CONTROL_POOL_SIZE];
+static NX_PACKET_POOL nx_control_pool;
+#endif
+
 static NX_DHCP nx_dhcp_client;
 
+// The last lease, kept in RAM so a reconnect can ask for the same address
+static struct
+{
+    // set when the link came back since the lease was bound, the address has to be confirmed again
+    bool link_changed;
+
+    ULONG ip_address;
+    ULONG dns_server_address[NETX_DNS_COUNT];
+    UINT dns_server_count;
+
+    // monotonic, zero when the server gave no lease time
+    uint64_t expiry_ms;
+} dhcp_lease;
+
 NX_IP nx_ip;
 NX_PACKET_POOL nx_pool;
 NX_DNS nx_dns_client;
@@ -59,28 +98,150 @@ static void print_mac()
         (uint8_t)(lsw & 0xFF));
 }
 
-static UINT dhcp_connect()
+static UINT link_connect()
 {
     UINT status;
     ULONG actual_status;
+
+    // Nothing to redo on a wired link, wait for it to come back up
+    if ((status = nx_ip_interface_status_check(&nx_ip, 0, NX_IP_LINK_ENABLED, &actual_status, LINK_WAIT_TIME_TICKS)))
+    {
+        printf("ERROR: Network link is down (0x%08x)\r\n", status);
+    }
+
+    // Only reached when the link layer was invalid, the lease needs confirming on whatever network this is
+    dhcp_lease.link_changed = true;
+
+    return status;
+}
+
+// Records the lease just bound
+static VOID dhcp_lease_update(ULONG ip_address)
+{
+    ULONG lease_time                         = 0;
+    UINT lease_time_size                     = sizeof(lease_time);
+    ULONG dns_server_address[NETX_DNS_COUNT] = {0};
+    UINT dns_server_address_size             = sizeof(UINT) * NETX_DNS_COUNT;
+    UINT dns_server_count;
+
+    dhcp_lease.expiry_ms = 0;
+    if (nx_dhcp_interface_user_option_retrieve(
+            &nx_dhcp_client, 0, NX_DHCP_OPTION_DHCP_LEASE, (UCHAR*)&lease_time, &lease_time_size) == NX_SUCCESS)
+    {
+        // All ones is an infinite lease
+        dhcp_lease.expiry_ms = lease_time == 0xFFFFFFFF ? UINT64_MAX : time_ms_get() + (uint64_t)lease_time * 1000;
+    }
+
+    // An ACK without DNS servers leaves the last known ones in place
+    if (nx_dhcp_interface_user_option_retrieve(&nx_dhcp_client,
+            0,
+            NX_DHCP_OPTION_DNS_SVR,
+            (UCHAR*)dns_server_address,
+            &dns_server_address_size) != NX_SUCCESS)
+    {
+        dns_server_address_size = 0;
+    }
+
+    dns_server_count = dns_server_address_size / sizeof(UINT);
+    if (dns_server_count > NETX_DNS_COUNT)
+    {
+        dns_server_count = NETX_DNS_COUNT;
+    }
+
+    dhcp_lease.ip_address = ip_address;
+    if (dns_server_count > 0)
+    {
+        memcpy(dhcp_lease.dns_server_address, dns_server_address, dns_server_count * sizeof(ULONG));
+        dhcp_lease.dns_server_count = dns_server_count;
+    }
+}
+
+// True while the link stayed up, the interface still holds the last lease and it has not run out. After a link
+// drop the host may be on another network, so the address is confirmed with an INIT-REBOOT (RFC 2131 3.7)
+static bool dhcp_lease_current()
+{
+    ULONG actual_status;
     ULONG ip_address;
     ULONG network_mask;
-    ULONG gateway_address;
 
-    printf("\r\nInitializing DHCP\r\n");
+    return !dhcp_lease.link_changed && dhcp_lease.expiry_ms != 0 && time_ms_get() < dhcp_lease.expiry_ms &&
+           nx_ip_status_check(&nx_ip, NX_IP_ADDRESS_RESOLVED, &actual_status, NX_NO_WAIT) == NX_SUCCESS &&
+           nx_ip_address_get(&nx_ip, &ip_address, &network_mask) == NX_SUCCESS &&
+           ip_address == dhcp_lease.ip_address;
+}
+
+// Restarts the DHCP client, going straight to a REQUEST for requested_address when it is not zero (INIT-REBOOT)
+static UINT dhcp_restart(ULONG requested_address, ULONG wait_ticks)
+{
+    UINT status;
+    ULONG actual_status;
+
+    // Not started yet on the first connect
+    nx_dhcp_stop(&nx_dhcp_client);
 
-    if ((status = nx_dhcp_force_renew(&nx_dhcp_client)))
+    if ((status = nx_dhcp_reinitialize(&nx_dhcp_client)))
     {
-        printf("ERROR: nx_dhcp_force_renew (0x%08x\r\n", status);
-        return status;
+        printf("ERROR: nx_dhcp_reinitialize (0x%08x)\r\n", status);
+    }
+
+    else if (requested_address != 0 &&
+             (status = nx_dhcp_request_client_ip(&nx_dhcp_client, requested_address, NX_TRUE)))
+    {
+        printf("ERROR: nx_dhcp_request_client_ip (0x%08x)\r\n", status);
+    }
+
+    else if ((status = nx_dhcp_start(&nx_dhcp_client)))
+    {
+        printf("ERROR: nx_dhcp_start (0x%08x)\r\n", status);
     }
 
     // Wait until address is solved
-    if ((status = nx_ip_status_check(&nx_ip, NX_IP_ADDRESS_RESOLVED, &actual_status, DHCP_WAIT_TIME_TICKS)))
+    else if ((status = nx_ip_status_check(&nx_ip, NX_IP_ADDRESS_RESOLVED, &actual_status, wait_ticks)))
     {
         // DHCP Failed...  no IP address!
-        printf("ERROR: Can't resolve DHCP address (0x%08x\r\n", status);
-        return status;
+        if (requested_address == 0)
+        {
+            printf("ERROR: Can't resolve DHCP address (0x%08x)\r\n", status);
+        }
+    }
+
+    return status;
+}
+
+static UINT dhcp_connect()
+{
+    UINT status;
+    ULONG ip_address;
+    ULONG network_mask;
+    ULONG gateway_address;
+
+    printf("\r\nInitializing DHCP\r\n");
+
+    // The link and the address survived the reconnect and the lease has time left, nothing to ask the server
+    if (dhcp_lease_current())
+    {
+        printf("\tReusing DHCP lease\r\n");
+    }
+
+    else
+    {
+        // Ask for the last address, a single REQUEST and ACK, before falling back to a full DISCOVER
+        if (dhcp_lease.ip_address == 0 || dhcp_restart(dhcp_lease.ip_address, DHCP_REBOOT_WAIT_TIME_TICKS))
+        {
+            if (dhcp_lease.ip_address != 0)
+            {
+                printf("\tDHCP server did not confirm the last address\r\n");
+            }
+
+            if ((status = dhcp_restart(0, DHCP_WAIT_TIME_TICKS)))
+            {
+                return status;
+            }
+        }
+
+        nx_ip_address_get(&nx_ip, &ip_address, &network_mask);
+        dhcp_lease_update(ip_address);
+        dhcp_lease.link_changed = false;
     }
 
     // Get IP address and gateway address
@@ -101,17 +262,13 @@ static UINT dhcp_connect()
 static UINT dns_connect()
 {
     UINT status;
-    ULONG dns_server_address[NETX_DNS_COUNT] = {0};
-    UINT dns_server_address_size             = sizeof(UINT) * NETX_DNS_COUNT;
 
     printf("\r\nInitializing DNS client\r\n");
 
-    // Retrieve DNS server address
-    if ((status = nx_dhcp_interface_user_option_retrieve(
-             &nx_dhcp_client, 0, NX_DHCP_OPTION_DNS_SVR, (UCHAR*)dns_server_address, &dns_server_address_size)))
+    if (dhcp_lease.dns_server_count == 0)
     {
-        printf("ERROR: nx_dhcp_interface_user_option_retrieve (0x%08x)\r\n", status);
-        return status;
+        printf("ERROR: DHCP lease has no DNS servers\r\n");
+        return NX_DNS_NO_SERVER;
     }
 
     if ((status = nx_dns_server_remove_all(&nx_dns_client)))
@@ -120,12 +277,12 @@ static UINT dns_connect()
         return status;
     }
 
-    for (int i = 0; i < dns_server_address_size / sizeof(UINT); ++i)
+    for (UINT i = 0; i < dhcp_lease.dns_server_count; ++i)
     {
-        print_address("DNS address", dns_server_address[i]);
+        print_address("DNS address", dhcp_lease.dns_server_address[i]);
 
         // Add an IPv4 server address to the Client list
-        if ((status = nx_dns_server_add(&nx_dns_client, dns_server_address[i])))
+        if ((status = nx_dns_server_add(&nx_dns_client, dhcp_lease.dns_server_address[i])))
         {
             printf("ERROR: nx_dns_server_add (0x%08x)\r\n", status);
             return status;
@@ -137,6 +294,60 @@ static UINT dns_connect()
     return NX_SUCCESS;
 }
 
+static UINT network_pools_create()
+{
+    UINT status;
+
+    // Create a packet pool.
+    if ((status = nx_packet_pool_create(&nx_pool, "NetX Packet Pool", NETX_PACKET_SIZE, netx_ip_pool, NETX_POOL_SIZE)))
+    {
+        printf("ERROR: nx_packet_pool_create (0x%08x)\r\n", status);
+    }
+
+#ifdef NETX_CONTROL_POOL
+    // Create the control packet pool
+    else if ((status = nx_packet_pool_create(&nx_control_pool,
+                  "NetX Control Packet Pool",
+                  NETX_CONTROL_PACKET_SIZE,
+                  netx_control_pool,
+                  NETX_CONTROL_POOL_SIZE)))
+    {
+        nx_packet_pool_delete(&nx_pool);
+        printf("ERROR: nx_packet_pool_create control (0x%08x)\r\n", status);
+    }
+#endif
+
+    return status;
+}
+
+static VOID network_pools_delete()
+{
+#ifdef NETX_CONTROL_POOL
+    nx_packet_pool_delete(&nx_control_pool);
+#endif
+    nx_packet_pool_delete(&nx_pool);
+}
+
+// Hand out packets by size from here on
+static UINT network_pools_register()
+{
+    UINT status;
+
+    if ((status = packet_pool_register(PACKET_POOL_BULK, &nx_pool)))
+    {
+        return status;
+    }
+
+#ifdef NETX_CONTROL_POOL
+    if ((status = packet_pool_register(PACKET_POOL_CONTROL, &nx_control_pool)))
+    {
+        packet_pool_unregister(PACKET_POOL_BULK);
+    }
+#endif
+
+    return status;
+}
+
 UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
 {
     UINT status;
@@ -144,10 +355,9 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
     // Initialize the NetX system.
     nx_system_initialize();
 
-    // Create a packet pool.
-    if ((status = nx_packet_pool_create(&nx_pool, "NetX Packet Pool", NETX_PACKET_SIZE, netx_ip_pool, NETX_POOL_SIZE)))
+    if ((status = network_pools_create()))
     {
-        printf("ERROR: nx_packet_pool_create (0x%08x)\r\n", status);
+        printf("ERROR: Failed to create the packet pools (0x%08x)\r\n", status);
     }
 
     // Create an IP instance
@@ -161,15 +371,25 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
                   NETX_IP_STACK_SIZE,
                   1)))
     {
-        nx_packet_pool_delete(&nx_pool);
+        network_pools_delete();
         printf("ERROR: nx_ip_create (0x%08x)\r\n", status);
     }
 
+#if defined(NX_ENABLE_DUAL_PACKET_POOL) && defined(NETX_CONTROL_POOL)
+    // Let NetX build its own small packets from the control pool
+    else if ((status = nx_ip_auxiliary_packet_pool_set(&nx_ip, &nx_control_pool)))
+    {
+        nx_ip_delete(&nx_ip);
+        network_pools_delete();
+        printf("ERROR: nx_ip_auxiliary_packet_pool_set (0x%08x)\r\n", status);
+    }
+#endif
+
     // Enable ARP and supply ARP cache memory
     else if ((status = nx_arp_enable(&nx_ip, (VOID*)netx_arp_cache_area, NETX_ARP_CACHE_SIZE)))
     {
         nx_ip_delete(&nx_ip);
-        nx_packet_pool_delete(&nx_pool);
+        network_pools_delete();
         printf("ERROR: nx_arp_enable (0x%08x)\r\n", status);
     }
 
@@ -177,7 +397,7 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
     else if ((status = nx_tcp_enable(&nx_ip)))
     {
         nx_ip_delete(&nx_ip);
-        nx_packet_pool_delete(&nx_pool);
+        network_pools_delete();
         printf("ERROR: nx_tcp_enable (0x%08x)\r\n", status);
         return status;
     }
@@ -186,7 +406,7 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
     else if ((status = nx_udp_enable(&nx_ip)))
     {
         nx_ip_delete(&nx_ip);
-        nx_packet_pool_delete(&nx_pool);
+        network_pools_delete();
         printf("ERROR: nx_udp_enable (0x%08x)\r\n", status);
     }
 
@@ -194,7 +414,7 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
     else if ((status = nx_icmp_enable(&nx_ip)))
     {
         nx_ip_delete(&nx_ip);
-        nx_packet_pool_delete(&nx_pool);
+        network_pools_delete();
         printf("ERROR: nx_icmp_enable (0x%08x)\r\n", status);
     }
 
@@ -202,25 +422,16 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
     else if ((status = nx_dhcp_create(&nx_dhcp_client, &nx_ip, "azure_iot")))
     {
         nx_ip_delete(&nx_ip);
-        nx_packet_pool_delete(&nx_pool);
+        network_pools_delete();
         printf("ERROR: nx_dhcp_create (0x%08x)\r\n", status);
     }
 
-    // Start the DHCP Client
-    if ((status = nx_dhcp_start(&nx_dhcp_client)))
-    {
-        nx_dhcp_delete(&nx_dhcp_client);
-        nx_ip_delete(&nx_ip);
-        nx_packet_pool_delete(&nx_pool);
-        printf("ERROR: nx_dhcp_start (0x%08x)\r\n", status);
-    }
-
     // Create DNS
     else if ((status = nx_dns_create(&nx_dns_client, &nx_ip, (UCHAR*)"DNS Client")))
     {
         nx_dhcp_delete(&nx_dhcp_client);
         nx_ip_delete(&nx_ip);
-        nx_packet_pool_delete(&nx_pool);
+        network_pools_delete();
         printf("ERROR: nx_dns_create (0x%08x)\r\n", status);
     }
 
@@ -231,14 +442,42 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
         nx_dns_delete(&nx_dns_client);
         nx_dhcp_delete(&nx_dhcp_client);
         nx_ip_delete(&nx_ip);
-        nx_packet_pool_delete(&nx_pool);
+        network_pools_delete();
         printf("ERROR: nx_dns_packet_pool_set (%0x08)\r\n", status);
     }
 #endif
 
+    else if ((status = network_pools_register()))
+    {
+        nx_dns_delete(&nx_dns_client);
+        nx_dhcp_delete(&nx_dhcp_client);
+        nx_ip_delete(&nx_ip);
+        network_pools_delete();
+        printf("ERROR: Failed to register the packet pools (0x%08x)\r\n", status);
+    }
+
+    // Cache lookups in front of the DNS client
+    else if ((status = dns_cache_init(&nx_dns_client)))
+    {
+        packet_pool_unregister(PACKET_POOL_CONTROL);
+        packet_pool_unregister(PACKET_POOL_BULK);
+        nx_dns_delete(&nx_dns_client);
+        nx_dhcp_delete(&nx_dhcp_client);
+        nx_ip_delete(&nx_ip);
+        network_pools_delete();
+        printf("ERROR: Failed to init the DNS cache (0x%08x)\r\n", status);
+    }
+
     // Initialize the SNTP client
     else if ((status = sntp_init()))
     {
+        dns_cache_deinit();
+        packet_pool_unregister(PACKET_POOL_CONTROL);
+        packet_pool_unregister(PACKET_POOL_BULK);
+        nx_dns_delete(&nx_dns_client);
+        nx_dhcp_delete(&nx_dhcp_client);
+        nx_ip_delete(&nx_ip);
+        network_pools_delete();
         printf("ERROR: Failed to init the SNTP client (0x%08x)\r\n", status);
     }
 
@@ -251,24 +490,43 @@ UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*))
     return status;
 }
 
-UINT network_connect()
+UINT network_connect(UINT invalid_layers)
 {
     UINT status;
+    ULONG actual_status;
+
+    // Pick up a dropped link or a lost address as well as whatever the caller found broken
+    if (nx_ip_interface_status_check(&nx_ip, 0, NX_IP_LINK_ENABLED, &actual_status, NX_NO_WAIT))
+    {
+        invalid_layers |= NETWORK_LAYER_LINK;
+    }
+    else if (nx_ip_status_check(&nx_ip, NX_IP_ADDRESS_RESOLVED, &actual_status, NX_NO_WAIT))
+    {
+        invalid_layers |= NETWORK_LAYER_LEASE;
+    }
+
+    network_layers_invalidate(invalid_layers);
+
+    // Wait for the link
+    if ((status = network_layer_connect(NETWORK_LAYER_LINK, link_connect)))
+    {
+        printf("ERROR: link_connect\r\n");
+    }
 
     // Fetch IP details
-    if ((status = dhcp_connect()))
+    else if ((status = network_layer_connect(NETWORK_LAYER_LEASE, dhcp_connect)))
     {
         printf("ERROR: dhcp_connect\r\n");
     }
 
     // Create DNS
-    else if ((status = dns_connect()))
+    else if ((status = network_layer_connect(NETWORK_LAYER_RESOLVER, dns_connect)))
     {
         printf("ERROR: dns_connect\r\n");
     }
 
     // Wait for an SNTP sync
-    else if ((status = sntp_sync()))
+    else if ((status = network_layer_connect(NETWORK_LAYER_CLOCK, sntp_sync)))
     {
         printf("ERROR: Failed to sync SNTP time (0x%08x)\r\n", status);
     }
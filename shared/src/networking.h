@@ -12,6 +12,6 @@ extern NX_PACKET_POOL nx_pool;
 extern NX_DNS nx_dns_client;
 
 UINT network_init(VOID (*ip_link_driver)(struct NX_IP_DRIVER_STRUCT*));
-UINT network_connect();
+UINT network_connect(UINT invalid_layers);
 
 #endif // _NETWORKING_H
\ No newline at end of file
@@ -0,0 +1,146 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "packet_pool.h"
+
+#include <stdio.h>
+
+#include "tx_api.h"
+
+typedef struct PACKET_POOL_ENTRY_STRUCT
+{
+    NX_PACKET_POOL* pool_ptr;
+    ULONG high_water;
+    ULONG fallback_count;
+} PACKET_POOL_ENTRY;
+
+static PACKET_POOL_ENTRY packet_pools[PACKET_POOL_CLASS_COUNT];
+
+// Usage is read straight after an allocation and straight before a release, the two points either side of a peak
+static VOID packet_pool_sample(PACKET_POOL_ENTRY* entry)
+{
+    ULONG total_packets;
+    ULONG free_packets;
+
+    if (entry->pool_ptr != NX_NULL &&
+        nx_packet_pool_info_get(entry->pool_ptr, &total_packets, &free_packets, NX_NULL, NX_NULL, NX_NULL) ==
+            NX_SUCCESS &&
+        total_packets - free_packets > entry->high_water)
+    {
+        entry->high_water = total_packets - free_packets;
+    }
+}
+
+UINT packet_pool_register(PACKET_POOL_CLASS pool_class, NX_PACKET_POOL* pool_ptr)
+{
+    if (pool_class >= PACKET_POOL_CLASS_COUNT || pool_ptr == NX_NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    packet_pools[pool_class].pool_ptr       = pool_ptr;
+    packet_pools[pool_class].high_water     = 0;
+    packet_pools[pool_class].fallback_count = 0;
+
+    return NX_SUCCESS;
+}
+
+// For a pool about to be deleted, allocations of its class go to the bulk pool after this
+VOID packet_pool_unregister(PACKET_POOL_CLASS pool_class)
+{
+    if (pool_class < PACKET_POOL_CLASS_COUNT)
+    {
+        packet_pools[pool_class].pool_ptr = NX_NULL;
+    }
+}
+
+NX_PACKET_POOL* packet_pool_get(PACKET_POOL_CLASS pool_class)
+{
+    if (pool_class >= PACKET_POOL_CLASS_COUNT)
+    {
+        return NX_NULL;
+    }
+
+    // Boards with a single pool only register it as the bulk pool
+    if (packet_pools[pool_class].pool_ptr == NX_NULL)
+    {
+        return packet_pools[PACKET_POOL_BULK].pool_ptr;
+    }
+
+    return packet_pools[pool_class].pool_ptr;
+}
+
+UINT packet_pool_allocate(ULONG payload_size, NX_PACKET** packet_ptr, ULONG packet_type, ULONG wait_option)
+{
+    PACKET_POOL_ENTRY* control = &packet_pools[PACKET_POOL_CONTROL];
+    PACKET_POOL_ENTRY* bulk    = &packet_pools[PACKET_POOL_BULK];
+    UINT status;
+
+    // The packet type is the header space NetX reserves ahead of the payload
+    if (control->pool_ptr != NX_NULL && packet_type + payload_size <= control->pool_ptr->nx_packet_pool_payload_size)
+    {
+        // Don't wait on the control pool while the bulk pool may have a packet to spare
+        status = nx_packet_allocate(
+            control->pool_ptr, packet_ptr, packet_type, bulk->pool_ptr != NX_NULL ? NX_NO_WAIT : wait_option);
+        packet_pool_sample(control);
+
+        if (status != NX_NO_PACKET || bulk->pool_ptr == NX_NULL)
+        {
+            return status;
+        }
+
+        control->fallback_count++;
+    }
+
+    if (bulk->pool_ptr == NX_NULL)
+    {
+        return NX_NOT_ENABLED;
+    }
+
+    status = nx_packet_allocate(bulk->pool_ptr, packet_ptr, packet_type, wait_option);
+    packet_pool_sample(bulk);
+
+    return status;
+}
+
+UINT packet_pool_release(NX_PACKET* packet_ptr)
+{
+    for (UINT i = 0; i < PACKET_POOL_CLASS_COUNT; ++i)
+    {
+        if (packet_pools[i].pool_ptr != NX_NULL && packet_pools[i].pool_ptr == packet_ptr->nx_packet_pool_owner)
+        {
+            packet_pool_sample(&packet_pools[i]);
+        }
+    }
+
+    return nx_packet_release(packet_ptr);
+}
+
+UINT packet_pool_stats_get(PACKET_POOL_CLASS pool_class, PACKET_POOL_STATS* stats)
+{
+    PACKET_POOL_ENTRY* entry;
+    UINT status;
+
+    if (pool_class >= PACKET_POOL_CLASS_COUNT || stats == NX_NULL)
+    {
+        return NX_PTR_ERROR;
+    }
+
+    entry = &packet_pools[pool_class];
+    if (entry->pool_ptr == NX_NULL)
+    {
+        return NX_NOT_ENABLED;
+    }
+
+    if ((status = nx_packet_pool_info_get(
+             entry->pool_ptr, &stats->total_packets, &stats->free_packets, &stats->empty_requests, NX_NULL, NX_NULL)))
+    {
+        return status;
+    }
+
+    stats->payload_size   = entry->pool_ptr->nx_packet_pool_payload_size;
+    stats->high_water     = entry->high_water;
+    stats->fallback_count = entry->fallback_count;
+
+    return NX_SUCCESS;
+}
@@ -0,0 +1,48 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _PACKET_POOL_H
+#define _PACKET_POOL_H
+
+#include "nx_api.h"
+
+typedef enum PACKET_POOL_CLASS_ENUM
+{
+    // ARP, TCP control segments, SNTP and other small frames
+    PACKET_POOL_CONTROL,
+
+    // TLS records, MQTT payloads and received frames, sized to the MTU
+    PACKET_POOL_BULK,
+
+    PACKET_POOL_CLASS_COUNT
+} PACKET_POOL_CLASS;
+
+typedef struct PACKET_POOL_STATS_STRUCT
+{
+    ULONG payload_size;
+    ULONG total_packets;
+    ULONG free_packets;
+
+    // most packets in use at once, as seen by the allocations and releases made through here
+    ULONG high_water;
+
+    // allocations that found the pool empty
+    ULONG empty_requests;
+
+    // small allocations served by the bulk pool because the control pool was empty
+    ULONG fallback_count;
+} PACKET_POOL_STATS;
+
+UINT packet_pool_register(PACKET_POOL_CLASS pool_class, NX_PACKET_POOL* pool_ptr);
+VOID packet_pool_unregister(PACKET_POOL_CLASS pool_class);
+NX_PACKET_POOL* packet_pool_get(PACKET_POOL_CLASS pool_class);
+
+// Allocates from the smallest pool the payload fits, falling back to the bulk pool
+UINT packet_pool_allocate(ULONG payload_size, NX_PACKET** packet_ptr, ULONG packet_type, ULONG wait_option);
+
+// Releases a packet after recording its pool's usage, received packets reach their peak just before this
+UINT packet_pool_release(NX_PACKET* packet_ptr);
+
+UINT packet_pool_stats_get(PACKET_POOL_CLASS pool_class, PACKET_POOL_STATS* stats);
+
+#endif // _PACKET_POOL_H
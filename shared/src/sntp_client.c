@@ -10,115 +10,260 @@
 #include "nxd_dns.h"
 #include "nxd_sntp_client.h"
 
+#include "azure_iot_connect.h"
+#include "dns_cache.h"
 #include "networking.h"
+#include "packet_pool.h"
+#include "time_service.h"
 
-#define SNTP_UPDATE_EVENT 1
+#define SNTP_PORT        123
+#define SNTP_PACKET_SIZE 48
 
-// Time to wait for each server poll
+// LI 0, version 4, mode 3 (client)
+#define SNTP_CLIENT_REQUEST 0x23
+#define SNTP_MODE_SERVER    4
+#define SNTP_LEAP_UNSYNCED  3
+
+// Highest stratum accepted, same limit the NetX SNTP client applied
+#ifdef NX_SNTP_CLIENT_MIN_SERVER_STRATUM
+#define SNTP_MAX_STRATUM NX_SNTP_CLIENT_MIN_SERVER_STRATUM
+#else
+#define SNTP_MAX_STRATUM 15
+#endif
+
+// Time to wait for all the servers together
 #define SNTP_WAIT_TIME (10 * NX_IP_PERIODIC_RATE)
 
+// Time to keep listening for a lower stratum after the first good reply
+#define SNTP_SETTLE_TIME (NX_IP_PERIODIC_RATE / 4)
+
+// Time between failed resyncs, and between checks while the resolver is down
+#define SNTP_RESYNC_RETRY (5 * 60 * NX_IP_PERIODIC_RATE)
+
+#define SNTP_THREAD_STACK_SIZE 2048
+#define SNTP_THREAD_PRIORITY   6
+
 // Seconds between Unix Epoch (1/1/1970) and NTP Epoch (1/1/1999)
 #define UNIX_TO_NTP_EPOCH_SECS 0x83AA7E80
 
+#define SNTP_SERVER_COUNT (sizeof(SNTP_SERVER) / sizeof(SNTP_SERVER[0]))
+
 static const char* SNTP_SERVER[] = {
     "0.pool.ntp.org",
     "1.pool.ntp.org",
     "2.pool.ntp.org",
     "3.pool.ntp.org",
 };
-static UINT sntp_server_count = 0;
 
-static NX_SNTP_CLIENT sntp_client;
+typedef struct SNTP_REPLY_STRUCT
+{
+    UINT stratum;
+    ULONG delay_ms;
+    uint64_t ticks;
+    uint64_t unix_ms;
+} SNTP_REPLY;
+
+static NX_UDP_SOCKET sntp_socket;
+
+// Ticks each request was sent at, echoed back by the server so replies can be matched
+static uint64_t sntp_request_ticks[SNTP_SERVER_COUNT];
+static NXD_ADDRESS sntp_address[SNTP_SERVER_COUNT];
+static bool sntp_request_sent[SNTP_SERVER_COUNT];
+
+static SNTP_STATS sntp_stats;
+
+// Serializes the syncs a reconnect runs with the ones the resync thread runs
+static TX_MUTEX sntp_mutex;
 
-static TX_EVENT_FLAGS_GROUP sntp_flags;
+static TX_THREAD sntp_thread;
+static ULONG sntp_thread_stack[SNTP_THREAD_STACK_SIZE / sizeof(ULONG)];
 
-// Variables to keep track of time
-static ULONG sntp_last_time = 0;
-static ULONG tx_last_ticks  = 0;
+// The time service sets how long the clock holds its accuracy after a sync, the resync is due after that
+static ULONG sntp_sync_ticks;
+static ULONG sntp_resync_ticks;
+static ULONG sntp_attempt_ticks;
+static bool sntp_synced = false;
 
-static VOID time_update_callback(NX_SNTP_TIME_MESSAGE* time_update_ptr, NX_SNTP_TIME* local_time)
+static ULONG read_ulong(const UCHAR* data)
 {
-    // Set the update flag so we pick up the new time in the SNTP thread
-    tx_event_flags_set(&sntp_flags, SNTP_UPDATE_EVENT, TX_OR);
+    return ((ULONG)data[0] << 24) | ((ULONG)data[1] << 16) | ((ULONG)data[2] << 8) | data[3];
 }
 
-static void set_sntp_time()
+static VOID write_ulong(UCHAR* data, ULONG value)
 {
-    UINT status;
-    ULONG seconds;
-    ULONG milliseconds;
-    CHAR time_buffer[64];
-
-    status = nx_sntp_client_get_local_time(&sntp_client, &seconds, &milliseconds, NX_NULL);
-    if (status != NX_SUCCESS)
-    {
-        printf("ERROR: Internal error with getting local time (0x%08x)\n", status);
-        return;
-    }
+    data[0] = (UCHAR)(value >> 24);
+    data[1] = (UCHAR)(value >> 16);
+    data[2] = (UCHAR)(value >> 8);
+    data[3] = (UCHAR)value;
+}
 
-    // Stash the Unix and ThreadX times
-    sntp_last_time = seconds - UNIX_TO_NTP_EPOCH_SECS;
-    tx_last_ticks  = tx_time_get();
+// NTP timestamp, seconds since 1900 and a 32 bit fraction, to Unix ms
+static uint64_t ntp_to_unix_ms(const UCHAR* timestamp)
+{
+    ULONG seconds  = read_ulong(timestamp) - UNIX_TO_NTP_EPOCH_SECS;
+    ULONG fraction = read_ulong(timestamp + 4);
 
-    nx_sntp_client_utility_display_date_time(&sntp_client, time_buffer, sizeof(time_buffer));
+    return (uint64_t)seconds * 1000 + (((uint64_t)fraction * 1000) >> 32);
+}
 
-    printf("\tSNTP time update: %s\r\n", time_buffer);
+static VOID set_sntp_time(SNTP_REPLY* reply)
+{
+    time_unix_set(reply->unix_ms, reply->ticks);
+
+    sntp_synced       = true;
+    sntp_sync_ticks   = tx_time_get();
+    sntp_resync_ticks = (ULONG)(time_resync_ms_get() * NX_IP_PERIODIC_RATE / 1000);
+
+    sntp_stats.sync_count++;
+    sntp_stats.last_stratum  = reply->stratum;
+    sntp_stats.last_delay_ms = reply->delay_ms;
+
+    printf("\tSNTP time update: %lu.%03lu (stratum %u, delay %lu ms, drift %ld ppb)\r\n",
+        (ULONG)(reply->unix_ms / 1000),
+        (ULONG)(reply->unix_ms % 1000),
+        reply->stratum,
+        reply->delay_ms,
+        time_drift_get());
     printf("SUCCESS: SNTP initialized\r\n");
 }
 
-static UINT sntp_client_run()
+static UINT sntp_request_send(UINT index)
 {
     UINT status;
-    NXD_ADDRESS sntp_address;
+    NX_PACKET* packet_ptr;
+    UCHAR request[SNTP_PACKET_SIZE] = {SNTP_CLIENT_REQUEST};
+
+    // The transmit timestamp is only a nonce the server echoes, the send ticks and the server index
+    sntp_request_ticks[index] = time_ticks_get();
+    write_ulong(&request[40], (ULONG)sntp_request_ticks[index]);
+    write_ulong(&request[44], index);
 
-    if (sntp_server_count > (sizeof(SNTP_SERVER) / sizeof(&SNTP_SERVER)))
+    if ((status = packet_pool_allocate(SNTP_PACKET_SIZE, &packet_ptr, NX_UDP_PACKET, NX_NO_WAIT)))
     {
-        // We rotated through all the servers, fail out.
-        return NX_SNTP_SERVER_NOT_AVAILABLE;
+        printf("ERROR: SNTP packet allocate (0x%08x)\r\n", status);
     }
 
-    printf("\tSNTP server %s\r\n", SNTP_SERVER[sntp_server_count]);
+    else if ((status = nx_packet_data_append(
+                  packet_ptr, request, sizeof(request), packet_ptr->nx_packet_pool_owner, NX_NO_WAIT)))
+    {
+        printf("ERROR: SNTP packet append (0x%08x)\r\n", status);
+        packet_pool_release(packet_ptr);
+    }
+
+    else if ((status = nxd_udp_socket_send(&sntp_socket, packet_ptr, &sntp_address[index], SNTP_PORT)))
+    {
+        printf("ERROR: SNTP request send (0x%08x)\r\n", status);
+        packet_pool_release(packet_ptr);
+    }
 
-    // Stop the server in case it's already running
-    nx_sntp_client_stop(&sntp_client);
+    return status;
+}
 
-    // Resolve DNS
-    if ((status = nxd_dns_host_by_name_get(&nx_dns_client,
-             (UCHAR*)SNTP_SERVER[sntp_server_count],
-             &sntp_address,
-             5 * NX_IP_PERIODIC_RATE,
-             NX_IP_VERSION_V4)))
+// Validates a server reply and works out the Unix time at the tick it arrived
+static bool sntp_reply_parse(NX_PACKET* packet_ptr, uint64_t ticks, SNTP_REPLY* reply)
+{
+    UCHAR data[SNTP_PACKET_SIZE];
+    ULONG bytes_copied;
+    NXD_ADDRESS source_address;
+    UINT source_port;
+    UINT index;
+    uint64_t server_receive_ms;
+    uint64_t server_transmit_ms;
+    uint64_t round_trip_ms;
+    uint64_t server_hold_ms;
+
+    if (nxd_udp_source_extract(packet_ptr, &source_address, &source_port) ||
+        nx_packet_data_extract_offset(packet_ptr, 0, data, sizeof(data), &bytes_copied) ||
+        bytes_copied != SNTP_PACKET_SIZE)
     {
-        printf("ERROR: Unable to resolve SNTP IP %s (0x%08x)\r\n", SNTP_SERVER[sntp_server_count], status);
+        return false;
     }
 
-    // Initialize the service
-    else if ((status = nxd_sntp_client_initialize_unicast(&sntp_client, &sntp_address)))
+    // The originate timestamp must be a request we sent, to that server
+    index = read_ulong(&data[28]);
+    if (index >= SNTP_SERVER_COUNT || !sntp_request_sent[index] ||
+        read_ulong(&data[24]) != (ULONG)sntp_request_ticks[index] ||
+        source_address.nxd_ip_address.v4 != sntp_address[index].nxd_ip_address.v4)
     {
-        printf("ERROR: Unable to initialize unicast SNTP client (0x%08x)\r\n", status);
+        return false;
     }
 
-    // Run Unicast client
-    else if ((status = nx_sntp_client_run_unicast(&sntp_client)))
+    // Either way this server has answered
+    sntp_request_sent[index] = false;
+
+    reply->stratum = data[1];
+    if ((data[0] & 0x07) != SNTP_MODE_SERVER || (data[0] >> 6) == SNTP_LEAP_UNSYNCED || reply->stratum == 0 ||
+        reply->stratum > SNTP_MAX_STRATUM || read_ulong(&data[40]) == 0)
     {
-        printf("ERROR: Unable to start unicast SNTP client (0x%08x)\r\n", status);
+        printf("\tSNTP server %s rejected (stratum %u)\r\n", SNTP_SERVER[index], reply->stratum);
+        return false;
     }
 
-    // rotate to the next SNTP service
-    sntp_server_count++;
+    // Network delay is the round trip less the time the server held the request, half of it is the way back
+    server_receive_ms  = ntp_to_unix_ms(&data[32]);
+    server_transmit_ms = ntp_to_unix_ms(&data[40]);
+    round_trip_ms      = time_ticks_to_ms(ticks - sntp_request_ticks[index]);
+    server_hold_ms     = server_transmit_ms >= server_receive_ms ? server_transmit_ms - server_receive_ms : 0;
 
-    return status;
+    reply->delay_ms = round_trip_ms > server_hold_ms ? (ULONG)(round_trip_ms - server_hold_ms) : 0;
+    reply->unix_ms  = server_transmit_ms + reply->delay_ms / 2;
+    reply->ticks    = ticks;
+
+    printf("\tSNTP server %s replied\r\n", SNTP_SERVER[index]);
+
+    return true;
 }
 
-ULONG sntp_time_get()
+static UINT sntp_pending_count()
+{
+    UINT pending = 0;
+
+    for (UINT i = 0; i < SNTP_SERVER_COUNT; ++i)
+    {
+        pending += sntp_request_sent[i] ? 1 : 0;
+    }
+
+    return pending;
+}
+
+static VOID resync_thread_entry(ULONG parameter)
 {
-    // Calculate how many seconds have elapsed since the last sync
-    ULONG tx_time_delta = (tx_time_get() - tx_last_ticks) / TX_TIMER_TICKS_PER_SECOND;
+    ULONG now;
+    ULONG wait;
+
+    while (true)
+    {
+        // Sleeps until the resync is due, a reconnect that synced in the meantime pushes it back
+        now = tx_time_get();
+        if (!sntp_synced)
+        {
+            wait = SNTP_RESYNC_RETRY;
+        }
+        else if (now - sntp_sync_ticks < sntp_resync_ticks)
+        {
+            wait = sntp_resync_ticks - (now - sntp_sync_ticks);
+        }
+        else if (now - sntp_attempt_ticks < SNTP_RESYNC_RETRY)
+        {
+            wait = SNTP_RESYNC_RETRY - (now - sntp_attempt_ticks);
+        }
+        else if (!(network_layers_valid_get() & NETWORK_LAYER_RESOLVER))
+        {
+            wait = SNTP_RESYNC_RETRY;
+        }
+        else
+        {
+            sntp_sync();
+            continue;
+        }
 
-    // Add this to the last sync time to get the current time
-    ULONG sntp_time = sntp_last_time + tx_time_delta;
+        tx_thread_sleep(wait);
+    }
+}
 
-    return sntp_time;
+ULONG sntp_time_get()
+{
+    return (ULONG)(time_unix_ms_get() / 1000);
 }
 
 UINT sntp_time(ULONG* unix_time)
@@ -132,68 +277,143 @@ UINT sntp_init()
 {
     UINT status;
 
-    if ((status = tx_event_flags_create(&sntp_flags, "SNTP")))
+    if ((status = time_service_init()))
     {
-        printf("ERROR: Create SNTP event flags (0x%08x)\r\n", status);
+        printf("ERROR: Failed to init the time service (0x%08x)\r\n", status);
     }
 
-    else if ((status = nx_sntp_client_create(
-                  &sntp_client, &nx_ip, 0, nx_ip.nx_ip_default_packet_pool, NX_NULL, NX_NULL, NULL)))
+    else if ((status = tx_mutex_create(&sntp_mutex, "SNTP", TX_INHERIT)))
     {
-        printf("ERROR: SNTP client create failed (0x%08x)\r\n", status);
+        printf("ERROR: SNTP mutex create failed (0x%08x)\r\n", status);
     }
 
-    else if ((status = nx_sntp_client_set_local_time(&sntp_client, 0, 0)))
+    else if ((status = nx_udp_socket_create(&nx_ip,
+             &sntp_socket,
+             "SNTP",
+             NX_IP_NORMAL,
+             NX_FRAGMENT_OKAY,
+             NX_IP_TIME_TO_LIVE,
+             SNTP_SERVER_COUNT)))
     {
-        printf("ERROR: Unable to set local time for SNTP client (0x%08x)\r\n", status);
-        nx_sntp_client_delete(&sntp_client);
+        tx_mutex_delete(&sntp_mutex);
+        printf("ERROR: SNTP socket create failed (0x%08x)\r\n", status);
     }
 
-    // Setup time update callback function
-    else if ((status = nx_sntp_client_set_time_update_notify(&sntp_client, time_update_callback)))
+    else if ((status = tx_thread_create(&sntp_thread,
+                  "SNTP resync",
+                  resync_thread_entry,
+                  0,
+                  sntp_thread_stack,
+                  SNTP_THREAD_STACK_SIZE,
+                  SNTP_THREAD_PRIORITY,
+                  SNTP_THREAD_PRIORITY,
+                  TX_NO_TIME_SLICE,
+                  TX_AUTO_START)))
     {
-        printf("ERROR: nx_sntp_client_set_time_update_notify (0x%08x)\r\n", status);
-        nx_sntp_client_delete(&sntp_client);
+        nx_udp_socket_delete(&sntp_socket);
+        tx_mutex_delete(&sntp_mutex);
+        printf("ERROR: SNTP thread create failed (0x%08x)\r\n", status);
     }
 
     return status;
 }
 
-UINT sntp_sync()
+static UINT sntp_query()
 {
     UINT status;
-    UINT server_status;
-    ULONG events = 0;
+    NX_PACKET* packet_ptr;
+    SNTP_REPLY reply;
+    SNTP_REPLY best_reply = {0};
+    ULONG start_ticks;
+    ULONG deadline_ticks;
+    ULONG now;
+    bool answered = false;
 
     printf("\r\nInitializing SNTP time sync\r\n");
 
-    // Reset the server index so we start from the beginning
-    sntp_server_count = 0;
+    if ((status = nx_udp_socket_bind(&sntp_socket, NX_ANY_PORT, NX_NO_WAIT)))
+    {
+        printf("ERROR: SNTP socket bind failed (0x%08x)\r\n", status);
+        return status;
+    }
 
-    while (NX_TRUE)
+    // Query every server at once so one that is down costs nothing
+    for (UINT i = 0; i < SNTP_SERVER_COUNT; ++i)
     {
-        // Run the client
-        sntp_client_run();
+        printf("\tSNTP server %s\r\n", SNTP_SERVER[i]);
 
-        // Wait for new events
-        events = 0;
-        tx_event_flags_get(&sntp_flags, SNTP_UPDATE_EVENT, TX_OR_CLEAR, &events, SNTP_WAIT_TIME);
+        sntp_request_sent[i] = false;
 
-        if (events & SNTP_UPDATE_EVENT)
+        // Resolve DNS, repeat syncs are answered from the cache
+        if ((status = dns_cache_host_get((UCHAR*)SNTP_SERVER[i], &sntp_address[i], 5 * NX_IP_PERIODIC_RATE)))
         {
-            // Get time updates
-            nx_sntp_client_receiving_updates(&sntp_client, &server_status);
+            printf("ERROR: Unable to resolve SNTP IP %s (0x%08x)\r\n", SNTP_SERVER[i], status);
+        }
+
+        else
+        {
+            sntp_request_sent[i] = sntp_request_send(i) == NX_SUCCESS;
+        }
+    }
 
-            // New time, update our local time and we are done
-            set_sntp_time();
-            status = NX_SUCCESS;
+    // Take the lowest stratum, then the shortest delay, among the replies that arrive by the deadline
+    start_ticks    = tx_time_get();
+    deadline_ticks = SNTP_WAIT_TIME;
+    while (sntp_pending_count() > 0)
+    {
+        now = tx_time_get() - start_ticks;
+        if (now >= deadline_ticks ||
+            nx_udp_socket_receive(&sntp_socket, &packet_ptr, deadline_ticks - now) != NX_SUCCESS)
+        {
             break;
         }
 
-        // Otherwise we rotate around to the next server
+        if (sntp_reply_parse(packet_ptr, time_ticks_get(), &reply))
+        {
+            if (!answered || reply.stratum < best_reply.stratum ||
+                (reply.stratum == best_reply.stratum && reply.delay_ms < best_reply.delay_ms))
+            {
+                best_reply = reply;
+            }
+
+            // After the first good reply only wait a little longer for a better one
+            if (!answered)
+            {
+                answered       = true;
+                deadline_ticks = tx_time_get() - start_ticks + SNTP_SETTLE_TIME;
+            }
+        }
+
+        packet_pool_release(packet_ptr);
     }
 
-    nx_sntp_client_stop(&sntp_client);
+    nx_udp_socket_unbind(&sntp_socket);
+
+    if (!answered)
+    {
+        printf("ERROR: No SNTP server replied\r\n");
+        sntp_stats.fail_count++;
+        return NX_SNTP_SERVER_NOT_AVAILABLE;
+    }
+
+    set_sntp_time(&best_reply);
+
+    return NX_SUCCESS;
+}
+
+UINT sntp_sync()
+{
+    UINT status;
+
+    tx_mutex_get(&sntp_mutex, TX_WAIT_FOREVER);
+    sntp_attempt_ticks = tx_time_get();
+    status             = sntp_query();
+    tx_mutex_put(&sntp_mutex);
 
     return status;
 }
+
+VOID sntp_stats_get(SNTP_STATS* stats_ptr)
+{
+    *stats_ptr = sntp_stats;
+}
@@ -6,10 +6,26 @@
 
 #include <tx_api.h>
 
+typedef struct SNTP_STATS_STRUCT
+{
+    ULONG sync_count;
+
+    // syncs that no server answered
+    ULONG fail_count;
+
+    // the reply the last sync used
+    UINT last_stratum;
+    ULONG last_delay_ms;
+} SNTP_STATS;
+
 ULONG sntp_time_get();
 UINT sntp_time(ULONG* unix_time);
 
+// Init also starts a thread that syncs again once the clock could drift past its accuracy target, while the
+// resolver layer is valid. That is an hour while the drift is unknown, stretching to a day as the correction
+// settles, and a reconnect sync in between pushes it back
 UINT sntp_init();
 UINT sntp_sync();
+VOID sntp_stats_get(SNTP_STATS* stats_ptr);
 
 #endif
@@ -0,0 +1,200 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#include "time_service.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// The tick count is observed at least this often so no wrap of the 32-bit counter is missed
+#define TIME_WRAP_CHECK_TICKS 0x40000000
+
+// Syncs closer together than this are too short to measure the oscillator against
+#define TIME_DRIFT_MIN_INTERVAL_MS (10 * 60 * 1000)
+
+// Larger differences are treated as a clock step rather than drift
+#define TIME_DRIFT_MAX_PPB 500000
+
+// The wall clock is kept within this of the reference between syncs, SAS token expiry and TLS certificate checks
+// need seconds, not milliseconds
+#define TIME_ACCURACY_TARGET_MS 1000
+
+// Bounds of the resync interval. It starts at the minimum and at most doubles per sync as the drift settles
+#define TIME_RESYNC_MIN_MS (60 * 60 * 1000)
+#define TIME_RESYNC_MAX_MS (24 * 60 * 60 * 1000)
+
+static TX_TIMER time_wrap_timer;
+
+// High word of the 64-bit tick count and the last low word seen
+static ULONG time_ticks_high = 0;
+static ULONG time_ticks_last = 0;
+
+// The Unix time in ms at a tick count plus the local oscillator drift in parts per billion
+static uint64_t time_base_unix_ms = 0;
+static uint64_t time_base_ticks   = 0;
+static LONG time_drift_ppb        = 0;
+static bool time_synced           = false;
+
+static uint64_t time_resync_ms = TIME_RESYNC_MIN_MS;
+
+static VOID time_wrap_check(ULONG parameter)
+{
+    time_ticks_get();
+}
+
+UINT time_service_init()
+{
+    UINT status;
+
+    if ((status = tx_timer_create(&time_wrap_timer,
+             "Time wrap",
+             time_wrap_check,
+             0,
+             TIME_WRAP_CHECK_TICKS,
+             TIME_WRAP_CHECK_TICKS,
+             TX_AUTO_ACTIVATE)))
+    {
+        printf("ERROR: time wrap timer create failed (0x%08x)\r\n", status);
+    }
+
+    return status;
+}
+
+// Caller has interrupts disabled
+static uint64_t time_ticks_extend()
+{
+    ULONG ticks = tx_time_get();
+
+    if (ticks < time_ticks_last)
+    {
+        time_ticks_high++;
+    }
+    time_ticks_last = ticks;
+
+    return ((uint64_t)time_ticks_high << 32) | ticks;
+}
+
+uint64_t time_ticks_get()
+{
+    TX_INTERRUPT_SAVE_AREA
+    uint64_t ticks64;
+
+    TX_DISABLE
+    ticks64 = time_ticks_extend();
+    TX_RESTORE
+
+    return ticks64;
+}
+
+uint64_t time_ticks_to_ms(uint64_t ticks)
+{
+    return ticks * 1000 / TX_TIMER_TICKS_PER_SECOND;
+}
+
+uint64_t time_ms_get()
+{
+    return time_ticks_to_ms(time_ticks_get());
+}
+
+uint64_t time_unix_ms_get()
+{
+    TX_INTERRUPT_SAVE_AREA
+    uint64_t ticks;
+    uint64_t base_unix_ms;
+    uint64_t base_ticks;
+    LONG drift_ppb;
+    int64_t elapsed_ms;
+
+    // Sample the ticks with the base so a sync in between can't leave them older than the base
+    TX_DISABLE
+    ticks        = time_ticks_extend();
+    base_unix_ms = time_base_unix_ms;
+    base_ticks   = time_base_ticks;
+    drift_ppb    = time_drift_ppb;
+    TX_RESTORE
+
+    elapsed_ms = (int64_t)time_ticks_to_ms(ticks - base_ticks);
+
+    return base_unix_ms + elapsed_ms + elapsed_ms * drift_ppb / 1000000000;
+}
+
+// How long the clock can run before the error left after drift correction reaches the accuracy target. The
+// residual is what the corrected clock got wrong over the last interval, so the interval grows as the drift
+// estimate settles and shrinks again when the oscillator moves, with temperature for instance
+static VOID time_resync_update(int64_t error_ms, int64_t local_ms)
+{
+    uint64_t residual_ppb;
+    uint64_t resync_ms = time_resync_ms * 2;
+
+    if (error_ms < 0)
+    {
+        error_ms = -error_ms;
+    }
+
+    if (error_ms >= TIME_ACCURACY_TARGET_MS)
+    {
+        resync_ms = time_resync_ms / 2;
+    }
+    else if (error_ms > 0)
+    {
+        residual_ppb = (uint64_t)error_ms * 1000000000 / (uint64_t)local_ms;
+        if (residual_ppb > 0 && (uint64_t)TIME_ACCURACY_TARGET_MS * 1000000000 / residual_ppb < resync_ms)
+        {
+            resync_ms = (uint64_t)TIME_ACCURACY_TARGET_MS * 1000000000 / residual_ppb;
+        }
+    }
+
+    if (resync_ms < TIME_RESYNC_MIN_MS)
+    {
+        resync_ms = TIME_RESYNC_MIN_MS;
+    }
+    else if (resync_ms > TIME_RESYNC_MAX_MS)
+    {
+        resync_ms = TIME_RESYNC_MAX_MS;
+    }
+
+    time_resync_ms = resync_ms;
+}
+
+VOID time_unix_set(uint64_t unix_ms, uint64_t ticks)
+{
+    TX_INTERRUPT_SAVE_AREA
+    int64_t local_ms = (int64_t)time_ticks_to_ms(ticks - time_base_ticks);
+    int64_t sample_ppb;
+    int64_t predicted_ms;
+    LONG drift_ppb = time_drift_ppb;
+
+    // Compare the raw oscillator against the reference across the whole interval since the last sync
+    if (time_synced && local_ms >= TIME_DRIFT_MIN_INTERVAL_MS)
+    {
+        // What the corrected clock read at the sync, against the reference
+        predicted_ms = (int64_t)time_base_unix_ms + local_ms + local_ms * drift_ppb / 1000000000;
+        time_resync_update((int64_t)unix_ms - predicted_ms, local_ms);
+
+        sample_ppb = (int64_t)(unix_ms - time_base_unix_ms) - local_ms;
+        sample_ppb = sample_ppb * 1000000000 / local_ms;
+
+        if (sample_ppb > -TIME_DRIFT_MAX_PPB && sample_ppb < TIME_DRIFT_MAX_PPB)
+        {
+            // Smooth the estimate so one noisy sync does not swing it
+            drift_ppb += (LONG)((sample_ppb - drift_ppb) / 4);
+        }
+    }
+
+    TX_DISABLE
+    time_base_unix_ms = unix_ms;
+    time_base_ticks   = ticks;
+    time_drift_ppb    = drift_ppb;
+    time_synced       = true;
+    TX_RESTORE
+}
+
+LONG time_drift_get()
+{
+    return time_drift_ppb;
+}
+
+uint64_t time_resync_ms_get()
+{
+    return time_resync_ms;
+}
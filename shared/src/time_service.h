@@ -0,0 +1,32 @@
+/* Copyright (c) Microsoft Corporation.
+   Licensed under the MIT License. */
+
+#ifndef _TIME_SERVICE_H
+#define _TIME_SERVICE_H
+
+#include <stdint.h>
+
+#include "tx_api.h"
+
+UINT time_service_init();
+
+// Monotonic ThreadX ticks extended to 64 bits so they never wrap
+uint64_t time_ticks_get();
+uint64_t time_ticks_to_ms(uint64_t ticks);
+
+// Monotonic milliseconds since boot, for measuring intervals
+uint64_t time_ms_get();
+
+// Wall clock Unix time in milliseconds, corrected for the measured oscillator drift. The client only takes
+// whole seconds of it through sntp_time, telemetry and batch "ts" values stay 32-bit Unix seconds
+uint64_t time_unix_ms_get();
+
+// Anchors the wall clock to a Unix time observed at a tick count
+VOID time_unix_set(uint64_t unix_ms, uint64_t ticks);
+LONG time_drift_get();
+
+// Time the clock can run from the last sync and stay within a second of the reference, from an hour while the
+// drift is unknown up to a day once the correction holds
+uint64_t time_resync_ms_get();
+
+#endif // _TIME_SERVICE_H